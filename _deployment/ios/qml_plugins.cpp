@@ -1,28 +1,8 @@
 #include <QtPlugin>
+// Platform and image format plugins. The QML plugins are added by build.rs from what src/ui imports (qml_imports.cpp)
 Q_IMPORT_PLUGIN(QIOSIntegrationPlugin)
 Q_IMPORT_PLUGIN(QSvgIconPlugin)
 Q_IMPORT_PLUGIN(QSvgPlugin)
 Q_IMPORT_PLUGIN(QJpegPlugin)
-Q_IMPORT_PLUGIN(QSCNetworkReachabilityNetworkInformationBackendFactory)
-Q_IMPORT_PLUGIN(QSecureTransportBackend)
-
-Q_IMPORT_PLUGIN(QtQuick2Plugin)
-Q_IMPORT_PLUGIN(QtQmlMetaPlugin)
-Q_IMPORT_PLUGIN(QtQmlPlugin)
-Q_IMPORT_PLUGIN(QtQmlModelsPlugin)
-Q_IMPORT_PLUGIN(QtQmlWorkerScriptPlugin)
-Q_IMPORT_PLUGIN(QtQuick_WindowPlugin)
-Q_IMPORT_PLUGIN(QtQuickControls2Plugin)
-Q_IMPORT_PLUGIN(QtQuickControls2MaterialStylePlugin)
-Q_IMPORT_PLUGIN(QtQuickControls2BasicStylePlugin)
-Q_IMPORT_PLUGIN(QtQuickTemplates2Plugin)
-Q_IMPORT_PLUGIN(QtQuickControls2ImplPlugin)
-Q_IMPORT_PLUGIN(QtQuickControls2MaterialStyleImplPlugin)
-Q_IMPORT_PLUGIN(QmlShapesPlugin)
-Q_IMPORT_PLUGIN(QtQuickControls2BasicStyleImplPlugin)
-Q_IMPORT_PLUGIN(QtQuickLayoutsPlugin)
-//Q_IMPORT_PLUGIN(QtQmlCorePlugin)
-Q_IMPORT_PLUGIN(QtQuickDialogsPlugin)
-Q_IMPORT_PLUGIN(QtQuickEffectsPlugin)
 
 // Q_IMPORT_PLUGIN(QIosOptionalPlugin_NSPhotoLibrary)
@@ -41,23 +41,29 @@ fn compile_qml(dir: &str, qt_include_path: &str, qt_library_path: &str) {
         }
     });
 
-    let qt_path = std::path::Path::new(qt_library_path).parent().unwrap();
-    let compiler_path = if qt_path.join("libexec/qmlcachegen").exists() {
-        qt_path.join("libexec/qmlcachegen").to_string_lossy().to_string()
-    } else if qt_path.join("../macos/libexec/qmlcachegen").exists() {
-        qt_path.join("../macos/libexec/qmlcachegen").to_string_lossy().to_string()
-    } else if env::var("CARGO_CFG_TARGET_OS").unwrap() == "windows" && env::var("CARGO_CFG_TARGET_ARCH").unwrap() == "aarch64" {
-        qt_path.join("../msvc2019_64/bin/qmlcachegen").to_string_lossy().to_string()
-    } else {
-        "qmlcachegen".to_string()
+    let qt_path = Path::new(qt_library_path).parent().unwrap();
+    let aot = qml_aot_mode();
+    let compiler_path = match aot {
+        QmlAot::Qmlsc if qt_host_tool(qt_library_path, "qmlsc").is_some() => qt_host_tool(qt_library_path, "qmlsc").unwrap(),
+        _ => {
+            if aot == QmlAot::Qmlsc { println!("cargo:warning=qmlsc not found, compiling the QML with qmlcachegen"); }
+            qt_host_tool(qt_library_path, "qmlcachegen").unwrap_or_else(|| "qmlcachegen".to_string())
+        }
     };
+    // Only the target Qt's modules, so the types match what's linked when cross-compiling
+    let mut aot_args = Vec::new();
+    if aot != QmlAot::Off {
+        aot_args.extend(["--bare".to_string(), "-I".to_string(), qt_path.join("qml").to_string_lossy().to_string()]);
+        if compiler_path.ends_with("qmlsc") { aot_args.push("--direct-calls".to_string()); }
+    }
+    println!("cargo:rerun-if-env-changed=GYROFLOW_QML_AOT");
 
     qrc.push_str("</qresource>\n</RCC>");
     let qrc_path = Path::new(&main_dir).join("ui.qrc").to_string_lossy().to_string();
     std::fs::write(&qrc_path, qrc).unwrap();
 
     for (qml, cpp) in &files {
-        assert!(Command::new(&compiler_path).args(["--resource", &qrc_path, "-o", cpp, qml]).status().unwrap().success());
+        assert!(Command::new(&compiler_path).args(&aot_args).args(["--resource", &qrc_path, "-o", cpp, qml]).status().unwrap().success());
     }
 
     let loader_path = out_dir.join("qmlcache_loader.cpp").to_str().unwrap().to_string();
@@ -71,6 +77,159 @@ fn compile_qml(dir: &str, qt_include_path: &str, qt_library_path: &str) {
     println!("cargo:rustc-link-lib=static:+whole-archive=qmlcache");
 }
 
+/// Whether `path` belongs to a module in Qt's `qml` directory that the UI doesn't import, so its resources don't have to be linked
+fn is_unused_qml_module(path: &Path, qt_qml_path: &Path, used: &[std::path::PathBuf]) -> bool {
+    let path = std::fs::canonicalize(path).unwrap_or_else(|_| path.to_path_buf());
+    if !path.starts_with(qt_qml_path) { return false; }
+    // The innermost directory with a qmldir, e.g. QtQuick/Effects and not QtQuick
+    let module = path.ancestors().skip(1).take_while(|x| x.starts_with(qt_qml_path) && *x != qt_qml_path).find(|x| x.join("qmldir").exists());
+    module.map_or(false, |m| !used.iter().any(|u| u == m))
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum QmlAot { Off, Qmlcachegen, Qmlsc }
+
+/// `GYROFLOW_QML_AOT`: "0" keeps the plain qmlcachegen run, "qmlsc" uses the Qt Quick Compiler extensions if they're installed,
+/// anything else compiles the typed bindings and functions to C++ with qmlcachegen. On by default for Android and iOS
+fn qml_aot_mode() -> QmlAot {
+    let mobile = matches!(env::var("CARGO_CFG_TARGET_OS").unwrap().as_str(), "android" | "ios");
+    match env::var("GYROFLOW_QML_AOT").as_deref() {
+        Ok("0") => QmlAot::Off,
+        Ok("qmlsc") => QmlAot::Qmlsc,
+        Ok(_) => QmlAot::Qmlcachegen,
+        Err(_) => if mobile { QmlAot::Qmlcachegen } else { QmlAot::Off },
+    }
+}
+
+/// Qt tools run on the build machine, for iOS they come from the macOS Qt next to the iOS one
+fn qt_host_tool(qt_library_path: &str, name: &str) -> Option<String> {
+    let qt_path = Path::new(qt_library_path).parent().unwrap();
+    let candidates = [
+        qt_path.join("libexec").join(name),
+        qt_path.join("../macos/libexec").join(name),
+        qt_path.join("bin").join(name),
+    ];
+    if let Some(x) = candidates.iter().find(|x| x.exists()) {
+        return Some(x.to_string_lossy().to_string());
+    }
+    if env::var("CARGO_CFG_TARGET_OS").unwrap() == "windows" && env::var("CARGO_CFG_TARGET_ARCH").unwrap() == "aarch64" {
+        return Some(qt_path.join("../msvc2019_64/bin").join(name).to_string_lossy().to_string());
+    }
+    None
+}
+
+/// Static plugins of the QML modules that `dir` imports (including their dependencies) with `qmlimportscanner`,
+/// as (plugin class, module directory)
+fn scan_qml_imports(dir: &str, qt_library_path: &str) -> Vec<(String, std::path::PathBuf)> {
+    let qt_path = Path::new(qt_library_path).parent().unwrap();
+    let scanner = qt_host_tool(qt_library_path, "qmlimportscanner").unwrap_or_else(|| "qmlimportscanner".to_string());
+    let output = Command::new(&scanner).args(["-rootPath", dir, "-importPath", &qt_path.join("qml").to_string_lossy()]).output().unwrap();
+    assert!(output.status.success(), "{scanner} failed: {}", String::from_utf8_lossy(&output.stderr));
+
+    let imports: Vec<serde_json::Value> = serde_json::from_slice(&output.stdout).unwrap();
+    let mut plugins: Vec<(String, std::path::PathBuf)> = Vec::new();
+    for x in imports {
+        // Modules registered by the app itself (Gyroflow, MDKVideo) have no plugin
+        let (Some(class), Some(path)) = (x["classname"].as_str(), x["path"].as_str()) else { continue; };
+        if !plugins.iter().any(|(c, _)| c == class) {
+            plugins.push((class.to_string(), std::fs::canonicalize(path).unwrap_or_else(|_| path.into())));
+        }
+    }
+    plugins
+}
+
+// Undistortion shader variants, each as (suffix, qsb defines), see the top of undistort.frag. The first one is the base shader
+const SHADER_VARIANTS: &[(&str, &str)] = &[
+    ("",             ""),
+    ("_yuv",         "-DINPUT_YUV"),
+    ("_fast_rs",     "-DNO_DRAWING -DNO_MESH_DATA -DNO_UNDERWATER -DBACKGROUND_SOLID -DFULL_LENS_CORRECTION"),
+    ("_fast",        "-DNO_DRAWING -DNO_MESH_DATA -DNO_UNDERWATER -DBACKGROUND_SOLID -DFULL_LENS_CORRECTION -DSINGLE_MATRIX"),
+    ("_yuv_fast_rs", "-DINPUT_YUV -DNO_DRAWING -DNO_MESH_DATA -DNO_UNDERWATER -DBACKGROUND_SOLID -DFULL_LENS_CORRECTION"),
+    ("_yuv_fast",    "-DINPUT_YUV -DNO_DRAWING -DNO_MESH_DATA -DNO_UNDERWATER -DBACKGROUND_SOLID -DFULL_LENS_CORRECTION -DSINGLE_MATRIX"),
+];
+
+/// Compiles all the undistortion shaders with their variants and texture.vert with Qt's `qsb`, like compiled/compile_shaders.sh does for the
+/// committed base shaders but with the RGBA32F matrices layout (PACKED_MATRICES), and packs them with `rcc` into `$OUT_DIR/baked_shaders.rcc` as `:/src/qt_gpu/baked/`.
+/// Returns false when `qsb` (the qtshadertools module) or `rcc` isn't installed, then only the committed shaders are used
+fn bake_shaders(qt_library_path: &str) -> bool {
+    let exe = env::consts::EXE_SUFFIX;
+    let (Some(qsb), Some(rcc)) = (qt_host_tool(qt_library_path, &format!("qsb{exe}")), qt_host_tool(qt_library_path, &format!("rcc{exe}"))) else {
+        println!("cargo:warning=qsb or rcc not found, the YUV and specialized undistortion shaders won't be available. Install the qtshadertools Qt module to compile them");
+        return false;
+    };
+    let out_dir = Path::new(&env::var("OUT_DIR").unwrap()).join("baked_shaders");
+    std::fs::create_dir_all(&out_dir).unwrap();
+
+    let models_dir = Path::new("src/core/stabilization/distortion_models");
+    let read = |path: &Path| std::fs::read_to_string(path).unwrap_or_else(|e| panic!("{path:?}: {e}"));
+    let frag = read(Path::new("src/qt_gpu/undistort.frag"));
+    let no_digital_lens = "vec2 digital_undistort_point(vec2 uv) { return uv; } vec2 digital_distort_point(vec2 uv) { return uv; }";
+
+    // (output file, source file, variant defines, common defines)
+    let mut jobs: Vec<(String, std::path::PathBuf, &str, &str)> = vec![("texture.vert.qsb".into(), std::fs::canonicalize("src/qt_gpu/texture.vert").unwrap(), "", "")];
+    for model in ["opencv_fisheye", "opencv_standard", "poly3", "poly5", "ptlens", "insta360", "sony"] {
+        for digital in ["", "gopro_superview", "gopro6_superview", "gopro_hyperview", "digital_stretch"] {
+            // GoPro superview/hyperview is only used with opencv_fisheye
+            if digital.starts_with("gopro") && model != "opencv_fisheye" { continue; }
+
+            let mut funcs = if digital.is_empty() { no_digital_lens.to_owned() } else { read(&models_dir.join(format!("{digital}.glsl"))) };
+            if model != "sony" {
+                funcs.push_str(" vec2 process_coord(vec2 uv, float idx) { return uv; } ");
+            }
+            funcs.push_str(&read(&models_dir.join(format!("{model}.glsl"))));
+            let mut shader = frag.replacen("LENS_MODEL_FUNCTIONS;", &funcs, 1);
+            if model == "sony" {
+                shader.push_str(" float get_mesh_data(int idx) { return texture(texMeshData, vec2(0, idx / 1023.0)).r; } ");
+            }
+
+            let name = if digital.is_empty() { model.to_owned() } else { format!("{model}_{digital}") };
+            let src = out_dir.join(format!("undistort_{name}.frag"));
+            std::fs::write(&src, shader).unwrap();
+            for (suffix, defines) in SHADER_VARIANTS {
+                // GYROFLOW_PACKED_MATRICES selects the matching texture layout in qrhi_undistort.cpp
+                jobs.push((format!("undistort_{name}{suffix}.frag.qsb"), src.clone(), defines, "-DPACKED_MATRICES"));
+            }
+        }
+    }
+
+    let threads = std::thread::available_parallelism().map(|x| x.get()).unwrap_or(4);
+    let failed = std::sync::atomic::AtomicBool::new(false);
+    std::thread::scope(|s| {
+        for chunk in jobs.chunks(jobs.len().div_ceil(threads)) {
+            let (qsb, out_dir, failed) = (&qsb, &out_dir, &failed);
+            s.spawn(move || for (out, src, defines, common) in chunk {
+                let output = Command::new(qsb)
+                    .args(["--glsl", "120,300 es,310 es,320 es,310,320,330,400,410,420", "--hlsl", "50", "--msl", "12"])
+                    .args(common.split_whitespace())
+                    .args(defines.split_whitespace())
+                    .arg("-o").arg(out_dir.join(out)).arg(src)
+                    .output();
+                match output {
+                    Ok(x) if x.status.success() => { },
+                    Ok(x) => { println!("cargo:warning=qsb failed for {out}: {}", String::from_utf8_lossy(&x.stderr).replace('\n', " ")); failed.store(true, std::sync::atomic::Ordering::Relaxed); },
+                    Err(e) => { println!("cargo:warning={qsb} failed: {e}"); failed.store(true, std::sync::atomic::Ordering::Relaxed); }
+                }
+            });
+        }
+    });
+    if failed.into_inner() { return false; }
+
+    let mut qrc = String::from("<RCC>\n<qresource prefix=\"/src/qt_gpu/baked\">\n");
+    for (out, ..) in &jobs {
+        let _ = writeln!(qrc, "<file>{out}</file>");
+    }
+    qrc.push_str("</qresource>\n</RCC>\n");
+    std::fs::write(out_dir.join("baked_shaders.qrc"), qrc).unwrap();
+
+    let rcc_path = Path::new(&env::var("OUT_DIR").unwrap()).join("baked_shaders.rcc");
+    let output = Command::new(&rcc).current_dir(&out_dir).args(["--binary", "-o"]).arg(&rcc_path).arg("baked_shaders.qrc").output();
+    match output {
+        Ok(x) if x.status.success() => true,
+        Ok(x) => { println!("cargo:warning=rcc failed: {}", String::from_utf8_lossy(&x.stderr)); false },
+        Err(e) => { println!("cargo:warning={rcc} failed: {e}"); false }
+    }
+}
+
 fn main() {
     let qt_include_path = env::var("DEP_QT_INCLUDE_PATH").unwrap();
     let qt_library_path = env::var("DEP_QT_LIBRARY_PATH").unwrap();
@@ -86,17 +245,39 @@ fn main() {
         }
     }
 
+    println!("cargo:rerun-if-changed=src/qt_gpu/undistort.frag");
+    println!("cargo:rerun-if-changed=src/qt_gpu/texture.vert");
+    println!("cargo:rerun-if-changed=src/core/stabilization/distortion_models/");
+    println!("cargo::rustc-check-cfg=cfg(qrhi_baked_shaders)");
+    let baked_shaders = bake_shaders(&qt_library_path);
+    if baked_shaders {
+        println!("cargo:rustc-cfg=qrhi_baked_shaders");
+    }
+
     let mut config = cpp_build::Config::new();
 
     for f in env::var("DEP_QT_COMPILE_FLAGS").unwrap().split_terminator(';') {
         config.flag(f);
     }
+    if baked_shaders {
+        config.define("GYROFLOW_PACKED_MATRICES", None);
+    }
     // config.define("QT_QML_DEBUG", None);
     println!("cargo:rerun-if-changed=src/qt_gpu/qrhi_undistort.cpp");
 
+    let mut qml_modules = Vec::new();
     if target_os == "ios" {
         println!("cargo:rerun-if-changed=_deployment/ios/qml_plugins.cpp");
-        config.file("_deployment/ios/qml_plugins.cpp");
+        println!("cargo:rerun-if-changed=src/ui/");
+        let plugins = scan_qml_imports("src/ui/", &qt_library_path);
+        let mut cpp = format!("// Generated by build.rs from the imports in src/ui/\n#include \"{}/_deployment/ios/qml_plugins.cpp\"\n", env::var("CARGO_MANIFEST_DIR").unwrap().replace('\\', "/"));
+        for (class, _) in &plugins {
+            let _ = writeln!(cpp, "Q_IMPORT_PLUGIN({class})");
+        }
+        let imports_path = Path::new(&env::var("OUT_DIR").unwrap()).join("qml_imports.cpp");
+        std::fs::write(&imports_path, cpp).unwrap();
+        config.file(&imports_path);
+        qml_modules = plugins.into_iter().map(|(_, path)| path).collect();
 
         println!("cargo:rustc-link-arg=-Wl,-e,_qt_main_wrapper");
         println!("cargo:rustc-link-arg=-fapple-link-rtlib");
@@ -117,6 +298,7 @@ fn main() {
             println!("cargo:rustc-link-lib=framework={x}");
         }
 
+        let qt_qml_path = std::fs::canonicalize(Path::new(&qt_library_path).parent().unwrap().join("qml")).unwrap_or_default();
         let mut added_paths = vec![];
         for x in walkdir::WalkDir::new(Path::new(&qt_library_path).parent().unwrap()) {
             let x = x.unwrap();
@@ -131,7 +313,7 @@ fn main() {
                path.to_ascii_lowercase().contains("test") {
                 continue;
             }
-            if name.starts_with("qrc_") && name.ends_with(".cpp.o") {
+            if name.starts_with("qrc_") && name.ends_with(".cpp.o") && !is_unused_qml_module(x.path(), &qt_qml_path, &qml_modules) {
                 println!("cargo:rustc-link-arg=-force_load");
                 println!("cargo:rustc-link-arg={}", path);
             }
@@ -241,7 +423,7 @@ fn main() {
         let out_dir = env::var("OUT_DIR").unwrap();
         for entry in Path::new(&out_dir).read_dir().unwrap() {
             let path = entry.unwrap().path();
-            if path.is_file() && path.to_string_lossy().contains("qml_plugins.o") {
+            if path.is_file() && path.to_string_lossy().contains("qml_imports.o") {
                 println!("cargo:rustc-link-arg=-force_load");
                 println!("cargo:rustc-link-arg={}", path.to_string_lossy());
                 break;
@@ -114,6 +114,18 @@ struct Opts {
     /// print app version
     #[argh(switch)]
     version: bool,
+
+    /// benchmark the Qt RHI undistortion with every compiled shader and write the timings as JSON to this file, "-" for stdout
+    #[argh(option)]
+    benchmark_rhi: Option<String>,
+
+    /// frames per shader for --benchmark-rhi, default: 300
+    #[argh(option, default = "300")]
+    benchmark_frames: usize,
+
+    /// frame size for --benchmark-rhi, default: "2704x2028"
+    #[argh(option, default = "String::from(\"2704x2028\")")]
+    benchmark_size: String,
 }
 
 pub fn will_run_in_console() -> bool {
@@ -138,6 +150,15 @@ pub fn run(open_file: &mut String, open_preset: &mut String) -> bool {
             return true;
         }
 
+        if let Some(out) = opts.benchmark_rhi {
+            let Some(size) = opts.benchmark_size.split_once('x').and_then(|(w, h)| Some((w.parse::<usize>().ok()?, h.parse::<usize>().ok()?))) else {
+                log::error!("Invalid --benchmark-size {}, expected eg. 1920x1080", opts.benchmark_size);
+                return true;
+            };
+            crate::qt_gpu::bench::run(Some(out.as_str()).filter(|x| *x != "-"), opts.benchmark_frames, size);
+            return true;
+        }
+
         let absolute_paths: Vec<String> = opts.input.iter().map(|file| {
             let path = std::path::PathBuf::from(file);
             if path.is_relative() {
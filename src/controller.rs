@@ -274,6 +274,7 @@ pub struct Controller {
     has_per_frame_lens_data: qt_method!(fn(&self) -> bool),
     export_stmap: qt_method!(fn(&self, folder_url: QUrl, per_frame: bool)),
     stmap_progress: qt_signal!(progress: f64, ready: usize, total: usize),
+    save_preview_frame: qt_method!(fn(&self, folder_url: QUrl, filename: QString)),
 
     // ---------- REDline conversion ----------
     find_redline: qt_method!(fn(&self) -> QString),
@@ -995,7 +996,7 @@ impl Controller {
             vid.onProcessTexture(Box::new(move |frame, timestamp_ms, width, height, backend_id, ptr1, ptr2, ptr3, ptr4, ptr5| -> bool {
                 if width < 4 || height < 4 || backend_id == 0 { return false; }
 
-                if !stab.params.read().stab_enabled { return true; }
+                if !stab.params.read().stab_enabled { qrhi_undistort::release(vid1.get_mdkplayer()); return true; }
 
                 let _time = std::time::Instant::now();
 
@@ -1013,13 +1014,17 @@ impl Controller {
                     let timestamp_ms = timestamp_ms + (offset as f64 / fps * 1000.0).round();
 
                     if let Some(ret) = qrhi_undistort::render(vid1.get_mdkplayer(), timestamp_ms, frame as usize, width, height, stab.clone(), &mut buffers) {
-                        update_info2((ret.fov, ret.minimal_fov, ret.focal_length, QString::from(format!("Processing {}x{} using {} took {:.2}ms", width, height, ret.backend, _time.elapsed().as_micros() as f64 / 1000.0))));
+                        let mut info = format!("Processing {}x{} using {} took {:.2}ms", width, height, ret.backend, _time.elapsed().as_micros() as f64 / 1000.0);
+                        if let Some(gpu_ms) = ret.gpu_time_ms { info.push_str(&format!(", GPU frame {:.2}ms", gpu_ms)); }
+                        if let Some(upload_ms) = ret.upload_time_ms { info.push_str(&format!(", upload {:.1} kB in {:.2}ms", ret.upload_bytes as f64 / 1024.0, upload_ms)); }
+                        update_info2((ret.fov, ret.minimal_fov, ret.focal_length, QString::from(info)));
                     } else {
                         update_info2((1.0, 1.0, None, QString::from("---")));
                     }
                     return true;
                 }
 
+                qrhi_undistort::release(vid1.get_mdkplayer()); // The other pipelines process the item texture in place
                 if preview_pipeline.load(SeqCst) > 1 { return false; }
 
                 let size = (width as usize, height as usize, width as usize * 4);
@@ -2381,6 +2386,26 @@ impl Controller {
         #[cfg(not(any(target_os = "windows", target_os = "macos")))] { QString::default() }
     }
 
+    /// Saves the next stabilized frame of the Qt RHI preview as PNG, read back from the GPU without stalling the render thread
+    fn save_preview_frame(&self, folder_url: QUrl, filename: QString) {
+        let url = filesystem::get_file_url(&util::qurl_to_encoded(folder_url), &filename.to_string(), true);
+        let err = util::qt_queued_callback_mut(self, |this, msg: String| {
+            this.error(QString::from("An error occured: %1"), QString::from(msg), QString::default());
+        });
+        qrhi_undistort::set_frame_readback(Some(Box::new(move |_timestamp_us, width, height, pixels| {
+            let pixels = pixels.to_vec();
+            let url = url.clone();
+            let err = err.clone();
+            core::run_threaded(move || {
+                let png = util::image_data_to_png(width, height, width * 4, &pixels);
+                if let Err(e) = filesystem::write(&url, &png) {
+                    err(format!("{url}: {e:?}"));
+                }
+            });
+            false
+        })));
+    }
+
     // Utilities
     fn get_username(&self) -> QString { let realname = whoami::realname(); QString::from(if realname.is_empty() { whoami::username() } else { realname }) }
     fn image_to_b64(&self, img: QImage) -> QString { util::image_to_b64(img) }
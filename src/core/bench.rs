@@ -0,0 +1,93 @@
+use std::time::{Duration, Instant};
+use serde_json::{json, Value};
+
+/// Per-frame durations of one measured step
+#[derive(Clone, Default)]
+pub struct Timings {
+    pub name: String,
+    ms: Vec<f64>,
+}
+
+impl Timings {
+    pub fn new(name: &str) -> Self { Self { name: name.to_owned(), ms: Vec::new() } }
+
+    pub fn push(&mut self, d: Duration) { self.ms.push(d.as_secs_f64() * 1000.0); }
+
+    /// Runs `f` and records how long it took
+    pub fn time<R, F: FnOnce() -> R>(&mut self, f: F) -> R {
+        let t = Instant::now();
+        let ret = f();
+        self.push(t.elapsed());
+        ret
+    }
+
+    pub fn len(&self) -> usize { self.ms.len() }
+
+    /// `{ count, mean, p50, p95, p99, max, fps }` in ms, fps being the throughput of this step alone
+    pub fn summary(&self) -> Value {
+        if self.ms.is_empty() { return json!({ "count": 0 }); }
+        let mut sorted = self.ms.clone();
+        sorted.sort_by(|a, b| a.total_cmp(b));
+        let pct = |p: f64| sorted[((sorted.len() as f64 * p).ceil() as usize).clamp(1, sorted.len()) - 1];
+        let mean = sorted.iter().sum::<f64>() / sorted.len() as f64;
+        json!({
+            "count": sorted.len(),
+            "mean":  mean,
+            "p50":   pct(0.50),
+            "p95":   pct(0.95),
+            "p99":   pct(0.99),
+            "max":   sorted[sorted.len() - 1],
+            "fps":   if mean > 0.0 { 1000.0 / mean } else { 0.0 },
+        })
+    }
+}
+
+/// Result of one benchmark run as JSON, shared by `live bench` and `gyroflow --benchmark-rhi` so runs
+/// from different commits can be diffed by a script. `GYROFLOW_BENCH_TAG` (e.g. the commit hash) is stored with the run
+pub struct BenchReport {
+    suite: String,
+    info: serde_json::Map<String, Value>,
+    steps: Vec<Value>,
+}
+
+impl BenchReport {
+    pub fn new(suite: &str) -> Self {
+        Self { suite: suite.to_owned(), info: Default::default(), steps: Vec::new() }
+    }
+
+    pub fn set_info(&mut self, key: &str, value: Value) { self.info.insert(key.to_owned(), value); }
+
+    /// Adds a step, `wall` is the time for all of its frames including anything around the measured calls
+    pub fn add(&mut self, timings: &Timings, wall: Option<Duration>, extra: Value) {
+        let mut step = json!({ "name": timings.name, "ms": timings.summary() });
+        if let Some(wall) = wall.filter(|w| !w.is_zero()) {
+            step["wall_s"] = json!(wall.as_secs_f64());
+            step["wall_fps"] = json!(timings.len() as f64 / wall.as_secs_f64());
+        }
+        if let Value::Object(extra) = extra {
+            for (k, v) in extra { step[k] = v; }
+        }
+        self.steps.push(step);
+    }
+
+    pub fn to_json(&self) -> Value {
+        json!({
+            "suite":   self.suite,
+            "tag":     std::env::var("GYROFLOW_BENCH_TAG").ok(),
+            "version": env!("CARGO_PKG_VERSION"),
+            "os":      std::env::consts::OS,
+            "arch":    std::env::consts::ARCH,
+            "info":    self.info,
+            "steps":   self.steps,
+        })
+    }
+
+    /// Writes the report to `path`, or to stdout if None
+    pub fn write(&self, path: Option<&str>) -> std::io::Result<()> {
+        let out = serde_json::to_string_pretty(&self.to_json())?;
+        match path {
+            Some(path) => std::fs::write(path, out),
+            None => { println!("{out}"); Ok(()) }
+        }
+    }
+}
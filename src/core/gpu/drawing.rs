@@ -38,6 +38,7 @@ pub struct DrawCanvas {
     pub scale: usize,
     pub has_any_pixels: bool,
     buffer: Vec<u8>,
+    drawn_rect: Option<(usize, usize, usize, usize)>, // x0, y0, x1, y1 (exclusive) in canvas pixels of everything drawn since `clear`
 
     drawing_cleared: AtomicBool,
 }
@@ -57,12 +58,20 @@ impl DrawCanvas {
             scale,
             buffer: vec![0; size],
             has_any_pixels: false,
+            drawn_rect: None,
             drawing_cleared: AtomicBool::new(false)
         }
     }
 
+    /// Only the drawn area is zeroed, the rest of the canvas is already empty
     pub fn clear(&mut self) {
-        self.buffer.fill(0);
+        if let Some((x0, y0, x1, y1)) = self.drawn_rect.take() {
+            let w = self.get_size().0;
+            for y in y0..y1 {
+                let row = (y * w + x0).min(self.buffer.len())..(y * w + x1).min(self.buffer.len());
+                self.buffer[row].fill(0);
+            }
+        }
         self.has_any_pixels = false;
     }
 
@@ -76,6 +85,11 @@ impl DrawCanvas {
                 let pos = (((y as f32 / self.scale as f32 + ystep as f32 + adj).floor()) * w as f32 + (x as f32 / self.scale as f32 + xstep as f32 + adj).floor()).round() as i32;
                 if pos >= 0 && pos < self.buffer.len() as i32 {
                     self.has_any_pixels = true;
+                    let (px, py) = (pos as usize % w.max(1), pos as usize / w.max(1));
+                    self.drawn_rect = Some(match self.drawn_rect {
+                        Some((x0, y0, x1, y1)) => (x0.min(px), y0.min(py), x1.max(px + 1), y1.max(py + 1)),
+                        None => (px, py, px + 1, py + 1)
+                    });
                     self.buffer[pos as usize] =
                         ((color as u8) << 3) |
                         ((alpha as u8) << 1) |
@@ -94,6 +108,17 @@ impl DrawCanvas {
     pub fn get_buffer_len(&self) -> usize {
         self.buffer.len()
     }
+    /// Bounding box of the drawn pixels as (x, y, width, height) in canvas pixels, None if nothing is drawn.
+    /// Everything outside of it is zero, so a renderer that keeps the canvas on the GPU only has to upload
+    /// this rect united with the one it uploaded last time
+    pub fn dirty_rect(&self) -> Option<(usize, usize, usize, usize)> {
+        self.drawn_rect.map(|(x0, y0, x1, y1)| (x0, y0, x1 - x0, y1 - y0))
+    }
+    /// The canvas only if anything is drawn, for renderers that don't keep the previous canvas
+    /// and for ones that track the dirty rect themselves
+    pub fn get_drawn_buffer(&self) -> &[u8] {
+        if self.has_any_pixels { self.buffer.as_slice() } else { &[] }
+    }
     pub fn get_buffer(&self) -> &[u8] {
         let buf = if self.has_any_pixels || !self.drawing_cleared.load(SeqCst) {
             self.buffer.as_slice()
@@ -4,6 +4,7 @@
 #[cfg(feature = "use-opencl")]
 pub mod opencl;
 pub mod wgpu;
+pub mod wgpu_stmap;
 
 pub mod wgpu_interop;
 #[cfg(not(any(target_os = "macos", target_os = "ios")))] pub mod wgpu_interop_vulkan;
@@ -2,7 +2,8 @@
 // Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
 
 use std::borrow::Cow;
-use std::sync::atomic::{ AtomicUsize, Ordering::SeqCst };
+use std::collections::HashMap;
+use std::sync::atomic::{ AtomicBool, AtomicUsize, Ordering::SeqCst };
 use wgpu::Adapter;
 use wgpu::BufferUsages;
 use wgpu::util::DeviceExt;
@@ -19,6 +20,7 @@ pub enum WgpuError {
     NoAvailableAdapter,
 }
 
+#[derive(Clone)]
 enum PipelineType {
     None,
     Render(wgpu::RenderPipeline),
@@ -43,6 +45,7 @@ pub struct WgpuWrapper  {
 
     pixel_format: wgpu::TextureFormat,
     padded_out_stride: u32,
+    shared_device: bool, // device and pipeline come from the process-wide cache, see `set_shared_device`
     in_size: u64,
     out_size: u64,
     params_size: u64,
@@ -69,6 +72,18 @@ lazy_static::lazy_static! {
     static ref INSTANCE: Mutex<wgpu::Instance> = Mutex::new(wgpu::Instance::new(&wgpu::InstanceDescriptor::default()));
     static ref ADAPTERS: RwLock<Vec<Adapter>> = RwLock::new(Vec::new());
     static ref ADAPTER: AtomicUsize = AtomicUsize::new(0);
+    // Only used with `set_shared_device(true)`: (adapter index, device, queue) and the pipelines created on that device
+    static ref SHARED_DEVICE: Mutex<Option<(usize, wgpu::Device, wgpu::Queue)>> = Mutex::new(None);
+    static ref SHARED_PIPELINES: Mutex<HashMap<u64, PipelineType>> = Mutex::new(HashMap::new());
+}
+static SHARE_DEVICE: AtomicBool = AtomicBool::new(false);
+
+/// One frame for `WgpuWrapper::undistort_batch`
+pub struct BatchItem<'a, 'b> {
+    pub wgpu: &'a WgpuWrapper,
+    pub buffers: &'a mut Buffers<'b>,
+    pub transform: &'a crate::stabilization::FrameTransform,
+    pub drawing: &'a [u8],
 }
 
 const EXCLUSIONS: &[&'static str] = &["Microsoft Basic Render Driver"];
@@ -110,6 +125,17 @@ impl WgpuWrapper {
         }
         None
     }
+    /// Makes every new `WgpuWrapper` on the current adapter use one device and queue, and reuse the pipelines already
+    /// compiled on it for the same kernel, instead of creating its own. Used when several streams render in one process.
+    /// Metal command queues passed in the buffers still get their own device
+    pub fn set_shared_device(enabled: bool) {
+        SHARE_DEVICE.store(enabled, SeqCst);
+        if !enabled {
+            *SHARED_DEVICE.lock() = None;
+            SHARED_PIPELINES.lock().clear();
+        }
+    }
+
     pub fn get_info() -> Option<String> {
         let lock = ADAPTERS.read();
         if let Some(ref adapter) = lock.get(ADAPTER.load(SeqCst)) {
@@ -143,6 +169,82 @@ impl WgpuWrapper {
         Some((name, list_name))
     }
 
+    fn request_device(adapter: &Adapter) -> Result<(wgpu::Device, wgpu::Queue), WgpuError> {
+        let max_buffer_bits = if cfg!(any(target_os = "android", target_os = "ios")) { 29 } else { 31 };
+        let max_storage_buffer_bits = if cfg!(any(target_os = "android", target_os = "ios")) { 27 } else { 31 };
+        let adapter_limits = adapter.limits();
+        let mut limits = wgpu::Limits {
+            max_storage_buffers_per_shader_stage: 6.min(adapter_limits.max_storage_buffers_per_shader_stage),
+            max_storage_textures_per_shader_stage: 4.min(adapter_limits.max_storage_textures_per_shader_stage),
+            max_buffer_size: ((1 << max_buffer_bits) - 1).min(adapter_limits.max_buffer_size),
+            max_storage_buffer_binding_size: ((1 << max_storage_buffer_bits) - 1+5).min(adapter_limits.max_storage_buffer_binding_size),
+            ..wgpu::Limits::default()
+        };
+        let mut result = Err(WgpuError::NoAvailableAdapter);
+        for _ in 0..4 {
+            let device = pollster::block_on(adapter.request_device(&wgpu::DeviceDescriptor {
+                label: None,
+                required_features: wgpu::Features::empty(),
+                required_limits: limits.clone(),
+                memory_hints: wgpu::MemoryHints::Performance,
+                trace: wgpu::Trace::Off
+            }));
+            if let Err(e) = &device {
+                let e_str = format!("{e:?}");
+                let re = regex::Regex::new("FailedLimit \\{ name: \"(.*?)\", requested: [0-9]+, allowed: ([0-9]+)").unwrap();
+                if let Some(captures) = re.captures(&e_str) {
+                    log::debug!("Catching wgpu limit error: {e_str}");
+                    let (_, [name, allowed]) = captures.extract();
+                    match name {
+                        "max_storage_buffers_per_shader_stage"  => { limits.max_storage_buffers_per_shader_stage  = allowed.parse().unwrap(); continue; },
+                        "max_storage_textures_per_shader_stage" => { limits.max_storage_textures_per_shader_stage = allowed.parse().unwrap(); continue; },
+                        "max_buffer_size"                       => { limits.max_buffer_size                       = allowed.parse().unwrap(); continue; },
+                        "max_storage_buffer_binding_size"       => { limits.max_storage_buffer_binding_size       = allowed.parse().unwrap(); continue; },
+                        _ => { }
+                    }
+                }
+            }
+            result = device.map_err(|e| WgpuError::RequestDevice(e));
+            break;
+        }
+        result
+    }
+
+    /// Device and queue on the current adapter, for the other wgpu users in core (see `wgpu_stmap.rs`)
+    pub(crate) fn create_device() -> Result<(wgpu::Device, wgpu::Queue), WgpuError> {
+        let adapter_initialized = ADAPTERS.read().get(ADAPTER.load(SeqCst)).is_some();
+        if !adapter_initialized { Self::initialize_context(); }
+        let lock = ADAPTERS.read();
+        let adapter = lock.get(ADAPTER.load(SeqCst)).ok_or(WgpuError::NoAvailableAdapter)?;
+        log::debug!("WGPU initializing adapter for {:?}", adapter.get_info());
+        Self::request_device(adapter)
+    }
+
+    /// `wgpu_undistort.wgsl` with the lens model functions and the scalar type filled in, and only the texture
+    /// or the buffer input sections
+    pub(crate) fn kernel_source(distortion_model: &DistortionModel, digital_lens: Option<&DistortionModel>, scalar: &str, uses_textures: bool) -> String {
+        let mut kernel = include_str!("wgpu_undistort.wgsl").to_string();
+        //let mut kernel = std::fs::read_to_string("D:/programowanie/projekty/Rust/gyroflow/src/core/gpu/wgpu_undistort.wgsl").unwrap();
+
+        let mut lens_model_functions = distortion_model.wgsl_functions().to_string();
+        let default_digital_lens = "fn digital_undistort_point(uv: vec2<f32>) -> vec2<f32> { return uv; }
+                                    fn digital_distort_point  (uv: vec2<f32>) -> vec2<f32> { return uv; }";
+        lens_model_functions.push_str(digital_lens.map(|x| x.wgsl_functions()).unwrap_or(default_digital_lens));
+        kernel = kernel.replace("LENS_MODEL_FUNCTIONS;", &lens_model_functions);
+        kernel = kernel.replace("SCALAR", scalar);
+
+        if uses_textures {
+            while let Some(pos) = kernel.find("{buffer_input}") {
+                kernel.replace_range(pos..kernel.find("{/buffer_input}").unwrap() + 15, "");
+            }
+        } else {
+            while let Some(pos) = kernel.find("{texture_input}") {
+                kernel.replace_range(pos..kernel.find("{/texture_input}").unwrap() + 16, "");
+            }
+        }
+        kernel
+    }
+
     pub fn new(params: &KernelParams, wgpu_format: (wgpu::TextureFormat, &str, bool), distortion_model: DistortionModel, digital_lens: Option<DistortionModel>, buffers: &Buffers, mut drawing_len: usize) -> Result<Self, WgpuError> {
         let max_matrix_count = 14 * if (params.flags & 16) == 16 { params.width } else { params.height } as usize;
 
@@ -172,6 +274,7 @@ impl WgpuWrapper {
 
         if let Some(adapter) = lock.get(adapter_id) {
             log::debug!("WGPU initializing adapter #{adapter_id}: {:?}", adapter.get_info());
+            let mut shared_device = false;
             let (device, queue) = match &buffers.input.data {
                 #[cfg(any(target_os = "macos", target_os = "ios"))]
                 BufferSource::Metal { command_queue, .. } |
@@ -201,62 +304,27 @@ impl WgpuWrapper {
                         }).map_err(|e| WgpuError::RequestDevice(e))?
                     }
                 },
-                _ => {
-                    let max_buffer_bits = if cfg!(any(target_os = "android", target_os = "ios")) { 29 } else { 31 };
-                    let max_storage_buffer_bits = if cfg!(any(target_os = "android", target_os = "ios")) { 27 } else { 31 };
-                    let adapter_limits = adapter.limits();
-                    let mut limits = wgpu::Limits {
-                        max_storage_buffers_per_shader_stage: 6.min(adapter_limits.max_storage_buffers_per_shader_stage),
-                        max_storage_textures_per_shader_stage: 4.min(adapter_limits.max_storage_textures_per_shader_stage),
-                        max_buffer_size: ((1 << max_buffer_bits) - 1).min(adapter_limits.max_buffer_size),
-                        max_storage_buffer_binding_size: ((1 << max_storage_buffer_bits) - 1+5).min(adapter_limits.max_storage_buffer_binding_size),
-                        ..wgpu::Limits::default()
-                    };
-                    let mut result = Err(WgpuError::NoAvailableAdapter);
-                    for _ in 0..4 {
-                        let device = pollster::block_on(adapter.request_device(&wgpu::DeviceDescriptor {
-                            label: None,
-                            required_features: wgpu::Features::empty(),
-                            required_limits: limits.clone(),
-                            memory_hints: wgpu::MemoryHints::Performance,
-                            trace: wgpu::Trace::Off
-                        }));
-                        if let Err(e) = &device {
-                            let e_str = format!("{e:?}");
-                            let re = regex::Regex::new("FailedLimit \\{ name: \"(.*?)\", requested: [0-9]+, allowed: ([0-9]+)").unwrap();
-                            if let Some(captures) = re.captures(&e_str) {
-                                log::debug!("Catching wgpu limit error: {e_str}");
-                                let (_, [name, allowed]) = captures.extract();
-                                match name {
-                                    "max_storage_buffers_per_shader_stage"  => { limits.max_storage_buffers_per_shader_stage  = allowed.parse().unwrap(); continue; },
-                                    "max_storage_textures_per_shader_stage" => { limits.max_storage_textures_per_shader_stage = allowed.parse().unwrap(); continue; },
-                                    "max_buffer_size"                       => { limits.max_buffer_size                       = allowed.parse().unwrap(); continue; },
-                                    "max_storage_buffer_binding_size"       => { limits.max_storage_buffer_binding_size       = allowed.parse().unwrap(); continue; },
-                                    _ => { }
-                                }
-                            }
+                _ if SHARE_DEVICE.load(SeqCst) => {
+                    let mut shared = SHARED_DEVICE.lock();
+                    let cached = shared.as_ref().filter(|x| x.0 == adapter_id).map(|(_, device, queue)| (device.clone(), queue.clone()));
+                    shared_device = true;
+                    match cached {
+                        Some(x) => x,
+                        None => {
+                            let (device, queue) = Self::request_device(adapter)?;
+                            *shared = Some((adapter_id, device.clone(), queue.clone()));
+                            SHARED_PIPELINES.lock().clear();
+                            (device, queue)
                         }
-                        result = device.map_err(|e| WgpuError::RequestDevice(e));
-                        break;
                     }
-                    result?
-                }
+                },
+                _ => Self::request_device(adapter)?
             };
 
             device.on_uncaptured_error(Box::new(|e| {
                 log::error!("Uncaptured device error: {e:?}");
             }));
 
-            let mut kernel = include_str!("wgpu_undistort.wgsl").to_string();
-            //let mut kernel = std::fs::read_to_string("D:/programowanie/projekty/Rust/gyroflow/src/core/gpu/wgpu_undistort.wgsl").unwrap();
-
-            let mut lens_model_functions = distortion_model.wgsl_functions().to_string();
-            let default_digital_lens = "fn digital_undistort_point(uv: vec2<f32>) -> vec2<f32> { return uv; }
-                                        fn digital_distort_point  (uv: vec2<f32>) -> vec2<f32> { return uv; }";
-            lens_model_functions.push_str(digital_lens.as_ref().map(|x| x.wgsl_functions()).unwrap_or(default_digital_lens));
-            kernel = kernel.replace("LENS_MODEL_FUNCTIONS;", &lens_model_functions);
-            kernel = kernel.replace("SCALAR", wgpu_format.1);
-
             if !drawing_enabled {
                 drawing_len = 16;
             }
@@ -266,20 +334,16 @@ impl WgpuWrapper {
             let out_texture = init_texture(&device, backend, &buffers.output, wgpu_format.0, false);
 
             let uses_textures = in_texture.wgpu_texture.is_some();
-            if uses_textures {
-                while let Some(pos) = kernel.find("{buffer_input}") {
-                    kernel.replace_range(pos..kernel.find("{/buffer_input}").unwrap() + 15, "");
-                }
-            } else {
-                while let Some(pos) = kernel.find("{texture_input}") {
-                    kernel.replace_range(pos..kernel.find("{/texture_input}").unwrap() + 16, "");
-                }
-            }
+            let kernel = Self::kernel_source(&distortion_model, digital_lens.as_ref(), wgpu_format.1, uses_textures);
             // log::info!("Using kernel: {kernel}");
 
-            let shader = device.create_shader_module(wgpu::ShaderModuleDescriptor {
-                source: wgpu::ShaderSource::Wgsl(Cow::Owned(kernel)),
-                label: None
+            // Everything the pipeline depends on, to reuse it on the shared device
+            let pipeline_key = shared_device.then(|| {
+                use std::hash::{ Hash, Hasher };
+                let mut hasher = std::collections::hash_map::DefaultHasher::new();
+                (&kernel, uses_textures, format!("{:?}", wgpu_format.0), params_size, in_size, out_size, drawing_len).hash(&mut hasher);
+                (params.interpolation, params.pix_element_count, params.bytes_per_pixel, params.flags).hash(&mut hasher);
+                hasher.finish()
             });
 
             let align = wgpu::COPY_BYTES_PER_ROW_ALIGNMENT as i32;
@@ -294,92 +358,106 @@ impl WgpuWrapper {
             let buf_coeffs  = device.create_buffer_init(&wgpu::util::BufferInitDescriptor { label: None, contents: bytemuck::cast_slice(&crate::stabilization::COEFFS), usage: wgpu::BufferUsages::STORAGE });
             let buf_mesh_data = device.create_buffer(&wgpu::BufferDescriptor { size: (crate::gyro_source::splines::MAX_BUFFER_SIZE * std::mem::size_of::<f32>()).max(4096) as _, usage: BufferUsages::STORAGE | BufferUsages::COPY_DST, label: None, mapped_at_creation: false });
 
-            let bind_group_layout = if uses_textures {
-                let sample_type = match wgpu_format.1 {
-                    "f32" => wgpu::TextureSampleType::Float { filterable: false },
-                    "u32" => wgpu::TextureSampleType::Uint,
-                    _ => { log::error!("Unknown texture scalar: {:?}", wgpu_format); wgpu::TextureSampleType::Float { filterable: false } }
-                };
-                device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
-                    entries: &[
-                        wgpu::BindGroupLayoutEntry { binding: 0, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Uniform, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(std::mem::size_of::<KernelParams>() as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 1, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(params_size as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 2, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new((crate::stabilization::COEFFS.len() * std::mem::size_of::<f32>()) as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 3, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(4096) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 4, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(drawing_len as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 5, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Texture { sample_type, view_dimension: wgpu::TextureViewDimension::D2, multisampled: false }, count: None },
-                    ],
-                    label: None,
-                })
+            let cached_pipeline = pipeline_key.and_then(|key| SHARED_PIPELINES.lock().get(&key).cloned());
+            let pipeline = if let Some(pipeline) = cached_pipeline {
+                pipeline
             } else {
-                device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
-                    entries: &[
-                        wgpu::BindGroupLayoutEntry { binding: 0, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Uniform, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(std::mem::size_of::<KernelParams>() as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 1, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(params_size as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 2, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new((crate::stabilization::COEFFS.len() * std::mem::size_of::<f32>()) as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 3, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(4096) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 4, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(drawing_len as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 5, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(in_size as _) }, count: None },
-                        wgpu::BindGroupLayoutEntry { binding: 6, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: false }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(out_size as _) }, count: None },
-                    ],
-                    label: None,
-                })
-            };
-
-            let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
-                label: None,
-                bind_group_layouts: &[&bind_group_layout],
-                push_constant_ranges: &[],
-            });
+                let shader = device.create_shader_module(wgpu::ShaderModuleDescriptor {
+                    source: wgpu::ShaderSource::Wgsl(Cow::Owned(kernel)),
+                    label: None
+                });
 
-            let compilation_options = wgpu::PipelineCompilationOptions {
-                constants: &[
-                    ("100", params.interpolation     as f64),
-                    ("101", params.pix_element_count as f64),
-                    ("102", params.bytes_per_pixel   as f64),
-                    ("103", params.flags             as f64),
-                ],
-                ..Default::default()
-            };
+                let bind_group_layout = if uses_textures {
+                    let sample_type = match wgpu_format.1 {
+                        "f32" => wgpu::TextureSampleType::Float { filterable: false },
+                        "u32" => wgpu::TextureSampleType::Uint,
+                        _ => { log::error!("Unknown texture scalar: {:?}", wgpu_format); wgpu::TextureSampleType::Float { filterable: false } }
+                    };
+                    device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+                        entries: &[
+                            wgpu::BindGroupLayoutEntry { binding: 0, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Uniform, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(std::mem::size_of::<KernelParams>() as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 1, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(params_size as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 2, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new((crate::stabilization::COEFFS.len() * std::mem::size_of::<f32>()) as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 3, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(4096) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 4, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(drawing_len as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 5, visibility: wgpu::ShaderStages::FRAGMENT, ty: wgpu::BindingType::Texture { sample_type, view_dimension: wgpu::TextureViewDimension::D2, multisampled: false }, count: None },
+                        ],
+                        label: None,
+                    })
+                } else {
+                    device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+                        entries: &[
+                            wgpu::BindGroupLayoutEntry { binding: 0, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Uniform, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(std::mem::size_of::<KernelParams>() as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 1, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(params_size as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 2, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new((crate::stabilization::COEFFS.len() * std::mem::size_of::<f32>()) as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 3, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(4096) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 4, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(drawing_len as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 5, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: true }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(in_size as _) }, count: None },
+                            wgpu::BindGroupLayoutEntry { binding: 6, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only: false }, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(out_size as _) }, count: None },
+                        ],
+                        label: None,
+                    })
+                };
 
-            let pipeline = if uses_textures {
-                PipelineType::Render(device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+                let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
                     label: None,
-                    layout: Some(&pipeline_layout),
-                    vertex: wgpu::VertexState {
-                        module: &shader,
-                        entry_point: Some("undistort_vertex"),
-                        buffers: &[],
-                        compilation_options: compilation_options.clone(),
-                    },
-                    fragment: Some(wgpu::FragmentState {
+                    bind_group_layouts: &[&bind_group_layout],
+                    push_constant_ranges: &[],
+                });
+
+                let compilation_options = wgpu::PipelineCompilationOptions {
+                    constants: &[
+                        ("100", params.interpolation     as f64),
+                        ("101", params.pix_element_count as f64),
+                        ("102", params.bytes_per_pixel   as f64),
+                        ("103", params.flags             as f64),
+                    ],
+                    ..Default::default()
+                };
+
+                let pipeline = if uses_textures {
+                    PipelineType::Render(device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+                        label: None,
+                        layout: Some(&pipeline_layout),
+                        vertex: wgpu::VertexState {
+                            module: &shader,
+                            entry_point: Some("undistort_vertex"),
+                            buffers: &[],
+                            compilation_options: compilation_options.clone(),
+                        },
+                        fragment: Some(wgpu::FragmentState {
+                            module: &shader,
+                            entry_point: Some("undistort_fragment"),
+                            targets: &[Some(wgpu::ColorTargetState {
+                                format: wgpu_format.0,
+                                blend: None,
+                                write_mask: wgpu::ColorWrites::default(),
+                            })],
+                            compilation_options,
+                        }),
+                        primitive: wgpu::PrimitiveState {
+                            topology: wgpu::PrimitiveTopology::TriangleStrip,
+                            ..wgpu::PrimitiveState::default()
+                        },
+                        multiview: None,
+                        depth_stencil: None,
+                        multisample: wgpu::MultisampleState::default(),
+                        cache: Default::default()
+                    }))
+                } else {
+                    PipelineType::Compute(device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
                         module: &shader,
-                        entry_point: Some("undistort_fragment"),
-                        targets: &[Some(wgpu::ColorTargetState {
-                            format: wgpu_format.0,
-                            blend: None,
-                            write_mask: wgpu::ColorWrites::default(),
-                        })],
+                        entry_point: Some("undistort_compute"),
+                        label: None,
+                        layout: Some(&pipeline_layout),
                         compilation_options,
-                    }),
-                    primitive: wgpu::PrimitiveState {
-                        topology: wgpu::PrimitiveTopology::TriangleStrip,
-                        ..wgpu::PrimitiveState::default()
-                    },
-                    multiview: None,
-                    depth_stencil: None,
-                    multisample: wgpu::MultisampleState::default(),
-                    cache: Default::default()
-                }))
-            } else {
-                PipelineType::Compute(device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
-                    module: &shader,
-                    entry_point: Some("undistort_compute"),
-                    label: None,
-                    layout: Some(&pipeline_layout),
-                    compilation_options,
-                    cache: Default::default()
-                }))
+                        cache: Default::default()
+                    }))
+                };
+                if let Some(key) = pipeline_key {
+                    SHARED_PIPELINES.lock().insert(key, pipeline.clone());
+                }
+                pipeline
             };
 
             let bind_group = match &pipeline {
@@ -432,35 +510,90 @@ impl WgpuWrapper {
                 params_size,
                 drawing_size: drawing_len as u64,
                 pixel_format: wgpu_format.0,
-                padded_out_stride: padded_out_stride as u32
+                padded_out_stride: padded_out_stride as u32,
+                shared_device,
             })
         } else {
             Err(WgpuError::NoAvailableAdapter)
         }
     }
 
+    pub fn is_shared_device(&self) -> bool { self.shared_device }
+
     pub fn undistort_image(&self, buffers: &mut Buffers, itm: &crate::stabilization::FrameTransform, drawing_buffer: &[u8]) -> bool {
+        let mut encoder = self.device.create_command_encoder(&wgpu::CommandEncoderDescriptor { label: None });
+        let Some(_temp_textures) = self.encode_undistort(&mut encoder, buffers, itm, drawing_buffer) else { return false; };
+
+        let sub_index = self.queue.submit(Some(encoder.finish()));
+        let receiver = self.map_output(buffers);
+        if receiver.is_some() {
+            let _ = self.device.poll(wgpu::PollType::Wait);
+        }
+        self.read_output(buffers, sub_index, receiver)
+    }
+
+    /// Undistorts all `items` with one command buffer, one submit and one wait when their wrappers are on the shared
+    /// device (see `set_shared_device`). Items on their own device are processed one by one. Returns the result per item
+    pub fn undistort_batch(items: &mut [BatchItem]) -> Vec<bool> {
+        let mut ok = vec![false; items.len()];
+        let Some(first) = items.iter().find(|x| x.wgpu.shared_device) else {
+            for (item, ok) in items.iter_mut().zip(ok.iter_mut()) {
+                *ok = item.wgpu.undistort_image(item.buffers, item.transform, item.drawing);
+            }
+            return ok;
+        };
+        let (device, queue) = (first.wgpu.device.clone(), first.wgpu.queue.clone());
+
+        let mut encoder = device.create_command_encoder(&wgpu::CommandEncoderDescriptor { label: Some("undistort batch") });
+        let mut encoded = Vec::with_capacity(items.len());
+        let mut temp_textures = Vec::with_capacity(items.len());
+        for (i, item) in items.iter_mut().enumerate() {
+            if !item.wgpu.shared_device {
+                ok[i] = item.wgpu.undistort_image(item.buffers, item.transform, item.drawing);
+                continue;
+            }
+            if let Some(temp) = item.wgpu.encode_undistort(&mut encoder, item.buffers, item.transform, item.drawing) {
+                temp_textures.push(temp);
+                encoded.push(i);
+            }
+        }
+        if encoded.is_empty() { return ok; }
+
+        let sub_index = queue.submit(Some(encoder.finish()));
+        let receivers: Vec<_> = encoded.iter().map(|&i| items[i].wgpu.map_output(items[i].buffers)).collect();
+        if receivers.iter().any(|x| x.is_some()) {
+            let _ = device.poll(wgpu::PollType::Wait);
+        }
+        for (&i, receiver) in encoded.iter().zip(receivers) {
+            let item = &mut items[i];
+            ok[i] = item.wgpu.read_output(item.buffers, sub_index.clone(), receiver);
+        }
+        drop(temp_textures);
+        ok
+    }
+
+    /// Records the uploads, the undistortion and the output copy into `encoder`. The returned temporary textures
+    /// have to be kept until the commands have been submitted
+    fn encode_undistort(&self, encoder: &mut wgpu::CommandEncoder, buffers: &mut Buffers, itm: &crate::stabilization::FrameTransform, drawing_buffer: &[u8]) -> Option<(Option<wgpu::Texture>, Option<wgpu::Texture>)> {
         let matrices = bytemuck::cast_slice(&itm.matrices);
 
         let in_size = (buffers.input.size.2 * buffers.input.size.1) as u64;
         let out_size = (buffers.output.size.2 * buffers.output.size.1) as u64;
-        if self.in_size  != in_size  { log::error!("Buffer size mismatch! {} vs {}", self.in_size,  in_size);  return false; }
-        if self.out_size != out_size { log::error!("Buffer size mismatch! {} vs {}", self.out_size, out_size); return false; }
-
-        let mut encoder = self.device.create_command_encoder(&wgpu::CommandEncoderDescriptor { label: None });
+        if self.in_size  != in_size  { log::error!("Buffer size mismatch! {} vs {}", self.in_size,  in_size);  return None; }
+        if self.out_size != out_size { log::error!("Buffer size mismatch! {} vs {}", self.out_size, out_size); return None; }
 
-        let _temp_texture = handle_input_texture(&self.device, &buffers.input, &self.queue, &mut encoder, &self.in_texture, self.pixel_format, self.padded_out_stride);
+        let temp_texture = handle_input_texture(&self.device, &buffers.input, &self.queue, encoder, &self.in_texture, self.pixel_format, self.padded_out_stride);
 
-        if self.params_size < matrices.len() as u64    { log::error!("Buffer size mismatch! {} vs {}", self.params_size, matrices.len()); return false; }
+        if self.params_size < matrices.len() as u64    { log::error!("Buffer size mismatch! {} vs {}", self.params_size, matrices.len()); return None; }
 
         self.queue.write_buffer(self.buf_matrices.as_ref().unwrap(), 0, matrices);
         self.queue.write_buffer(self.buf_params.as_ref().unwrap(), 0, bytemuck::bytes_of(&itm.kernel_params));
         if !drawing_buffer.is_empty() {
-            if self.drawing_size < drawing_buffer.len() as u64 { log::error!("Buffer size mismatch! {} vs {}", self.drawing_size, drawing_buffer.len()); return false; }
+            if self.drawing_size < drawing_buffer.len() as u64 { log::error!("Buffer size mismatch! {} vs {}", self.drawing_size, drawing_buffer.len()); return None; }
             self.queue.write_buffer(self.buf_drawing.as_ref().unwrap(), 0, drawing_buffer);
         }
         if !itm.mesh_data.is_empty() {
-            if self.buf_mesh_data.is_none() || (self.buf_mesh_data.as_ref().unwrap().size() as usize * 4) < itm.mesh_data.len() { log::error!("Buffer size mismatch buf_mesh_data! {} vs {}", self.buf_mesh_data.as_ref().unwrap().size() * 4, itm.mesh_data.len()); return false; }
+            if self.buf_mesh_data.is_none() || (self.buf_mesh_data.as_ref().unwrap().size() as usize * 4) < itm.mesh_data.len() { log::error!("Buffer size mismatch buf_mesh_data! {} vs {}", self.buf_mesh_data.as_ref().unwrap().size() * 4, itm.mesh_data.len()); return None; }
             self.queue.write_buffer(self.buf_mesh_data.as_ref().unwrap(), 0, bytemuck::cast_slice(&itm.mesh_data));
         }
 
@@ -495,19 +628,25 @@ impl WgpuWrapper {
             }
         }
 
-        let _temp_texture2 = handle_output_texture(&self.device, &buffers.output, &self.queue, &mut encoder, &self.out_texture, self.pixel_format, self.staging_buffer.as_ref().unwrap(), self.padded_out_stride);
+        let temp_texture2 = handle_output_texture(&self.device, &buffers.output, &self.queue, encoder, &self.out_texture, self.pixel_format, self.staging_buffer.as_ref().unwrap(), self.padded_out_stride);
 
-        let sub_index = self.queue.submit(Some(encoder.finish()));
+        Some((temp_texture, temp_texture2))
+    }
+
+    /// Requests the staging buffer mapping for CPU outputs, after the submit and before polling the device
+    fn map_output(&self, buffers: &Buffers) -> Option<futures_intrusive::channel::shared::OneshotReceiver<Result<(), wgpu::BufferAsyncError>>> {
+        let BufferSource::Cpu { .. } = &buffers.output.data else { return None; };
+        let (sender, receiver) = futures_intrusive::channel::shared::oneshot_channel();
+        self.staging_buffer.as_ref().unwrap().slice(..).map_async(wgpu::MapMode::Read, move |v| sender.send(v).unwrap());
+        Some(receiver)
+    }
 
+    /// Copies the mapped staging buffer to a CPU output, or finishes a GPU output
+    fn read_output(&self, buffers: &mut Buffers, sub_index: wgpu::SubmissionIndex, receiver: Option<futures_intrusive::channel::shared::OneshotReceiver<Result<(), wgpu::BufferAsyncError>>>) -> bool {
         match &mut buffers.output.data {
             BufferSource::Cpu { buffer, .. } => {
                 let buffer_slice = self.staging_buffer.as_ref().unwrap().slice(..);
-                let (sender, receiver) = futures_intrusive::channel::shared::oneshot_channel();
-                buffer_slice.map_async(wgpu::MapMode::Read, move |v| sender.send(v).unwrap());
-
-                let _ = self.device.poll(wgpu::PollType::Wait);
-
-                if let Some(Ok(())) = pollster::block_on(receiver.receive()) {
+                if let Some(Ok(())) = receiver.and_then(|r| pollster::block_on(r.receive())) {
                     let data = buffer_slice.get_mapped_range();
                     if self.padded_out_stride == buffers.output.size.2 as u32 {
                         // Fast path
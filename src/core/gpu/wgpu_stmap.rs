@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
+
+use std::borrow::Cow;
+use std::collections::HashMap;
+use wgpu::BufferUsages;
+use wgpu::util::DeviceExt;
+use parking_lot::Mutex;
+use crate::stabilization::{ KernelParams, KernelParamsFlags };
+use crate::stabilization::distortion_models::DistortionModel;
+use crate::stmap_live::StmapGpuBackend;
+use super::wgpu::{ WgpuWrapper, WgpuError };
+
+/// Buffers for one map size and matrix count
+struct MapBuffers {
+    key: (usize, usize), // coordinate count, matrix floats
+    buf_matrices: wgpu::Buffer,
+    buf_output: wgpu::Buffer,
+    staging_buffer: wgpu::Buffer,
+    bind_group: wgpu::BindGroup,
+}
+
+#[derive(Default)]
+struct State {
+    // None if the kernel for that lens didn't compile, so it's not retried for every frame
+    pipelines: HashMap<u64, Option<wgpu::ComputePipeline>>,
+    buffers: Option<MapBuffers>,
+}
+
+/// Undistortion maps for `StmapsLive` with the `stmap_compute` entry point of `wgpu_undistort.wgsl`, on its own device
+pub struct WgpuStmap {
+    device: wgpu::Device,
+    queue: wgpu::Queue,
+    bind_group_layout: wgpu::BindGroupLayout,
+    pipeline_layout: wgpu::PipelineLayout,
+    buf_params: wgpu::Buffer,
+    buf_coeffs: wgpu::Buffer,
+    buf_mesh_data: wgpu::Buffer,
+    buf_unused: wgpu::Buffer, // drawing and input, the map doesn't read them
+    state: Mutex<State>,
+}
+
+impl WgpuStmap {
+    // The CPU map applies the lens shift, mesh, focal plane and underwater corrections whenever there's data for them
+    const MAP_FLAGS: KernelParamsFlags = KernelParamsFlags::HAS_IBIS_DATA.union(KernelParamsFlags::HAS_MESH_DATA).union(KernelParamsFlags::HAS_FPD_DATA).union(KernelParamsFlags::ANY_UNDERWATER);
+
+    pub fn new() -> Result<Self, WgpuError> {
+        let (device, queue) = WgpuWrapper::create_device()?;
+        device.on_uncaptured_error(Box::new(|e| {
+            log::error!("Uncaptured device error: {e:?}");
+        }));
+
+        let storage = |binding, read_only| wgpu::BindGroupLayoutEntry { binding, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Storage { read_only }, has_dynamic_offset: false, min_binding_size: None }, count: None };
+        let bind_group_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            entries: &[
+                wgpu::BindGroupLayoutEntry { binding: 0, visibility: wgpu::ShaderStages::COMPUTE, ty: wgpu::BindingType::Buffer { ty: wgpu::BufferBindingType::Uniform, has_dynamic_offset: false, min_binding_size: wgpu::BufferSize::new(std::mem::size_of::<KernelParams>() as _) }, count: None },
+                storage(1, true),
+                storage(2, true),
+                storage(3, true),
+                storage(4, true),
+                storage(5, true),
+                storage(6, false),
+            ],
+            label: Some("stmap"),
+        });
+        let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+            label: Some("stmap"),
+            bind_group_layouts: &[&bind_group_layout],
+            push_constant_ranges: &[],
+        });
+
+        let buf_params    = device.create_buffer(&wgpu::BufferDescriptor { size: std::mem::size_of::<KernelParams>() as u64, usage: BufferUsages::UNIFORM | BufferUsages::COPY_DST, label: None, mapped_at_creation: false });
+        let buf_coeffs    = device.create_buffer_init(&wgpu::util::BufferInitDescriptor { label: None, contents: bytemuck::cast_slice(&crate::stabilization::COEFFS), usage: wgpu::BufferUsages::STORAGE });
+        let buf_mesh_data = device.create_buffer(&wgpu::BufferDescriptor { size: (crate::gyro_source::splines::MAX_BUFFER_SIZE * std::mem::size_of::<f32>()).max(4096) as _, usage: BufferUsages::STORAGE | BufferUsages::COPY_DST, label: None, mapped_at_creation: false });
+        let buf_unused    = device.create_buffer(&wgpu::BufferDescriptor { size: 16, usage: BufferUsages::STORAGE, label: None, mapped_at_creation: false });
+
+        Ok(Self { device, queue, bind_group_layout, pipeline_layout, buf_params, buf_coeffs, buf_mesh_data, buf_unused, state: Mutex::new(State::default()) })
+    }
+
+    fn create_pipeline(&self, params: &KernelParams, distortion_model: &DistortionModel, digital_lens: Option<&DistortionModel>) -> Option<wgpu::ComputePipeline> {
+        let kernel = WgpuWrapper::kernel_source(distortion_model, digital_lens, "f32", false);
+
+        self.device.push_error_scope(wgpu::ErrorFilter::Validation);
+        let shader = self.device.create_shader_module(wgpu::ShaderModuleDescriptor {
+            source: wgpu::ShaderSource::Wgsl(Cow::Owned(kernel)),
+            label: Some("stmap")
+        });
+        let pipeline = self.device.create_compute_pipeline(&wgpu::ComputePipelineDescriptor {
+            module: &shader,
+            entry_point: Some("stmap_compute"),
+            label: Some("stmap"),
+            layout: Some(&self.pipeline_layout),
+            compilation_options: wgpu::PipelineCompilationOptions {
+                constants: &[
+                    ("100", params.interpolation as f64),
+                    ("101", 2.0), // (x, y) f32 pairs
+                    ("102", 8.0),
+                    ("103", params.flags         as f64),
+                ],
+                ..Default::default()
+            },
+            cache: Default::default()
+        });
+        if let Some(e) = pollster::block_on(self.device.pop_error_scope()) {
+            log::error!("Failed to create the ST map pipeline for {}: {e}", distortion_model.id());
+            return None;
+        }
+        Some(pipeline)
+    }
+
+    fn create_buffers(&self, key: (usize, usize)) -> MapBuffers {
+        let out_size = (key.0 * std::mem::size_of::<f32>()) as u64;
+        let buf_matrices   = self.device.create_buffer(&wgpu::BufferDescriptor { size: (key.1 * std::mem::size_of::<f32>()) as u64, usage: BufferUsages::STORAGE | BufferUsages::COPY_DST, label: None, mapped_at_creation: false });
+        let buf_output     = self.device.create_buffer(&wgpu::BufferDescriptor { size: out_size, usage: BufferUsages::STORAGE | BufferUsages::COPY_SRC, label: None, mapped_at_creation: false });
+        let staging_buffer = self.device.create_buffer(&wgpu::BufferDescriptor { size: out_size, usage: BufferUsages::MAP_READ | BufferUsages::COPY_DST, label: None, mapped_at_creation: false });
+        let bind_group = self.device.create_bind_group(&wgpu::BindGroupDescriptor {
+            label: Some("stmap"),
+            layout: &self.bind_group_layout,
+            entries: &[
+                wgpu::BindGroupEntry { binding: 0, resource: self.buf_params.as_entire_binding() },
+                wgpu::BindGroupEntry { binding: 1, resource: buf_matrices.as_entire_binding() },
+                wgpu::BindGroupEntry { binding: 2, resource: self.buf_coeffs.as_entire_binding() },
+                wgpu::BindGroupEntry { binding: 3, resource: self.buf_mesh_data.as_entire_binding() },
+                wgpu::BindGroupEntry { binding: 4, resource: self.buf_unused.as_entire_binding() },
+                wgpu::BindGroupEntry { binding: 5, resource: self.buf_unused.as_entire_binding() },
+                wgpu::BindGroupEntry { binding: 6, resource: buf_output.as_entire_binding() },
+            ],
+        });
+        MapBuffers { key, buf_matrices, buf_output, staging_buffer, bind_group }
+    }
+}
+
+impl StmapGpuBackend for WgpuStmap {
+    fn undistort_map(&self, kernel_params: &KernelParams, matrices: &[[f32; 14]], mesh_data: &[f32], distortion_model: &DistortionModel, digital_lens: Option<&DistortionModel>) -> Option<Vec<f32>> {
+        let (width, height) = (kernel_params.output_width.max(0) as usize, kernel_params.output_height.max(0) as usize);
+        if width == 0 || height == 0 || matrices.is_empty() { return None; }
+        if mesh_data.len() * std::mem::size_of::<f32>() > self.buf_mesh_data.size() as usize { log::error!("Buffer size mismatch buf_mesh_data! {} vs {}", self.buf_mesh_data.size() / 4, mesh_data.len()); return None; }
+
+        let mut params = *kernel_params;
+        params.flags |= Self::MAP_FLAGS.bits();
+
+        let mut state = self.state.lock();
+        let pipeline_key = {
+            use std::hash::{ Hash, Hasher };
+            let mut hasher = std::collections::hash_map::DefaultHasher::new();
+            (distortion_model.id(), digital_lens.map(|x| x.id()), params.interpolation, params.flags).hash(&mut hasher);
+            hasher.finish()
+        };
+        if !state.pipelines.contains_key(&pipeline_key) {
+            let pipeline = self.create_pipeline(&params, distortion_model, digital_lens);
+            state.pipelines.insert(pipeline_key, pipeline);
+        }
+        let pipeline = state.pipelines.get(&pipeline_key).cloned().flatten()?;
+
+        let matrices: &[f32] = bytemuck::cast_slice(matrices);
+        let key = (width * height * 2, matrices.len());
+        if state.buffers.as_ref().map_or(true, |x| x.key != key) {
+            state.buffers = Some(self.create_buffers(key));
+        }
+        let buffers = state.buffers.as_ref().unwrap();
+
+        self.queue.write_buffer(&self.buf_params, 0, bytemuck::bytes_of(&params));
+        self.queue.write_buffer(&buffers.buf_matrices, 0, bytemuck::cast_slice(matrices));
+        // An empty mesh has to clear the header of the previous one
+        self.queue.write_buffer(&self.buf_mesh_data, 0, bytemuck::cast_slice(if mesh_data.is_empty() { &[0.0f32][..] } else { mesh_data }));
+
+        let mut encoder = self.device.create_command_encoder(&wgpu::CommandEncoderDescriptor { label: Some("stmap") });
+        {
+            let mut cpass = encoder.begin_compute_pass(&wgpu::ComputePassDescriptor { label: None, timestamp_writes: None });
+            cpass.set_pipeline(&pipeline);
+            cpass.set_bind_group(0, &buffers.bind_group, &[]);
+            cpass.dispatch_workgroups(width.div_ceil(8) as u32, height.div_ceil(8) as u32, 1);
+        }
+        encoder.copy_buffer_to_buffer(&buffers.buf_output, 0, &buffers.staging_buffer, 0, buffers.staging_buffer.size());
+        self.queue.submit(Some(encoder.finish()));
+
+        let (sender, receiver) = futures_intrusive::channel::shared::oneshot_channel();
+        let buffer_slice = buffers.staging_buffer.slice(..);
+        buffer_slice.map_async(wgpu::MapMode::Read, move |v| sender.send(v).unwrap());
+        let _ = self.device.poll(wgpu::PollType::Wait);
+
+        if let Some(Ok(())) = pollster::block_on(receiver.receive()) {
+            let data = buffer_slice.get_mapped_range();
+            let coords = bytemuck::cast_slice::<u8, f32>(&data).to_vec();
+            // We have to make sure all mapped views are dropped before we unmap the buffer.
+            drop(data);
+            buffers.staging_buffer.unmap();
+            Some(coords)
+        } else {
+            log::error!("failed to run the ST map compute on wgpu!");
+            None
+        }
+    }
+}
@@ -659,4 +659,38 @@ fn undistort_compute(@builtin(global_invocation_id) global_id: vec3<u32>) {
     if (pix_element_count >= 3) { output_buffer[buffer_pos + 2u] = final_px.z; }
     if (pix_element_count >= 4) { output_buffer[buffer_pos + 3u] = final_px.w; }
 }
+
+// ST map mode (see wgpu_stmap.rs): the source position of every output pixel as (x, y), (0, 0) where there's none.
+// Same as the undistortion map in stmap_live.rs, only the rolling shutter row selection and rotate_and_distort
+@compute @workgroup_size(8, 8)
+fn stmap_compute(@builtin(global_invocation_id) global_id: vec3<u32>) {
+    if (global_id.x >= u32(params.output_width) || global_id.y >= u32(params.output_height)) { return; }
+    let out_pos = vec2<f32>(f32(global_id.x), f32(global_id.y));
+
+    var sy = 0u;
+    if (bool(flags & 16)) { // Horizontal RS
+        sy = u32(min(params.width, max(0, i32(floor(0.5 + out_pos.x)))));
+    } else {
+        sy = u32(min(params.height, max(0, i32(floor(0.5 + out_pos.y)))));
+    }
+    if (params.matrix_count > 1) {
+        let idx: u32 = u32((params.matrix_count / 2) * 14); // Use middle matrix
+        let uv = rotate_and_distort(out_pos, idx, params.f, params.c, params.k1, params.k2, params.k3);
+        if (uv.x > -99998.0) {
+            if (bool(flags & 16)) { // Horizontal RS
+                sy = u32(min(params.width, max(0, i32(floor(0.5 + uv.x)))));
+            } else {
+                sy = u32(min(params.height, max(0, i32(floor(0.5 + uv.y)))));
+            }
+        }
+    }
+
+    let idx: u32 = min(sy, u32(params.matrix_count - 1)) * 14u;
+    var uv = rotate_and_distort(out_pos, idx, params.f, params.c, params.k1, params.k2, params.k3);
+    if (uv.x < -99998.0) { uv = vec2<f32>(0.0, 0.0); }
+
+    let buffer_pos = (global_id.y * u32(params.output_width) + global_id.x) * 2u;
+    output_buffer[buffer_pos + 0u] = uv.x;
+    output_buffer[buffer_pos + 1u] = uv.y;
+}
 // {/buffer_input}
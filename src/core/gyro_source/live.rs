@@ -7,7 +7,9 @@ use super::FileMetadata;
 use super::TimeQuat;
 use super::Quat64;
 use std::fmt;
-use std::sync::atomic::{AtomicBool, Ordering, AtomicU64};
+use std::sync::atomic::{AtomicBool, Ordering, AtomicU64, AtomicUsize};
+use std::cell::UnsafeCell;
+use std::mem::MaybeUninit;
 use std::collections::BTreeMap;
 use nalgebra::{Quaternion as NQuat, UnitQuaternion as NUnitQuat}; // adjust if you already import nalgebra elsewhere
 use std::path::Path;
@@ -41,6 +43,97 @@ impl fmt::Display for LiveClockSync {
 pub struct ImuRing {
     pub buf: VecDeque<LiveImuSample>,
     pub keep_us: i64, // e.g. 3_000_000
+    pub pushed: u64,  // total number of samples ever pushed, used as a read cursor
+    pub ingest: Arc<ImuSpsc>, // samples from the socket, drained into `buf` by `drain_ingest`
+}
+
+/// Lock-free single-producer single-consumer queue of raw sensor samples.
+/// The producer is the IMU socket thread (see `ImuProducer`), the consumer is `ImuRing::drain_ingest`,
+/// which needs `&mut ImuRing`, so there is always a single consumer. When full, new samples are dropped and counted
+pub struct ImuSpsc {
+    slots: Box<[UnsafeCell<MaybeUninit<LiveImuSample>>]>,
+    mask: usize,
+    head: AtomicUsize, // next slot to write, only modified by the producer
+    tail: AtomicUsize, // next slot to read, only modified by the consumer
+    producer_taken: AtomicBool,
+    dropped: AtomicU64,
+}
+unsafe impl Send for ImuSpsc { }
+unsafe impl Sync for ImuSpsc { }
+
+impl Default for ImuSpsc {
+    fn default() -> Self { Self::new(16384) } // ~4 s at 4 kHz
+}
+
+impl ImuSpsc {
+    pub fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(2).next_power_of_two();
+        Self {
+            slots: (0..capacity).map(|_| UnsafeCell::new(MaybeUninit::uninit())).collect(),
+            mask: capacity - 1,
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+            producer_taken: AtomicBool::new(false),
+            dropped: AtomicU64::new(0),
+        }
+    }
+
+    /// Returns the producer handle, or None if another thread currently holds it
+    pub fn producer(self: &Arc<Self>) -> Option<ImuProducer> {
+        if self.producer_taken.swap(true, Ordering::Acquire) { return None; }
+        Some(ImuProducer { q: self.clone() })
+    }
+
+    pub fn dropped(&self) -> u64 { self.dropped.load(Ordering::Relaxed) }
+
+    fn push(&self, s: LiveImuSample) -> bool {
+        let head = self.head.load(Ordering::Relaxed);
+        let tail = self.tail.load(Ordering::Acquire);
+        if head.wrapping_sub(tail) > self.mask {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+            return false;
+        }
+        // Safety: only the producer writes, and the slot is not visible to the consumer until `head` is published
+        unsafe { (*self.slots[head & self.mask].get()).write(s); }
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+        true
+    }
+
+    // Safety: must only be called by the single consumer
+    unsafe fn pop_all<F: FnMut(LiveImuSample)>(&self, mut cb: F) -> usize {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let head = self.head.load(Ordering::Acquire);
+        let n = head.wrapping_sub(tail);
+        for i in 0..n {
+            cb(unsafe { (*self.slots[tail.wrapping_add(i) & self.mask].get()).assume_init_read() });
+        }
+        self.tail.store(head, Ordering::Release);
+        n
+    }
+}
+
+/// Write end of `ImuSpsc`. There is at most one at a time, dropping it allows a new one to be taken
+pub struct ImuProducer {
+    q: Arc<ImuSpsc>,
+}
+
+impl ImuProducer {
+    /// Returns false if the queue was full and the sample was dropped
+    #[inline]
+    pub fn push(&mut self, s: LiveImuSample) -> bool { self.q.push(s) }
+
+    pub fn push_slice(&mut self, samples: &[LiveImuSample]) -> usize {
+        samples.iter().filter(|s| self.q.push(**s)).count()
+    }
+
+    /// False once the ring this queue belongs to is gone (e.g. live mode was restarted), a new producer is needed then
+    pub fn is_attached(&self) -> bool { Arc::strong_count(&self.q) > 1 }
+}
+
+impl Drop for ImuProducer {
+    fn drop(&mut self) {
+        self.q.producer_taken.store(false, Ordering::Release);
+    }
 }
 
 
@@ -66,12 +159,13 @@ impl fmt::Display for LiveImuSample {
 
 
 impl ImuRing {
-    pub fn new(keep_us: i64) -> Self { Self { buf: VecDeque::new(), keep_us } }
+    pub fn new(keep_us: i64) -> Self { Self { buf: VecDeque::new(), keep_us, pushed: 0, ingest: Arc::new(ImuSpsc::default()) } }
     pub fn push(&mut self, s: LiveImuSample, now_video_us: i64, sync: &LiveClockSync) {
         // convert to video clock immediately
         let vts = (sync.a * s.ts_sensor_us as f64 + sync.b).round() as i64;
         let sample = LiveImuSample { ts_sensor_us: vts, ..s }; // reuse field for video ts
         self.buf.push_back(sample);
+        self.pushed += 1;
         // evict old
         while let Some(front) = self.buf.front() {
             if now_video_us - front.ts_sensor_us > self.keep_us { self.buf.pop_front(); } else { break; }
@@ -84,25 +178,235 @@ impl ImuRing {
         self.buf.iter().copied().collect()
     }
 
+    /// Moves everything queued in `ingest` into the ring. `transform` is applied to the raw sensor sample
+    /// before the clock conversion, each sample's own video timestamp is used for the eviction
+    pub fn drain_ingest<F: Fn(LiveImuSample) -> LiveImuSample>(&mut self, sync: &LiveClockSync, transform: F) -> usize {
+        let q = self.ingest.clone();
+        // Safety: `&mut self` makes this the only consumer of `ingest`
+        unsafe {
+            q.pop_all(|s| {
+                let s = transform(s);
+                let now_video_us = (sync.a * s.ts_sensor_us as f64 + sync.b).round() as i64;
+                self.push(s, now_video_us, sync);
+            })
+        }
+    }
 
+    /// Appends the samples pushed after cursor `since` to `out` and returns the new cursor.
+    /// Samples already evicted from the ring are skipped.
+    pub fn samples_since(&self, since: u64, out: &mut Vec<LiveImuSample>) -> u64 {
+        let new = (self.pushed.saturating_sub(since) as usize).min(self.buf.len());
+        out.extend(self.buf.range(self.buf.len() - new..).copied());
+        self.pushed
+    }
+}
 
+/// Default lookahead of the live smoothing, the smoothed buffer lags the integrated one by this much
+pub const LIVE_SMOOTHING_LOOKAHEAD_MS: f64 = 100.0;
+
+/// Integrator state carried between `integrate_live_data` ticks, plus the integrated window it is appending to.
+pub struct LiveIntegration {
+    pub integrator: Option<crate::imu_integration::StreamingIntegrator>,
+    pub cursor: u64,
+    pub quats: QuatBuffer,
+    pub smoothed: QuatBuffer, // counter-rotations, same as `recompute_smoothness` output
+    pub smoother: crate::smoothing::causal::CausalSmoother,
+    pub horizon: LiveHorizonLock,
+    pub max_angles: LiveMaxAngles,
+    pub samples: Vec<LiveImuSample>, // scratch, reused every tick
+}
+
+/// What `HorizonLock::lock_with` needs in the live path, updated by `GyroSource::set_live_horizon_lock`
+#[derive(Default, Clone)]
+pub struct LiveHorizonLock {
+    pub lock: crate::smoothing::horizon::HorizonLock,
+    pub keyframes: crate::keyframes::KeyframeManager,
+    pub video_rotation: f64,
+}
 
+/// Maximum (pitch, yaw, roll) of the live counter-rotations over the window, same as `Smoothing::get_max_angles`.
+/// One monotonic deque per axis, so each sample costs O(1) amortized
+#[derive(Default, Clone)]
+pub struct LiveMaxAngles {
+    axes: [VecDeque<(i64, f64)>; 3], // (timestamp_us, abs angle), angles decreasing from front to back
 }
 
-#[derive(Debug, Clone, Default)]
+impl LiveMaxAngles {
+    pub fn push(&mut self, ts_us: i64, correction: &Quat64) {
+        let (pitch, yaw, roll) = correction.euler_angles();
+        for (axis, v) in self.axes.iter_mut().zip([pitch.abs(), yaw.abs(), roll.abs()]) {
+            while axis.back().map(|x| x.1 <= v).unwrap_or_default() {
+                axis.pop_back();
+            }
+            axis.push_back((ts_us, v));
+        }
+    }
+
+    pub fn trim_before(&mut self, cut_us: i64) {
+        for axis in &mut self.axes {
+            while axis.front().map(|x| x.0 < cut_us).unwrap_or_default() {
+                axis.pop_front();
+            }
+        }
+    }
+
+    pub fn clear(&mut self) {
+        for axis in &mut self.axes { axis.clear(); }
+    }
+
+    /// (pitch, yaw, roll) in deg
+    pub fn get(&self) -> (f64, f64, f64) {
+        let max = |i: usize| self.axes[i].front().map(|x| x.1.to_degrees()).unwrap_or_default();
+        (max(0), max(1), max(2))
+    }
+}
+
+impl Default for LiveIntegration {
+    fn default() -> Self {
+        Self { integrator: None, cursor: 0, quats: QuatBuffer::default(), smoothed: QuatBuffer::default(),
+               smoother: crate::smoothing::causal::CausalSmoother::new(0.25, LIVE_SMOOTHING_LOOKAHEAD_MS),
+               horizon: LiveHorizonLock::default(), max_angles: LiveMaxAngles::default(), samples: Vec::new() }
+    }
+}
+
+impl LiveIntegration {
+    /// Drops everything older than `keep_us` before the newest quat
+    pub fn trim(&mut self, keep_us: i64) {
+        if self.quats.is_empty() { return; }
+        let cut = self.quats.last_us - keep_us;
+        self.quats.trim_before(cut);
+        self.smoothed.trim_before(cut);
+        self.max_angles.trim_before(cut);
+    }
+}
+
+/// Append-only storage behind `QuatBuffer`. Each slot is written once, by the buffer at the tail, before any
+/// buffer that includes it exists, so clones and published buffers read it without copying or locking
+struct QuatLog {
+    timestamps: Box<[UnsafeCell<MaybeUninit<i64>>]>,
+    quats: Box<[UnsafeCell<MaybeUninit<Quat64>>]>,
+    reserved: AtomicUsize, // slots claimed by the buffer at the tail
+}
+unsafe impl Send for QuatLog { }
+unsafe impl Sync for QuatLog { }
+
+impl QuatLog {
+    fn new(capacity: usize) -> Arc<Self> {
+        Arc::new(Self {
+            timestamps: (0..capacity).map(|_| UnsafeCell::new(MaybeUninit::uninit())).collect(),
+            quats: (0..capacity).map(|_| UnsafeCell::new(MaybeUninit::uninit())).collect(),
+            reserved: AtomicUsize::new(0),
+        })
+    }
+    #[inline]
+    fn capacity(&self) -> usize { self.timestamps.len() }
+}
+
+/// Time-indexed quats stored as two parallel arrays sorted by timestamp.
+/// The arrays are a `start..end` window of a shared `QuatLog`: trimming moves `start`, pushing writes past `end`
+/// and cloning only copies the indices. When the log is full the window is moved to a new one twice its size.
+/// Lookups estimate the index from the average sample rate and fall back to a binary search for non-uniform data.
+#[derive(Clone)]
 pub struct QuatBuffer {
-    pub quats: TimeQuat,
+    log: Arc<QuatLog>,
+    start: usize,
+    end: usize,
     pub first_us: i64,
     pub last_us:  i64,
 }
 
+impl Default for QuatBuffer {
+    fn default() -> Self { Self::with_capacity(0) }
+}
+
+impl fmt::Debug for QuatBuffer {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("QuatBuffer").field("len", &self.len()).field("first_us", &self.first_us).field("last_us", &self.last_us).finish()
+    }
+}
 
 impl QuatBuffer {
     pub fn from_btreemap(map: &TimeQuat) -> Option<Self> {
         if map.is_empty() { return None; }
-        let first_us = *map.keys().next().unwrap();
-        let last_us  = *map.keys().next_back().unwrap();
-        Some(Self { quats: map.clone(), first_us, last_us })
+        let mut buf = Self::with_capacity(map.len());
+        for (&ts, &q) in map {
+            buf.push(ts, q);
+        }
+        Some(buf)
+    }
+
+    pub fn with_capacity(n: usize) -> Self {
+        Self { log: QuatLog::new(n), start: 0, end: 0, first_us: 0, last_us: 0 }
+    }
+
+    #[inline]
+    pub fn len(&self) -> usize { self.end - self.start }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool { self.end == self.start }
+
+    /// µs, strictly increasing
+    #[inline]
+    pub fn timestamps(&self) -> &[i64] {
+        // Safety: the slots in `start..end` were written before this buffer got them and are never written again
+        unsafe { std::slice::from_raw_parts(self.log.timestamps.as_ptr().add(self.start) as *const i64, self.len()) }
+    }
+
+    #[inline]
+    pub fn quats(&self) -> &[Quat64] {
+        // Safety: same as `timestamps`
+        unsafe { std::slice::from_raw_parts(self.log.quats.as_ptr().add(self.start) as *const Quat64, self.len()) }
+    }
+
+    /// Appends a quat. Samples not newer than the last one are ignored
+    pub fn push(&mut self, ts_us: i64, q: Quat64) {
+        if !self.is_empty() && ts_us <= self.last_us { return; }
+        // Only one buffer can append to a log, a clone that was pushed to before this one gets a new log too
+        let claimed = self.end < self.log.capacity() &&
+            self.log.reserved.compare_exchange(self.end, self.end + 1, Ordering::AcqRel, Ordering::Relaxed).is_ok();
+        if !claimed {
+            self.relocate((self.len() * 2).max(1024));
+            self.log.reserved.store(self.end + 1, Ordering::Relaxed);
+        }
+        // Safety: the slot was claimed above, so no other buffer writes it or has it in its window
+        unsafe {
+            (*self.log.timestamps[self.end].get()).write(ts_us);
+            (*self.log.quats[self.end].get()).write(q);
+        }
+        if self.is_empty() { self.first_us = ts_us; }
+        self.end += 1;
+        self.last_us = ts_us;
+    }
+
+    /// Copies the window to the start of a new log
+    fn relocate(&mut self, capacity: usize) {
+        let log = QuatLog::new(capacity);
+        for (i, (&ts, &q)) in self.timestamps().iter().zip(self.quats()).enumerate() {
+            // Safety: `log` isn't shared with anything yet
+            unsafe {
+                (*log.timestamps[i].get()).write(ts);
+                (*log.quats[i].get()).write(q);
+            }
+        }
+        self.end = self.len();
+        self.start = 0;
+        log.reserved.store(self.end, Ordering::Relaxed);
+        self.log = log;
+    }
+
+    /// Removes all quats older than `cut_us`. Only the head moves, the slots are reclaimed with the log
+    pub fn trim_before(&mut self, cut_us: i64) {
+        let n = self.timestamps().partition_point(|&t| t < cut_us);
+        if n == 0 { return; }
+        self.start += n;
+        self.first_us = self.timestamps().first().copied().unwrap_or(0);
+        if self.is_empty() { self.last_us = 0; }
+    }
+
+    pub fn clear(&mut self) {
+        self.start = self.end;
+        self.first_us = 0;
+        self.last_us = 0;
     }
 
     #[inline]
@@ -129,49 +433,76 @@ impl QuatBuffer {
         (target_us as f64 - self.mid_us() as f64).abs() <= tol
     }
 
+    /// Index `i` with `timestamps[i] <= t_us < timestamps[i + 1]`, `t_us` must be within `first_us..=last_us`.
+    /// `hint` is where to start looking, an estimate from the average rate is used when None
+    #[inline]
+    fn index_at(&self, t_us: i64, hint: Option<usize>) -> usize {
+        let timestamps = self.timestamps();
+        let n = timestamps.len();
+        if n < 2 { return 0; }
+        let mut i = hint.unwrap_or_else(|| {
+            let span = self.span_us();
+            if span <= 0 { return 0; }
+            (((t_us - self.first_us) as i128 * (n as i128 - 1) / span as i128) as usize).min(n - 2)
+        }).min(n - 2);
+        // Uniform data lands on the right index or next to it, anything further away is searched
+        for _ in 0..4 {
+            if timestamps[i] > t_us {
+                if i == 0 { return 0; }
+                i -= 1;
+            } else if timestamps[i + 1] <= t_us {
+                if i + 2 >= n { return n - 2; }
+                i += 1;
+            } else {
+                return i;
+            }
+        }
+        timestamps.partition_point(|&t| t <= t_us).saturating_sub(1).min(n - 2)
+    }
+
+    #[inline]
+    fn interpolate(&self, i: usize, t_us: i64) -> Quat64 {
+        let (timestamps, quats) = (self.timestamps(), self.quats());
+        let (t0, q0) = (timestamps[i], quats[i]);
+        if t0 >= t_us || i + 1 >= timestamps.len() { return q0; }
+        let dt = (timestamps[i + 1] - t0) as f64;
+        if dt <= 0.0 { return q0; }
+        q0.slerp(&quats[i + 1], (t_us - t0) as f64 / dt)
+    }
+
     /// Simple SLERP lookup (same logic you already use elsewhere).
     pub fn quat_at_ms(&self, t_ms: f64) -> Option<Quat64> {
-        if self.quats.is_empty() { return None; }
+        if self.is_empty() { return None; }
         let t_us = (t_ms * 1000.0).round() as i64;
         let t_us = t_us.clamp(self.first_us, self.last_us);
+        Some(self.interpolate(self.index_at(t_us, None), t_us))
+    }
 
-        if let Some((&t0, &q0)) = self.quats.range(..=t_us).next_back() {
-            if t0 == t_us { return Some(q0); }
-            if let Some((&t1, &q1)) = self.quats.range(t_us..).next() {
-                let dt = (t1 - t0) as f64;
-                if dt <= 0.0 { return Some(q0); }
-                let a = (t_us - t0) as f64 / dt;
-                return Some(q0.slerp(&q1, a));
-            }
+    /// Batched lookup of `out.len()` quats at `start_ms + i * step_ms`, e.g. all rolling shutter rows of a frame.
+    /// Only the first index is estimated, the rest is found by walking forward from the previous one
+    pub fn quats_at_ms(&self, start_ms: f64, step_ms: f64, out: &mut [Quat64]) -> bool {
+        if self.is_empty() { return false; }
+        let mut hint = None;
+        for (i, o) in out.iter_mut().enumerate() {
+            let t_us = ((start_ms + step_ms * i as f64) * 1000.0).round() as i64;
+            let t_us = t_us.clamp(self.first_us, self.last_us);
+            let idx = self.index_at(t_us, hint);
+            *o = self.interpolate(idx, t_us);
+            hint = Some(idx);
         }
-        self.quats.values().next_back().copied()
+        true
     }
 
-     pub fn to_btreemap(&self) -> BTreeMap<i64, Quat64> {
-        let mut map = BTreeMap::new();
-        for (dt_us, q) in &self.quats {
-            map.insert(*dt_us, *q);
-        }
-        map
+    pub fn to_btreemap(&self) -> BTreeMap<i64, Quat64> {
+        self.timestamps().iter().copied().zip(self.quats().iter().copied()).collect()
     }
 
     /// Duration of this buffer in milliseconds (based on first/last timestamps).
     pub fn duration_ms(&self) -> f64 {
-        if self.quats.len() < 2 {
+        if self.len() < 2 {
             return 0.0;
         }
-        let mut first_ts = 0;
-        let mut last_ts = 0;
-        if let Some((first_key, first_value)) = self.quats.iter().next() {
-            first_ts = *first_key;
-        } 
-
-        // Get the last element (largest key)
-        if let Some((last_key, last_value)) = self.quats.iter().next_back() {
-            last_ts = *last_key;
-        }
-
-        (last_ts - first_ts) as f64 / 1000.0
+        (self.last_us - self.first_us) as f64 / 1000.0
     }
 
     pub fn from_csv_samples_range(
@@ -204,26 +535,37 @@ impl QuatBuffer {
     }
 }
 
-#[derive(Debug, Default)]
+/// Number of buffers a store keeps, live publishes one per tick and each covers the whole live window
+pub const QUAT_BUFFER_STORE_CAPACITY: usize = 64;
+
+#[derive(Debug)]
 pub struct QuatBufferStore {
     dq: RwLock<VecDeque<Arc<QuatBuffer>>>,
     version: AtomicU64,
+    capacity: AtomicUsize,
+}
+
+impl Default for QuatBufferStore {
+    fn default() -> Self { Self::new() }
 }
 
 impl QuatBufferStore {
     pub fn new() -> Self {
         Self {
-            dq: RwLock::new(VecDeque::new()),
+            dq: RwLock::new(VecDeque::with_capacity(QUAT_BUFFER_STORE_CAPACITY)),
             version: AtomicU64::new(0),
+            capacity: AtomicUsize::new(QUAT_BUFFER_STORE_CAPACITY),
         }
     }
 
-    /// Publish a new buffer (no capacity-based deletion here).
+    /// Publish a new buffer, the oldest ones are dropped once the store is over capacity.
     pub fn publish(&self, buf: QuatBuffer) -> (Arc<QuatBuffer>, u64) {
         let arc = Arc::new(buf);
         {
-            let mut w: parking_lot::lock_api::RwLockWriteGuard<'_, parking_lot::RawRwLock, VecDeque<Arc<QuatBuffer>>> = self.dq.write();
+            let mut w = self.dq.write();
             w.push_back(arc.clone());
+            let capacity = self.capacity.load(Ordering::Relaxed).max(1);
+            while w.len() > capacity { w.pop_front(); }
         }
         let ver = self.version.fetch_add(1, Ordering::SeqCst) + 1;
         (arc, ver)
@@ -246,50 +588,42 @@ impl QuatBufferStore {
         let pre_us  = (pre_ms * 1000.0) as i64;
         let post_us = (post_ms * 1000.0) as i64;
 
-        // 1) Read-pass: find best candidate index (newest-first).
-        let (cand_idx, fallback_idx) = {
+        // 1) Read-pass: find best candidate (newest-first).
+        let (centered, covering) = {
             let r = self.dq.read();
-            let mut centered_idx: Option<usize> = None;
-            let mut cover_idx:    Option<usize> = None;
+            let mut centered: Option<Arc<QuatBuffer>> = None;
+            let mut covering: Option<Arc<QuatBuffer>> = None;
 
-            for (i, buf) in r.iter().enumerate().rev() {
+            for buf in r.iter().rev() {
                 if buf.covers_with_padding(t_us, pre_us, post_us) {
-                    if cover_idx.is_none() { cover_idx = Some(i); }
+                    if covering.is_none() { covering = Some(buf.clone()); }
                     if buf.is_centered_for(t_us, center_ratio) {
-                        centered_idx = Some(i);
+                        centered = Some(buf.clone());
                         break; // newest centered wins
                     }
                 }
             }
-            (centered_idx, cover_idx)
+            (centered, covering)
         };
 
         // Prefer centered; else maybe fallback to covering.
-        let chosen_idx = cand_idx.or(if fallback_ok { fallback_idx } else { None })?;
+        let chosen = centered.or(if fallback_ok { covering } else { None })?;
 
-        // 2) Write-pass: clone chosen buffer, then prune older centered ones.
+        // 2) Write-pass: prune older centered ones.
         let (chosen_arc, ver) = {
             let mut w = self.dq.write();
-
-            // Clone the chosen buffer for return
-            let chosen = w.get(chosen_idx).cloned()?;
             let ver = self.version.load(Ordering::Relaxed);
 
+            // `publish` may have dropped buffers from the front since the read-pass, so the index is looked up again
+            let chosen_idx = w.iter().position(|x| Arc::ptr_eq(x, &chosen)).unwrap_or(0);
+
             // Remove any **older** buffers (front..chosen_idx) that ALSO center the same frame.
-            // We walk from front to just before chosen_idx, keeping those that do NOT center.
             let mut i = 0_usize;
-            while i < chosen_idx && i < w.len() {
-                // Invariant: `w.len()` can change as we remove.
-                if let Some(buf) = w.get(i) {
-                    if buf.is_centered_for(t_us, center_ratio) && buf.covers_with_padding(t_us, pre_us, post_us) {
-                        w.remove(i);            // remove; do NOT advance i
-                        // Because we removed at i < chosen_idx, the chosen_idx shifts left by 1.
-                        // But we don't need chosen_idx anymore.
-                        continue;
-                    }
-                }
+            w.retain(|buf| {
+                let older = i < chosen_idx;
                 i += 1;
-            }
+                !(older && buf.is_centered_for(t_us, center_ratio) && buf.covers_with_padding(t_us, pre_us, post_us))
+            });
 
             (chosen, ver)
         };
@@ -358,6 +692,10 @@ impl QuatBufferStore {
         let mut i0: usize = 0;
         let mut i1: usize = 0;
 
+        // The windows are selected by time, so the store has to hold all of them
+        let windows = ((last_us - first_us) / step_us + 1) as usize;
+        self.capacity.fetch_max(windows, Ordering::Relaxed);
+
         let mut published = 0_usize;
         let mut last_ver = self.version.load(Ordering::Relaxed);
 
@@ -404,6 +742,7 @@ impl QuatBufferStore {
 pub struct LiveState {
     pub header: String,
     pub ring: Mutex<ImuRing>,
+    pub integration: Mutex<LiveIntegration>,
     pub sync: LiveClockSync,
     pub quat_buffer_store_org: QuatBufferStore,
     pub quat_buffer_store_smoothed: QuatBufferStore,
@@ -416,6 +755,7 @@ impl Default for LiveState {
              header: String::new(),
              // default keep_us=3s; enable_live will override when constructing
              ring: Mutex::new(ImuRing::new(3_000_000)),
+             integration: Mutex::new(LiveIntegration::default()),
              sync: LiveClockSync::default(),
              quat_buffer_store_org: QuatBufferStore::new(),
              quat_buffer_store_smoothed: QuatBufferStore::new(),
@@ -453,3 +793,196 @@ impl LiveState {
     }
 }
 
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample(i: i64) -> LiveImuSample {
+        LiveImuSample { ts_sensor_us: i, gyro: [i as f64, 0.0, 0.0], accel: None }
+    }
+    fn pop_ts(q: &ImuSpsc) -> Vec<i64> {
+        let mut out = Vec::new();
+        unsafe { q.pop_all(|s| out.push(s.ts_sensor_us)); }
+        out
+    }
+    fn quat(i: i64) -> Quat64 { Quat64::from_euler_angles(0.0, 0.0, i as f64 * 0.001) }
+    fn buffer(timestamps: &[i64]) -> QuatBuffer {
+        let mut b = QuatBuffer::with_capacity(16);
+        for &t in timestamps { b.push(t, quat(t)); }
+        b
+    }
+    fn assert_quat(q: Option<Quat64>, expected: Quat64) {
+        assert!(q.unwrap().angle_to(&expected) < 1e-9, "{q:?} != {expected:?}");
+    }
+
+    #[test]
+    fn spsc_capacity_is_power_of_two() {
+        assert_eq!(ImuSpsc::new(0).slots.len(), 2);
+        assert_eq!(ImuSpsc::new(5).slots.len(), 8);
+        assert_eq!(ImuSpsc::new(8).slots.len(), 8);
+    }
+
+    #[test]
+    fn spsc_full_ring_drops_and_counts() {
+        let q = ImuSpsc::new(4);
+        for i in 0..4 { assert!(q.push(sample(i))); }
+        assert!(!q.push(sample(4)));
+        assert!(!q.push(sample(5)));
+        assert_eq!(q.dropped(), 2);
+        assert_eq!(pop_ts(&q), [0, 1, 2, 3]);
+        // Space again after the consumer caught up
+        assert!(q.push(sample(6)));
+        assert_eq!(pop_ts(&q), [6]);
+        assert_eq!(q.dropped(), 2);
+    }
+
+    #[test]
+    fn spsc_wraps_around_the_slots_and_the_counters() {
+        let q = ImuSpsc::new(4);
+        // Start the counters just before they overflow
+        q.head.store(usize::MAX - 1, Ordering::Relaxed);
+        q.tail.store(usize::MAX - 1, Ordering::Relaxed);
+        let mut next = 0;
+        for _ in 0..5 {
+            for i in next..next + 3 { assert!(q.push(sample(i))); }
+            assert_eq!(pop_ts(&q), (next..next + 3).collect::<Vec<_>>());
+            next += 3;
+        }
+        for i in next..next + 4 { assert!(q.push(sample(i))); }
+        assert!(!q.push(sample(next + 4)));
+        assert_eq!(pop_ts(&q), (next..next + 4).collect::<Vec<_>>());
+        assert_eq!(q.dropped(), 1);
+        assert!(pop_ts(&q).is_empty());
+    }
+
+    #[test]
+    fn producer_push_slice_across_the_wrap() {
+        let q = Arc::new(ImuSpsc::new(8));
+        let mut p = q.producer().unwrap();
+        assert_eq!(p.push_slice(&(0..6).map(sample).collect::<Vec<_>>()), 6);
+        assert_eq!(pop_ts(&q), [0, 1, 2, 3, 4, 5]);
+
+        // Slots 6, 7, 0, 1, ..
+        assert_eq!(p.push_slice(&(6..14).map(sample).collect::<Vec<_>>()), 8);
+        // Full, only the ones that fit are taken
+        assert_eq!(p.push_slice(&(14..16).map(sample).collect::<Vec<_>>()), 0);
+        assert_eq!(pop_ts(&q), (6..14).collect::<Vec<_>>());
+        assert_eq!(p.push_slice(&(16..26).map(sample).collect::<Vec<_>>()), 8);
+        assert_eq!(pop_ts(&q), (16..24).collect::<Vec<_>>());
+        assert_eq!(q.dropped(), 4);
+    }
+
+    #[test]
+    fn single_producer() {
+        let q = Arc::new(ImuSpsc::new(4));
+        let p = q.producer().unwrap();
+        assert!(q.producer().is_none());
+        assert!(p.is_attached());
+        drop(p);
+        let p = q.producer().unwrap();
+        drop(q);
+        assert!(!p.is_attached());
+    }
+
+    #[test]
+    fn index_at_buffer_edges() {
+        let b = buffer(&[1000, 2000, 3000, 4000, 5000]);
+        assert_eq!(b.index_at(1000, None), 0);
+        assert_eq!(b.index_at(1999, None), 0);
+        assert_eq!(b.index_at(2000, None), 1);
+        assert_eq!(b.index_at(4999, None), 3);
+        // The last timestamp uses the last pair
+        assert_eq!(b.index_at(5000, None), 3);
+        // Hints past the end or far from the target
+        assert_eq!(b.index_at(1000, Some(10)), 0);
+        assert_eq!(b.index_at(5000, Some(0)), 3);
+
+        assert_quat(b.quat_at_ms(0.0), quat(1000));
+        assert_quat(b.quat_at_ms(1.0), quat(1000));
+        assert_quat(b.quat_at_ms(5.0), quat(5000));
+        assert_quat(b.quat_at_ms(100.0), quat(5000));
+
+        assert_eq!(buffer(&[1000]).index_at(1000, None), 0);
+        assert_eq!(QuatBuffer::default().quat_at_ms(1.0), None);
+    }
+
+    #[test]
+    fn index_at_non_uniform_matches_partition_point() {
+        let ts = [0, 1, 2, 3, 4, 1000, 1001, 5000, 9000, 9001];
+        let b = buffer(&ts);
+        for t in 0..=9001 {
+            let expected = ts.partition_point(|&x| x <= t).saturating_sub(1).min(ts.len() - 2);
+            assert_eq!(b.index_at(t, None), expected, "t = {t}");
+            assert_eq!(b.index_at(t, Some(0)), expected, "t = {t}");
+        }
+    }
+
+    #[test]
+    fn trim_before_edges() {
+        let mut b = buffer(&[1000, 2000, 3000, 4000]);
+        b.trim_before(1000);
+        assert_eq!(b.len(), 4);
+        b.trim_before(2000);
+        assert_eq!((b.len(), b.first_us, b.last_us), (3, 2000, 4000));
+        assert_eq!(b.timestamps(), [2000, 3000, 4000]);
+        // Lookups work on the moved window
+        assert_eq!(b.index_at(2000, None), 0);
+        assert_eq!(b.index_at(4000, None), 1);
+        assert_quat(b.quat_at_ms(1.0), quat(2000));
+        b.trim_before(4001);
+        assert!(b.is_empty());
+        assert_eq!((b.first_us, b.last_us), (0, 0));
+        // An empty window accepts any timestamp again
+        b.push(500, quat(500));
+        assert_eq!(b.timestamps(), [500]);
+    }
+
+    #[test]
+    fn push_ignores_old_samples() {
+        let mut b = buffer(&[1000, 2000]);
+        b.push(2000, quat(0));
+        b.push(1500, quat(0));
+        assert_eq!(b.timestamps(), [1000, 2000]);
+        assert_eq!(b.quats(), [quat(1000), quat(2000)]);
+    }
+
+    #[test]
+    fn clones_share_the_log_until_both_append() {
+        let mut a = buffer(&[1, 2, 3]);
+        let snapshot = a.clone();
+        // The tail is still this buffer's, nothing is copied
+        a.push(4, quat(4));
+        assert!(Arc::ptr_eq(&a.log, &snapshot.log));
+        assert_eq!(snapshot.timestamps(), [1, 2, 3]);
+
+        // The snapshot's next slot is already taken by `a`, so it moves to its own log
+        let mut b = snapshot.clone();
+        b.push(10, quat(10));
+        assert!(!Arc::ptr_eq(&a.log, &b.log));
+        assert_eq!(a.timestamps(), [1, 2, 3, 4]);
+        assert_eq!(b.timestamps(), [1, 2, 3, 10]);
+        assert_eq!(b.quats(), [quat(1), quat(2), quat(3), quat(10)]);
+        assert_eq!(snapshot.timestamps(), [1, 2, 3]);
+
+        a.push(5, quat(5));
+        assert_eq!(a.timestamps(), [1, 2, 3, 4, 5]);
+        assert_eq!(b.timestamps(), [1, 2, 3, 10]);
+    }
+
+    #[test]
+    fn relocate_keeps_the_window_when_the_log_is_full() {
+        let mut b = QuatBuffer::with_capacity(4);
+        for t in 0..4 { b.push(t, quat(t)); }
+        b.trim_before(2);
+        let old = b.clone();
+        b.push(4, quat(4));
+        assert!(!Arc::ptr_eq(&b.log, &old.log));
+        assert_eq!(b.start, 0);
+        assert!(b.log.capacity() >= 1024);
+        assert_eq!(b.timestamps(), [2, 3, 4]);
+        assert_eq!(b.quats(), [quat(2), quat(3), quat(4)]);
+        assert_eq!((b.first_us, b.last_us), (2, 4));
+        assert_eq!(old.timestamps(), [2, 3]);
+    }
+}
@@ -155,6 +155,7 @@ impl GyroSource {
         *st = Some(live::LiveState {
             header: make_header(video_fps),              // use actual video FPS
             ring: parking_lot::Mutex::new(live::ImuRing::new((keep_seconds * 1_000_000.0) as i64)),
+            integration: parking_lot::Mutex::new(live::LiveIntegration::default()),
             sync: live::LiveClockSync { a, b },
             quat_buffer_store_org: live::QuatBufferStore::new(),
             quat_buffer_store_smoothed: live::QuatBufferStore::new(),
@@ -195,80 +196,104 @@ impl GyroSource {
         }
     }
 
+    /// Lock-free write end for live IMU samples, see `live::ImuSpsc`. The samples are raw sensor samples,
+    /// the IMU transforms and clock sync are applied when `integrate_live_data` drains them.
+    /// Returns None when live mode is off or another producer is active
+    pub fn live_imu_producer(&self) -> Option<live::ImuProducer> {
+        self.live.read().as_ref().and_then(|st| st.ring.lock().ingest.producer())
+    }
+
+    /// Timestamp (us, video clock) of the newest integrated live quaternion, None before the first publish
+    pub fn live_latest_quat_us(&self) -> Option<i64> {
+        self.live.read().as_ref().and_then(|st| st.quat_buffer_store_org.get_latest_buffer()).map(|b| b.last_us)
+    }
+
+    /// Sets the live smoothing parameters (see `smoothing::causal::CausalSmoother`). Cheap, meant to be called every frame
+    pub fn set_live_smoothing(&self, time_constant: f64, lookahead_ms: f64) {
+        if let Some(st) = self.live.read().as_ref() {
+            let mut li = st.integration.lock();
+            li.smoother.time_constant = time_constant;
+            li.smoother.lookahead_ms = lookahead_ms.max(0.0);
+        }
+    }
+
+    /// Sets the horizon lock the live smoothing applies, the same step `recompute_smoothness` runs before smoothing
+    pub fn set_live_horizon_lock(&self, lock: super::smoothing::horizon::HorizonLock, keyframes: &crate::keyframes::KeyframeManager, video_rotation: f64) {
+        if let Some(st) = self.live.read().as_ref() {
+            let mut li = st.integration.lock();
+            li.horizon = live::LiveHorizonLock { lock, keyframes: keyframes.clone(), video_rotation };
+        }
+    }
+
+    /// Integrates the IMU samples that arrived since the previous call and publishes the updated live window.
+    /// The integrator state is kept in `LiveState::integration`, so each tick costs O(new samples).
+    /// Changing `integration_method` restarts the integration from the samples still in the ring.
     pub fn integrate_live_data(&mut self) {
     // 0) Live enabled?
     let live_opt = self.live.read();
-    if live_opt.is_none() {
-        return;
-    }
-    // 1) Copy IMU window out of ring (no heavy work under lock)
-    let live_state = live_opt.as_ref().unwrap();
-    let samples = {
-        let ring = live_state.ring.lock();
-        ring.snapshot()
+    let Some(live_state) = live_opt.as_ref() else { return; };
+    let mut li = live_state.integration.lock();
+    let li = &mut *li;
+
+    let keep_us = {
+        let mut ring = live_state.ring.lock();
+        if li.integrator.as_ref().map(|x| x.method()) != Some(self.integration_method) {
+            li.integrator = Some(StreamingIntegrator::new(self.integration_method, ring.keep_us as f64 / 1_000_000.0 * 0.05));
+            li.cursor = 0;
+            li.quats.clear();
+            li.smoothed.clear();
+            li.smoother.reset();
+            li.max_angles.clear();
+        }
+        // 1) Take in what the socket queued, then copy only the new samples out of the ring (no heavy work under lock)
+        ring.drain_ingest(&live_state.sync, |s| self.transform_live_sample(s));
+        li.samples.clear();
+        li.cursor = ring.samples_since(li.cursor, &mut li.samples);
+        ring.keep_us
     }; // lock released
 
-     
-    if samples.is_empty() {
-        log::warn!("No IMU samples available for live integration");
+    if li.samples.is_empty() {
+        if li.quats.is_empty() { log::warn!("No IMU samples available for live integration"); }
         return;
     }
-    //println!("Integrating {} live IMU samples", samples.len());
 
-    // 2) Convert to TimeIMU (telemetry_parser::IMUData)
-    let mut imu_data_vec: Vec<TimeIMU> = Vec::with_capacity(samples.len());
-    for s in &samples {
+    // 2) Integrate the new samples and append them to the window
+    let integrator = li.integrator.as_mut().unwrap();
+    let mut new_quats = TimeQuat::new();
+    for s in &li.samples {
         let mut imu_point = TimeIMU::default();
         imu_point.timestamp_ms = s.ts_sensor_us as f64 / 1000.0;
-        imu_point.gyro  = Some(s.gyro);   // if s.gyro is [f32;3], cast to f64 here
-        imu_point.accl  = s.accel;        // same note as above
-        imu_data_vec.push(imu_point);
+        imu_point.gyro = Some(s.gyro);
+        imu_point.accl = s.accel;
+        let Some((ts, q)) = integrator.push(&imu_point) else { continue; };
+        li.quats.push(ts, q);
+        new_quats.insert(ts, q);
     }
 
-    let start_ms   = imu_data_vec.first().unwrap().timestamp_ms;
-    let end_ms     = imu_data_vec.last().unwrap().timestamp_ms;
-    println!("Live IMU data timestamps: {:.3} ms to {:.3} ms", start_ms, end_ms);
-    let duration_ms = end_ms - start_ms;
-    //println!("Live IMU data duration: {:.3} ms", duration_ms);
-    // 3) Integrate → quats (sorted by timestamp)
-    let quat_map: TimeQuat = match self.integration_method {
-        
-        1 => ComplementaryIntegrator::integrate(&imu_data_vec, duration_ms),
-        2 => VQFIntegrator::integrate(&imu_data_vec, duration_ms),
-        3 => SimpleGyroIntegrator::integrate(&imu_data_vec, duration_ms),
-        4 => SimpleGyroAccelIntegrator::integrate(&imu_data_vec, duration_ms),
-        5 => MahonyIntegrator::integrate(&imu_data_vec, duration_ms),
-        6 => MadgwickIntegrator::integrate(&imu_data_vec, duration_ms),
-        0 | _ => {
-            log::info!("Using Complementary filter for live data (fallback)");
-            ComplementaryIntegrator::integrate(&imu_data_vec, duration_ms)
-        }
-    };
-    //println!("Integrated {} quaternions from live IMU data", quat_map.len());
-    // 4) Build a tiny smoothed map (example: blend last with previous)
-    let mut smoothed_quat_map = BTreeMap::new();
-    let mut prev_opt: Option<(&i64, &Quat64)> = None;
-
-    for (ts, q) in &quat_map {
-        if let Some((_, prev_q)) = prev_opt {
-            let blended = prev_q.slerp(&q, 0.5);
-            smoothed_quat_map.insert(*ts, blended);
-        }
-        prev_opt = Some((ts, q));
+    // 3) Horizon lock on the new quats, then causal smoothing. Quats become final once the lookahead is available
+    let mut locked = new_quats.clone();
+    li.horizon.lock.lock_with(&mut locked, &new_quats, &self.file_metadata.read().gravity_vectors, self.use_gravity_vectors, &li.horizon.keyframes, li.horizon.video_rotation);
+    for ((&ts, &org), &q) in new_quats.iter().zip(locked.values()) {
+        li.smoother.push_locked(ts, org, q);
     }
-    //println!("Smoothed {} quaternions for live data", smoothed_quat_map.len());
-
-    // 5) Convert both to QuatBuffer (use your associated function)
-    let buf_org       = QuatBuffer::from_btreemap(&quat_map);
-    let buf_smoothed  = QuatBuffer::from_btreemap(&smoothed_quat_map);
-
-    //6 publish both buffers (stores are internally synchronized)
-    if let Some(st) = self.live.read().as_ref() {
-        st.quat_buffer_store_org.publish(buf_org.unwrap());
-        st.quat_buffer_store_smoothed.publish(buf_smoothed.unwrap());
-        //println!("published live quat buffers");
+    let smoothed = &mut li.smoothed;
+    let max_angles = &mut li.max_angles;
+    li.smoother.drain_final(|ts, org, smoothed_q| {
+        let correction = smoothed_q.inverse() * org;
+        max_angles.push(ts, &correction);
+        smoothed.push(ts, correction);
+    });
+    li.trim(keep_us);
+    self.max_angles = li.max_angles.get();
+
+    // 4) Publish both buffers (stores are internally synchronized). The clones share the storage with the window,
+    //    so only the quats appended above were written this tick
+    if !li.quats.is_empty() {
+        live_state.quat_buffer_store_org.publish(li.quats.clone());
+    }
+    if !li.smoothed.is_empty() {
+        live_state.quat_buffer_store_smoothed.publish(li.smoothed.clone());
     }
-    //println!("Finished integrating live IMU data");
 }
 
     /* end live handling */
@@ -1086,6 +1111,34 @@ impl GyroSource {
     self.quat_at_timestamp(&self.quaternions, timestamp_ms)
 }
 
+/// Batched `org_quat_at_timestamp` for `out.len()` timestamps `start_ms + i * step_ms` (the rolling shutter rows of a frame).
+/// The live buffer is selected once for the whole batch instead of once per row.
+pub fn org_quats_at_timestamps(&self, start_ms: f64, step_ms: f64, out: &mut [Quat64]) {
+    if out.is_empty() { return; }
+    let end_ms = start_ms + step_ms * (out.len() - 1) as f64;
+    // Offsets are linearly interpolated, so correcting both ends keeps the rows evenly spaced
+    let corrected_start = start_ms - self.offset_at_video_timestamp(start_ms);
+    let corrected_end = end_ms - self.offset_at_video_timestamp(end_ms);
+    let corrected_step = if out.len() > 1 { (corrected_end - corrected_start) / (out.len() - 1) as f64 } else { 0.0 };
+
+    if let Some(st) = self.live.read().as_ref() {
+        const PRE_MS: f64 = 0.0;
+        const POST_MS: f64 = 500.0;
+        const CENTER_RATIO: f64 = 0.25;
+
+        let mid_ms = (corrected_start + corrected_end) / 2.0;
+        if let Some((buf, _ver)) = st.quat_buffer_store_org.select_centered_and_prune(mid_ms, PRE_MS, POST_MS, CENTER_RATIO, true) {
+            if buf.quats_at_ms(corrected_start, corrected_step, out) {
+                return;
+            }
+        }
+    }
+
+    for (i, o) in out.iter_mut().enumerate() {
+        *o = self.quat_at_timestamp(&self.quaternions, start_ms + step_ms * i as f64);
+    }
+}
+
 pub fn smoothed_quat_at_timestamp(&self, timestamp_ms: f64) -> Quat64 {
     let corrected_ms = timestamp_ms - self.offset_at_video_timestamp(timestamp_ms);
 
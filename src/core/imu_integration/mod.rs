@@ -314,3 +314,128 @@ impl GyroIntegrator for MadgwickIntegrator {
         quats
     }
 }
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+enum StreamingFilter {
+    Complementary(ComplementaryFilterV2),
+    // Created on the second sample, VQF needs the sample period up front
+    VQF(Option<vqf::VQF>),
+    SimpleGyro(Quat64),
+    SimpleGyroAccel(Quat64),
+    Mahony(Mahony<f64>),
+    Madgwick(Madgwick<f64>),
+}
+
+/// Sample-by-sample version of the integrators above, for live mode.
+/// The state is kept between calls, so every sample is integrated once instead of re-running the whole window.
+/// `method` uses the same numbering as `GyroSource::integration_method`.
+/// VQF runs the real-time filter only, without the backward pass of `offline_vqf`.
+pub struct StreamingIntegrator {
+    method: i32,
+    filter: StreamingFilter,
+    start_time: Option<f64>,
+    prev_time: Option<f64>,
+}
+
+impl StreamingIntegrator {
+    pub fn new(method: i32, settle_time_s: f64) -> Self {
+        let init_pos = UnitQuaternion::from_euler_angles(std::f64::consts::FRAC_PI_2, 0.0, 0.0);
+        let filter = match method {
+            2 => StreamingFilter::VQF(None),
+            3 => StreamingFilter::SimpleGyro(init_pos),
+            4 => StreamingFilter::SimpleGyroAccel(init_pos),
+            5 => StreamingFilter::Mahony(Mahony::new_with_quat(0.001, 0.5, 0.0, init_pos)),
+            6 => StreamingFilter::Madgwick(Madgwick::new_with_quat(0.001, 0.02, init_pos)),
+            _ => {
+                let mut f = ComplementaryFilterV2::default();
+                f.set_initial_settle_time(settle_time_s.min(2.0));
+                StreamingFilter::Complementary(f)
+            }
+        };
+        Self { method, filter, start_time: None, prev_time: None }
+    }
+
+    pub fn method(&self) -> i32 { self.method }
+
+    /// Integrates one sample. Returns the orientation at the sample timestamp (µs),
+    /// or None for samples without gyro data, out of order samples and the first VQF sample
+    pub fn push(&mut self, v: &TimeIMU) -> Option<(i64, Quat64)> {
+        let g = v.gyro.as_ref()?;
+        let first = self.prev_time.is_none();
+        let prev_time = match self.prev_time {
+            Some(t) if v.timestamp_ms <= t => return None,
+            Some(t) => t,
+            None => {
+                // Like the batch integrators, assume one period before the first sample (1 ms, the rate isn't known yet)
+                self.start_time = Some(v.timestamp_ms - 1.0);
+                v.timestamp_ms - 1.0
+            }
+        };
+        self.prev_time = Some(v.timestamp_ms);
+        let dt = (v.timestamp_ms - prev_time) / 1000.0;
+        let ts = (v.timestamp_ms * 1000.0) as i64;
+
+        let mut a = v.accl.unwrap_or_default();
+        let quat = match &mut self.filter {
+            StreamingFilter::Complementary(f) => {
+                if a[0].abs() == 0.0 && a[1].abs() == 0.0 && a[2].abs() == 0.0 { a[0] += 0.0000001; }
+                f.update(-a[1], a[0], a[2], -g[1] * DEG2RAD, g[0] * DEG2RAD, g[2] * DEG2RAD, dt);
+                let x = f.get_orientation();
+                Quat64::from_quaternion(Quaternion::from_parts(x.0, Vector3::new(x.1, x.2, x.3)))
+            },
+            StreamingFilter::VQF(f) => {
+                // The first sample only gives us a timestamp
+                if first { return None; }
+                let f = f.get_or_insert_with(|| {
+                    let params = vqf::VQFParams { tau_acc: 40.0, tau_mag: 40.0, ..Default::default() };
+                    vqf::VQF::vqf(Some(params), dt, 0.0, 0.0)
+                });
+                f.update(&[-g[1] * DEG2RAD, g[0] * DEG2RAD, g[2] * DEG2RAD], &[-a[1], a[0], a[2]], None);
+                let q = f.get_quat6d();
+                Quat64::from_quaternion(Quaternion::from_parts(q[0], Vector3::new(q[1], q[2], q[3])))
+            },
+            StreamingFilter::SimpleGyro(orientation) => {
+                let omega = Vector3::new(-g[1], g[0], g[2]) * DEG2RAD;
+                let delta_q = UnitQuaternion::from_scaled_axis(omega * dt);
+                *orientation = Quat64::from_quaternion(orientation.quaternion() * delta_q.quaternion());
+                *orientation
+            },
+            StreamingFilter::SimpleGyroAccel(orientation) => {
+                let mut omega = Vector3::new(-g[1], g[0], g[2]) * DEG2RAD;
+                let acc = Vector3::new(-a[1], a[0], a[2]).try_normalize(0.0).unwrap_or_default();
+                if (0.9..1.1).contains(&acc.norm()) {
+                    let correction_world = (*orientation * acc).cross(&Vector3::new(0.0, 0.0, 1.0));
+                    let weight = if v.timestamp_ms - self.start_time.unwrap_or(prev_time) < 15000.0 { 10.0 } else { 0.6 };
+                    omega += weight * (orientation.conjugate() * correction_world);
+                }
+                let delta_q = UnitQuaternion::from_scaled_axis(omega * dt);
+                *orientation = Quat64::from_quaternion(orientation.quaternion() * delta_q.quaternion());
+                *orientation
+            },
+            StreamingFilter::Mahony(ahrs) => {
+                if a[0].abs() == 0.0 && a[1].abs() == 0.0 && a[2].abs() == 0.0 { a[0] += 0.0000001; }
+                let gyro = Vector3::new(-g[1], g[0], g[2]) * DEG2RAD;
+                let accl = Vector3::new(-a[1], a[0], a[2]);
+                *ahrs.sample_period_mut() = dt;
+                match ahrs.update_imu(&gyro, &accl) {
+                    Ok(quat) => *quat,
+                    Err(e) => { log::warn!("Invalid data! {:?} Gyro: [{}, {}, {}] Accel: [{}, {}, {}]", e, gyro[0], gyro[1], gyro[2], accl[0], accl[1], accl[2]); return None; }
+                }
+            },
+            StreamingFilter::Madgwick(ahrs) => {
+                if a[0].abs() == 0.0 && a[1].abs() == 0.0 && a[2].abs() == 0.0 { a[0] += 0.0000001; }
+                let gyro = Vector3::new(-g[1], g[0], g[2]) * DEG2RAD;
+                let accl = Vector3::new(-a[1], a[0], a[2]);
+                *ahrs.sample_period_mut() = dt;
+                match ahrs.update_imu(&gyro, &accl) {
+                    Ok(quat) => *quat,
+                    Err(e) => { log::warn!("Invalid data! {:?} Gyro: [{}, {}, {}] Accel: [{}, {}, {}]", e, gyro[0], gyro[1], gyro[2], accl[0], accl[1], accl[2]); return None; }
+                }
+            },
+        };
+        Some((ts, quat))
+    }
+}
@@ -26,6 +26,7 @@ pub mod util;
 pub mod stabilization_params;
 
 pub mod stmap_live;
+pub mod bench;
 
 use std::sync::{ Arc, atomic::{ AtomicU64, AtomicBool, Ordering::SeqCst } };
 use std::collections::BTreeMap;
@@ -114,6 +115,8 @@ pub struct StabilizationManager {
     pub params: Arc<RwLock<StabilizationParams>>,
 
     pub sync_data: Arc<RwLock<SyncData>>,
+
+    pub live_zoom: Arc<RwLock<zooming::live::LiveZoom>>,
 }
 
 impl Default for StabilizationManager {
@@ -152,6 +155,8 @@ impl Default for StabilizationManager {
             camera_id: Arc::new(RwLock::new(None)),
 
             sync_data: Arc::new(RwLock::new(SyncData::default())),
+
+            live_zoom: Arc::new(RwLock::new(zooming::live::LiveZoom::default())),
         }
     }
 }
@@ -429,25 +434,50 @@ impl StabilizationManager {
         Ok(())
     }
 
+    /// Per-frame update in live mode. Smoothing runs causally while the IMU data is integrated
+    /// and the zoom only looks at a bounded window of previous frames, so the cost doesn't grow with the stream length.
+    /// The compute params are rebuilt every `recompute_period` frames
     pub fn live_on_new_frame(&self, frame_idx: usize, now_ms: f64, recompute_period: usize) {
         // keep params timeline in sync
-        {
+        let (fps, adaptive_zoom_window) = {
             let mut p = self.params.write();
             p.frame_count = frame_idx.max(p.frame_count);
             p.duration_ms = now_ms.max(p.duration_ms);
-        }
+            (p.get_scaled_fps(), p.adaptive_zoom_window)
+        };
 
-        // update IMU transforms if GUI changed
-        // self.recompute_gyro();  // only if needed
+        let time_constant = self.smoothing.read().live_time_constant();
+        self.gyro.read().set_live_smoothing(time_constant, gyro_source::live::LIVE_SMOOTHING_LOOKAHEAD_MS);
 
-        // occasional (or per-N-frames) heavy recompute:
-        if frame_idx % recompute_period == 30{
-            self.recompute_smoothness();
-            self.recompute_adaptive_zoom();
-            self.recompute_undistortion();
+        if frame_idx % recompute_period.max(1) != 0 {
+            return;
+        }
+
+        let mut params = stabilization::ComputeParams::from_manager(self);
+        let horizon_lock = self.smoothing.read().horizon_lock.clone();
+        self.gyro.read().set_live_horizon_lock(horizon_lock, &params.keyframes, params.video_rotation);
 
+        // Zoom for this frame only. `fovs` holds a single value, which `FrameTransform` uses for every frame
+        let fov = if adaptive_zoom_window < -0.9 || adaptive_zoom_window > 0.0001 {
+            let min_fov = zooming::calculate_fov_at(&params, frame_idx, now_ms);
+            let mut zoom = self.live_zoom.write();
+            if !zoom.matches(adaptive_zoom_window, fps) {
+                *zoom = zooming::live::LiveZoom::new(adaptive_zoom_window, fps);
+            }
+            zoom.push(frame_idx, min_fov)
+        } else {
+            1.0
+        };
+        let lens_fov_adjustment = params.lens.optimal_fov.unwrap_or(1.0);
+        {
+            let mut stab_params = self.params.write();
+            stab_params.set_fovs(vec![fov], lens_fov_adjustment);
+            stab_params.minimal_fovs.clear();
         }
-        
+        params.fovs = vec![fov];
+        params.minimal_fovs.clear();
+
+        self.stabilization.write().set_compute_params(params);
     }
 
     pub fn load_gyro_info_live(
@@ -1078,7 +1108,42 @@ impl StabilizationManager {
         println!("output: {}", buffers.output.get_checksum());   
     }
 
-    pub fn process_pixels<T: PixelType>(&self, mut timestamp_us: i64, frame: Option<usize>, buffers: &mut Buffers) -> Result<stabilization::ProcessedInfo, GyroflowCoreError> {
+    pub fn process_pixels<T: PixelType>(&self, timestamp_us: i64, frame: Option<usize>, buffers: &mut Buffers) -> Result<stabilization::ProcessedInfo, GyroflowCoreError> {
+        let (timestamp_us, frame) = self.prepare_for_processing::<T>(timestamp_us, frame, buffers)?;
+
+        if let Some(undist) = self.stabilization.try_read_for(std::time::Duration::from_millis(30000)) {
+            undist.process_pixels::<T>(timestamp_us, frame, buffers, None)
+        } else {
+            Err(GyroflowCoreError::Unknown)
+        }
+    }
+
+    /// Stabilizes one frame for each manager in `jobs` as `(manager, timestamp_us, frame, buffers)`, used to render several
+    /// live streams together. See `Stabilization::process_pixels_batch`, with a shared wgpu device all frames go in one submit
+    pub fn process_pixels_batch<T: PixelType>(jobs: &mut [(&StabilizationManager, i64, Option<usize>, &mut Buffers)]) -> Vec<Result<stabilization::ProcessedInfo, GyroflowCoreError>> {
+        let mut results: Vec<Option<Result<stabilization::ProcessedInfo, GyroflowCoreError>>> = (0..jobs.len()).map(|_| None).collect();
+        let mut prepared = Vec::with_capacity(jobs.len());
+        for (i, job) in jobs.iter_mut().enumerate() {
+            match job.0.prepare_for_processing::<T>(job.1, job.2, job.3) {
+                Ok((timestamp_us, frame)) => match job.0.stabilization.try_read_for(std::time::Duration::from_millis(30000)) {
+                    Some(undist) => prepared.push((i, undist, timestamp_us, frame, &mut *job.3)),
+                    None => results[i] = Some(Err(GyroflowCoreError::Unknown)),
+                },
+                Err(e) => results[i] = Some(Err(e)),
+            }
+        }
+        let mut batch: Vec<_> = prepared.iter_mut().map(|(_, undist, timestamp_us, frame, buffers)| (&**undist, *timestamp_us, *frame, &mut **buffers)).collect();
+        let batch_results = stabilization::Stabilization::process_pixels_batch::<T>(&mut batch);
+        drop(batch);
+        for ((i, ..), result) in prepared.iter().zip(batch_results) {
+            results[*i] = Some(result);
+        }
+        results.into_iter().map(|x| x.unwrap_or(Err(GyroflowCoreError::Unknown))).collect()
+    }
+
+    /// Everything `process_pixels` does before the undistortion: frame offset and fps scale, pending recomputes and
+    /// backend initialization. Returns the adjusted timestamp and frame
+    fn prepare_for_processing<T: PixelType>(&self, mut timestamp_us: i64, frame: Option<usize>, buffers: &mut Buffers) -> Result<(i64, Option<usize>), GyroflowCoreError> {
         if let gpu::BufferSource::Cpu { buffer } = &buffers.input.data  { if buffer.is_empty() { return Err(GyroflowCoreError::InputBufferEmpty); } }
         if let gpu::BufferSource::Cpu { buffer } = &buffers.output.data { if buffer.is_empty() { return Err(GyroflowCoreError::OutputBufferEmpty); } }
 
@@ -1119,12 +1184,7 @@ impl StabilizationManager {
                 return Err(GyroflowCoreError::Unknown);
             }
         }
-
-        if let Some(undist) = self.stabilization.try_read_for(std::time::Duration::from_millis(30000)) {
-            undist.process_pixels::<T>(timestamp_us, frame, buffers, None)
-        } else {
-            Err(GyroflowCoreError::Unknown)
-        }
+        Ok((timestamp_us, frame))
     }
 
     pub fn set_video_rotation(&self, v: f64) { self.params.write().video_rotation = v; self.invalidate_smoothing(); }
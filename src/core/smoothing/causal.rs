@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
+
+use super::*;
+use std::collections::VecDeque;
+
+/// Streaming version of the Plain 3D smoothing for live mode.
+///
+/// The forward pass runs as the quats arrive. The reverse pass only covers a fixed lookahead window,
+/// so a quat is final once `lookahead_ms` of newer data is available. The work per sample is bounded
+/// by the lookahead and doesn't grow with the length of the stream.
+#[derive(Clone)]
+pub struct CausalSmoother {
+    pub time_constant: f64, // s, 0 = no smoothing, infinite = fixed camera
+    pub lookahead_ms: f64,
+    // (timestamp_us, original, forward smoothed) for every sample that is not final yet
+    pending: VecDeque<(i64, Quat64, Quat64)>,
+    forward: Option<Quat64>,
+    last_ts: i64,
+}
+
+impl CausalSmoother {
+    pub fn new(time_constant: f64, lookahead_ms: f64) -> Self {
+        Self { time_constant, lookahead_ms: lookahead_ms.max(0.0), pending: VecDeque::new(), forward: None, last_ts: 0 }
+    }
+
+    #[inline]
+    fn alpha(&self, dt_us: i64) -> f64 {
+        if self.time_constant <= 0.0 { return 1.0; }
+        1.0 - (-(dt_us.max(0) as f64 / 1_000_000.0) / self.time_constant).exp()
+    }
+
+    /// Runs the forward pass for one sample. Timestamps must be increasing
+    pub fn push(&mut self, ts_us: i64, q: Quat64) {
+        self.push_locked(ts_us, q, q);
+    }
+
+    /// Like `push`, but smooths `q` (e.g. after the horizon lock) while `org` is what `drain_final` returns as the original
+    pub fn push_locked(&mut self, ts_us: i64, org: Quat64, q: Quat64) {
+        if self.forward.is_some() && ts_us <= self.last_ts { return; }
+        let fwd = match self.forward {
+            Some(prev) => prev.slerp(&q, self.alpha(ts_us - self.last_ts)),
+            None => q,
+        };
+        self.forward = Some(fwd);
+        self.last_ts = ts_us;
+        self.pending.push_back((ts_us, org, fwd));
+    }
+
+    /// Emits `(timestamp_us, original, smoothed)` for every sample that now has the full lookahead after it
+    pub fn drain_final<F: FnMut(i64, Quat64, Quat64)>(&mut self, mut cb: F) {
+        let lookahead_us = (self.lookahead_ms * 1000.0) as i64;
+        let final_until = self.last_ts - lookahead_us;
+        let n_final = self.pending.iter().take_while(|x| x.0 <= final_until).count();
+        if n_final == 0 { return; }
+
+        // Reverse pass from the newest sample down to the oldest final one
+        let mut q = self.pending.back().unwrap().2;
+        let mut next_ts = self.last_ts;
+        let mut out = Vec::with_capacity(n_final);
+        for (i, &(ts, org, fwd)) in self.pending.iter().enumerate().rev() {
+            q = q.slerp(&fwd, self.alpha(next_ts - ts));
+            next_ts = ts;
+            if i < n_final { out.push((ts, org, q)); }
+        }
+        for (ts, org, smoothed) in out.into_iter().rev() {
+            cb(ts, org, smoothed);
+        }
+        self.pending.drain(..n_final);
+    }
+
+    pub fn reset(&mut self) {
+        self.pending.clear();
+        self.forward = None;
+        self.last_ts = 0;
+    }
+}
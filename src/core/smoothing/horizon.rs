@@ -54,7 +54,11 @@ impl HorizonLock {
     }
 
     pub fn lock(&self, quats: &mut TimeQuat, org_quats: &TimeQuat, grav: &Option<crate::gyro_source::TimeVec>, use_grav: bool, _int_method: usize, compute_params: &ComputeParams) {
-        let keyframes = &compute_params.keyframes;
+        self.lock_with(quats, org_quats, grav, use_grav, &compute_params.keyframes, compute_params.video_rotation);
+    }
+
+    /// Same as `lock`, with only the parts of `ComputeParams` it reads, so the live path doesn't need a full snapshot
+    pub fn lock_with(&self, quats: &mut TimeQuat, org_quats: &TimeQuat, grav: &Option<crate::gyro_source::TimeVec>, use_grav: bool, keyframes: &KeyframeManager, video_rotation: f64) {
         if self.lock_enabled || keyframes.is_keyframed(&KeyframeType::LockHorizonAmount) {
             if let Some(gvec) = grav {
                 if !gvec.is_empty() && use_grav {
@@ -71,7 +75,7 @@ impl HorizonLock {
                         let angle_corr = (-correction[(0, 1)]).simd_atan2(correction[(0, 0)]);
 
                         let timestamp_ms = *ts as f64 / 1000.0;
-                        let video_rotation = keyframes.value_at_gyro_timestamp(&KeyframeType::VideoRotation, timestamp_ms).unwrap_or(compute_params.video_rotation);
+                        let video_rotation = keyframes.value_at_gyro_timestamp(&KeyframeType::VideoRotation, timestamp_ms).unwrap_or(video_rotation);
                         let horizonroll = keyframes.value_at_gyro_timestamp(&KeyframeType::LockHorizonRoll, timestamp_ms).unwrap_or(self.horizonroll) + video_rotation;
                         let horizonlockpercent = keyframes.value_at_gyro_timestamp(&KeyframeType::LockHorizonAmount, timestamp_ms).unwrap_or(self.horizonlockpercent);
 
@@ -86,7 +90,7 @@ impl HorizonLock {
 
             for (ts, smoothed_ori) in quats.iter_mut() {
                 let timestamp_ms = *ts as f64 / 1000.0;
-                let video_rotation = keyframes.value_at_gyro_timestamp(&KeyframeType::VideoRotation, timestamp_ms).unwrap_or(compute_params.video_rotation);
+                let video_rotation = keyframes.value_at_gyro_timestamp(&KeyframeType::VideoRotation, timestamp_ms).unwrap_or(video_rotation);
                 let horizonroll = keyframes.value_at_gyro_timestamp(&KeyframeType::LockHorizonRoll, timestamp_ms).unwrap_or(self.horizonroll) + video_rotation;
                 let horizonlockpercent = keyframes.value_at_gyro_timestamp(&KeyframeType::LockHorizonAmount, timestamp_ms).unwrap_or(self.horizonlockpercent);
 
@@ -6,6 +6,7 @@ pub mod none;
 pub mod plain;
 pub mod fixed;
 pub mod default_algo;
+pub mod causal;
 
 pub use nalgebra::*;
 use super::gyro_source::{ TimeQuat, Quat64 };
@@ -112,6 +113,19 @@ impl Smoothing {
         hasher.finish()
     }
 
+    /// Time constant for `causal::CausalSmoother`, approximated from the current algorithm's parameters
+    pub fn live_time_constant(&self) -> f64 {
+        let alg = self.current();
+        match self.current_id {
+            0 => 0.0,
+            3 => f64::INFINITY,
+            _ => {
+                let tc = alg.get_parameter("time_constant");
+                if tc > 0.0 { tc } else { alg.get_parameter("smoothness") * alg.get_parameter("max_smoothness") }
+            }
+        }
+    }
+
     pub fn get_names(&self) -> Vec<String> {
         self.algs.0.iter().map(|x| x.get_name()).collect()
     }
@@ -218,13 +218,17 @@ impl FrameTransform {
         // Only compute 1 matrix if not using rolling shutter correction
         let rows = if frame_readout_time.abs() > 0.0 { if params.frame_readout_direction.is_horizontal() { params.width } else { params.height } } else { 1 };
 
+        // Readout quats for all rows in one pass, the lookup walks forward from the previous row
+        let mut readout_quats = vec![crate::gyro_source::Quat64::identity(); rows];
+        gyro.org_quats_at_timestamps(start_ts, if frame_readout_time.abs() > 0.0 { row_readout_time } else { 0.0 }, &mut readout_quats);
+
         let matrices = (0..rows).into_par_iter().map(|y| {
             let quat_time = if frame_readout_time.abs() > 0.0 {
                 start_ts + row_readout_time * y as f64
             } else {
                 start_ts
             };
-            let readout_quat = gyro.org_quat_at_timestamp(quat_time);
+            let readout_quat = readout_quats[y];
             let quat = smoothed_quat1
                      * quat1
                      * readout_quat;
@@ -185,6 +185,9 @@ pub struct ProcessedInfo {
     pub minimal_fov: f64,
     pub focal_length: Option<f64>,
     pub backend: &'static str,
+    pub gpu_time_ms: Option<f64>,    // GPU time of the frame, if the backend can measure it
+    pub upload_time_ms: Option<f64>, // CPU time of preparing the uploads
+    pub upload_bytes: u64,
 }
 
 impl Stabilization {
@@ -192,6 +195,7 @@ impl Stabilization {
         self.stab_data.clear();
         self.compute_params = params;
     }
+    pub fn compute_params(&self) -> &ComputeParams { &self.compute_params }
 
     fn get_rect(desc: &BufferDescription) -> [i32; 4] {
         let mut ret = [0i32; 4];
@@ -600,40 +604,7 @@ impl Stabilization {
     
 
 
-   pub fn process_pixels<T: PixelType>(
-    &self,
-    timestamp_us: i64,
-    frame: Option<usize>,
-    buffers: &mut Buffers,
-    frame_transform: Option<&FrameTransform>,
-) -> Result<ProcessedInfo, GyroflowCoreError> {
-    if buffers.input.size.1 < 4 || buffers.output.size.1 < 4 {
-        return Err(GyroflowCoreError::SizeTooSmall);
-    }
-
-    let mut _tmp_transform = None;
-    if frame_transform.is_none() && !self.cache_frame_transform {
-        _tmp_transform = Some(self.get_frame_transform_at::<T>(timestamp_us, frame, buffers));
-    }
-    let itm = frame_transform
-        .map(|x| Some(x))
-        .unwrap_or_else(|| {
-            if !self.cache_frame_transform {
-                _tmp_transform.as_ref()
-            } else {
-                self.stab_data.get(&timestamp_us)
-            }
-        });
-
-    if let Some(itm) = itm {
-        let mut ret = ProcessedInfo {
-            fov:          itm.fov,
-            minimal_fov:  itm.minimal_fov,
-            focal_length: itm.focal_length,
-            backend:      "",
-        };
-        let drawing_buffer = self.drawing.get_buffer();
-
+    fn check_frame_transform(&self, itm: &FrameTransform, buffers: &Buffers) -> Result<(), GyroflowCoreError> {
         if self.size
             != (itm.kernel_params.width as usize, itm.kernel_params.height as usize)
         {
@@ -669,6 +640,88 @@ impl Stabilization {
                 buffers.output.size.0 as i32,
             ));
         }
+        Ok(())
+    }
+
+    /// `process_pixels` for one frame of each stabilizer in `jobs`. The frames on wgpu instances on the shared device
+    /// (`WgpuWrapper::set_shared_device`) are recorded into a single command buffer and read back after one submit,
+    /// everything else goes through `process_pixels` one by one. Each stabilizer has to be ready for processing
+    pub fn process_pixels_batch<T: PixelType>(jobs: &mut [(&Stabilization, i64, Option<usize>, &mut Buffers)]) -> Vec<Result<ProcessedInfo, GyroflowCoreError>> {
+        let mut results: Vec<Option<Result<ProcessedInfo, GyroflowCoreError>>> = (0..jobs.len()).map(|_| None).collect();
+        let mut batch = Vec::with_capacity(jobs.len()); // (job index, stabilizer, wgpu instance, buffers, transform, timestamp)
+        for (i, job) in jobs.iter_mut().enumerate() {
+            let (stab, timestamp_us, frame) = (job.0, job.1, job.2);
+            let buffers = &mut *job.3;
+            let wrapper = stab.wgpu.as_ref().filter(|x| x.is_shared_device() && stab.initialized_backend.is_wgpu() && wgpu::is_buffer_supported(buffers));
+            if let Some(wrapper) = wrapper {
+                if buffers.input.size.1 < 4 || buffers.output.size.1 < 4 {
+                    results[i] = Some(Err(GyroflowCoreError::SizeTooSmall));
+                    continue;
+                }
+                let itm = if stab.cache_frame_transform { stab.stab_data.get(&timestamp_us).cloned() } else { Some(stab.get_frame_transform_at::<T>(timestamp_us, frame, buffers)) };
+                if let Some(itm) = itm {
+                    match stab.check_frame_transform(&itm, buffers) {
+                        Ok(()) => batch.push((i, stab, wrapper, buffers, itm, timestamp_us)),
+                        Err(e) => results[i] = Some(Err(e)),
+                    }
+                    continue;
+                }
+            }
+            results[i] = Some(stab.process_pixels::<T>(timestamp_us, frame, buffers, None));
+        }
+
+        let mut items: Vec<_> = batch.iter_mut().map(|(_, stab, wrapper, buffers, itm, _)| wgpu::BatchItem { wgpu: *wrapper, buffers: &mut **buffers, transform: itm, drawing: stab.drawing.get_buffer() }).collect();
+        let ok = wgpu::WgpuWrapper::undistort_batch(&mut items);
+        drop(items);
+        for ((i, stab, _, buffers, itm, timestamp_us), ok) in batch.into_iter().zip(ok) {
+            results[i] = Some(if ok {
+                Ok(ProcessedInfo { fov: itm.fov, minimal_fov: itm.minimal_fov, focal_length: itm.focal_length, backend: "wgpu", gpu_time_ms: None, upload_time_ms: None, upload_bytes: 0 })
+            } else {
+                // Retry on its own, like a single frame would
+                stab.process_pixels::<T>(timestamp_us, None, buffers, Some(&itm))
+            });
+        }
+        results.into_iter().map(|x| x.unwrap_or(Err(GyroflowCoreError::Unknown))).collect()
+    }
+
+   pub fn process_pixels<T: PixelType>(
+    &self,
+    timestamp_us: i64,
+    frame: Option<usize>,
+    buffers: &mut Buffers,
+    frame_transform: Option<&FrameTransform>,
+) -> Result<ProcessedInfo, GyroflowCoreError> {
+    if buffers.input.size.1 < 4 || buffers.output.size.1 < 4 {
+        return Err(GyroflowCoreError::SizeTooSmall);
+    }
+
+    let mut _tmp_transform = None;
+    if frame_transform.is_none() && !self.cache_frame_transform {
+        _tmp_transform = Some(self.get_frame_transform_at::<T>(timestamp_us, frame, buffers));
+    }
+    let itm = frame_transform
+        .map(|x| Some(x))
+        .unwrap_or_else(|| {
+            if !self.cache_frame_transform {
+                _tmp_transform.as_ref()
+            } else {
+                self.stab_data.get(&timestamp_us)
+            }
+        });
+
+    if let Some(itm) = itm {
+        let mut ret = ProcessedInfo {
+            fov:          itm.fov,
+            minimal_fov:  itm.minimal_fov,
+            focal_length: itm.focal_length,
+            backend:      "",
+            gpu_time_ms:    None,
+            upload_time_ms: None,
+            upload_bytes:   0,
+        };
+        let drawing_buffer = self.drawing.get_buffer();
+
+        self.check_frame_transform(itm, buffers)?;
 
         // --- helper to log hashes of input/output buffers for GPU paths ---
         fn log_buf_hashes(label: &str, buffers: &Buffers) {
@@ -792,7 +845,8 @@ impl Stabilization {
             }
         }
 
-        // CPU path (no logging here anymore)
+        // CPU path (no logging here anymore). There's no canvas to clear between frames here, so nothing is passed when nothing is drawn
+        let cpu_drawing = self.drawing.get_drawn_buffer();
         let ok = match self.interpolation {
             Interpolation::Bilinear => {
                 Self::undistort_image_cpu::<2, T>(
@@ -801,7 +855,7 @@ impl Stabilization {
                     &self.compute_params.distortion_model,
                     self.compute_params.digital_lens.as_ref(),
                     &itm.matrices,
-                    drawing_buffer,
+                    cpu_drawing,
                     &itm.mesh_data,
                 )
             }
@@ -812,7 +866,7 @@ impl Stabilization {
                     &self.compute_params.distortion_model,
                     self.compute_params.digital_lens.as_ref(),
                     &itm.matrices,
-                    drawing_buffer,
+                    cpu_drawing,
                     &itm.mesh_data,
                 )
             }
@@ -823,7 +877,7 @@ impl Stabilization {
                     &self.compute_params.distortion_model,
                     self.compute_params.digital_lens.as_ref(),
                     &itm.matrices,
-                    drawing_buffer,
+                    cpu_drawing,
                     &itm.mesh_data,
                 )
             }
@@ -834,7 +888,7 @@ impl Stabilization {
                     &self.compute_params.distortion_model,
                     self.compute_params.digital_lens.as_ref(),
                     &itm.matrices,
-                    drawing_buffer,
+                    cpu_drawing,
                     &itm.mesh_data,
                 )
             }
@@ -845,7 +899,7 @@ impl Stabilization {
                     &self.compute_params.distortion_model,
                     self.compute_params.digital_lens.as_ref(),
                     &itm.matrices,
-                    drawing_buffer,
+                    cpu_drawing,
                     &itm.mesh_data,
                 )
             }
@@ -856,7 +910,7 @@ impl Stabilization {
                     &self.compute_params.distortion_model,
                     self.compute_params.digital_lens.as_ref(),
                     &itm.matrices,
-                    drawing_buffer,
+                    cpu_drawing,
                     &itm.mesh_data,
                 )
             }
@@ -867,7 +921,7 @@ impl Stabilization {
                     &self.compute_params.distortion_model,
                     self.compute_params.digital_lens.as_ref(),
                     &itm.matrices,
-                    drawing_buffer,
+                    cpu_drawing,
                     &itm.mesh_data,
                 )
             }
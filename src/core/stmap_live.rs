@@ -1,15 +1,18 @@
 
-use std::sync::{Arc, Mutex, atomic::{AtomicBool, Ordering}};
+use std::sync::{Arc, Mutex, atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering}};
 use std::thread;
-use std::time::Duration;
+use std::time::{Duration, Instant};
+use parking_lot::RwLock;
 
-use crossbeam_channel::{Receiver, SendError, Sender, TrySendError, unbounded};
+use crossbeam_channel::{Receiver, SendError, Sender, TrySendError, bounded};
 use log::{debug, error, info, warn};
 use exr::prelude::{SpecificChannels, Vec2, Image, Compression, WritableImage};
 use crate::{StabilizationManager, stabilization::*, zooming::*};
+use crate::stabilization::distortion_models::DistortionModel;
 use rayon::prelude::ParallelSliceMut;
 use rayon::iter::ParallelIterator;
 use rayon::iter::IndexedParallelIterator;
+use rayon::iter::IntoParallelRefIterator;
 // reuse your existing helpers & types from stmaps.rs
 
 /// Item submitted by the capture/render scheduler.
@@ -19,39 +22,194 @@ pub struct LiveFrameJob {
     pub frame_ts_ms: f64,
 }
 
-/// Same shape as generate_stmaps() emits.
-pub type StmapItem = (String, usize, Vec<u8>, Vec<u8>);
+/// Dense ST map as (x, y) coordinate pairs in input pixels, row-major. Shared, so handing it to the
+/// render thread or several consumers doesn't copy it. An empty map means it couldn't be generated
+#[derive(Clone, Debug, Default)]
+pub struct LiveStmap {
+    pub width: usize,
+    pub height: usize,
+    pub coords: Arc<Vec<f32>>,
+}
+
+impl LiveStmap {
+    pub fn new(width: usize, height: usize, coords: Vec<f32>) -> Self {
+        debug_assert_eq!(coords.len(), width * height * 2);
+        Self { width, height, coords: Arc::new(coords) }
+    }
+    pub fn is_empty(&self) -> bool { self.coords.is_empty() }
+
+    #[inline]
+    pub fn get(&self, x: usize, y: usize) -> (f32, f32) {
+        let i = (y * self.width + x) * 2;
+        (self.coords[i], self.coords[i + 1])
+    }
+
+    /// Encodes the map as a normalized ST map EXR, the same format generate_stmaps() writes. Only meant for offline use
+    pub fn to_exr(&self) -> Vec<u8> {
+        StmapsLive::encode_exr(self.width, self.height, &self.coords)
+    }
+}
+
+/// (filename base, frame, redistort map, undistort map), like generate_stmaps() but without the EXR encoding
+pub type StmapItem = (String, usize, LiveStmap, LiveStmap);
+
+/// GPU implementation of the undistortion map, see `gpu/wgpu_stmap.rs`.
+/// Returns `output_width * output_height` (x, y) pairs in input pixels, or None to fall back to the CPU path.
+pub trait StmapGpuBackend: Send + Sync {
+    fn undistort_map(&self, kernel_params: &KernelParams, matrices: &[[f32; 14]], mesh_data: &[f32], distortion_model: &DistortionModel, digital_lens: Option<&DistortionModel>) -> Option<Vec<f32>>;
+}
+
+/// Snapshot of the live queue counters, see `StmapsLive::stats()`
+#[derive(Clone, Copy, Debug, Default)]
+pub struct StmapsLiveStats {
+    pub submitted: u64,
+    pub completed: u64,
+    /// Jobs dropped from the input queue because the worker fell behind
+    pub dropped_jobs: u64,
+    /// Finished maps dropped from the output queue because the render thread didn't pick them up
+    pub dropped_maps: u64,
+    pub in_queue_depth: usize,
+    pub out_queue_depth: usize,
+    /// Time between submit_frame() and the worker picking up the job
+    pub last_job_age_ms: f64,
+    pub max_job_age_ms: f64,
+    /// Interpolation error of the last sparse-grid redistort map against the exact transform, in pixels.
+    /// Measured at the grid cell centers, zero with the exact path
+    pub grid_max_error_px: f64,
+    pub grid_mean_error_px: f64,
+}
+
+#[derive(Default)]
+struct Counters {
+    submitted: AtomicU64,
+    completed: AtomicU64,
+    dropped_jobs: AtomicU64,
+    dropped_maps: AtomicU64,
+    last_job_age_us: AtomicU64,
+    max_job_age_us: AtomicU64,
+    grid_max_error_px: AtomicU64, // f64 bits
+    grid_mean_error_px: AtomicU64,
+}
+
+/// Results that only depend on the lens and the params, valid while the fingerprint matches
+#[derive(Default)]
+struct LensCache {
+    fingerprint: u64,
+    dist_grid_step: usize,
+    /// PASS 1 of the map generation: FOV scale and the size of the undistorted map
+    pass1: Option<(f64, usize, usize)>,
+    /// With the rotation suppressed and no per-frame lens data, the maps themselves are the same for every frame
+    maps: Option<(LiveStmap, LiveStmap, Option<(f64, f64)>)>,
+}
+
+/// Worker settings that can be changed while it's running
+#[derive(Default)]
+struct Settings {
+    gpu: RwLock<Option<Arc<dyn StmapGpuBackend>>>,
+    exr_sink: RwLock<Option<String>>,
+    dist_grid_step: AtomicUsize,
+}
+
+/// Sends on a bounded channel, dropping the oldest queued items to make room. Returns how many were dropped
+fn send_drop_oldest<T>(tx: &Sender<T>, rx: &Receiver<T>, mut item: T) -> Result<u64, SendError<T>> {
+    let mut dropped = 0;
+    loop {
+        match tx.try_send(item) {
+            Ok(()) => return Ok(dropped),
+            Err(TrySendError::Full(back)) => {
+                item = back;
+                if rx.try_recv().is_ok() { dropped += 1; }
+            }
+            Err(TrySendError::Disconnected(back)) => return Err(SendError(back)),
+        }
+    }
+}
 
 pub struct StmapsLive {
-    tx_in: Sender<LiveFrameJob>,
+    tx_in: Sender<(LiveFrameJob, Instant)>,
+    rx_in: Receiver<(LiveFrameJob, Instant)>,
     rx_out: Receiver<StmapItem>,
     running: Arc<AtomicBool>,
+    settings: Arc<Settings>,
+    counters: Arc<Counters>,
     _worker: thread::JoinHandle<()>,
 }
 
 impl StmapsLive {
-    /// Create a live STMaps worker with bounded queues.
+    pub const DEFAULT_IN_CAP: usize = 2;
+    pub const DEFAULT_OUT_CAP: usize = 4;
+
+    pub fn new(stab: Arc<StabilizationManager>) -> Self {
+        Self::with_capacity(stab, Self::DEFAULT_IN_CAP, Self::DEFAULT_OUT_CAP)
+    }
+
+    /// Create a live STMaps worker with bounded, drop-oldest queues.
     /// - in_cap: how many pending frame jobs we queue
     /// - out_cap: how many finished stmaps we keep for the render thread
-    pub fn new(stab: Arc<StabilizationManager>) -> Self {
-        let (tx_in, rx_in) = unbounded::<LiveFrameJob>();
-        let (tx_out, rx_out) = unbounded::<StmapItem>();
+    pub fn with_capacity(stab: Arc<StabilizationManager>, in_cap: usize, out_cap: usize) -> Self {
+        let (tx_in, rx_in) = bounded::<(LiveFrameJob, Instant)>(in_cap.max(1));
+        let (tx_out, rx_out) = bounded::<StmapItem>(out_cap.max(1));
         let running = Arc::new(AtomicBool::new(true));
+        let counters = Arc::new(Counters::default());
 
         let running_flag = running.clone();
+        let settings = Arc::new(Settings::default());
+        // The undistortion maps are built on the GPU when there is one, the CPU path stays as the fallback
+        match crate::gpu::wgpu_stmap::WgpuStmap::new() {
+            Ok(gpu) => { *settings.gpu.write() = Some(Arc::new(gpu)); },
+            Err(e) => { warn!("stmaps_live: no wgpu device, building the maps on the CPU: {e:?}"); }
+        }
+        let settings2 = settings.clone();
+        let rx_in2 = rx_in.clone();
+        let rx_out2 = rx_out.clone();
+        let counters2 = counters.clone();
 
-        println!("Starting stmaps_live worker...");
+        info!("Starting stmaps_live worker (in_cap: {in_cap}, out_cap: {out_cap})");
         let worker = thread::Builder::new()
             .name("stmaps_live_worker".into())
             .spawn(move || {
-                Self::worker_loop(stab, rx_in, tx_out, running_flag);
+                Self::worker_loop(stab, rx_in2, tx_out, rx_out2, running_flag, settings2, counters2);
             })
             .expect("spawn stmaps live worker");
 
 
-        Self { tx_in, rx_out, running, _worker: worker }
+        Self { tx_in, rx_in, rx_out, running, settings, counters, _worker: worker }
+    }
+
+    /// Also writes every generated map pair as EXR files into `folder_url`, named like the ST map export.
+    /// This is for offline use, the encoding is slow. None disables it
+    pub fn set_exr_sink(&self, folder_url: Option<String>) {
+        *self.settings.exr_sink.write() = folder_url;
+    }
+
+    /// Evaluates the redistort map only every `step` pixels and interpolates it bilinearly, 0 computes every pixel.
+    /// The error against the exact transform is reported in `stats()`
+    pub fn set_dist_grid_step(&self, step: usize) {
+        self.settings.dist_grid_step.store(step, Ordering::Relaxed);
+    }
+
+    pub fn stats(&self) -> StmapsLiveStats {
+        let c = &self.counters;
+        StmapsLiveStats {
+            submitted:       c.submitted.load(Ordering::Relaxed),
+            completed:       c.completed.load(Ordering::Relaxed),
+            dropped_jobs:    c.dropped_jobs.load(Ordering::Relaxed),
+            dropped_maps:    c.dropped_maps.load(Ordering::Relaxed),
+            in_queue_depth:  self.rx_in.len(),
+            out_queue_depth: self.rx_out.len(),
+            last_job_age_ms: c.last_job_age_us.load(Ordering::Relaxed) as f64 / 1000.0,
+            max_job_age_ms:  c.max_job_age_us.load(Ordering::Relaxed) as f64 / 1000.0,
+            grid_max_error_px:  f64::from_bits(c.grid_max_error_px.load(Ordering::Relaxed)),
+            grid_mean_error_px: f64::from_bits(c.grid_mean_error_px.load(Ordering::Relaxed)),
+        }
     }
 
+    /// Use `backend` for the undistortion maps instead of the CPU, None goes back to the CPU path.
+    pub fn set_gpu_backend(&self, backend: Option<Arc<dyn StmapGpuBackend>>) {
+        *self.settings.gpu.write() = backend;
+    }
+    pub fn has_gpu_backend(&self) -> bool { self.settings.gpu.read().is_some() }
+
      pub fn rx(&self) -> Receiver<StmapItem> {
         self.rx_out.clone()
     }
@@ -65,11 +223,16 @@ impl StmapsLive {
             frame_index,
             frame_ts_ms: ts_us as f64 / 1000.0,
         };
-        match self.tx_in.send(job) {
-            Ok(_) => {}
+        self.counters.submitted.fetch_add(1, Ordering::Relaxed);
+        match send_drop_oldest(&self.tx_in, &self.rx_in, (job, Instant::now())) {
+            Ok(0) => {}
+            Ok(dropped) => {
+                self.counters.dropped_jobs.fetch_add(dropped, Ordering::Relaxed);
+                debug!("stmaps_live: worker behind, dropped {dropped} oldest job(s) for frame {frame_index}");
+            }
             Err(SendError(_)) => {
                 error!("stmaps_live: input channel disconnected");
-            } 
+            }
         }
     }
 
@@ -87,11 +250,13 @@ impl StmapsLive {
 
     fn worker_loop(
         stab: Arc<StabilizationManager>,
-        rx_in: Receiver<LiveFrameJob>,
+        rx_in: Receiver<(LiveFrameJob, Instant)>,
         tx_out: Sender<StmapItem>,
+        rx_out: Receiver<StmapItem>,
         running: Arc<AtomicBool>,
+        settings: Arc<Settings>,
+        counters: Arc<Counters>,
     ) {
-        println!("Starting stmaps_live worker loop...");
         // --------- GLOBAL CACHE (recomputed on param/lens changes) ---------
         // filename_base mirrors generate_stmaps()
         let filename_base = {
@@ -113,17 +278,26 @@ impl StmapsLive {
             kernel_flags.set(KernelParamsFlags::HORIZONTAL_RS, p.frame_readout_direction.is_horizontal());
         }
 
-        // Optional: remember last hash of params/lens to refresh cache when needed
-        let mut last_params_fingerprint: Option<u64> = None;
+        let mut cache = LensCache::default();
 
         while running.load(Ordering::Relaxed) {
             let job = match rx_in.recv_timeout(Duration::from_millis(10)) {
-                Ok(j) => {println!("got live frameJob."); j},
-                Err(crossbeam_channel::RecvTimeoutError::Timeout) => {print!("couldnt get live frameJob.") ;continue},
-                Err(_) => {print!("couldnt get live frameJob."); break},
+                Ok((j, submitted)) => {
+                    let age_us = submitted.elapsed().as_micros() as u64;
+                    counters.last_job_age_us.store(age_us, Ordering::Relaxed);
+                    counters.max_job_age_us.fetch_max(age_us, Ordering::Relaxed);
+                    j
+                },
+                Err(crossbeam_channel::RecvTimeoutError::Timeout) => continue,
+                Err(_) => break,
             };
 
-            
+            let send = |item: StmapItem| {
+                match send_drop_oldest(&tx_out, &rx_out, item) {
+                    Ok(dropped) => { counters.dropped_maps.fetch_add(dropped, Ordering::Relaxed); }
+                    Err(SendError(_)) => { error!("stmaps_live: output channel disconnected"); }
+                }
+            };
 
             // ComputeParams fresh per job, similar to generate_stmaps()
             let mut compute_params = ComputeParams::from_manager(&stab);
@@ -135,37 +309,42 @@ impl StmapsLive {
             compute_params.fovs.clear();
             compute_params.minimal_fovs.clear();
 
-            // Invalidate global bits if params changed (optional hash)
-            let this_fingerprint = Self::fingerprint_params(&compute_params);
-            if last_params_fingerprint != Some(this_fingerprint) {
+            // Anything derived from the lens and params only is reused until they change
+            let fingerprint = Self::fingerprint_params(&compute_params);
+            let dist_grid_step = settings.dist_grid_step.load(Ordering::Relaxed);
+            if cache.fingerprint != fingerprint || cache.dist_grid_step != dist_grid_step {
                 debug!("stmaps_live: params/lens changed → refresh cached globals");
-                // If you need to rebuild bigger globals, do it here.
-                last_params_fingerprint = Some(this_fingerprint);
+                cache = LensCache { fingerprint, dist_grid_step, ..Default::default() };
             }
 
             // Build maps for one frame @ live timestamp.
+            let gpu_backend = settings.gpu.read().clone();
             match Self::build_maps_for_frame_live(
                 &stab,
+                gpu_backend.as_deref(),
                 compute_params,
                 kernel_flags,
                 &filename_base,
                 job.frame_index,
                 job.frame_ts_ms,
+                dist_grid_step,
+                &mut cache,
             ) {
-                Ok(item) => {
-                    match tx_out.send(item){
-                        //debugging purpose
-                        Ok(_) => {println!("stmaps_live: sent stmap for frame {}", job.frame_index);},
-                        Err(SendError(_)) => {
-                            error!("stmaps_live: output channel disconnected");
-                        }
+                Ok((item, grid_error)) => {
+                    counters.completed.fetch_add(1, Ordering::Relaxed);
+                    let (max_err, mean_err) = grid_error.unwrap_or_default();
+                    counters.grid_max_error_px.store(max_err.to_bits(), Ordering::Relaxed);
+                    counters.grid_mean_error_px.store(mean_err.to_bits(), Ordering::Relaxed);
+                    if let Some(folder_url) = settings.exr_sink.read().as_ref() {
+                        Self::write_exr(folder_url, &item);
                     }
+                    send(item);
                 }
                 Err(e) => {
                     warn!("stmaps_live: failed to build maps for frame {} ts={:.3}ms: {e:?}",
                           job.frame_index, job.frame_ts_ms);
                     // You may still send a placeholder so the renderer does not stall:
-                    let _ = tx_out.send((filename_base.clone(), job.frame_index, vec![], vec![]));
+                    send((filename_base.clone(), job.frame_index, LiveStmap::default(), LiveStmap::default()));
                 }
             }
         }
@@ -173,53 +352,169 @@ impl StmapsLive {
         info!("stmaps_live: worker exit");
     }
 
-    #[inline]
+    /// Hash of everything the lens-only part of the maps depends on
     fn fingerprint_params(p: &ComputeParams) -> u64 {
-        // Minimal fingerprint; extend with lens id, rs direction, etc.
-        // (Or use a real hasher on the relevant fields)
-        let mut h = 0xcbf29ce484222325u64;
-        h ^= (p.width as u64) ^ (p.height as u64) ^ (p.scaled_fps.to_bits() as u64);
-        h
+        use std::hash::{Hash, Hasher};
+        let mut h = std::collections::hash_map::DefaultHasher::new();
+        (p.width, p.height, p.output_width, p.output_height).hash(&mut h);
+        for v in [p.scaled_fps, p.frame_readout_time, p.video_rotation, p.lens_correction_amount, p.light_refraction_coefficient,
+                  p.additional_rotation.0, p.additional_rotation.1, p.additional_rotation.2,
+                  p.additional_translation.0, p.additional_translation.1, p.additional_translation.2] {
+            v.to_bits().hash(&mut h);
+        }
+        p.frame_readout_direction.is_horizontal().hash(&mut h);
+        format!("{:?}", p.frame_readout_direction).hash(&mut h);
+        (p.framebuffer_inverted, p.suppress_rotation).hash(&mut h);
+        p.distortion_model.id().hash(&mut h);
+        p.digital_lens.as_ref().map(|x| x.id()).hash(&mut h);
+        for v in p.digital_lens_params.iter().flatten() { v.to_bits().hash(&mut h); }
+        // The parts of the lens profile the transform reads, see FrameTransform and the distortion models
+        let lens = &p.lens;
+        (lens.calib_dimension.w, lens.calib_dimension.h).hash(&mut h);
+        for v in [lens.input_horizontal_stretch, lens.input_vertical_stretch] { v.to_bits().hash(&mut h); }
+        for row in &lens.fisheye_params.camera_matrix { for v in row { v.to_bits().hash(&mut h); } }
+        for v in &lens.fisheye_params.distortion_coeffs { v.to_bits().hash(&mut h); }
+        for v in [lens.fisheye_params.radial_distortion_limit, lens.focal_length, lens.crop_factor, lens.optimal_fov] { v.map(f64::to_bits).hash(&mut h); }
+        (&lens.distortion_model, &lens.digital_lens).hash(&mut h);
+        for v in lens.digital_lens_params.iter().flatten() { v.to_bits().hash(&mut h); }
+        if let Some(interpolations) = &lens.interpolations { Self::hash_json(interpolations, &mut h); }
+        Self::has_per_frame_lens_data(p).hash(&mut h);
+        h.finish()
+    }
+
+    fn hash_json(v: &serde_json::Value, h: &mut impl std::hash::Hasher) {
+        use std::hash::Hash;
+        use serde_json::Value;
+        match v {
+            Value::Null      => 0u8.hash(h),
+            Value::Bool(x)   => x.hash(h),
+            Value::Number(x) => x.as_f64().map(f64::to_bits).hash(h),
+            Value::String(x) => x.hash(h),
+            Value::Array(x)  => { x.len().hash(h); for v in x { Self::hash_json(v, h); } }
+            Value::Object(x) => { x.len().hash(h); for (k, v) in x { k.hash(h); Self::hash_json(v, h); } }
+        }
+    }
+
+    /// Whether the lens data can change from frame to frame (focal length changes, IBIS/OIS, mesh correction)
+    fn has_per_frame_lens_data(p: &ComputeParams) -> bool {
+        let gyro = p.gyro.read();
+        let md = gyro.file_metadata.read();
+        !md.lens_positions.is_empty() || !md.lens_params.is_empty() || !md.camera_stab_data.is_empty() || !md.mesh_correction.is_empty()
     }
 
     /// This is the single-frame worker; it mirrors your generate_stmaps body, parameterized by timestamp_ms.
     fn build_maps_for_frame_live(
         stab: &StabilizationManager,
+        gpu: Option<&dyn StmapGpuBackend>,
         mut compute_params: ComputeParams,
         kernel_flags: KernelParamsFlags,
         filename_base: &str,
         frame: usize,
         timestamp_ms: f64,
-    ) -> Result<StmapItem, anyhow::Error> {
+        dist_grid_step: usize,
+        cache: &mut LensCache,
+    ) -> Result<(StmapItem, Option<(f64, f64)>), anyhow::Error> {
         let (width, height) = {
             let params = stab.params.read();
             (params.size.0, params.size.1)
         };
 
-        // PASS 1 — identical to generate_stmaps:
-        let org_output_size = (width, height);
-        compute_params.fov_scale = 1.0;
-        compute_params.width              = width;  compute_params.height              = height;
-        compute_params.output_width       = width;  compute_params.output_height       = height;
+        let lens_only = !Self::has_per_frame_lens_data(&compute_params);
+        if lens_only && compute_params.suppress_rotation {
+            if let Some((dist, undist, grid_error)) = &cache.maps {
+                return Ok(((filename_base.to_string(), frame, dist.clone(), undist.clone()), *grid_error));
+            }
+        }
+        let (fov_scale, new_width, new_height) = match cache.pass1.filter(|_| lens_only) {
+            Some(pass1) => pass1,
+            None => {
+                let pass1 = Self::fov_pass(&mut compute_params, width, height, frame, timestamp_ms);
+                if lens_only { cache.pass1 = Some(pass1); }
+                pass1
+            }
+        };
+
+        compute_params.fov_scale = fov_scale;
+        compute_params.width              = new_width;  compute_params.height              = new_height;
+        compute_params.output_width       = new_width;  compute_params.output_height       = new_height;
 
+        // PASS 2 — recompute with updated fov_scale:
         let mut transform = FrameTransform::at_timestamp(&compute_params, timestamp_ms, frame);
-        transform.kernel_params.width  = width as i32;
-        transform.kernel_params.height = height as i32;
-        transform.kernel_params.output_width  = width as i32;
-        transform.kernel_params.output_height = height as i32;
+        transform.kernel_params.width  = new_width as i32;
+        transform.kernel_params.height = new_height as i32;
+        transform.kernel_params.output_width  = new_width as i32;
+        transform.kernel_params.output_height = new_height as i32;
         transform.kernel_params.flags = kernel_flags.bits();
 
-        let mesh_data = transform.mesh_data.iter().map(|x| *x as f64).collect::<Vec<f64>>();
+        let r_limit_sq = transform.kernel_params.r_limit * transform.kernel_params.r_limit;
+
+        // undist
+        let gpu_coords = gpu.and_then(|gpu| gpu.undistort_map(
+            &transform.kernel_params, &transform.matrices, &transform.mesh_data,
+            &compute_params.distortion_model, compute_params.digital_lens.as_ref()
+        )).filter(|coords| coords.len() == new_width * new_height * 2);
+
+        let undist_coords = gpu_coords.unwrap_or_else(|| {
+            let mesh_data2 = transform.mesh_data.iter().map(|x| *x as f64).collect::<Vec<f64>>();
+            Self::parallel_coords(new_width, new_height, |x, y| {
+                let mut sy = if compute_params.frame_readout_direction.is_horizontal() {
+                    (x.round() as i32).min(transform.kernel_params.width).max(0) as usize
+                } else {
+                    (y.round() as i32).min(transform.kernel_params.height).max(0) as usize
+                };
+                if transform.kernel_params.matrix_count > 1 {
+                    let idx = transform.kernel_params.matrix_count as usize / 2;
+                    if let Some(pt) = Stabilization::rotate_and_distort(
+                        (x as f32, y as f32), idx, &transform.kernel_params, &transform.matrices,
+                        &compute_params.distortion_model, compute_params.digital_lens.as_ref(),
+                        r_limit_sq, &mesh_data2
+                    ) {
+                        if compute_params.frame_readout_direction.is_horizontal() {
+                            sy = (pt.0.round() as i32).min(transform.kernel_params.width).max(0) as usize;
+                        } else {
+                            sy = (pt.1.round() as i32).min(transform.kernel_params.height).max(0) as usize;
+                        }
+                    }
+                }
+                let idx = sy.min(transform.kernel_params.matrix_count as usize - 1);
+                Stabilization::rotate_and_distort(
+                    (x as f32, y as f32), idx, &transform.kernel_params, &transform.matrices,
+                    &compute_params.distortion_model, compute_params.digital_lens.as_ref(),
+                    r_limit_sq, &mesh_data2
+                )
+            })
+        });
+        let undist = LiveStmap::new(new_width, new_height, undist_coords);
+
+        // dist
+        compute_params.width        = width;  compute_params.height        = height;
+        compute_params.output_width = width;  compute_params.output_height = height;
 
-        let bbox = fov_iterative::FovIterative::new(&compute_params, org_output_size)
+        let (dist_coords, grid_error) = Self::dist_coords(&compute_params, width, height, dist_grid_step, timestamp_ms, frame);
+        let dist = LiveStmap::new(width, height, dist_coords);
+
+        if lens_only && compute_params.suppress_rotation {
+            cache.maps = Some((dist.clone(), undist.clone(), grid_error));
+        }
+        Ok(((filename_base.to_string(), frame, dist, undist), grid_error))
+    }
+
+    /// PASS 1, like generate_stmaps: the bounding box of the undistorted frame gives the FOV scale and the map size
+    fn fov_pass(compute_params: &mut ComputeParams, width: usize, height: usize, frame: usize, timestamp_ms: f64) -> (f64, usize, usize) {
+        let org_output_size = (width, height);
+        compute_params.fov_scale = 1.0;
+        compute_params.width              = width;  compute_params.height              = height;
+        compute_params.output_width       = width;  compute_params.output_height       = height;
+
+        let bbox = fov_iterative::FovIterative::new(compute_params, org_output_size)
             .points_around_rect(width as f32, height as f32, 31, 31);
 
         let (camera_matrix, distortion_coeffs, _p, rotations, is, mesh) =
-            FrameTransform::at_timestamp_for_points(&compute_params, &bbox, timestamp_ms, Some(frame), false);
+            FrameTransform::at_timestamp_for_points(compute_params, &bbox, timestamp_ms, Some(frame), false);
 
         let undistorted_bbox = undistort_points(
             &bbox, camera_matrix, &distortion_coeffs, rotations[0], None, Some(rotations),
-            &compute_params, 1.0, timestamp_ms, is, mesh
+            compute_params, 1.0, timestamp_ms, is, mesh
         );
 
         let mut min_x = 0.0; let mut min_y = 0.0; let mut max_x = 0.0; let mut max_y = 0.0;
@@ -230,70 +525,105 @@ impl StmapsLive {
         let new_width  = (max_x - min_x).ceil() as usize;
         let new_height = (max_y - min_y).ceil() as usize;
 
-        compute_params.fov_scale = (new_width as f32 / width as f32)
+        let fov_scale = (new_width as f32 / width as f32)
             .max(new_height as f32 / height as f32) as f64;
-        compute_params.width              = new_width;  compute_params.height              = new_height;
-        compute_params.output_width       = new_width;  compute_params.output_height       = new_height;
+        (fov_scale, new_width, new_height)
+    }
 
-        // PASS 2 — recompute with updated fov_scale:
-        transform = FrameTransform::at_timestamp(&compute_params, timestamp_ms, frame);
-        transform.kernel_params.width  = new_width as i32;
-        transform.kernel_params.height = new_height as i32;
-        transform.kernel_params.output_width  = new_width as i32;
-        transform.kernel_params.output_height = new_height as i32;
-        transform.kernel_params.flags = kernel_flags.bits();
+    /// Redistort coordinates of `points`, with the lens data and the per-point rotations set up once for the whole batch
+    fn dist_points(compute_params: &ComputeParams, points: &[(f32, f32)], timestamp_ms: f64, frame: usize) -> Vec<(f32, f32)> {
+        let (camera_matrix, distortion_coeffs, _p, rotations, is, mesh) =
+            FrameTransform::at_timestamp_for_points(compute_params, points, timestamp_ms, Some(frame), true);
+        undistort_points(
+            points, camera_matrix, &distortion_coeffs, rotations[0], None, Some(rotations),
+            compute_params, 1.0, timestamp_ms, is, mesh
+        )
+    }
 
-        let r_limit_sq = transform.kernel_params.r_limit * transform.kernel_params.r_limit;
+    /// Dense redistort map. With `step` > 1 the transform is only evaluated on a grid with that spacing (plus the last
+    /// row and column) and interpolated bilinearly. Cells with an invalid corner are computed exactly.
+    /// Returns the max and mean interpolation error in pixels, measured at the centers of every 4th row of cells
+    fn dist_coords(compute_params: &ComputeParams, width: usize, height: usize, step: usize, timestamp_ms: f64, frame: usize) -> (Vec<f32>, Option<(f64, f64)>) {
+        let mut coords = vec![0.0f32; width * height * 2];
+        let write = |row: &mut [f32], xs: &[usize], pts: Vec<(f32, f32)>| {
+            for (&x, pt) in xs.iter().zip(pts) {
+                row[x * 2] = pt.0;
+                row[x * 2 + 1] = pt.1;
+            }
+        };
 
-        // undist
-        let mesh_data2 = transform.mesh_data.iter().map(|x| *x as f64).collect::<Vec<f64>>();
-        let undist = Self::parallel_exr(new_width, new_height, |x, y| {
-            let mut sy = if compute_params.frame_readout_direction.is_horizontal() {
-                (x.round() as i32).min(transform.kernel_params.width).max(0) as usize
-            } else {
-                (y.round() as i32).min(transform.kernel_params.height).max(0) as usize
-            };
-            if transform.kernel_params.matrix_count > 1 {
-                let idx = transform.kernel_params.matrix_count as usize / 2;
-                if let Some(pt) = Stabilization::rotate_and_distort(
-                    (x as f32, y as f32), idx, &transform.kernel_params, &transform.matrices,
-                    &compute_params.distortion_model, compute_params.digital_lens.as_ref(),
-                    r_limit_sq, &mesh_data2
-                ) {
-                    if compute_params.frame_readout_direction.is_horizontal() {
-                        sy = (pt.0.round() as i32).min(transform.kernel_params.width).max(0) as usize;
-                    } else {
-                        sy = (pt.1.round() as i32).min(transform.kernel_params.height).max(0) as usize;
-                    }
+        if step <= 1 || width <= step || height <= step {
+            // Rotations are computed per point anyway, so a batch per row gives exactly the per-pixel result
+            let xs = (0..width).collect::<Vec<_>>();
+            coords.par_chunks_mut(width * 2).enumerate().for_each(|(y, row)| {
+                let points = xs.iter().map(|&x| (x as f32, y as f32)).collect::<Vec<_>>();
+                write(row, &xs, Self::dist_points(compute_params, &points, timestamp_ms, frame));
+            });
+            return (coords, None);
+        }
+
+        let axis = |len: usize| -> Vec<usize> {
+            let mut v = (0..len).step_by(step).collect::<Vec<_>>();
+            if v.last() != Some(&(len - 1)) { v.push(len - 1); }
+            v
+        };
+        let (gx, gy) = (axis(width), axis(height));
+        let grid = gy.par_iter().map(|&y| {
+            let points = gx.iter().map(|&x| (x as f32, y as f32)).collect::<Vec<_>>();
+            Self::dist_points(compute_params, &points, timestamp_ms, frame)
+        }).collect::<Vec<_>>();
+
+        let valid = |p: (f32, f32)| p.0 > -999999.0 && p.1 > -999999.0;
+        let lerp = |a: (f32, f32), b: (f32, f32), t: f32| (a.0 + (b.0 - a.0) * t, a.1 + (b.1 - a.1) * t);
+        let cell_row = |y: usize| (gy.partition_point(|&v| v <= y) - 1).min(gy.len() - 2);
+
+        coords.par_chunks_mut(width * 2).enumerate().for_each(|(y, row)| {
+            let cy = cell_row(y);
+            let ty = (y - gy[cy]) as f32 / (gy[cy + 1] - gy[cy]) as f32;
+            let (top, bottom) = (&grid[cy], &grid[cy + 1]);
+            let mut exact = Vec::new();
+            let mut cx = 0;
+            for x in 0..width {
+                while cx + 2 < gx.len() && gx[cx + 1] <= x { cx += 1; }
+                let (a, b, c, d) = (top[cx], top[cx + 1], bottom[cx], bottom[cx + 1]);
+                if valid(a) && valid(b) && valid(c) && valid(d) {
+                    let tx = (x - gx[cx]) as f32 / (gx[cx + 1] - gx[cx]) as f32;
+                    let pt = lerp(lerp(a, b, tx), lerp(c, d, tx), ty);
+                    row[x * 2] = pt.0;
+                    row[x * 2 + 1] = pt.1;
+                } else {
+                    exact.push(x);
                 }
             }
-            let idx = sy.min(transform.kernel_params.matrix_count as usize - 1);
-            Stabilization::rotate_and_distort(
-                (x as f32, y as f32), idx, &transform.kernel_params, &transform.matrices,
-                &compute_params.distortion_model, compute_params.digital_lens.as_ref(),
-                r_limit_sq, &mesh_data2
-            )
+            if !exact.is_empty() {
+                let points = exact.iter().map(|&x| (x as f32, y as f32)).collect::<Vec<_>>();
+                write(row, &exact, Self::dist_points(compute_params, &points, timestamp_ms, frame));
+            }
         });
 
-        // dist
-        compute_params.width        = width;  compute_params.height        = height;
-        compute_params.output_width = width;  compute_params.output_height = height;
-
-        let dist = Self::parallel_exr(width, height, |x, y| {
-            let distorted = [(x as f32, y as f32)];
-            let (camera_matrix, distortion_coeffs, _p, rotations, is, mesh) =
-                FrameTransform::at_timestamp_for_points(&compute_params, &distorted, timestamp_ms, Some(frame), true);
-            undistort_points(
-                &distorted, camera_matrix, &distortion_coeffs, rotations[0], None, Some(rotations),
-                &compute_params, 1.0, timestamp_ms, is, mesh
-            ).first().copied()
-        });
+        // Error bound against the exact path
+        let errors = (0..gy.len() - 1).step_by(4).collect::<Vec<_>>().par_iter().flat_map_iter(|&cy| {
+            let y = (gy[cy] + gy[cy + 1]) / 2;
+            let xs = (0..gx.len() - 1).map(|cx| (gx[cx] + gx[cx + 1]) / 2).collect::<Vec<_>>();
+            let points = xs.iter().map(|&x| (x as f32, y as f32)).collect::<Vec<_>>();
+            let exact = Self::dist_points(compute_params, &points, timestamp_ms, frame);
+            let coords = &coords;
+            xs.into_iter().zip(exact).filter(|&(_, e)| valid(e)).map(move |(x, e)| {
+                let i = (y * width + x) * 2;
+                (((coords[i] - e.0) as f64).powi(2) + ((coords[i + 1] - e.1) as f64).powi(2)).sqrt()
+            }).collect::<Vec<_>>()
+        }).collect::<Vec<f64>>();
+        let max_err = errors.iter().copied().fold(0.0, f64::max);
+        let mean_err = if errors.is_empty() { 0.0 } else { errors.iter().sum::<f64>() / errors.len() as f64 };
+        if max_err > step as f64 * 0.05 {
+            debug!("stmaps_live: grid step {step} interpolation error max {max_err:.3}px, mean {mean_err:.3}px");
+        }
 
-        Ok((filename_base.to_string(), frame, dist, undist))
+        (coords, Some((max_err, mean_err)))
     }
 
 
-    fn parallel_exr(width: usize, height: usize, cb: impl Fn(f32, f32) -> Option<(f32, f32)> + Sync) -> Vec<u8> {
+    fn parallel_coords(width: usize, height: usize, cb: impl Fn(f32, f32) -> Option<(f32, f32)> + Sync) -> Vec<f32> {
         let mut coords = vec![0.0f32; width * height * 2];
         coords.par_chunks_mut(width * 2).enumerate().for_each(|(y, row)| { // Parallel iterator over buffer rows
             row.chunks_mut(2).enumerate().for_each(|(x, pix)| { // iterator over row pixels
@@ -303,6 +633,20 @@ impl StmapsLive {
                 }
             });
         });
+        coords
+    }
+
+    fn write_exr(folder_url: &str, (fname_base, frame, dist, undist): &StmapItem) {
+        for (kind, map) in [("undistort", undist), ("redistort", dist)] {
+            if map.is_empty() { continue; }
+            let url = crate::filesystem::get_file_url(folder_url, &format!("{fname_base}-{kind}-{frame}.exr"), true);
+            if let Err(e) = crate::filesystem::write(&url, &map.to_exr()) {
+                warn!("stmaps_live: failed to write {url}: {e:?}");
+            }
+        }
+    }
+
+    fn encode_exr(width: usize, height: usize, coords: &[f32]) -> Vec<u8> {
         let channels = SpecificChannels::rgb(|Vec2(x, y)| (
                     coords[y * width * 2 + x * 2 + 0] / width as f32,
                 1.0 - (coords[y * width * 2 + x * 2 + 1] / height as f32),
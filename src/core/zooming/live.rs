@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
+
+use std::collections::VecDeque;
+
+/// Causal adaptive zoom for live mode, fed one fov per frame.
+///
+/// Takes the minimum fov over the last `adaptive_zoom_window` seconds (monotonic deque, O(1) amortized),
+/// zooms in immediately when that drops and zooms out with a 0.2 s one-pole filter, like the second pass of the envelope follower.
+/// A negative window keeps the minimum over the whole stream (static zoom).
+#[derive(Default, Clone)]
+pub struct LiveZoom {
+    window_frames: Option<usize>, // None = static zoom
+    release_alpha: f64,
+    mins: VecDeque<(usize, f64)>, // (frame, fov), fovs increasing from front to back
+    current: Option<f64>,
+}
+
+impl LiveZoom {
+    pub fn new(adaptive_zoom_window: f64, fps: f64) -> Self {
+        let fps = if fps > 0.0 { fps } else { 30.0 };
+        Self {
+            window_frames: if adaptive_zoom_window < -0.9 { None } else { Some(((adaptive_zoom_window * fps).floor() as usize).max(1)) },
+            release_alpha: 1.0 - (-(1.0 / fps) / 0.2).exp(),
+            mins: VecDeque::new(),
+            current: None,
+        }
+    }
+
+    /// Same parameters as `new`, used to decide if the state needs to be rebuilt
+    pub fn matches(&self, adaptive_zoom_window: f64, fps: f64) -> bool {
+        let other = Self::new(adaptive_zoom_window, fps);
+        self.window_frames == other.window_frames && self.release_alpha == other.release_alpha
+    }
+
+    /// Adds the minimal fov of `frame` and returns the fov to use for it
+    pub fn push(&mut self, frame: usize, fov: f64) -> f64 {
+        let Some(window) = self.window_frames else {
+            let out = self.current.map_or(fov, |c| c.min(fov));
+            self.current = Some(out);
+            return out;
+        };
+        while self.mins.back().map(|x| x.1 >= fov).unwrap_or_default() {
+            self.mins.pop_back();
+        }
+        self.mins.push_back((frame, fov));
+        while self.mins.front().map(|x| x.0 + window <= frame).unwrap_or_default() {
+            self.mins.pop_front();
+        }
+        let target = self.mins.front().map(|x| x.1).unwrap_or(fov);
+
+        let out = match self.current {
+            Some(c) if target >= c => c + (target - c) * self.release_alpha,
+            _ => target,
+        };
+        self.current = Some(out);
+        out
+    }
+}
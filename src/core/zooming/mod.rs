@@ -3,6 +3,7 @@
 
 pub mod fov_iterative;
 pub mod zoom_dynamic;
+pub mod live;
 
 use std::collections::hash_map::DefaultHasher;
 use std::hash::Hasher;
@@ -32,11 +33,7 @@ pub trait FieldOfViewAlgorithm {
     fn get_debug_points(&self) -> BTreeMap<i64, Vec<(f64, f64)>>;
 }
 
-pub fn calculate_fovs(compute_params: &ComputeParams, timestamps: &[(usize, f64)], method: ZoomMethod) -> (Vec<f64>, Vec<f64>, BTreeMap<i64, Vec<(f64, f64)>>)  {
-    if timestamps.is_empty() {
-        return Default::default();
-    }
-
+fn fov_compute_params(compute_params: &ComputeParams) -> (ComputeParams, (usize, usize)) {
     let mut compute_params = compute_params.clone();
     compute_params.fov_scale = 1.0;
     compute_params.fovs.clear();
@@ -47,6 +44,22 @@ pub fn calculate_fovs(compute_params: &ComputeParams, timestamps: &[(usize, f64)
     let org_output_size = (compute_params.output_width, compute_params.output_height);
     compute_params.output_width = compute_params.width;
     compute_params.output_height = compute_params.height;
+    (compute_params, org_output_size)
+}
+
+/// Minimal fov of a single frame, without any zoom smoothing. Used by live mode together with `live::LiveZoom`
+pub fn calculate_fov_at(compute_params: &ComputeParams, frame: usize, timestamp_ms: f64) -> f64 {
+    let (compute_params, org_output_size) = fov_compute_params(compute_params);
+    let fov_estimator = fov_iterative::FovIterative::new(&compute_params, org_output_size);
+    fov_estimator.compute(&[(frame, timestamp_ms)], &[]).first().copied().unwrap_or(1.0)
+}
+
+pub fn calculate_fovs(compute_params: &ComputeParams, timestamps: &[(usize, f64)], method: ZoomMethod) -> (Vec<f64>, Vec<f64>, BTreeMap<i64, Vec<(f64, f64)>>)  {
+    if timestamps.is_empty() {
+        return Default::default();
+    }
+
+    let (compute_params, org_output_size) = fov_compute_params(compute_params);
 
     let fov_estimator = fov_iterative::FovIterative::new(&compute_params, org_output_size);
     let mut fov_values = fov_estimator.compute(timestamps, &compute_params.trim_ranges);
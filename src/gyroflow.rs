@@ -21,7 +21,7 @@ mod resources;
 #[cfg(not(compiled_qml))]
 mod resources_qml;
 pub mod ui { pub mod ui_tools; pub mod components { pub mod TimelineGyroChart; pub mod TimelineKeyframesView; pub mod FrequencyGraph; pub mod Settings; } }
-pub mod qt_gpu { pub mod qrhi_undistort; }
+pub mod qt_gpu { pub mod qrhi_undistort; pub mod bench; }
 
 use ui::components::TimelineGyroChart::TimelineGyroChart;
 use ui::components::TimelineKeyframesView::TimelineKeyframesView;
@@ -84,7 +84,20 @@ fn entry() {
         cpp!(unsafe [] { qputenv("QML_FORCE_DISK_CACHE", "1"); });
     }
 
+    // Keep the compiled graphics pipelines (including the Qt RHI undistortion ones) across sessions, so the driver doesn't have to recompile them on every launch
+    let pipeline_cache_path = gyroflow_core::settings::data_dir().join("pipeline_cache.bin");
+    let pipeline_cache_exists = pipeline_cache_path.exists();
+    let pipeline_cache = QString::from(pipeline_cache_path.to_string_lossy().to_string());
+    let gpu_profiling = gyroflow_core::settings::get_bool("gpuProfiling", false);
+    cpp!(unsafe [pipeline_cache as "QString", pipeline_cache_exists as "bool", gpu_profiling as "bool"] {
+        if (!qEnvironmentVariableIsSet("QSG_RHI_PIPELINE_CACHE_SAVE")) qputenv("QSG_RHI_PIPELINE_CACHE_SAVE", pipeline_cache.toLocal8Bit());
+        if (!qEnvironmentVariableIsSet("QSG_RHI_PIPELINE_CACHE_LOAD") && pipeline_cache_exists) qputenv("QSG_RHI_PIPELINE_CACHE_LOAD", pipeline_cache.toLocal8Bit());
+        // GPU timestamps for the frame time in the processing info, only when asked for in the Advanced settings since it adds a query to every frame
+        if (!qEnvironmentVariableIsSet("QSG_RHI_PROFILE") && gpu_profiling) qputenv("QSG_RHI_PROFILE", "1");
+    });
+
     crate::resources::rsrc();
+    crate::resources::rsrc_shader_variants();
     #[cfg(not(compiled_qml))]
     crate::resources_qml::rsrc_qml();
 
@@ -0,0 +1,185 @@
+//! `live bench <video> <imu> [--frames N] [--warmup N] [--cpu-maps] [--out results.json]`
+//!
+//! Replays a recorded session through the live pipeline as fast as it can be decoded, without the TCP server and the
+//! integration timer. `<imu>` is either a GCSV file, whose samples are fed through the IMU ingest queue up to each frame's
+//! timestamp plus the smoothing lookahead, or a quaternion CSV for the `load_file` path of `start_single_stream`.
+//! Frame timestamps come from the frame index and the stream fps, so two runs on the same files do exactly the same work.
+//! `--cpu-maps` builds the live undistortion maps on the CPU instead of the wgpu compute pass.
+//! Prints the timings of every step as JSON (see `gyroflow_core::bench`), or writes them to `--out`.
+
+use std::path::Path;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use serde_json::json;
+
+use gyroflow_core::StabilizationManager;
+use gyroflow_core::bench::{BenchReport, Timings};
+use gyroflow_core::gyro_source::FileMetadata;
+use gyroflow_core::gyro_source::live::{LiveImuSample, LIVE_SMOOTHING_LOOKAHEAD_MS};
+use gyroflow_core::stabilization::pixel_formats::RGBA8;
+use gyroflow_core::stmap_live::StmapsLive;
+
+use crate::frame_pool::frame_pool;
+use crate::live_pix_fmt::{PixelFormat, spawn_stream_reader};
+use crate::render_live::buffers_from_live_frame_rgba;
+
+const USAGE: &str = "usage: live bench <video> <imu.gcsv | quats.csv> [--frames N] [--warmup N] [--cpu-maps] [--out results.json]";
+const DEFAULT_WARMUP: usize = 10; // frames to skip while the backends and caches initialize
+
+struct Args {
+    video: String,
+    imu: String,
+    frames: Option<usize>,
+    warmup: usize,
+    cpu_maps: bool,
+    out: Option<String>,
+}
+
+fn parse_args(mut args: impl Iterator<Item = String>) -> Result<Args, String> {
+    let mut positional = Vec::new();
+    let (mut frames, mut warmup, mut cpu_maps, mut out) = (None, DEFAULT_WARMUP, false, None);
+    let number = |v: Option<String>| v.and_then(|v| v.parse::<usize>().ok()).ok_or_else(|| USAGE.to_string());
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--frames" => frames = Some(number(args.next())?),
+            "--warmup" => warmup = number(args.next())?,
+            "--cpu-maps" => cpu_maps = true,
+            "--out"    => out = Some(args.next().ok_or_else(|| USAGE.to_string())?),
+            _ => positional.push(arg),
+        }
+    }
+    let [video, imu] = &positional[..] else { return Err(USAGE.into()); };
+    Ok(Args { video: video.clone(), imu: imu.clone(), frames, warmup, cpu_maps, out })
+}
+
+/// Samples of a GCSV file, with the header applied the same way as for a streamed one
+fn read_gcsv(content: &str) -> (FileMetadata, Vec<LiveImuSample>) {
+    let header_end = content.lines().position(|l| l.starts_with("t,")).map(|x| x + 1).unwrap_or(0);
+    let header = content.lines().take(header_end).collect::<Vec<_>>().join("\n");
+    let metadata = crate::parse_gyroflow_header(&header);
+    if !crate::has_tscale() { crate::set_tscale(1.0); } // header without tscale
+
+    let mut samples: Vec<LiveImuSample> = content.lines().skip(header_end).filter_map(crate::parse_imu_line).collect();
+    samples.sort_by_key(|s| s.ts_sensor_us);
+    (metadata, samples)
+}
+
+fn video_info(url: &str) -> Result<(f64, (usize, usize)), String> {
+    ffmpeg_next::init().map_err(|e| format!("ffmpeg init failed: {e:?}"))?;
+    let ictx = ffmpeg_next::format::input(&url).map_err(|e| format!("open {url}: {e:?}"))?;
+    let stream = ictx.streams().best(ffmpeg_next::media::Type::Video).ok_or("no video stream in input")?;
+    let rate = stream.avg_frame_rate();
+    let fps = if rate.denominator() > 0 && rate.numerator() > 0 { f64::from(rate) } else { crate::FPS };
+    let decoder = ffmpeg_next::codec::context::Context::from_parameters(stream.parameters())
+        .and_then(|c| c.decoder().video())
+        .map_err(|e| format!("open decoder: {e:?}"))?;
+    Ok((fps, (decoder.width() as usize, decoder.height() as usize)))
+}
+
+pub fn run(args: impl Iterator<Item = String>) -> Result<(), String> {
+    let args = parse_args(args)?;
+    let (fps, size) = video_info(&args.video)?;
+
+    let imu_content = std::fs::read_to_string(&args.imu).map_err(|e| format!("read {}: {e:?}", args.imu))?;
+    let is_gcsv = imu_content.starts_with("GYROFLOW");
+    let (metadata, samples) = if is_gcsv { read_gcsv(&imu_content) } else { (FileMetadata::default(), Vec::new()) };
+    log::info!("bench: {}x{} @ {fps:.3} fps, {} IMU samples{}", size.0, size.1, samples.len(), if is_gcsv { "" } else { " (quaternion file)" });
+
+    let stab = Arc::new(StabilizationManager::default());
+    stab.init_from_stream_data(fps, size);
+    stab.start_single_stream(metadata, 3.0, 1.0, 0.0, size, size, Path::new(&args.imu), !is_gcsv)
+        .map_err(|e| format!("start_single_stream: {e:?}"))?;
+    stab.set_render_params(size, size);
+    let mut producer = stab.gyro.read().live_imu_producer();
+
+    let stmaps = StmapsLive::new(Arc::clone(&stab));
+    if args.cpu_maps { stmaps.set_gpu_backend(None); }
+
+    // Small queue, so the decoder is only as far ahead as the processing lets it be
+    let (frame_tx, frame_rx) = crossbeam_channel::bounded(4);
+    let reader = spawn_stream_reader(&args.video, frame_tx, PixelFormat::Rgba, usize::MAX, false)
+        .map_err(|e| format!("stream reader: {e:?}"))?;
+
+    let mut imu = Timings::new("imu_integrate");
+    let mut on_frame = Timings::new("live_on_new_frame");
+    let mut process = Timings::new("process_pixels");
+    let mut maps = Timings::new("build_maps_for_frame_live");
+    let mut frame_total = Timings::new("frame");
+    let mut imu_cursor = 0;
+    let mut dropped_imu = 0;
+    let mut failed = 0;
+    let mut backend = "";
+    let mut started: Option<Instant> = None;
+    let lookahead_us = (LIVE_SMOOTHING_LOOKAHEAD_MS * 1000.0) as i64;
+
+    for (idx, mut frame) in frame_rx.iter() {
+        if args.frames.map_or(false, |n| idx >= args.warmup + n) { break; }
+        let measure = idx >= args.warmup;
+        if measure && started.is_none() { started = Some(Instant::now()); }
+        let frame_start = Instant::now();
+
+        let ts_us = (idx as f64 * 1_000_000.0 / fps).round() as i64;
+
+        // Everything the sensor had produced by the time this frame could be rendered
+        let t = Instant::now();
+        if let Some(p) = producer.as_mut() {
+            let end = imu_cursor + samples[imu_cursor..].partition_point(|s| s.ts_sensor_us <= ts_us + lookahead_us);
+            while imu_cursor < end {
+                let pushed = p.push_slice(&samples[imu_cursor..end]);
+                stab.gyro.write().integrate_live_data();
+                if pushed == 0 { dropped_imu += end - imu_cursor; imu_cursor = end; }
+                imu_cursor += pushed;
+            }
+        }
+        if measure { imu.push(t.elapsed()); }
+
+        let t = Instant::now();
+        stab.live_on_new_frame(idx, ts_us as f64 / 1000.0, 1);
+        if measure { on_frame.push(t.elapsed()); }
+
+        let (w, h) = frame.get_size();
+        let mut output = frame_pool().take(w as usize * h as usize * 4);
+        let mut buffers = buffers_from_live_frame_rgba(&mut frame, &mut output);
+        let t = Instant::now();
+        let result = stab.process_pixels::<RGBA8>(ts_us, None, &mut buffers);
+        if measure { process.push(t.elapsed()); }
+        match result {
+            Ok(info) => backend = info.backend,
+            Err(e) => { failed += 1; log::warn!("bench: process_pixels failed at frame {idx}: {e:?}"); }
+        }
+
+        // The worker is idle between frames, so this is the map generation plus one channel round trip
+        let t = Instant::now();
+        stmaps.submit_frame(idx, ts_us);
+        let _map = stmaps.recv_map();
+        if measure { maps.push(t.elapsed()); frame_total.push(frame_start.elapsed()); }
+    }
+    let wall = started.map(|s| s.elapsed()).unwrap_or(Duration::ZERO);
+    stmaps.stop();
+    drop(frame_rx);
+    let _ = reader.join();
+
+    let stats = stmaps.stats();
+    let lens = stab.lens.read();
+    let mut report = BenchReport::new("live");
+    report.set_info("video", json!(args.video));
+    report.set_info("imu", json!(args.imu));
+    report.set_info("imu_source", json!(if is_gcsv { "gcsv" } else { "quats" }));
+    report.set_info("size", json!([size.0, size.1]));
+    report.set_info("fps", json!(fps));
+    report.set_info("warmup_frames", json!(args.warmup));
+    report.set_info("lens", json!(format!("{} {} {}", lens.camera_brand, lens.camera_model, lens.lens_model)));
+    report.set_info("backend", json!(backend));
+    report.set_info("maps_backend", json!(if stmaps.has_gpu_backend() { "wgpu" } else { "cpu" }));
+    report.set_info("failed_frames", json!(failed));
+    report.set_info("dropped_imu_samples", json!(dropped_imu));
+    report.add(&frame_total, Some(wall), json!({}));
+    report.add(&imu, None, json!({}));
+    report.add(&on_frame, None, json!({}));
+    report.add(&process, None, json!({}));
+    report.add(&maps, None, json!({ "grid_max_error_px": stats.grid_max_error_px, "grid_mean_error_px": stats.grid_mean_error_px }));
+    report.write(args.out.as_deref()).map_err(|e| format!("write results: {e:?}"))?;
+
+    log::info!("bench: {} frames in {:.2}s ({:.2} fps)", frame_total.len(), wall.as_secs_f64(), frame_total.len() as f64 / wall.as_secs_f64().max(1e-9));
+    Ok(())
+}
@@ -0,0 +1,71 @@
+use std::ops::{Deref, DerefMut};
+use std::sync::{Arc, Mutex, OnceLock};
+
+/// Recycled byte buffers for the live frames. The stream reader, the stabilizer and `fplay` all take their
+/// buffers from here, so at a steady frame size nothing is allocated per frame.
+/// Buffers go back to the pool when the `PooledBuffer` is dropped, on whichever thread that happens
+pub struct FramePool {
+    free: Mutex<Vec<Vec<u8>>>,
+    max_free: usize,
+}
+
+pub struct PooledBuffer {
+    buf: Vec<u8>,
+    pool: Arc<FramePool>,
+}
+
+impl FramePool {
+    /// `max_free` is how many idle buffers are kept, anything above that is freed
+    pub fn new(max_free: usize) -> Arc<Self> {
+        Arc::new(Self { free: Mutex::new(Vec::with_capacity(max_free)), max_free })
+    }
+
+    /// Returns a buffer of exactly `len` bytes. The contents are whatever the previous user left there,
+    /// callers are expected to overwrite all of it
+    pub fn take(self: &Arc<Self>, len: usize) -> PooledBuffer {
+        let recycled = {
+            let mut free = self.free.lock().unwrap();
+            let pos = free.iter().position(|b| b.capacity() >= len);
+            pos.map(|i| free.swap_remove(i))
+        };
+        let mut buf = recycled.unwrap_or_else(|| Vec::with_capacity(len));
+        if buf.len() >= len {
+            buf.truncate(len);
+        } else {
+            // Zero-filled only the first time a buffer grows to this size
+            buf.resize(len, 0);
+        }
+        PooledBuffer { buf, pool: Arc::clone(self) }
+    }
+
+    /// Zero-length buffer that doesn't hold on to a recycled allocation, for frames whose pixels live elsewhere
+    pub fn empty(self: &Arc<Self>) -> PooledBuffer {
+        PooledBuffer { buf: Vec::new(), pool: Arc::clone(self) }
+    }
+}
+
+impl Drop for PooledBuffer {
+    fn drop(&mut self) {
+        let buf = std::mem::take(&mut self.buf);
+        if buf.capacity() == 0 { return; }
+        let mut free = self.pool.free.lock().unwrap();
+        if free.len() < self.pool.max_free {
+            free.push(buf);
+        }
+    }
+}
+
+impl Deref for PooledBuffer {
+    type Target = [u8];
+    fn deref(&self) -> &[u8] { &self.buf }
+}
+
+impl DerefMut for PooledBuffer {
+    fn deref_mut(&mut self) -> &mut [u8] { &mut self.buf }
+}
+
+/// Pool shared by the whole live pipeline. Enough for the decoded frames in flight plus the output and conversion buffers
+pub fn frame_pool() -> &'static Arc<FramePool> {
+    static POOL: OnceLock<Arc<FramePool>> = OnceLock::new();
+    POOL.get_or_init(|| FramePool::new(16))
+}
@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
+
+//! In-process encoded output for live mode.
+//!
+//! Encodes the stabilized frames with the hardware encoders from the main app (NVENC, QSV, VAAPI, VideoToolbox, AMF, ...)
+//! and muxes them to a file or a network URL (`srt://`, `udp://`, `rtp://`). Input is NV12, so the NV12 live path
+//! goes from the decoder to the encoder without ever expanding to RGBA.
+
+use anyhow::{anyhow, bail, Context, Result};
+use ffmpeg_next as ffmpeg;
+use ffmpeg::{codec, encoder, ffi, format, frame, Dictionary, Packet, Rational};
+use ffmpeg::software::scaling::{context::Context as Scaler, flag::Flags};
+use ffmpeg::util::format::Pixel;
+
+use crate::live_pix_fmt::PixelFormat;
+use crate::rendering::ffmpeg_hw;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum SinkCodec { H264, Hevc }
+
+#[derive(Clone, Debug)]
+pub struct SinkProps {
+    pub width: u32,
+    pub height: u32,
+    pub fps: f64,
+    pub bitrate_mbps: f64,
+    pub codec: SinkCodec,
+    pub keyframe_distance_s: f64,
+    pub device: Option<String>, // hwaccel_device, None = default
+}
+
+impl Default for SinkProps {
+    fn default() -> Self {
+        Self { width: 0, height: 0, fps: 30.0, bitrate_mbps: 10.0, codec: SinkCodec::H264, keyframe_distance_s: 1.0, device: None }
+    }
+}
+
+/// Same order as `get_possible_encoders` in the main app, hardware first and the software encoder as the fallback
+fn possible_encoders(codec: SinkCodec) -> Vec<(&'static str, bool)> {
+    match codec {
+        SinkCodec::H264 => vec![
+            #[cfg(any(target_os = "macos", target_os = "ios"))]
+            ("h264_videotoolbox", true),
+            #[cfg(any(target_os = "windows", target_os = "linux"))]
+            ("h264_nvenc",        true),
+            #[cfg(any(target_os = "windows", target_os = "linux"))]
+            ("h264_amf",          true),
+            #[cfg(any(target_os = "linux"))]
+            ("h264_vaapi",        true),
+            #[cfg(any(target_os = "windows", target_os = "linux"))]
+            ("h264_qsv",          true),
+            #[cfg(target_os = "windows")]
+            ("h264_mf",           true),
+            ("libx264",           false),
+        ],
+        SinkCodec::Hevc => vec![
+            #[cfg(any(target_os = "macos", target_os = "ios"))]
+            ("hevc_videotoolbox", true),
+            #[cfg(any(target_os = "windows", target_os = "linux"))]
+            ("hevc_nvenc",        true),
+            #[cfg(any(target_os = "windows", target_os = "linux"))]
+            ("hevc_amf",          true),
+            #[cfg(any(target_os = "linux"))]
+            ("hevc_vaapi",        true),
+            #[cfg(any(target_os = "windows", target_os = "linux"))]
+            ("hevc_qsv",          true),
+            #[cfg(target_os = "windows")]
+            ("hevc_mf",           true),
+            ("libx265",           false),
+        ],
+    }
+}
+
+/// Low latency settings per encoder family. No B-frames and no lookahead, a live stream can't wait for future frames
+fn low_latency_options(name: &str) -> Vec<(&'static str, &'static str)> {
+    if name.contains("nvenc")        { vec![("preset", "p1"), ("tune", "ull"), ("zerolatency", "1"), ("rc-lookahead", "0")] }
+    else if name.contains("videotoolbox") { vec![("realtime", "1")] }
+    else if name.contains("amf")     { vec![("usage", "ultralowlatency")] }
+    else if name.contains("qsv")     { vec![("preset", "veryfast"), ("look_ahead", "0")] }
+    else if name.starts_with("libx") { vec![("preset", "ultrafast"), ("tune", "zerolatency")] }
+    else { Vec::new() }
+}
+
+/// Muxer for the URL scheme. Files are guessed from the extension
+fn muxer_for_url(url: &str) -> Option<&'static str> {
+    let scheme = url.split("://").next().filter(|_| url.contains("://"))?.to_ascii_lowercase();
+    match scheme.as_str() {
+        "srt" | "udp" | "tcp" => Some("mpegts"),
+        "rtp"                 => Some("rtp_mpegts"),
+        "rtmp" | "rtmps"      => Some("flv"),
+        _ => None,
+    }
+}
+
+/// Copies a tightly packed plane into a frame plane with line size `stride`
+fn copy_to_plane(dst: &mut [u8], stride: usize, src: &[u8], row_bytes: usize, rows: usize) {
+    if stride == row_bytes {
+        dst[..row_bytes * rows].copy_from_slice(&src[..row_bytes * rows]);
+        return;
+    }
+    for (row, s) in src.chunks_exact(row_bytes).take(rows).enumerate() {
+        let start = row * stride;
+        dst[start..start + row_bytes].copy_from_slice(s);
+    }
+}
+
+pub struct HwSink {
+    octx: format::context::Output,
+    encoder: encoder::video::Video,
+    encoder_name: &'static str,
+    time_base: Rational,
+    ost_time_base: Rational,
+    size: (u32, u32),
+    frame: frame::Video,               // software frame in `frame_format`
+    frame_format: Pixel,
+    hw_frame: Option<frame::Video>,    // Some when the encoder only takes frames in its own device memory (VAAPI, QSV)
+    scaler: Option<(Pixel, Scaler)>,   // input format -> `frame_format`, only when they differ
+    first_ts: Option<i64>,
+    last_pts: i64,
+    finished: bool,
+}
+
+impl HwSink {
+    pub fn open(url: &str, props: &SinkProps) -> Result<Self> {
+        ffmpeg::init().context("ffmpeg init failed")?;
+        ffmpeg::format::network::init();
+        if props.width == 0 || props.height == 0 || props.width % 2 != 0 || props.height % 2 != 0 {
+            bail!("HwSink: invalid size {}x{}, NV12 needs even dimensions", props.width, props.height);
+        }
+        let size = (props.width, props.height);
+
+        #[cfg(any(target_os = "macos", target_os = "ios"))]
+        ffmpeg_hw::initialize_ctx(ffi::AVHWDeviceType::AV_HWDEVICE_TYPE_VIDEOTOOLBOX);
+
+        let encoders = possible_encoders(props.codec);
+        let (encoder_name, is_hw, hw_type) = ffmpeg_hw::find_working_encoder(&encoders, props.device.as_deref());
+        let codec = encoder::find_by_name(encoder_name).ok_or_else(|| anyhow!("HwSink: encoder {encoder_name} not found"))?;
+        let supported = unsafe { if (*codec.as_ptr()).pix_fmts.is_null() { Vec::new() } else { ffmpeg_hw::pix_formats_to_vec((*codec.as_ptr()).pix_fmts) } };
+
+        // Encoders that only list their device format need the frames uploaded, the rest take NV12 from system memory
+        let upload = is_hw && hw_type.is_some() && supported.len() == 1 && ffmpeg_hw::is_hardware_format(supported[0].into());
+        let frame_format = if upload || supported.is_empty() || supported.contains(&Pixel::NV12) {
+            Pixel::NV12
+        } else {
+            supported.iter().copied().find(|x| !ffmpeg_hw::is_hardware_format((*x).into())).ok_or_else(|| anyhow!("HwSink: {encoder_name} has no software pixel formats"))?
+        };
+        log::info!("HwSink: {url} with {encoder_name} (hw: {is_hw}, device: {hw_type:?}, upload: {upload}, format: {frame_format:?})");
+
+        let mut octx = match muxer_for_url(url) {
+            Some(muxer) => format::output_as(&url, muxer),
+            None => format::output(&url),
+        }.with_context(|| format!("HwSink: open output {url}"))?;
+        let global_header = octx.format().flags().contains(format::Flags::GLOBAL_HEADER);
+
+        let time_base = Rational::new(1, 1_000_000);
+        let fps = if props.fps > 0.0 { props.fps } else { 30.0 };
+        let frame_rate = Rational::new((fps * 1000.0).round() as i32, 1000);
+
+        let mut ost = octx.add_stream(codec).context("HwSink: add stream")?;
+        let mut enc = codec::context::Context::new_with_codec(codec).encoder().video().context("HwSink: encoder context")?;
+        enc.set_width(size.0);
+        enc.set_height(size.1);
+        enc.set_format(frame_format);
+        enc.set_frame_rate(Some(frame_rate));
+        enc.set_time_base(time_base);
+        let bitrate = (props.bitrate_mbps * 1024.0 * 1024.0) as usize;
+        enc.set_bit_rate(bitrate);
+        if !encoder_name.contains("videotoolbox") {
+            enc.set_max_bit_rate(bitrate);
+        }
+        enc.set_gop(((fps * props.keyframe_distance_s) as u32).max(1));
+        enc.set_max_b_frames(0);
+        if global_header {
+            enc.set_flags(codec::Flags::GLOBAL_HEADER);
+        }
+
+        let mut hw_frame = None;
+        if let Some(hw_type) = hw_type {
+            let mut probe = frame::Video::new(frame_format, size.0, size.1);
+            if ffmpeg_hw::initialize_hwframes_context(unsafe { enc.as_mut_ptr() }, unsafe { probe.as_mut_ptr() }, hw_type, frame_format.into(), size, upload, props.device.as_deref()).is_err() {
+                bail!("HwSink: failed to create encoder HW context for {encoder_name}");
+            }
+            if upload {
+                if unsafe { (*enc.as_ptr()).hw_frames_ctx.is_null() } {
+                    bail!("HwSink: {encoder_name} needs a frames context but none was created");
+                }
+                hw_frame = Some(frame::Video::empty());
+            }
+        }
+
+        let mut options = Dictionary::new();
+        for (k, v) in low_latency_options(encoder_name) {
+            options.set(k, v);
+        }
+        let encoder = enc.open_with(options).with_context(|| format!("HwSink: open encoder {encoder_name}"))?;
+        ost.set_parameters(&encoder);
+        ost.set_time_base(time_base);
+
+        octx.write_header().context("HwSink: write header")?;
+        let ost_time_base = octx.stream(0).map(|s| s.time_base()).unwrap_or(time_base);
+
+        Ok(Self {
+            octx,
+            encoder,
+            encoder_name,
+            time_base,
+            ost_time_base,
+            size,
+            frame: frame::Video::new(frame_format, size.0, size.1),
+            frame_format,
+            hw_frame,
+            scaler: None,
+            first_ts: None,
+            last_pts: -1,
+            finished: false,
+        })
+    }
+
+    pub fn encoder_name(&self) -> &'static str { self.encoder_name }
+
+    /// Encodes a tightly packed NV12 frame (Y plane followed by the interleaved UV plane)
+    pub fn push_nv12(&mut self, data: &[u8], ts_us: i64) -> Result<()> {
+        let (w, h) = (self.size.0 as usize, self.size.1 as usize);
+        if data.len() != w * h + w * (h / 2) {
+            bail!("HwSink: bad NV12 buffer size: got {}, expected {}", data.len(), w * h + w * (h / 2));
+        }
+        if self.frame_format != Pixel::NV12 {
+            let (y, uv) = data.split_at(w * h);
+            return self.push_converted(Pixel::NV12, &[y, uv], &[w, w], ts_us);
+        }
+        self.make_frame_writable()?;
+        let (y, uv) = data.split_at(w * h);
+        let (stride0, stride1) = (self.frame.stride(0), self.frame.stride(1));
+        copy_to_plane(self.frame.data_mut(0), stride0, y, w, h);
+        copy_to_plane(self.frame.data_mut(1), stride1, uv, w, h / 2);
+        self.send_frame(ts_us)
+    }
+
+    /// Encodes a tightly packed RGB24 or RGBA frame. The conversion writes straight into the encoder frame
+    pub fn push_packed(&mut self, data: &[u8], pix_fmt: PixelFormat, ts_us: i64) -> Result<()> {
+        let (w, h) = (self.size.0 as usize, self.size.1 as usize);
+        let (src_fmt, bpp) = match pix_fmt {
+            PixelFormat::Rgb24 => (Pixel::RGB24, 3),
+            PixelFormat::Rgba  => (Pixel::RGBA, 4),
+            PixelFormat::Nv12  => return self.push_nv12(data, ts_us),
+        };
+        if data.len() != w * h * bpp {
+            bail!("HwSink: bad {pix_fmt} buffer size: got {}, expected {}", data.len(), w * h * bpp);
+        }
+        self.push_converted(src_fmt, &[data], &[w * bpp], ts_us)
+    }
+
+    fn push_converted(&mut self, src_fmt: Pixel, planes: &[&[u8]], strides: &[usize], ts_us: i64) -> Result<()> {
+        if self.scaler.as_ref().map(|x| x.0) != Some(src_fmt) {
+            let sc = Scaler::get(src_fmt, self.size.0, self.size.1, self.frame_format, self.size.0, self.size.1, Flags::BILINEAR)
+                .context("HwSink: create scaler")?;
+            self.scaler = Some((src_fmt, sc));
+        }
+        self.make_frame_writable()?;
+
+        let mut src_ptrs = [std::ptr::null::<u8>(); 4];
+        let mut src_strides = [0i32; 4];
+        for (i, (p, s)) in planes.iter().zip(strides).enumerate() {
+            src_ptrs[i] = p.as_ptr();
+            src_strides[i] = *s as i32;
+        }
+        let sc = &mut self.scaler.as_mut().unwrap().1;
+        let err = unsafe {
+            let dst = self.frame.as_mut_ptr();
+            ffi::sws_scale(sc.as_mut_ptr(), src_ptrs.as_ptr(), src_strides.as_ptr(), 0, self.size.1 as i32, (*dst).data.as_ptr(), (*dst).linesize.as_ptr())
+        };
+        if err < 0 {
+            bail!("HwSink: sws_scale failed: {err}");
+        }
+        self.send_frame(ts_us)
+    }
+
+    /// The encoder may still reference the previous frame's buffer, get a fresh one instead of overwriting it
+    fn make_frame_writable(&mut self) -> Result<()> {
+        let err = unsafe { ffi::av_frame_make_writable(self.frame.as_mut_ptr()) };
+        if err < 0 { bail!("HwSink: av_frame_make_writable failed: {err}"); }
+        Ok(())
+    }
+
+    fn send_frame(&mut self, ts_us: i64) -> Result<()> {
+        let first_ts = *self.first_ts.get_or_insert(ts_us);
+        let pts = (ts_us - first_ts).max(self.last_pts + 1);
+        self.last_pts = pts;
+        self.frame.set_pts(Some(pts));
+
+        if let Some(hw_frame) = self.hw_frame.as_mut() {
+            unsafe {
+                let hw_ptr = hw_frame.as_mut_ptr();
+                ffi::av_frame_unref(hw_ptr);
+                let err = ffi::av_hwframe_get_buffer((*self.encoder.as_ptr()).hw_frames_ctx, hw_ptr, 0);
+                if err < 0 { bail!("HwSink: av_hwframe_get_buffer failed: {err}"); }
+                let err = ffi::av_hwframe_transfer_data(hw_ptr, self.frame.as_ptr(), 0);
+                if err < 0 { bail!("HwSink: av_hwframe_transfer_data failed: {err}"); }
+                (*hw_ptr).pts = pts;
+            }
+            self.encoder.send_frame(hw_frame).context("HwSink: send frame")?;
+        } else {
+            self.encoder.send_frame(&self.frame).context("HwSink: send frame")?;
+        }
+        self.write_packets()
+    }
+
+    fn write_packets(&mut self) -> Result<()> {
+        let mut encoded = Packet::empty();
+        while self.encoder.receive_packet(&mut encoded).is_ok() {
+            encoded.set_stream(0);
+            encoded.rescale_ts(self.time_base, self.ost_time_base);
+            encoded.write_interleaved(&mut self.octx).context("HwSink: write packet")?;
+        }
+        Ok(())
+    }
+
+    /// Flushes the encoder and writes the trailer. Also called on drop
+    pub fn finish(&mut self) -> Result<()> {
+        if self.finished { return Ok(()); }
+        self.finished = true;
+        self.encoder.send_eof().context("HwSink: send eof")?;
+        self.write_packets()?;
+        self.octx.write_trailer().context("HwSink: write trailer")?;
+        Ok(())
+    }
+}
+
+impl Drop for HwSink {
+    fn drop(&mut self) {
+        if let Err(e) = self.finish() {
+            log::warn!("HwSink: finish failed: {e:?}");
+        }
+    }
+}
@@ -0,0 +1,235 @@
+//! Per-frame latency tracing for the live pipeline.
+//!
+//! Every frame carries a `FrameTrace` with monotonic timestamps for each stage, from the packet leaving the demuxer to
+//! the output returning. Finished traces go into log-bucketed histograms. Every `DUMP_INTERVAL` the p50/p95/p99 per step
+//! are logged, and the recent traces are written in Chrome trace format to `$LIVE_TRACE_FILE` if it is set
+//! (open it in chrome://tracing or Perfetto).
+//!
+//! Only built with the `latency-trace` feature. Without it `FrameTrace` is zero-sized and every call here is an empty inline fn.
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Stage {
+    PacketIn,  // packet read from the input, before decoding
+    Decoded,   // frame out of the decoder
+    Queued,    // converted and sent to the render channel
+    RenderIn,  // picked up by `render_live_loop`
+    Processed, // stabilization done
+    Presented, // ffplay / encoder returned
+}
+pub const STAGE_COUNT: usize = 6;
+
+#[cfg(feature = "latency-trace")]
+mod imp {
+    use super::{Stage, STAGE_COUNT};
+    use std::sync::{Mutex, OnceLock};
+    use std::collections::VecDeque;
+    use std::time::{Duration, Instant};
+
+    const DUMP_INTERVAL: Duration = Duration::from_secs(5);
+    const KEEP_TRACES: usize = 4096;
+
+    // (name, from, to) of the reported steps
+    const STEPS: [(&str, Stage, Stage); 6] = [
+        ("decode",  Stage::PacketIn,  Stage::Decoded),
+        ("convert", Stage::Decoded,   Stage::Queued),
+        ("queue",   Stage::Queued,    Stage::RenderIn),
+        ("process", Stage::RenderIn,  Stage::Processed),
+        ("present", Stage::Processed, Stage::Presented),
+        ("total",   Stage::PacketIn,  Stage::Presented),
+    ];
+
+    /// Nanoseconds since the first call, 0 is reserved for "not reached"
+    pub type Timestamp = u64;
+
+    #[inline]
+    pub fn now() -> Timestamp {
+        static EPOCH: OnceLock<Instant> = OnceLock::new();
+        (EPOCH.get_or_init(Instant::now).elapsed().as_nanos() as u64).max(1)
+    }
+
+    #[derive(Clone, Copy, Default, Debug)]
+    pub struct FrameTrace {
+        frame: usize,
+        ts_us: i64,
+        t: [Timestamp; STAGE_COUNT],
+        imu_lag_us: Option<i64>, // frame timestamp minus the newest integrated IMU sample, > 0 = IMU behind
+    }
+
+    impl FrameTrace {
+        #[inline] pub fn new(frame: usize, ts_us: i64) -> Self { Self { frame, ts_us, ..Default::default() } }
+        #[inline] pub fn mark(&mut self, stage: Stage) { self.t[stage as usize] = now(); }
+        #[inline] pub fn mark_at(&mut self, stage: Stage, t: Timestamp) { self.t[stage as usize] = t; }
+        /// `f` only runs when tracing is compiled in
+        #[inline] pub fn set_imu_lag_with<F: FnOnce() -> Option<i64>>(&mut self, f: F) { self.imu_lag_us = f(); }
+
+        fn step_ns(&self, from: Stage, to: Stage) -> Option<u64> {
+            let (a, b) = (self.t[from as usize], self.t[to as usize]);
+            (a != 0 && b != 0).then(|| b.saturating_sub(a))
+        }
+    }
+
+    /// Records the trace when dropped, if the frame got to `Presented`. Frames that failed on the way are only counted
+    pub struct TraceGuard(pub FrameTrace);
+    impl TraceGuard {
+        #[inline] pub fn new(trace: FrameTrace) -> Self { Self(trace) }
+        #[inline] pub fn mark(&mut self, stage: Stage) { self.0.mark(stage); }
+        #[inline] pub fn set_imu_lag_with<F: FnOnce() -> Option<i64>>(&mut self, f: F) { self.0.set_imu_lag_with(f); }
+    }
+    impl Drop for TraceGuard {
+        fn drop(&mut self) { record(&self.0); }
+    }
+
+    /// Log-linear buckets, 8 per power of two (~12% wide), so any value up to hours fits in a few hundred counters
+    #[derive(Clone)]
+    struct Histogram { buckets: Vec<u64>, count: u64, max: u64 }
+    impl Default for Histogram {
+        fn default() -> Self { Self { buckets: vec![0; 64 * 8], count: 0, max: 0 } }
+    }
+    impl Histogram {
+        fn bucket(v: u64) -> usize {
+            if v < 8 { return v as usize; }
+            let e = 63 - v.leading_zeros() as usize; // >= 3
+            (e - 2) * 8 + ((v >> (e - 3)) & 7) as usize
+        }
+        fn bucket_value(i: usize) -> u64 {
+            if i < 8 { return i as u64; }
+            let (e, sub) = (i / 8 + 2, (i % 8) as u64);
+            ((8 + sub) << (e - 3)) + (1u64 << (e - 3)) / 2 // middle of the bucket
+        }
+        fn add(&mut self, v: u64) {
+            self.buckets[Self::bucket(v).min(self.buckets.len() - 1)] += 1;
+            self.count += 1;
+            self.max = self.max.max(v);
+        }
+        fn percentile(&self, p: f64) -> u64 {
+            if self.count == 0 { return 0; }
+            let target = ((self.count as f64 * p).ceil() as u64).max(1);
+            let mut acc = 0;
+            for (i, c) in self.buckets.iter().enumerate() {
+                acc += c;
+                if acc >= target { return Self::bucket_value(i).min(self.max); }
+            }
+            self.max
+        }
+    }
+
+    #[derive(Default)]
+    struct Collector {
+        steps: [Histogram; STEPS.len()],
+        imu_lag: Histogram, // us, lag > 0 only
+        imu_ahead: u64,     // frames where the IMU was already past the frame
+        incomplete: u64,
+        recent: VecDeque<FrameTrace>,
+        last_dump: Option<Instant>,
+    }
+
+    fn collector() -> &'static Mutex<Collector> {
+        static C: OnceLock<Mutex<Collector>> = OnceLock::new();
+        C.get_or_init(Default::default)
+    }
+
+    pub fn record(trace: &FrameTrace) {
+        let mut c = collector().lock().unwrap();
+        if trace.t[Stage::Presented as usize] == 0 {
+            c.incomplete += 1;
+            return;
+        }
+        for (i, (_, from, to)) in STEPS.iter().enumerate() {
+            if let Some(ns) = trace.step_ns(*from, *to) { c.steps[i].add(ns); }
+        }
+        match trace.imu_lag_us {
+            Some(lag) if lag >= 0 => c.imu_lag.add(lag as u64),
+            Some(_) => c.imu_ahead += 1,
+            None => { }
+        }
+        if c.recent.len() >= KEEP_TRACES { c.recent.pop_front(); }
+        c.recent.push_back(*trace);
+
+        let due = c.last_dump.map_or(true, |t| t.elapsed() >= DUMP_INTERVAL);
+        if due {
+            c.last_dump = Some(Instant::now());
+            dump_locked(&mut c);
+        }
+    }
+
+    /// Logs the histograms since the previous dump and writes the Chrome trace, if configured
+    pub fn dump() {
+        dump_locked(&mut collector().lock().unwrap());
+    }
+
+    fn dump_locked(c: &mut Collector) {
+        let ms = |ns: u64| ns as f64 / 1_000_000.0;
+        let frames = c.steps[STEPS.len() - 1].count;
+        if frames == 0 { return; }
+        let mut out = format!("live latency over {frames} frames ({} incomplete), ms p50/p95/p99/max:", c.incomplete);
+        for (i, (name, _, _)) in STEPS.iter().enumerate() {
+            let h = &c.steps[i];
+            out += &format!(" {name} {:.2}/{:.2}/{:.2}/{:.2}", ms(h.percentile(0.5)), ms(h.percentile(0.95)), ms(h.percentile(0.99)), ms(h.max));
+        }
+        out += &format!(" | imu lag {:.2}/{:.2}/{:.2} ({} ahead)",
+            c.imu_lag.percentile(0.5) as f64 / 1000.0, c.imu_lag.percentile(0.95) as f64 / 1000.0, c.imu_lag.percentile(0.99) as f64 / 1000.0, c.imu_ahead);
+        log::info!("{out}");
+
+        if let Ok(path) = std::env::var("LIVE_TRACE_FILE") {
+            if let Err(e) = std::fs::write(&path, chrome_trace(c.recent.iter())) {
+                log::warn!("latency: failed to write {path}: {e:?}");
+            }
+        }
+
+        c.steps = Default::default();
+        c.imu_lag = Default::default();
+        c.imu_ahead = 0;
+        c.incomplete = 0;
+    }
+
+    /// Chrome trace event format: one complete ("X") event per step, one thread row per step, and the IMU lag as a counter
+    fn chrome_trace<'a>(traces: impl Iterator<Item = &'a FrameTrace>) -> String {
+        let mut events = Vec::new();
+        for (i, (name, _, _)) in STEPS.iter().enumerate() {
+            events.push(serde_json::json!({ "name": "thread_name", "ph": "M", "pid": 1, "tid": i, "args": { "name": name } }));
+        }
+        for tr in traces {
+            for (i, (name, from, to)) in STEPS.iter().enumerate() {
+                if let Some(ns) = tr.step_ns(*from, *to) {
+                    events.push(serde_json::json!({
+                        "name": name, "ph": "X", "pid": 1, "tid": i,
+                        "ts": tr.t[*from as usize] as f64 / 1000.0, "dur": ns as f64 / 1000.0,
+                        "args": { "frame": tr.frame, "ts_us": tr.ts_us }
+                    }));
+                }
+            }
+            if let Some(lag) = tr.imu_lag_us {
+                events.push(serde_json::json!({ "name": "imu_lag_ms", "ph": "C", "pid": 1, "ts": tr.t[Stage::RenderIn as usize] as f64 / 1000.0, "args": { "lag": lag as f64 / 1000.0 } }));
+            }
+        }
+        serde_json::json!({ "traceEvents": events, "displayTimeUnit": "ms" }).to_string()
+    }
+}
+
+#[cfg(not(feature = "latency-trace"))]
+mod imp {
+    use super::Stage;
+
+    pub type Timestamp = ();
+    #[inline(always)] pub fn now() -> Timestamp { }
+
+    #[derive(Clone, Copy, Default, Debug)]
+    pub struct FrameTrace;
+    impl FrameTrace {
+        #[inline(always)] pub fn new(_frame: usize, _ts_us: i64) -> Self { Self }
+        #[inline(always)] pub fn mark(&mut self, _stage: Stage) { }
+        #[inline(always)] pub fn mark_at(&mut self, _stage: Stage, _t: Timestamp) { }
+        #[inline(always)] pub fn set_imu_lag_with<F: FnOnce() -> Option<i64>>(&mut self, _f: F) { }
+    }
+
+    pub struct TraceGuard;
+    impl TraceGuard {
+        #[inline(always)] pub fn new(_trace: FrameTrace) -> Self { Self }
+        #[inline(always)] pub fn mark(&mut self, _stage: Stage) { }
+        #[inline(always)] pub fn set_imu_lag_with<F: FnOnce() -> Option<i64>>(&mut self, _f: F) { }
+    }
+
+    #[inline(always)] pub fn dump() { }
+}
+
+pub use imp::*;
@@ -11,7 +11,7 @@ use ffmpeg_next as ffmpeg;
 use ffmpeg::codec::context::Context as CodecContext;
 use ffmpeg::codec::decoder::Video as VideoDecoder;
 use ffmpeg::format::{self, context::Input};
-use ffmpeg::frame;
+use ffmpeg::{ffi, frame};
 use ffmpeg::software::scaling::{context::Context as Scaler, flag::Flags};
 use ffmpeg::util::format::Pixel;
 use std::time::Instant;
@@ -21,6 +21,9 @@ use ffmpeg_next::Rescale;
 use gyroflow_core::stmap_live::StmapsLive;
 use std::sync::Arc;
 use std::fmt;
+use crate::frame_pool::{frame_pool, PooledBuffer};
+use crate::rendering::ffmpeg_hw;
+use crate::latency::{self, FrameTrace, Stage};
 
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum PixelFormat {
@@ -46,7 +49,9 @@ pub struct LiveFrame {
     pub width: u32,
     pub height: u32,
     pub pix_fmt: PixelFormat, // <-- use PixelFormat here
-    pub data: Vec<u8>,
+    pub data: PooledBuffer,   // tightly packed, recycled through frame_pool() when the frame is dropped
+    pub surface: Option<frame::Video>, // decoded GPU surface (CUDA/VideoToolbox NV12), `data` is empty then
+    pub trace: FrameTrace,
 }
 
 impl LiveFrame {
@@ -56,6 +61,8 @@ impl LiveFrame {
 
     pub fn ts_us(&self) -> i64 { self.ts_us }
 
+    pub fn is_gpu(&self) -> bool { self.surface.is_some() }
+
     pub fn as_rgb24(&self) -> &[u8] {
         assert!(self.pix_fmt == PixelFormat::Rgb24, "expected RGB24 frame");
         &self.data
@@ -63,7 +70,7 @@ impl LiveFrame {
 
     pub fn as_rgb24_mut(&mut self) -> &mut [u8] {
         assert!(self.pix_fmt == PixelFormat::Rgb24, "expected RGB24 frame");
-        &mut self.data
+        &mut self.data[..]
     }
 
     pub fn make_cpu_rgb24_buffer(&self) -> (&[u8], u32, u32) {
@@ -78,7 +85,57 @@ impl LiveFrame {
 
     pub fn as_rgba_mut(&mut self) -> &mut [u8] {
         assert!(self.pix_fmt == PixelFormat::Rgba, "expected RGBA frame");
-        &mut self.data
+        &mut self.data[..]
+    }
+
+    /// Y plane followed by the interleaved UV plane, both tightly packed
+    pub fn as_nv12_mut(&mut self) -> &mut [u8] {
+        assert!(self.pix_fmt == PixelFormat::Nv12, "expected NV12 frame");
+        &mut self.data[..]
+    }
+}
+
+/// RGBA -> RGB24, dropping alpha. `dst` must hold `src.len() / 4 * 3` bytes.
+/// Fixed-size chunks without bounds checks, so the compiler can turn it into SIMD shuffles
+pub fn rgba_to_rgb24(src: &[u8], dst: &mut [u8]) {
+    debug_assert_eq!(src.len() / 4 * 3, dst.len());
+    for (s, d) in src.chunks_exact(4).zip(dst.chunks_exact_mut(3)) {
+        d.copy_from_slice(&s[..3]);
+    }
+}
+
+/// RGB24 -> RGBA with opaque alpha. `dst` must hold `src.len() / 3 * 4` bytes
+pub fn rgb24_to_rgba(src: &[u8], dst: &mut [u8]) {
+    debug_assert_eq!(src.len() / 3 * 4, dst.len());
+    for (s, d) in src.chunks_exact(3).zip(dst.chunks_exact_mut(4)) {
+        d[..3].copy_from_slice(s);
+        d[3] = 255;
+    }
+}
+
+/// Copies `rows` rows of `row_bytes` from a plane with line size `stride` into `dst`, tightly packed
+pub(crate) fn copy_plane(dst: &mut [u8], src: &[u8], stride: usize, row_bytes: usize, rows: usize) {
+    if stride == row_bytes {
+        dst[..row_bytes * rows].copy_from_slice(&src[..row_bytes * rows]);
+        return;
+    }
+    for (row, d) in dst.chunks_exact_mut(row_bytes).take(rows).enumerate() {
+        let start = row * stride;
+        d.copy_from_slice(&src[start..start + row_bytes]);
+    }
+}
+
+/// HW surfaces the renderer can read in place: CUDA device memory and VideoToolbox pixel buffers, both with NV12 underneath
+fn surface_is_nv12(frame: &frame::Video) -> bool {
+    match frame.format() {
+        #[cfg(any(target_os = "windows", target_os = "linux"))]
+        Pixel::CUDA => unsafe {
+            let hw_frames_ctx = (*frame.as_ptr()).hw_frames_ctx;
+            !hw_frames_ctx.is_null() && (*((*hw_frames_ctx).data as *const ffi::AVHWFramesContext)).sw_format == ffi::AVPixelFormat::AV_PIX_FMT_NV12
+        },
+        #[cfg(any(target_os = "macos", target_os = "ios"))]
+        Pixel::VIDEOTOOLBOX => crate::rendering::zero_copy::map_hardware_format(Pixel::VIDEOTOOLBOX, frame) == Some(Pixel::NV12),
+        _ => false
     }
 }
 
@@ -87,6 +144,7 @@ pub fn spawn_stream_reader(
     out_tx: Sender<(usize, LiveFrame)>,
     target_pix_fmt: LivePixFmt,   // which format we want out: Rgb24 / Nv12 / Rgba32
     max_queue_warn: usize,        // for basic health logs
+    hw_decode: bool,              // decode with hwaccel, NV12 frames then stay on the GPU where the undistort can read them
     //st_live: Arc<StmapsLive>
 ) -> Result<std::thread::JoinHandle<()>> {
     ffmpeg::init().context("ffmpeg init failed")?;
@@ -95,7 +153,7 @@ pub fn spawn_stream_reader(
     let handle = std::thread::Builder::new()
         .name("stream_reader".into())
         .spawn(move || {
-            if let Err(e) = run_reader(&url_owned, &out_tx, target_pix_fmt, max_queue_warn /*, st_live.clone()*/) {
+            if let Err(e) = run_reader(&url_owned, &out_tx, target_pix_fmt, max_queue_warn, hw_decode /*, st_live.clone()*/) {
                 eprintln!("[stream_reader] fatal error: {e:?}");
             }
         })?;
@@ -108,6 +166,7 @@ fn run_reader(
     out_tx: &Sender<(usize, LiveFrame)>,
     target_pix_fmt: LivePixFmt,
     max_queue_warn: usize,
+    hw_decode: bool,
 ) -> Result<()> 
 {
     println!("Starting stream reader for URL: {}", url);
@@ -137,6 +196,20 @@ fn run_reader(
         .context("decoder not found for stream codec")?;
     let mut decoder_ctx = CodecContext::from_parameters(codec_params)
         .context("build decoder context")?;
+
+    let mut gpu_decoding = false;
+    if hw_decode {
+        match ffmpeg_hw::init_device_for_decoding(0, unsafe { decoder_codec.as_ptr() }, &mut decoder_ctx, None) {
+            Ok((_, type_, name, pix_fmt)) if !name.is_empty() => {
+                log::info!("[stream_reader] HW decoding with {name} ({type_:?}), format {pix_fmt:?}");
+                // Surfaces handed to the renderer stay referenced while they wait in the channel
+                unsafe { (*decoder_ctx.as_mut_ptr()).extra_hw_frames = 8; }
+                gpu_decoding = true;
+            }
+            Ok(_) => log::warn!("[stream_reader] no HW decoder for {:?}, decoding in software", decoder_codec.name()),
+            Err(e) => log::warn!("[stream_reader] HW decoder init failed ({e:?}), decoding in software"),
+        }
+    }
     let mut decoder = decoder_ctx.decoder().video()
         .context("open video decoder")?;
 
@@ -151,10 +224,15 @@ fn run_reader(
     };
 
     let mut scaler: Option<(u32, u32, Pixel, Scaler)> = None;
+    // Scaler output, reallocated only together with the scaler
+    let mut out = frame::Video::empty();
+    // Download target for HW frames that can't stay on the GPU
+    let mut sw_frame = frame::Video::empty();
 
     // --- 4) Demux/Decode loop ---
     for (stream, mut packet) in ictx.packets() {
         if stream.index() != v_stream_idx { continue; }
+        let packet_t = latency::now();
 
         if decoder.send_packet(&packet).is_err() {
             continue;
@@ -162,73 +240,80 @@ fn run_reader(
 
         let mut frame = frame::Video::empty();
         while decoder.receive_frame(&mut frame).is_ok() {
-
-            // Lazily rebuild scaler if needed
-            let (w, h, src_fmt) = (frame.width(), frame.height(), frame.format());
-            if scaler.as_ref().map(|(sw, sh, sf, _)| (*sw, *sh, *sf))
-                != Some((w, h, src_fmt)) 
-            {
-                let sc = Scaler::get(src_fmt, w, h, target_fmt, w, h, Flags::BILINEAR)
-                    .context("create scaler")?;
-                scaler = Some((w, h, src_fmt, sc));
+            let ts_us = frame.timestamp().unwrap_or_else(|| {
+                let pts = packet.pts().unwrap_or(0);
+                pts.rescale(tb, ffmpeg::util::rational::Rational(1, 1_000_000))
+            });
+            let (w, h) = (frame.width(), frame.height());
+            let mut trace = FrameTrace::new(frame_index, ts_us);
+            trace.mark_at(Stage::PacketIn, packet_t);
+            trace.mark(Stage::Decoded);
+
+            // --- 5) HW frames: keep NV12 surfaces for the renderer (it downloads them itself when its backend isn't wgpu), download anything else once ---
+            let mut downloaded = false;
+            if gpu_decoding && ffmpeg_hw::is_hardware_format(frame.format().into()) {
+                if target_fmt == Pixel::NV12 && surface_is_nv12(&frame) {
+                    let surface = std::mem::replace(&mut frame, frame::Video::empty());
+                    trace.mark(Stage::Queued);
+                    let msg = LiveFrame { ts_us, width: w, height: h, pix_fmt: LivePixFmt::Nv12, data: frame_pool().empty(), surface: Some(surface), trace };
+                    if out_tx.send((frame_index, msg)).is_err() {
+                        log::info!("[stream_reader] receiver gone, stopping");
+                        return Ok(());
+                    }
+                    frame_index += 1;
+                    continue;
+                }
+                let err = unsafe { ffi::av_hwframe_transfer_data(sw_frame.as_mut_ptr(), frame.as_ptr(), 0) };
+                if err < 0 {
+                    eprintln!("[stream_reader] av_hwframe_transfer_data failed: {err}");
+                    continue;
+                }
+                downloaded = true;
             }
+            let src = if downloaded { &sw_frame } else { &frame };
+            let src_fmt = src.format();
+
+            // --- 6) Convert to target pixel format, skipped when the decoder (or the download) already gives it ---
+            let conv = if src_fmt == target_fmt {
+                src
+            } else {
+                // Lazily rebuild scaler if needed
+                if scaler.as_ref().map(|(sw, sh, sf, _)| (*sw, *sh, *sf))
+                    != Some((w, h, src_fmt)) 
+                {
+                    let sc = Scaler::get(src_fmt, w, h, target_fmt, w, h, Flags::BILINEAR)
+                        .context("create scaler")?;
+                    scaler = Some((w, h, src_fmt, sc));
+                    out = frame::Video::new(target_fmt, w, h);
+                }
+                let (_, _, _, sc) = scaler.as_mut().unwrap();
+                sc.run(src, &mut out).context("scale/run")?;
+                &out
+            };
 
-            let (_, _, _, sc) = scaler.as_mut().unwrap();
-
-            // --- 5) Convert to target pixel format ---
-            let mut out = frame::Video::empty();
-            out.set_format(target_fmt);
-            out.set_width(w);
-            out.set_height(h);
-            sc.run(&frame, &mut out).context("scale/run")?;
-
-            // --- 6) Extract tightly-packed bytes ---
+            // --- 7) Extract tightly-packed bytes into a recycled buffer ---
+            let (w_usize, h_usize) = (w as usize, h as usize);
             let (bytes, pix_fmt) = match target_fmt {
                 Pixel::RGB24 => {
-                    let mut buf = Vec::with_capacity((w * h * 3) as usize);
-                    let ls = out.stride(0) as usize;
-                    let row_bytes = (w as usize) * 3;
-                    let data = out.data(0);
-
-                    for row in 0..h as usize {
-                        let start = row * ls;
-                        buf.extend_from_slice(&data[start..start + row_bytes]);
-                    }
+                    let mut buf = frame_pool().take(w_usize * h_usize * 3);
+                    copy_plane(&mut buf, conv.data(0), conv.stride(0) as usize, w_usize * 3, h_usize);
                     (buf, LivePixFmt::Rgb24)
                 }
 
                 Pixel::RGBA => {
-                    let mut buf = Vec::with_capacity((w * h * 4) as usize);
-                    let ls = out.stride(0) as usize;
-                    let row_bytes = (w as usize) * 4;
-                    let data = out.data(0);
-
-                    for row in 0..h as usize {
-                        let start = row * ls;
-                        buf.extend_from_slice(&data[start..start + row_bytes]);
-                    }
+                    let mut buf = frame_pool().take(w_usize * h_usize * 4);
+                    copy_plane(&mut buf, conv.data(0), conv.stride(0) as usize, w_usize * 4, h_usize);
                     (buf, LivePixFmt::Rgba)
                 }
 
                 Pixel::NV12 => {
-                    let mut buf = Vec::with_capacity((w * h * 3 / 2) as usize);
-
-                    let ls_y = out.stride(0) as usize;
-                    let ls_uv = out.stride(1) as usize;
-                    let data_y = out.data(0);
-                    let data_uv = out.data(1);
+                    let y_len = w_usize * h_usize;
+                    let mut buf = frame_pool().take(y_len + w_usize * (h_usize / 2));
 
-                    // copy Y plane
-                    for row in 0..h as usize {
-                        let start = row * ls_y;
-                        buf.extend_from_slice(&data_y[start..start + w as usize]);
-                    }
-
-                    // copy UV plane
-                    for row in 0..(h as usize / 2) {
-                        let start = row * ls_uv;
-                        buf.extend_from_slice(&data_uv[start..start + w as usize]);
-                    }
+                    // Y plane, then the interleaved UV plane
+                    let (dst_y, dst_uv) = buf.split_at_mut(y_len);
+                    copy_plane(dst_y, conv.data(0), conv.stride(0) as usize, w_usize, h_usize);
+                    copy_plane(dst_uv, conv.data(1), conv.stride(1) as usize, w_usize, h_usize / 2);
 
                     (buf, LivePixFmt::Nv12)
                 }
@@ -236,23 +321,21 @@ fn run_reader(
                 _ => panic!("Unsupported output pixel format"),
             };
 
-            // --- 7) Timestamp ---
-            let ts_us = frame.timestamp().unwrap_or_else(|| {
-                let pts = packet.pts().unwrap_or(0);
-                pts.rescale(tb, ffmpeg::util::rational::Rational(1, 1_000_000))
-            });
-
             // --- 8) Send the frame to the consumer ---
+            trace.mark(Stage::Queued);
             let msg = LiveFrame {
                 ts_us,
                 width: w,
                 height: h,
                 pix_fmt,
                 data: bytes,
+                surface: None,
+                trace,
             };
 
-            if let Err(err) = out_tx.send((frame_index, msg)) {
-                eprintln!("[stream_reader] channel send err: {}", err);
+            if out_tx.send((frame_index, msg)).is_err() {
+                log::info!("[stream_reader] receiver gone, stopping");
+                return Ok(());
             }
 
             frame_index += 1;
@@ -2,9 +2,16 @@
 mod render_live;
 mod live_pix_fmt;
 mod fplay;
+mod frame_pool;
+mod rendering;
+mod hw_sink;
+mod render_nv12;
+mod latency;
+mod bench;
+mod render_multi;
 //mod render_map_kind;
 
-use std::io::{BufRead, BufReader};
+use std::io::{BufRead, BufReader, Read};
 use std::net::{TcpListener, TcpStream};
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Arc;
@@ -13,19 +20,20 @@ use std::time::Duration;
 
 
 
-use crossbeam_channel::{unbounded, Receiver, Sender};
+use crossbeam_channel::{unbounded, Receiver};
 use serde_json::json;
 use std::collections::BTreeMap;
 
 use gyroflow_core::gyro_source::FileMetadata;
-use gyroflow_core::gyro_source::live::LiveImuSample;
+use gyroflow_core::gyro_source::live::{LiveImuSample, ImuProducer};
 use gyroflow_core::stabilization_params::ReadoutDirection;
 use gyroflow_core::StabilizationManager;
 use gyroflow_core::stmap_live::{StmapsLive, LiveFrameJob};
 
 use crate::render_live::{LiveRenderConfig, render_live_loop};
+use crate::render_multi::{MultiStream, render_multi_loop};
 use crate::live_pix_fmt::{LiveFrame, PixelFormat, spawn_stream_reader};
-use std::sync::OnceLock;
+use std::cell::Cell;
 use std::path::Path;
 
 
@@ -35,6 +43,12 @@ const IMU_ADDR: &str = "127.0.0.1:7007";
 const MAX_QUEUE_WARN: usize = 50;
 const URL: &str = "C:\\git\\videos\\gyrovid.mp4"; // replace with your stream URL
 
+// Encoded output instead of ffplay, e.g. Some("srt://127.0.0.1:9000?mode=caller"), Some("rtp://127.0.0.1:5004") or Some("out.mp4").
+// The stream is then decoded to NV12 and stays NV12 up to the encoder
+const OUTPUT_URL: Option<&str> = None;
+// Decode with hwaccel when available. With NV12 output, CUDA and VideoToolbox frames go to the GPU undistort without a copy to system memory
+const HW_DECODE: bool = true;
+
 const FPS: f64 =  30.0;
 const WIDTH: usize = 2704;
 const HEIGHT: usize = 2028;
@@ -44,56 +58,134 @@ const load_file: bool = false; //set to true to load from file instead of imu st
 
 
 
+/// One camera: its video input, IMU server and output. Each stream has its own `StabilizationManager`.
+/// With more than one, all streams render in one thread on a shared wgpu device, see `render_multi`
+pub struct StreamConfig {
+    pub name: &'static str,
+    pub url: &'static str,
+    pub imu_addr: &'static str,
+    pub width: usize,
+    pub height: usize,
+    pub fps: f64,
+    pub output_url: Option<&'static str>,
+}
+
+// Add an entry per camera, e.g. { name: "cam1", url: "srt://...", imu_addr: "127.0.0.1:7017", .. }
+const STREAMS: &[StreamConfig] = &[
+    StreamConfig { name: "cam0", url: URL, imu_addr: IMU_ADDR, width: WIDTH, height: HEIGHT, fps: FPS, output_url: OUTPUT_URL },
+];
+
 const G_SCALE: f64 = 1.0;
 const A_SCALE: f64 = 1.0;
-static TSCALE: OnceLock<f64> = OnceLock::new();
+
+thread_local! {
+    // From the GCSV header. Per thread, because each IMU connection parses its header and samples on its own server thread
+    static TSCALE: Cell<Option<f64>> = const { Cell::new(None) };
+}
 
 pub fn set_tscale(val: f64) {
-    TSCALE.set(val).expect("TSCALE already set!");
+    TSCALE.with(|x| x.set(Some(val)));
 }
 
 pub fn get_tscale() -> f64 {
-    *TSCALE.get().expect("TSCALE not initialized yet!")
+    TSCALE.with(|x| x.get()).expect("TSCALE not initialized yet!")
+}
+
+pub fn has_tscale() -> bool {
+    TSCALE.with(|x| x.get()).is_some()
 }
 
 fn main() {
     
 
     env_logger::init();
+    // `live bench ...` replays a recorded session instead of listening for a stream, see bench.rs
+    if std::env::args().nth(1).as_deref() == Some("bench") {
+        if let Err(e) = bench::run(std::env::args().skip(2)) {
+            eprintln!("bench: {e}");
+            std::process::exit(1);
+        }
+        return;
+    }
+
+    // Stop flag
+    let stop = Arc::new(AtomicBool::new(false));
+
+    let multi = STREAMS.len() > 1;
+    if multi {
+        // One device and pipeline cache for all streams, so their frames can be submitted together
+        gyroflow_core::gpu::wgpu::WgpuWrapper::set_shared_device(true);
+    }
+    let streams: Vec<LiveStream> = STREAMS.iter().map(|cfg| start_stream(cfg, &stop, multi)).collect();
+    let managers: Vec<Arc<StabilizationManager>> = streams.iter().map(|s| Arc::clone(&s.stab_man)).collect();
+
+    let _render_thread = thread::spawn(move || {
+        if !multi {
+            let s = streams.into_iter().next().unwrap();
+            let mut cfg = LiveRenderConfig::new(s.cfg.fps);
+            cfg.output_url = s.cfg.output_url;
+            println!("waiting fosr metadata...");
+            s.meta_rx.recv().expect("Failed to receive metadata-ready signal");
+            println!("Starting render live loop");
+            render_live_loop(s.frame_rx, s.stab_man, cfg, PixelFormat::Rgba);
+        } else {
+            render_multi_loop(streams.into_iter().map(|s| {
+                let mut cfg = LiveRenderConfig::new(s.cfg.fps);
+                cfg.output_url = s.cfg.output_url;
+                MultiStream { name: s.cfg.name, stab_man: s.stab_man, frames_rx: s.frame_rx, meta_rx: s.meta_rx, cfg }
+            }).collect());
+        }
+    });
+
+    // Keep main alive; periodically integrate live data
+    if(!load_file){
+        loop {
+            for stab_man in &managers {
+                stab_man.gyro.write().integrate_live_data();
+            }
+            if stop.load(Ordering::Relaxed) {
+                break;
+            }
+                    thread::sleep(Duration::from_millis(INTEGRATE_PERIOD_MS));
+
+        }   
+    }else{
+        loop{
+            thread::sleep(Duration::from_millis(1000));
+        }
+    }
+    
+}
+
+struct LiveStream {
+    cfg: &'static StreamConfig,
+    stab_man: Arc<StabilizationManager>,
+    frame_rx: Receiver<(usize, LiveFrame)>,
+    meta_rx: Receiver<()>,
+}
+
+/// Starts the stream reader, and the IMU server of one camera.
+/// `meta_rx` fires once the GCSV header has been applied to the manager
+fn start_stream(stream: &'static StreamConfig, stop: &Arc<AtomicBool>, multi: bool) -> LiveStream {
     // Manager
     let stab_man = Arc::new(StabilizationManager::default());
-    let metadata: FileMetadata = FileMetadata::default();
     // Initialize from stream data (size + initial fps; can be overridden by header fps)
-    stab_man.init_from_stream_data(FPS, (WIDTH, HEIGHT));
- 
-    // Stop flag
-    let stop = Arc::new(AtomicBool::new(false));
+    stab_man.init_from_stream_data(stream.fps, (stream.width, stream.height));
 
     // Crossbeam channel (Sender, Receiver)
-    let (imu_tx, imu_rx) = unbounded::<LiveImuSample>();
     let (frame_tx, frame_rx) = unbounded::<(usize, LiveFrame)>();
     let (meta_tx, meta_rx) = unbounded::<()>();
     //create an stmap
     //let st_live: Arc<StmapsLive> = Arc::new(StmapsLive::new(Arc::clone(&stab_man)));
 
-    let stream_reader_thread =  spawn_stream_reader(URL, frame_tx.clone(), PixelFormat::Rgba, MAX_QUEUE_WARN, /*Arc::clone(&st_live)*/)
+    // The multi-stream renderer batches RGBA frames only
+    let stream_pix_fmt = if stream.output_url.is_some() && !multi { PixelFormat::Nv12 } else { PixelFormat::Rgba };
+    let _stream_reader_thread = spawn_stream_reader(stream.url, frame_tx.clone(), stream_pix_fmt, MAX_QUEUE_WARN, HW_DECODE, /*Arc::clone(&st_live)*/)
         .expect("failed to spawn stream reader thread");
 
-
-    
-    let cfg = LiveRenderConfig::new(FPS);
-
-    let value = Arc::clone(&stab_man);
-    let render_thread = thread::spawn(move || {
-        println!("waiting fosr metadata...");
-        meta_rx.recv().expect("Failed to receive metadata-ready signal");
-        println!("Starting render live loop");
-        render_live_loop(frame_rx, Arc::clone(&value), cfg, PixelFormat::Rgba);
-    });
-    
-
        // Prepare a callback that will be called once per client when the full GCSV header is received
     let stab_for_header = Arc::clone(&stab_man);
+    let (width, height) = (stream.width, stream.height);
     let header_cb: Arc<dyn Fn(&str) + Send + Sync> = Arc::new(move |header: &str| {
         
         let meta_tx = meta_tx.clone();
@@ -103,7 +195,7 @@ fn main() {
         log::info!("Parsed GCSV header into FileMetadata: {:?}", metadata.detected_source);
         println!("Parsed GCSV header into FileMetadata: {:?}", metadata.frame_readout_direction);
         // Initialize live stream with this metadata
-        let _ = stab_for_header.start_single_stream(metadata, 3.0, 1.0, 0.0, (WIDTH, HEIGHT), (WIDTH, HEIGHT), Path::new(load_file_path), load_file);
+        let _ = stab_for_header.start_single_stream(metadata, 3.0, 1.0, 0.0, (width, height), (width, height), Path::new(load_file_path), load_file);
         
         println!("metadata loaded into stabilizer");
 
@@ -111,64 +203,60 @@ fn main() {
         let _ = meta_tx.send(());
     });
 
-    // Spawn server thread (binds and waits for generator to connect and write)
-    spawn_line_server::<LiveImuSample>(
-        "imu server",
-        IMU_ADDR,
-        imu_tx,
-        Arc::clone(&stop),
+    // Spawn server thread (binds and waits for generator to connect and write). The samples go straight from the
+    // socket thread into GyroSource, a whole read buffer at a time
+    let mut imu_sink = ImuSink { stab: Arc::clone(&stab_man), producer: None };
+    spawn_line_server::<LiveImuSample, _>(
+        stream.name,
+        stream.imu_addr,
+        move |batch| imu_sink.push(batch),
+        Arc::clone(stop),
         Some(header_cb),
         parse_imu_line,
+        Some((IMU_RECORD_SIZE, parse_imu_record)),
     );
 
+    LiveStream { cfg: stream, stab_man, frame_rx, meta_rx }
+}
+
+/// Hands IMU samples to GyroSource through its lock-free ingest queue.
+/// The GyroSource lock is only taken to get the producer once live mode is enabled (after the header)
+struct ImuSink {
+    stab: Arc<StabilizationManager>,
+    producer: Option<ImuProducer>,
+}
 
-    // Spawn consumer thread: pull samples from channel and push into GyroSource
-
-    {
-        let mut counter: i64 = 0;
-        let stab = Arc::clone(&stab_man);
-        thread::spawn(move || {
-            while let Ok(imu_sample) = imu_rx.recv() {
-                 
-                let LiveImuSample { ts_sensor_us, .. } = imu_sample;
-                // If you have a video clock, pass it; reusing sensor time for now
-                let now_video_us = ts_sensor_us;
-                //println!("Received IMU sample at ts_sensor_us={}", imu_sample);
-                //working :)
-                let mut g = stab.gyro.write();
-                g.push_live_imu(imu_sample, now_video_us);
-                if(counter%1000==0) {println!("IMU sample: {:?}", imu_sample);} 
-                counter+=1;
+impl ImuSink {
+    fn push(&mut self, batch: &[LiveImuSample]) {
+        if !self.producer.as_ref().map(|p| p.is_attached()).unwrap_or_default() {
+            self.producer = self.stab.gyro.read().live_imu_producer();
+        }
+        match self.producer.as_mut() {
+            Some(p) => {
+                let pushed = p.push_slice(batch);
+                if pushed < batch.len() { log::warn!("IMU ingest queue full, dropped {} samples", batch.len() - pushed); }
             }
-        });
-    }
-    // Keep main alive; periodically integrate live data
-    if(!load_file){
-        loop {
-            stab_man.gyro.write().integrate_live_data();
-            if stop.load(Ordering::Relaxed) {
-                break;
+            None => {
+                // Live mode not enabled yet, fall back to the locked path
+                let g = self.stab.gyro.read();
+                for s in batch {
+                    g.push_live_imu(*s, s.ts_sensor_us);
+                }
             }
-                    thread::sleep(Duration::from_millis(INTEGRATE_PERIOD_MS));
-
-        }   
-    }else{
-        loop{
-            thread::sleep(Duration::from_millis(1000));
         }
     }
-    
 }
 
 /// TCP line **server**: bind(addr) and accept() clients; for each client,
-/// read lines, parse with `parse_line`, and send to `tx`.
-fn spawn_line_server<T: Send + 'static>(
+/// read lines, parse with `parse_line`, and pass them to `sink`.
+fn spawn_line_server<T: Send + 'static, F: FnMut(&[T]) + Send + 'static>(
     name: &'static str,
     addr: &'static str,
-    tx: Sender<T>,
+    mut sink: F,
     stop: Arc<AtomicBool>,
     on_header: Option<Arc<dyn Fn(&str) + Send + Sync>>,
     parse_line: fn(&str) -> Option<T>,
+    parse_record: Option<(usize, fn(&[u8]) -> Option<T>)>,
 ) {
  {
     thread::Builder::new()
@@ -198,10 +286,11 @@ fn spawn_line_server<T: Send + 'static>(
                         if let Err(e) = handle_client(
                             name,
                             stream.try_clone().unwrap(),
-                            &tx,
+                            &mut sink,
                             &stop,
                             on_header.clone(),
                             parse_line,
+                            parse_record,
                         ) {
                             eprintln!("[{name}] client handler error: {e}");
                         }
@@ -220,30 +309,38 @@ fn spawn_line_server<T: Send + 'static>(
  }
 }
 
-/// Handle a single connected client: read lines → parse → send
+/// Handle a single connected client: read lines → parse → sink
+///
+/// If the header contains a `framing,binary` line and `parse_record` is set, everything after the
+/// "t,..." line is read as fixed-size binary records instead of text lines
 fn handle_client<T: Send>(
     name: &str,
     stream: TcpStream,
-    tx: &Sender<T>,
+    sink: &mut dyn FnMut(&[T]),
     stop: &Arc<AtomicBool>,
     on_header: Option<Arc<dyn Fn(&str) + Send + Sync>>,
     parse_line: fn(&str) -> Option<T>,
+    parse_record: Option<(usize, fn(&[u8]) -> Option<T>)>,
 ) -> std::io::Result<()> {
        stream.set_read_timeout(Some(Duration::from_millis(500)))?;
-    let reader = BufReader::new(stream);
+    let mut reader = BufReader::new(stream);
 
     // Header state: we collect lines until we hit the "t,..." line
     let mut in_header = on_header.is_some();
     let mut header_buf = String::new();
+    let mut binary = false;
+    let mut line = String::new();
 
-    for maybe_line in reader.lines() {
+    while !binary {
         if stop.load(Ordering::Relaxed) {
             eprintln!("[{name}] stop requested");
-            break;
+            return Ok(());
         }
-        match maybe_line {
-            Ok(l) => {
-                let line_trimmed = l.trim();
+        line.clear();
+        match reader.read_line(&mut line) {
+            Ok(0) => return Ok(()), // EOF
+            Ok(_) => {
+                let line_trimmed = line.trim();
                 if in_header {
                     // Accumulate header lines (including "GYROFLOW IMU LOG", version, etc.)
                     header_buf.push_str(line_trimmed);
@@ -252,6 +349,7 @@ fn handle_client<T: Send>(
                     // End of header is the column header line "t,..." (e.g. "t,gx,gy,gz,ax,ay,az")
                     if line_trimmed.starts_with("t,") {
                         in_header = false;
+                        binary = parse_record.is_some() && header_buf.lines().any(|l| l.trim() == "framing,binary");
 
                         if let Some(cb) = &on_header {
                             // Remove trailing newline for cleanliness
@@ -266,10 +364,7 @@ fn handle_client<T: Send>(
 
                 // After header: normal IMU data lines
                 if let Some(msg) = parse_line(line_trimmed) {
-                    if tx.send(msg).is_err() {
-                        eprintln!("[{name}] main loop dropped; exiting client handler");
-                        break;
-                    }
+                    sink(std::slice::from_ref(&msg));
                 }
             }
             Err(e) => {
@@ -285,9 +380,76 @@ fn handle_client<T: Send>(
         }
     }
 
+    // Binary records: read whatever is available, decode all complete records in one go and hand them over as one batch.
+    // The BufReader still holds any bytes that arrived together with the header
+    let (record_size, parse_record) = parse_record.unwrap();
+    eprintln!("[{name}] binary framing, {record_size} byte records");
+    let mut buf = vec![0u8; record_size * 2048];
+    let mut batch = Vec::with_capacity(2048);
+    let mut filled = 0;
+    while !stop.load(Ordering::Relaxed) {
+        match reader.read(&mut buf[filled..]) {
+            Ok(0) => break, // EOF
+            Ok(n) => {
+                filled += n;
+                let complete = filled - filled % record_size;
+                batch.clear();
+                batch.extend(buf[..complete].chunks_exact(record_size).filter_map(parse_record));
+                if !batch.is_empty() {
+                    sink(&batch);
+                }
+                buf.copy_within(complete..filled, 0);
+                filled -= complete;
+            }
+            Err(e) => {
+                if e.kind() == std::io::ErrorKind::WouldBlock
+                    || e.kind() == std::io::ErrorKind::TimedOut
+                    || e.kind() == std::io::ErrorKind::Interrupted
+                {
+                    continue;
+                } else {
+                    return Err(e);
+                }
+            }
+        }
+    }
+
     Ok(())
 }
 
+/// Size of one binary IMU record: `t` as f64 (same units as the text `t` column, scaled by `tscale`),
+/// then gx, gy, gz, ax, ay, az as f32. All little-endian
+const IMU_RECORD_SIZE: usize = 8 + 6 * 4;
+
+fn parse_imu_record(r: &[u8]) -> Option<LiveImuSample> {
+    let f = |i: usize| f32::from_le_bytes(r[8 + i * 4..12 + i * 4].try_into().unwrap()) as f64;
+    let raw_t = f64::from_le_bytes(r[0..8].try_into().ok()?);
+    if !raw_t.is_finite() { return None; }
+    Some(make_imu_sample(raw_t, [f(0), f(1), f(2)], [f(3), f(4), f(5)]))
+}
+
+/// Converts the raw `t` column to µs with the header's tscale and applies the gyro/accel scales
+fn make_imu_sample(raw_t: f64, g: [f64; 3], a: [f64; 3]) -> LiveImuSample {
+    // 1. Apply tscale (global multiplier)
+    let us: f64 = 0.000001; // 1 microsecond in seconds
+    let scaler: f64 = get_tscale() / us;
+    let scaled = raw_t * scaler;
+
+    // 2. Clamp into i64 inte
+    let ts_sensor_us = scaled
+        .clamp(i64::MIN as f64, i64::MAX as f64)
+        .round() as i64;
+
+    // If your sender used scale factors (gscale/ascale), multiply here; for now = 1.0
+    const GSCALE: f64 = G_SCALE;
+    const ASCALE: f64 = A_SCALE;
+
+    let gyro = [g[0] * GSCALE, g[1] * GSCALE, g[2] * GSCALE];
+    let accel = Some([a[0] * ASCALE, a[1] * ASCALE, a[2] * ASCALE]);
+
+    LiveImuSample { ts_sensor_us, gyro, accel }
+}
+
 /// Simple parser that accepts "t,gx,gy,gz,ax,ay,az"
 /// - If `t` is large (>= 1e12), treat as nanoseconds and convert to microseconds
 /// - Otherwise treat `t` as a sample index and synthesize µs with a fixed sample period
@@ -309,31 +471,10 @@ fn parse_imu_line(line: &str) -> Option<LiveImuSample> {
   
     //println!("Parsed IMU line: t={} gx={} gy={} gz={} ax={} ay={} az={}", t_str, gx, gy, gz, ax, ay, az);
 
-    // auto-detect time column
-    // 1. Parse to f64 because we want to apply scaling
+    // Parse to f64 because we want to apply scaling
     let raw_val = t_str.parse::<f64>().ok()?;
 
-
-    // 2. Apply tscale (global multiplier)
-    let us: f64 = 0.000001; // 1 microsecond in seconds
-    let scaler: f64 = get_tscale() / us;
-    let scaled = raw_val * scaler;
-
-    // 3. Clamp into i64 inte
-    let clamped = scaled
-        .clamp(i64::MIN as f64, i64::MAX as f64)
-        .round() as i64;
-
-    let ts_sensor_us = clamped;
-
-    // If your sender used scale factors (gscale/ascale), multiply here; for now = 1.0
-    const GSCALE: f64 = G_SCALE;
-    const ASCALE: f64 = A_SCALE;
-
-    let gyro = [gx * GSCALE, gy * GSCALE, gz * GSCALE];
-    let accel = Some([ax * ASCALE, ay * ASCALE, az * ASCALE]);
-
-    Some(LiveImuSample { ts_sensor_us, gyro, accel })
+    Some(make_imu_sample(raw_val, [gx, gy, gz], [ax, ay, az]))
 }
 
 /// Parse Gyroflow-style header text → FileMetadata (used if you send the header)
@@ -4,9 +4,13 @@ use log::{debug, info, warn, trace};
 use std::time::{Duration, Instant};
 use once_cell::sync::OnceCell;
 use gyroflow_core::StabilizationManager;
-use crate::live_pix_fmt::{LiveFrame, PixelFormat};
-use gyroflow_core::stmap_live::StmapItem;
+use crate::live_pix_fmt::{LiveFrame, PixelFormat, rgb24_to_rgba, rgba_to_rgb24};
+use crate::frame_pool::frame_pool;
+use gyroflow_core::stmap_live::{LiveStmap, StmapItem};
 use crate::fplay;
+use crate::hw_sink::{HwSink, SinkProps};
+use crate::render_nv12::Nv12Stabilizer;
+use crate::latency::{self, Stage, TraceGuard};
 use crate::Arc;
 use gyroflow_core::stabilization::pixel_formats::{RGB8, RGBA8};
 
@@ -15,6 +19,8 @@ pub struct LiveRenderConfig {
     pub wait_for_map_timeout: Duration,
     pub trim_before_idx: bool,
     pub present_fps: f64,
+    pub output_url: Option<&'static str>, // encode in-process to this file/URL instead of sending raw frames to ffplay
+    pub output_bitrate_mbps: f64,
 }
 
 impl Default for LiveRenderConfig {
@@ -23,6 +29,8 @@ impl Default for LiveRenderConfig {
             wait_for_map_timeout: Duration::from_millis(8),
             trim_before_idx: true,
             present_fps: 30.0,
+            output_url: None,
+            output_bitrate_mbps: 10.0,
         }
     }
 
@@ -36,24 +44,26 @@ impl LiveRenderConfig {
             wait_for_map_timeout: Duration::from_millis(8),
             trim_before_idx: true,
             present_fps: present_fps as f64,
+            output_url: None,
+            output_bitrate_mbps: 10.0,
         }
     }
 }
 
 struct MapCache {
     start_idx: usize,
-    buf: Vec<Option<(Vec<u8>, Vec<u8>)>>,
+    buf: Vec<Option<(LiveStmap, LiveStmap)>>,
 }
 
 impl MapCache {
     fn new() -> Self { Self { start_idx: 0, buf: Vec::new() } }
-    fn insert(&mut self, idx: usize, dist: Vec<u8>, undist: Vec<u8>) {
+    fn insert(&mut self, idx: usize, dist: LiveStmap, undist: LiveStmap) {
         if idx < self.start_idx { return; }
         let pos = idx - self.start_idx;
         if pos >= self.buf.len() { self.buf.resize(pos + 1, None); }
         self.buf[pos] = Some((dist, undist));
     }
-    fn take(&mut self, idx: usize) -> Option<(Vec<u8>, Vec<u8>)> {
+    fn take(&mut self, idx: usize) -> Option<(LiveStmap, LiveStmap)> {
         if idx < self.start_idx { return None; }
         let pos = idx - self.start_idx;
         if pos >= self.buf.len() { return None; }
@@ -69,14 +79,14 @@ impl MapCache {
     }
 }
 
-fn identity_map_fallback(_w: u32, _h: u32) -> Option<(Vec<u8>, Vec<u8>)> { None }
+fn identity_map_fallback(_w: u32, _h: u32) -> Option<(LiveStmap, LiveStmap)> { None }
 
 fn drain_maps_until(
     maps_rx: &Receiver<StmapItem>,
     cache: &mut MapCache,
     wanted_idx: usize,
     deadline: Instant,
-) -> Option<(Vec<u8>, Vec<u8>)> {
+) -> Option<(LiveStmap, LiveStmap)> {
     loop {
         if Instant::now() >= deadline { return None; }
         let left = deadline.saturating_duration_since(Instant::now());
@@ -91,13 +101,6 @@ fn drain_maps_until(
     }
 }
 
-fn checksum(buf: &[u8]) -> u64 {
-    use std::hash::{Hash, Hasher};
-    let mut h = std::collections::hash_map::DefaultHasher::new();
-    buf.hash(&mut h);
-    h.finish()
-}
-
 pub fn render_live_loop(
     frames_rx: Receiver<(usize, LiveFrame)>,
     stab_man: Arc<StabilizationManager>,
@@ -106,80 +109,96 @@ pub fn render_live_loop(
 ) {
     println!("render_live: start");
     let mut initialized = false;
+    let mut sink: Option<HwSink> = None;
+    let mut nv12: Option<Nv12Stabilizer> = None;
 
-    while let Ok((_frame_idx, frame)) = frames_rx.recv() {
+    while let Ok((_frame_idx, mut frame)) = frames_rx.recv() {
 
         
         let (w, h) = frame.get_size();
         let ts_us = frame.ts_us();
         let ts_ms = ts_us as f64 / 1000.0;
+        // Recorded when dropped at the end of the iteration, only if the frame got presented
+        let mut trace = TraceGuard::new(frame.trace);
+        trace.mark(Stage::RenderIn);
+        trace.set_imu_lag_with(|| stab_man.gyro.read().live_latest_quat_us().map(|q| ts_us - q));
         stab_man.live_on_new_frame(_frame_idx, ts_ms, 1);
         
-        // Initialize stab + ffplay once we know the actual frame size
+        // Initialize stab + output once we know the actual frame size
         if !initialized {
             
             stab_man.set_render_params((w as usize, h as usize), (w as usize, h as usize));
             log::info!("Live stabilization initialized for {}x{}", w, h);
 
+            if let Some(url) = cfg.output_url {
+                let props = SinkProps { width: w, height: h, fps: cfg.present_fps, bitrate_mbps: cfg.output_bitrate_mbps, ..Default::default() };
+                match HwSink::open(url, &props) {
+                    Ok(s) => {
+                        log::info!("render_live: encoding to {url} with {}", s.encoder_name());
+                        sink = Some(s);
+                    }
+                    Err(e) => eprintln!("Failed to open output {url}: {e:?}, falling back to ffplay"),
+                }
+            }
+
             // init ffplay with the chosen display format (Rgb24 or Rgba)
-            if let Err(e) = fplay::init_ffplay(w, h, cfg.present_fps, display_pix_fmt) {
-                eprintln!("Failed to init ffplay: {e:?}");
-                return;
+            if sink.is_none() {
+                if let Err(e) = fplay::init_ffplay(w, h, cfg.present_fps, display_pix_fmt) {
+                    eprintln!("Failed to init ffplay: {e:?}");
+                    return;
+                }
             }
 
             initialized = true;
         }
 
+        // The input is stabilized in place from the decoded frame, the output and the display conversion
+        // come from the shared pool and go back to it at the end of the iteration
+        let (w_usize, h_usize) = (w as usize, h as usize);
         match frame.pix_fmt {
             PixelFormat::Rgb24 => {
                 // -------- RGB24 input path --------
-                let input_rgb = frame.as_rgb24();
-                if input_rgb.len() != (w as usize) * (h as usize) * 3 {
+                if frame.as_rgb24().len() != w_usize * h_usize * 3 {
                     eprintln!(
                         "render_live: bad RGB24 buffer size: got {}, expected {}",
-                        input_rgb.len(),
-                        (w as usize) * (h as usize) * 3
+                        frame.as_rgb24().len(),
+                        w_usize * h_usize * 3
                     );
                     continue;
                 }
 
-                let mut input_rgb_vec = input_rgb.to_vec();
-                let mut output_rgb = vec![0u8; (w as usize) * (h as usize) * 3];
-
-                let _in_before  = checksum(&input_rgb_vec);
-                let _out_before = checksum(&output_rgb);
-
-                let mut buffers = buffers_from_live_frame_rgb24(&frame, input_rgb_vec.as_mut_slice(), &mut output_rgb);
+                let mut output_rgb = frame_pool().take(w_usize * h_usize * 3);
+                let mut buffers = buffers_from_live_frame_rgb24(&mut frame, &mut output_rgb);
 
                 match stab_man.process_pixels::<RGB8>(ts_us, None, &mut buffers) {
-                    Ok(info) => {
-                        let _out_after = checksum(&output_rgb);
-                        
-
+                    Ok(_info) => {
+                        trace.mark(Stage::Processed);
+                        if let Some(sink) = sink.as_mut() {
+                            if let Err(e) = sink.push_packed(&output_rgb, PixelFormat::Rgb24, ts_us) {
+                                eprintln!("HwSink::push_packed failed (RGB24): {e:?}");
+                            } else {
+                                trace.mark(Stage::Presented);
+                            }
+                            continue;
+                        }
                         // Decide how to send, based on display_pix_fmt
                         match display_pix_fmt {
                             PixelFormat::Rgb24 => {
                                 if let Err(e) = fplay::push_frame(&output_rgb) {
                                     eprintln!("fplay::push_frame failed (RGB24->RGB24): {e:?}");
+                                } else {
+                                    trace.mark(Stage::Presented);
                                 }
                             }
                             PixelFormat::Rgba => {
                                 // Convert RGB24 -> RGBA for display
-                                let w_usize = w as usize;
-                                let h_usize = h as usize;
-                                let mut output_rgba = vec![0u8; w_usize * h_usize * 4];
-
-                                for i in 0..(w_usize * h_usize) {
-                                    let src = i * 3;
-                                    let dst = i * 4;
-                                    output_rgba[dst    ] = output_rgb[src    ];
-                                    output_rgba[dst + 1] = output_rgb[src + 1];
-                                    output_rgba[dst + 2] = output_rgb[src + 2];
-                                    output_rgba[dst + 3] = 255;
-                                }
+                                let mut output_rgba = frame_pool().take(w_usize * h_usize * 4);
+                                rgb24_to_rgba(&output_rgb, &mut output_rgba);
 
                                 if let Err(e) = fplay::push_frame(&output_rgba) {
                                     eprintln!("fplay::push_frame failed (RGB24->RGBA): {e:?}");
+                                } else {
+                                    trace.mark(Stage::Presented);
                                 }
                             }
                             PixelFormat::Nv12 => {
@@ -196,49 +215,47 @@ pub fn render_live_loop(
 
             PixelFormat::Rgba => {
                 // -------- RGBA input path --------
-                
-                let input_rgba = frame.as_rgba();
-                if input_rgba.len() != (w as usize) * (h as usize) * 4 {
+                if frame.as_rgba().len() != w_usize * h_usize * 4 {
                     eprintln!(
                         "render_live: bad RGBA buffer size: got {}, expected {}",
-                        input_rgba.len(),
-                        (w as usize) * (h as usize) * 4
+                        frame.as_rgba().len(),
+                        w_usize * h_usize * 4
                     );
                     continue;
                 }
 
-                let mut input_rgba_vec = input_rgba.to_vec();
-                let mut output_rgba = vec![0u8; (w as usize) * (h as usize) * 4];
-
-                let mut buffers = buffers_from_live_frame_rgba(&frame, input_rgba_vec.as_mut_slice(), &mut output_rgba);
+                let mut output_rgba = frame_pool().take(w_usize * h_usize * 4);
+                let mut buffers = buffers_from_live_frame_rgba(&mut frame, &mut output_rgba);
 
                 match stab_man.process_pixels::<RGBA8>(ts_us, None, &mut buffers) {
-                    Ok(info) => {
-                        
-
+                    Ok(_info) => {
+                        trace.mark(Stage::Processed);
+                        if let Some(sink) = sink.as_mut() {
+                            if let Err(e) = sink.push_packed(&output_rgba, PixelFormat::Rgba, ts_us) {
+                                eprintln!("HwSink::push_packed failed (RGBA): {e:?}");
+                            } else {
+                                trace.mark(Stage::Presented);
+                            }
+                            continue;
+                        }
                         match display_pix_fmt {
                             PixelFormat::Rgba => {
                                 // Already RGBA, send directly
                                 if let Err(e) = fplay::push_frame(&output_rgba) {
                                     eprintln!("fplay::push_frame failed (RGBA->RGBA): {e:?}");
+                                } else {
+                                    trace.mark(Stage::Presented);
                                 }
                             }
                             PixelFormat::Rgb24 => {
                                 // Convert RGBA -> RGB24 (drop alpha)
-                                let w_usize = w as usize;
-                                let h_usize = h as usize;
-                                let mut output_rgb = vec![0u8; w_usize * h_usize * 3];
-
-                                for i in 0..(w_usize * h_usize) {
-                                    let src = i * 4;
-                                    let dst = i * 3;
-                                    output_rgb[dst    ] = output_rgba[src    ];
-                                    output_rgb[dst + 1] = output_rgba[src + 1];
-                                    output_rgb[dst + 2] = output_rgba[src + 2];
-                                }
+                                let mut output_rgb = frame_pool().take(w_usize * h_usize * 3);
+                                rgba_to_rgb24(&output_rgba, &mut output_rgb);
 
                                 if let Err(e) = fplay::push_frame(&output_rgb) {
                                     eprintln!("fplay::push_frame failed (RGBA->RGB24): {e:?}");
+                                } else {
+                                    trace.mark(Stage::Presented);
                                 }
                             }
                             PixelFormat::Nv12 => {
@@ -254,25 +271,48 @@ pub fn render_live_loop(
             }
 
             PixelFormat::Nv12 => {
-                eprintln!(
-                    "render_live: received NV12 frame ({}x{}), but NV12 is not yet handled in render_live_loop. \
-                     Choose Rgb24 or Rgba as stream target format if you want stabilization.",
-                    w, h
-                );
-                continue;
+                // -------- NV12 input path, only with an encoded output (ffplay takes packed RGB) --------
+                let Some(sink) = sink.as_mut() else {
+                    eprintln!("render_live: received NV12 frame ({}x{}), but NV12 needs an output_url. Choose Rgb24 or Rgba for ffplay.", w, h);
+                    continue;
+                };
+                let nv12 = nv12.get_or_insert_with(|| Nv12Stabilizer::new(&stab_man, (w_usize, h_usize)));
+                nv12.update_params(&stab_man);
+
+                let mut output_nv12 = frame_pool().take(w_usize * h_usize + w_usize * (h_usize / 2));
+                let result = match frame.surface.as_mut() {
+                    Some(surface) => nv12.process_surface(&stab_man, ts_us, surface, &mut output_nv12),
+                    None => nv12.process(&stab_man, ts_us, frame.as_nv12_mut(), &mut output_nv12),
+                };
+                if let Err(e) = result {
+                    eprintln!("Stabilization failed at ts_us={ts_us} (NV12): {e}");
+                    continue;
+                }
+                trace.mark(Stage::Processed);
+                if let Err(e) = sink.push_nv12(&output_nv12, ts_us) {
+                    eprintln!("HwSink::push_nv12 failed: {e:?}");
+                } else {
+                    trace.mark(Stage::Presented);
+                }
             }
         }
     }
 
+    latency::dump();
+    if let Some(mut sink) = sink.take() {
+        if let Err(e) = sink.finish() {
+            eprintln!("HwSink::finish failed: {e:?}");
+        }
+    }
     log::info!("render_live: exit");
     //fplay::shutdown_ffplay();
 }
 
 // ------------------------ buffer helpers ------------------------
 
+/// Describes the frame's own data as the input, so the stabilizer reads it in place
 fn buffers_from_live_frame_rgb24<'a>(
-    frame: &'a LiveFrame,
-    input_rgb: &'a mut [u8],
+    frame: &'a mut LiveFrame,
     output_rgb: &'a mut [u8],
 ) -> Buffers<'a> {
     let (w, h) = frame.get_size();
@@ -280,14 +320,11 @@ fn buffers_from_live_frame_rgb24<'a>(
     let h_usize = h as usize;
     let stride = w_usize * 3; // RGB24: 3 bytes per pixel
 
-    let src = frame.as_rgb24();
-    input_rgb[..src.len()].copy_from_slice(src);
-
     let input_desc = BufferDescription {
         size: (w_usize, h_usize, stride),
         rect: None,
         rotation: None,
-        data: BufferSource::Cpu { buffer: input_rgb },
+        data: BufferSource::Cpu { buffer: frame.as_rgb24_mut() },
         texture_copy: false,
     };
 
@@ -302,9 +339,8 @@ fn buffers_from_live_frame_rgb24<'a>(
     Buffers { input: input_desc, output: output_desc }
 }
 
-fn buffers_from_live_frame_rgba<'a>(
-    frame: &'a LiveFrame,
-    input_rgba: &'a mut [u8],
+pub(crate) fn buffers_from_live_frame_rgba<'a>(
+    frame: &'a mut LiveFrame,
     output_rgba: &'a mut [u8],
 ) -> Buffers<'a> {
     let (w, h) = frame.get_size();
@@ -312,14 +348,11 @@ fn buffers_from_live_frame_rgba<'a>(
     let h_usize = h as usize;
     let stride = w_usize * 4; // RGBA: 4 bytes per pixel
 
-    let src = frame.as_rgba();
-    input_rgba[..src.len()].copy_from_slice(src);
-
     let input_desc = BufferDescription {
         size: (w_usize, h_usize, stride),
         rect: None,
         rotation: None,
-        data: BufferSource::Cpu { buffer: input_rgba },
+        data: BufferSource::Cpu { buffer: frame.as_rgba_mut() },
         texture_copy: false,
     };
 
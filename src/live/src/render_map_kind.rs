@@ -1,7 +1,5 @@
-use exr::prelude::*;
-use std::io::Cursor;
 use crate::live_pix_fmt::{LiveFrame, LivePixFmt};
-use exr::image::pixel_vec::PixelVec;
+use gyroflow_core::stmap_live::LiveStmap;
 
 #[derive(Clone, Copy, Debug)]
 pub enum RenderMapKind { Distort, Undistort }
@@ -11,50 +9,6 @@ fn clamp(v: f32, lo: f32, hi: f32) -> f32 {
     if v < lo { lo } else if v > hi { hi } else { v }
 }
 
-type RgbaF32 = (f32, f32, f32, f32);
-
-fn decode_stmap_from_exr(
-    exr_bytes: &[u8],
-    out_w: usize,
-    out_h: usize,
-) -> Option<(usize, usize, Vec<f32>)> {
-    // Read first RGBA layer, largest res, from &[u8] into PixelVec<(f32,f32,f32,f32)>
-    let img: exr::image::RgbaImage<PixelVec<RgbaF32>> =
-        exr::image::read::read()
-            .no_deep_data()
-            .largest_resolution_level()
-            .rgba_channels(
-                PixelVec::<RgbaF32>::constructor, // allocate pixel storage
-                PixelVec::<RgbaF32>::set_pixel,    // write a pixel
-            )
-            .first_valid_layer()
-            .all_attributes()
-            .from_buffered(Cursor::new(exr_bytes))
-            .ok()?; // Option<_>
-
-    let src_w = img.layer_data.size.x();
-    let src_h = img.layer_data.size.y();
-
-    let w = out_w.max(src_w);
-    let h = out_h.max(src_h);
-
-    // Flattened RGBA tuples live here:
-    let pixels: &[(f32,f32,f32,f32)] = &img.layer_data.channel_data.pixels.pixels;
-
-    let mut coords = vec![0.0f32; w * h * 2];
-    for (i, &(r, g, _b, _a)) in pixels.iter().enumerate() {
-        let x_src = i % src_w;
-        let y_src = i / src_w;
-        if x_src < w && y_src < h {
-            let idx = y_src * w + x_src;
-            coords[idx * 2]     = r * w as f32;           // X = R * width
-            coords[idx * 2 + 1] = (1.0 - g) * h as f32;   // Y = (1-G) * height
-        }
-    }
-
-    Some((w, h, coords))
-}
-
 fn bilinear_sample_rgb24(src: &[u8], w: usize, h: usize, u: f32, v: f32) -> [u8; 4] {
     if w == 0 || h == 0 { return [0,0,0,255]; }
     let u = clamp(u, 0.0, (w as f32) - 1.0);
@@ -116,14 +70,17 @@ fn rgba_to_rgb(rgba: &[u8], rgb: &mut [u8]) {
 
 pub fn render_with_maps_to_rgb24(
     frame: &LiveFrame,
-    dist_exr: &[u8],
-    undist_exr: &[u8],
+    dist: &LiveStmap,
+    undist: &LiveStmap,
     which: RenderMapKind,
 ) -> Option<(u32, u32, Vec<u8>)> {
-    let (map_w, map_h, coords) = match which {
-        RenderMapKind::Undistort => decode_stmap_from_exr(undist_exr, frame.width as usize, frame.height as usize)?,
-        RenderMapKind::Distort => decode_stmap_from_exr(dist_exr, frame.width as usize, frame.height as usize)?,
+    // The maps already hold the coordinates in input pixels, no decoding needed
+    let map = match which {
+        RenderMapKind::Undistort => undist,
+        RenderMapKind::Distort => dist,
     };
+    if map.is_empty() { return None; }
+    let (map_w, map_h, coords) = (map.width, map.height, &map.coords[..]);
     let mut out_rgba = vec![0u8; map_w * map_h * 4];
     match frame.pix_fmt {
         LivePixFmt::Rgb24 => {
@@ -0,0 +1,185 @@
+use std::sync::Arc;
+use std::time::Duration;
+use crossbeam_channel::{Receiver, Select, TryRecvError};
+use gyroflow_core::StabilizationManager;
+use gyroflow_core::stabilization::pixel_formats::RGBA8;
+use crate::live_pix_fmt::{LiveFrame, PixelFormat};
+use crate::frame_pool::{frame_pool, PooledBuffer};
+use crate::fplay;
+use crate::hw_sink::{HwSink, SinkProps};
+use crate::latency::{self, Stage, TraceGuard};
+use crate::render_live::{LiveRenderConfig, buffers_from_live_frame_rgba};
+
+const IDLE_TIMEOUT: Duration = Duration::from_millis(100);
+
+/// One camera of a multi-stream rig, with its own stabilization state and output
+pub struct MultiStream {
+    pub name: &'static str,
+    pub stab_man: Arc<StabilizationManager>,
+    pub frames_rx: Receiver<(usize, LiveFrame)>,
+    pub meta_rx: Receiver<()>,
+    pub cfg: LiveRenderConfig,
+}
+
+struct StreamState {
+    stream: MultiStream,
+    ready: bool,  // GCSV header received
+    ended: bool,  // stream reader gone
+    initialized: bool,
+    sink: Option<HwSink>,
+    ffplay: bool, // this stream owns the ffplay window
+    dropped: u64,
+}
+
+struct PendingFrame {
+    stream: usize,
+    idx: usize,
+    ts_us: i64,
+    frame: LiveFrame,
+    output: PooledBuffer,
+    trace: TraceGuard,
+}
+
+/// Render loop for several streams in one thread. Every tick takes the newest frame of each stream (older ones are
+/// dropped, a camera that falls behind shouldn't hold back the others) and stabilizes all of them in one
+/// `StabilizationManager::process_pixels_batch` call, so on the shared wgpu device all undistort passes go in one
+/// command buffer. Frames are RGBA, each stream is encoded to its own `output_url`, and at most one stream without an
+/// output goes to ffplay
+pub fn render_multi_loop(streams: Vec<MultiStream>) {
+    println!("render_multi: start with {} streams", streams.len());
+    let mut states: Vec<StreamState> = streams.into_iter().map(|stream| StreamState {
+        stream, ready: false, ended: false, initialized: false, sink: None, ffplay: false, dropped: 0
+    }).collect();
+    let mut ffplay_taken = false;
+
+    while states.iter().any(|s| !s.ended) {
+        // Wait for a frame from any stream that has its metadata, or for the metadata of the others
+        let (i, received) = {
+            let mut sel = Select::new();
+            let mut ops = Vec::new(); // stream index of each select operation
+            for (i, s) in states.iter().enumerate().filter(|(_, s)| !s.ended) {
+                if s.ready { sel.recv(&s.stream.frames_rx); } else { sel.recv(&s.stream.meta_rx); }
+                ops.push(i);
+            }
+            match sel.select_timeout(IDLE_TIMEOUT) {
+                Ok(oper) => {
+                    let i = ops[oper.index()];
+                    let s = &states[i];
+                    if s.ready { (i, oper.recv(&s.stream.frames_rx).map(Some)) } else { (i, oper.recv(&s.stream.meta_rx).map(|_| None)) }
+                }
+                Err(_) => continue,
+            }
+        };
+        let mut newest: Vec<Option<(usize, LiveFrame)>> = (0..states.len()).map(|_| None).collect();
+        match received {
+            Ok(Some(frame)) => newest[i] = Some(frame),
+            Ok(None) => { states[i].ready = true; log::info!("render_multi: {} metadata ready", states[i].stream.name); }
+            Err(_) => states[i].ended = true,
+        }
+
+        // Catch up on everything else that's already queued
+        for (i, s) in states.iter_mut().enumerate().filter(|(_, s)| s.ready && !s.ended) {
+            loop {
+                match s.stream.frames_rx.try_recv() {
+                    Ok(frame) => {
+                        if newest[i].replace(frame).is_some() { s.dropped += 1; }
+                    }
+                    Err(TryRecvError::Empty) => break,
+                    Err(TryRecvError::Disconnected) => { s.ended = true; break; }
+                }
+            }
+        }
+
+        let mut pending = Vec::new();
+        for (i, frame) in newest.into_iter().enumerate() {
+            let Some((idx, frame)) = frame else { continue; };
+            if let Some(p) = prepare_frame(&mut states[i], i, idx, frame, &mut ffplay_taken) {
+                pending.push(p);
+            }
+        }
+        if pending.is_empty() { continue; }
+
+        let keys: Vec<(usize, i64)> = pending.iter().map(|p| (p.stream, p.ts_us)).collect();
+        let mut buffers: Vec<_> = pending.iter_mut().map(|p| buffers_from_live_frame_rgba(&mut p.frame, &mut p.output)).collect();
+        let mut jobs: Vec<_> = keys.iter().zip(buffers.iter_mut()).map(|((i, ts_us), b)| (&*states[*i].stream.stab_man, *ts_us, None, b)).collect();
+        let results = StabilizationManager::process_pixels_batch::<RGBA8>(&mut jobs);
+        drop(jobs);
+        drop(buffers);
+
+        for (mut p, result) in pending.into_iter().zip(results) {
+            let s = &mut states[p.stream];
+            if let Err(e) = result {
+                eprintln!("render_multi: {} stabilization failed at frame {} ts_us={}: {e:?}", s.stream.name, p.idx, p.ts_us);
+                continue;
+            }
+            p.trace.mark(Stage::Processed);
+            if let Some(sink) = s.sink.as_mut() {
+                match sink.push_packed(&p.output, PixelFormat::Rgba, p.ts_us) {
+                    Ok(()) => p.trace.mark(Stage::Presented),
+                    Err(e) => eprintln!("render_multi: {} HwSink::push_packed failed: {e:?}", s.stream.name),
+                }
+            } else if s.ffplay {
+                match fplay::push_frame(&p.output) {
+                    Ok(()) => p.trace.mark(Stage::Presented),
+                    Err(e) => eprintln!("render_multi: {} fplay::push_frame failed: {e:?}", s.stream.name),
+                }
+            }
+        }
+    }
+
+    latency::dump();
+    for s in states.iter_mut() {
+        if s.dropped > 0 { log::info!("render_multi: {} skipped {} frames to keep up", s.stream.name, s.dropped); }
+        if let Some(mut sink) = s.sink.take() {
+            if let Err(e) = sink.finish() {
+                eprintln!("render_multi: {} HwSink::finish failed: {e:?}", s.stream.name);
+            }
+        }
+    }
+    log::info!("render_multi: exit");
+}
+
+/// Per-frame setup of one stream, same as `render_live_loop` up to the processing
+fn prepare_frame(s: &mut StreamState, stream: usize, idx: usize, frame: LiveFrame, ffplay_taken: &mut bool) -> Option<PendingFrame> {
+    let (w, h) = frame.get_size();
+    let ts_us = frame.ts_us();
+    let stab_man = &s.stream.stab_man;
+    let mut trace = TraceGuard::new(frame.trace);
+    trace.mark(Stage::RenderIn);
+    trace.set_imu_lag_with(|| stab_man.gyro.read().live_latest_quat_us().map(|q| ts_us - q));
+
+    if frame.pix_fmt != PixelFormat::Rgba || frame.as_rgba().len() != w as usize * h as usize * 4 {
+        eprintln!("render_multi: {} expected RGBA {}x{} frames", s.stream.name, w, h);
+        return None;
+    }
+    stab_man.live_on_new_frame(idx, ts_us as f64 / 1000.0, 1);
+
+    if !s.initialized {
+        stab_man.set_render_params((w as usize, h as usize), (w as usize, h as usize));
+        log::info!("render_multi: {} initialized for {}x{}", s.stream.name, w, h);
+        if let Some(url) = s.stream.cfg.output_url {
+            let props = SinkProps { width: w, height: h, fps: s.stream.cfg.present_fps, bitrate_mbps: s.stream.cfg.output_bitrate_mbps, ..Default::default() };
+            match HwSink::open(url, &props) {
+                Ok(sink) => {
+                    log::info!("render_multi: {} encoding to {url} with {}", s.stream.name, sink.encoder_name());
+                    s.sink = Some(sink);
+                }
+                Err(e) => eprintln!("render_multi: {} failed to open output {url}: {e:?}", s.stream.name),
+            }
+        }
+        if s.sink.is_none() {
+            if *ffplay_taken {
+                log::warn!("render_multi: {} has no output_url and ffplay is already used by another stream, frames are only processed", s.stream.name);
+            } else if let Err(e) = fplay::init_ffplay(w, h, s.stream.cfg.present_fps, PixelFormat::Rgba) {
+                eprintln!("render_multi: {} failed to init ffplay: {e:?}", s.stream.name);
+            } else {
+                *ffplay_taken = true;
+                s.ffplay = true;
+            }
+        }
+        s.initialized = true;
+    }
+
+    let output = frame_pool().take(w as usize * h as usize * 4);
+    Some(PendingFrame { stream, idx, ts_us, frame, output, trace })
+}
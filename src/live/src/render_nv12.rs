@@ -0,0 +1,166 @@
+use gyroflow_core::StabilizationManager;
+use gyroflow_core::gpu::{BufferDescription, Buffers, BufferSource};
+use gyroflow_core::stabilization::{Stabilization, ComputeParams};
+use gyroflow_core::stabilization::pixel_formats::{PixelType, Luma8, UV8};
+use ffmpeg_next::{ffi, frame};
+use ffmpeg_next::format::Pixel;
+use crate::rendering::zero_copy::{self, RenderGlobals};
+use crate::live_pix_fmt::copy_plane;
+
+/// Stabilizes tightly packed NV12 frames plane by plane, the same way the main renderer handles
+/// NV12 video: a `Luma8` pass for Y and a `UV8` pass for the interleaved chroma, each with its own `Stabilization`.
+/// This keeps the live NV12 path in NV12 from the decoder to the encoder
+pub struct Nv12Stabilizer {
+    size: (usize, usize),
+    y: Stabilization,
+    uv: Stabilization,
+    render_globals: RenderGlobals, // texture cache for VideoToolbox surfaces
+    sw_frame: frame::Video,        // download target for surfaces when the backend isn't wgpu
+    downloaded: Vec<u8>,           // `sw_frame` tightly packed
+}
+
+impl Nv12Stabilizer {
+    pub fn new(stab: &StabilizationManager, size: (usize, usize)) -> Self {
+        let mut ret = Self { size, y: Self::make_plane(stab), uv: Self::make_plane(stab), render_globals: RenderGlobals::default(),
+                           sw_frame: frame::Video::empty(), downloaded: Vec::new() };
+        ret.update_params(stab);
+        ret
+    }
+
+    fn make_plane(stab: &StabilizationManager) -> Stabilization {
+        let mut plane = Stabilization::default();
+        plane.interpolation = stab.stabilization.read().interpolation;
+        plane.share_wgpu_instances = true;
+        plane.set_device(stab.params.read().current_device as isize);
+        let (size, output_size) = {
+            let params = stab.params.read();
+            (params.size, params.output_size)
+        };
+        plane.init_size(size, output_size);
+        plane
+    }
+
+    /// Takes the compute params that `live_on_new_frame` has just set on the manager, with the background converted per plane
+    pub fn update_params(&mut self, stab: &StabilizationManager) {
+        let params = stab.stabilization.read().compute_params().clone();
+        Self::set_plane_params::<Luma8>(&mut self.y, params.clone(), &[0]);
+        Self::set_plane_params::<UV8>(&mut self.uv, params, &[1, 2]);
+    }
+
+    fn set_plane_params<T: PixelType>(plane: &mut Stabilization, mut params: ComputeParams, yuvi: &[usize]) {
+        // Decoded live video is limited range
+        params.background = T::from_rgb_color(params.background, yuvi, true);
+        plane.set_compute_params(params);
+    }
+
+    /// `input` is stabilized in place from the decoded frame into `output`, both are Y followed by interleaved UV
+    pub fn process(&mut self, stab: &StabilizationManager, ts_us: i64, input: &mut [u8], output: &mut [u8]) -> Result<(), String> {
+        let (w, h) = self.size;
+        let y_len = w * h;
+        if input.len() != y_len + w * (h / 2) || output.len() != input.len() {
+            return Err(format!("bad NV12 buffer size: got {} -> {}, expected {}", input.len(), output.len(), y_len + w * (h / 2)));
+        }
+        self.process_planes(ts_us + Self::offset_us(stab), input, output)
+    }
+
+    fn process_planes(&mut self, ts_us: i64, input: &mut [u8], output: &mut [u8]) -> Result<(), String> {
+        let (w, h) = self.size;
+        let y_len = w * h;
+        let (in_y, in_uv) = input.split_at_mut(y_len);
+        let (out_y, out_uv) = output.split_at_mut(y_len);
+        Self::process_plane::<Luma8>(&mut self.y,  ts_us, 0, &mut Buffers { input: cpu_buffer(in_y,  (w, h, w)),         output: cpu_buffer(out_y,  (w, h, w)) })?;
+        Self::process_plane::<UV8>  (&mut self.uv, ts_us, 1, &mut Buffers { input: cpu_buffer(in_uv, (w / 2, h / 2, w)), output: cpu_buffer(out_uv, (w / 2, h / 2, w)) })
+    }
+
+    /// Same as `process`, but reads the planes straight from a decoded GPU surface (CUDA or VideoToolbox).
+    /// Only the wgpu backend can take these buffers, with any other one the surface is downloaded once and processed as `process` does
+    pub fn process_surface(&mut self, stab: &StabilizationManager, ts_us: i64, surface: &mut frame::Video, output: &mut [u8]) -> Result<(), String> {
+        let (w, h) = self.size;
+        let y_len = w * h;
+        if output.len() != y_len + w * (h / 2) {
+            return Err(format!("bad NV12 buffer size: got {}, expected {}", output.len(), y_len + w * (h / 2)));
+        }
+        let ts_us = ts_us + Self::offset_us(stab);
+
+        let (out_y, out_uv) = output.split_at_mut(y_len);
+        let input = surface_buffer(surface, 0, (w, h), &mut self.render_globals, Luma8::wgpu_format().map(|x| x.0));
+        let mut buffers = Buffers { input, output: cpu_buffer(out_y, (w, h, w)) };
+        if Self::needs_init(&self.y) {
+            self.y.ensure_ready_for_processing::<Luma8>(ts_us, None, &mut buffers);
+            self.y.stab_data.clear();
+        }
+        if !self.y.initialized_backend.is_wgpu() {
+            let mut downloaded = std::mem::take(&mut self.downloaded);
+            let result = self.download(surface, &mut downloaded).and_then(|_| self.process_planes(ts_us, &mut downloaded, output));
+            self.downloaded = downloaded;
+            return result;
+        }
+        Self::process_plane::<Luma8>(&mut self.y, ts_us, 0, &mut buffers)?;
+        let input = surface_buffer(surface, 1, (w / 2, h / 2), &mut self.render_globals, UV8::wgpu_format().map(|x| x.0));
+        Self::process_plane::<UV8>(&mut self.uv, ts_us, 1, &mut Buffers { input, output: cpu_buffer(out_uv, (w / 2, h / 2, w)) })
+    }
+
+    /// Copies `surface` to the CPU with a single transfer and packs it into `out` the way `process` takes it
+    fn download(&mut self, surface: &frame::Video, out: &mut Vec<u8>) -> Result<(), String> {
+        let err = unsafe { ffi::av_hwframe_transfer_data(self.sw_frame.as_mut_ptr(), surface.as_ptr(), 0) };
+        if err < 0 {
+            return Err(format!("av_hwframe_transfer_data failed: {err}"));
+        }
+        if self.sw_frame.format() != Pixel::NV12 {
+            return Err(format!("downloaded surface is {:?}, expected NV12", self.sw_frame.format()));
+        }
+        let (w, h) = self.size;
+        out.resize(w * h + w * (h / 2), 0);
+        let (y, uv) = out.split_at_mut(w * h);
+        copy_plane(y,  self.sw_frame.data(0), self.sw_frame.stride(0) as usize, w, h);
+        copy_plane(uv, self.sw_frame.data(1), self.sw_frame.stride(1) as usize, w, h / 2);
+        Ok(())
+    }
+
+    fn needs_init(plane: &Stabilization) -> bool {
+        plane.initialized_backend.is_none() || plane.pending_device_change.is_some()
+    }
+
+    fn offset_us(stab: &StabilizationManager) -> i64 {
+        let params = stab.params.read();
+        (params.frame_offset as f64 / params.fps * 1000000.0).round() as i64
+    }
+
+    fn process_plane<T: PixelType>(plane: &mut Stabilization, ts_us: i64, plane_index: usize, buffers: &mut Buffers) -> Result<(), String> {
+        if Self::needs_init(plane) {
+            plane.ensure_ready_for_processing::<T>(ts_us, None, buffers);
+            plane.stab_data.clear();
+        }
+        let mut transform = plane.get_frame_transform_at::<T>(ts_us, None, buffers);
+        transform.kernel_params.pixel_value_limit = 255.0;
+        transform.kernel_params.max_pixel_value = 255.0;
+        if plane.initialized_backend.is_wgpu() && T::wgpu_format().map(|x| x.2).unwrap_or_default() {
+            transform.kernel_params.pixel_value_limit = 1.0;
+            transform.kernel_params.max_pixel_value = 1.0;
+        }
+        transform.kernel_params.plane_index = plane_index as i32;
+        plane.process_pixels::<T>(ts_us, None, buffers, Some(&transform)).map(|_| ()).map_err(|e| format!("{e:?}"))
+    }
+}
+
+fn cpu_buffer(buffer: &mut [u8], size: (usize, usize, usize)) -> BufferDescription<'_> {
+    BufferDescription { size, rect: None, rotation: None, data: BufferSource::Cpu { buffer }, texture_copy: false }
+}
+
+/// One plane of a HW surface. CUDA planes are device pointers with the frame's line size, VideoToolbox goes through the
+/// Metal texture cache in `zero_copy`, like the main renderer
+#[allow(unused_variables)]
+fn surface_buffer<'a>(surface: &'a mut frame::Video, plane: usize, size: (usize, usize), render_globals: &mut RenderGlobals, wgpu_format: Option<gyroflow_core::WgpuTextureFormat>) -> BufferDescription<'a> {
+    match surface.format() {
+        #[cfg(any(target_os = "windows", target_os = "linux"))]
+        ffmpeg_next::format::Pixel::CUDA => {
+            let (ptr, stride) = unsafe { ((*surface.as_ptr()).data[plane], (*surface.as_ptr()).linesize[plane] as usize) };
+            BufferDescription {
+                size: (size.0, size.1, stride),
+                data: BufferSource::CUDABuffer { buffer: ptr as *mut std::ffi::c_void },
+                ..Default::default()
+            }
+        }
+        _ => zero_copy::get_plane_buffer(surface, zero_copy::get_plane_size(surface, plane), plane, render_globals, wgpu_format)
+    }
+}
@@ -0,0 +1,14 @@
+//! The parts of the main app's `rendering` module that don't depend on Qt, shared as-is with the live binary
+
+#[allow(dead_code)]
+#[path = "../../rendering/ffmpeg_hw.rs"]
+pub mod ffmpeg_hw;
+
+#[allow(dead_code)]
+#[path = "../../rendering/zero_copy.rs"]
+pub mod zero_copy;
+
+// What `ffmpeg_hw` expects from its parent module
+#[derive(Debug)]
+pub enum FFmpegError { CannotCreateGPUDecoding }
+pub fn append_log(msg: &str) { log::debug!("{}", msg); }
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
+
+use std::collections::HashSet;
+use std::time::{Duration, Instant};
+use cpp::*;
+use qmetaobject::QString;
+use serde_json::json;
+use gyroflow_core::StabilizationManager;
+use gyroflow_core::bench::{BenchReport, Timings};
+use gyroflow_core::gpu::{BufferDescription, BufferSource, Buffers};
+use gyroflow_core::stabilization::distortion_models::DistortionModel;
+use super::qrhi_undistort::{HeadlessUndistort, InputFormat, OutputFormat, SHADER_DIR, SPECIALIZED_SHADERS};
+
+cpp! {{
+    #include <QtGui/QGuiApplication>
+    #include <QDir>
+}}
+
+const WARMUP_FRAMES: usize = 10; // pipeline creation and the first uploads
+const FPS: f64 = 30.0;
+const LENS: &str = "GoPro HERO6 Black 4:3 Wide NO-EIS eddy"; // same profile as live mode
+
+/// Distortion model and digital lens of a compiled shader, eg. `undistort_opencv_fisheye_gopro_superview.frag.qsb`
+fn parse_variant(file: &str) -> Option<(String, Option<String>)> {
+    let stem = file.strip_prefix("undistort_")?.strip_suffix(".frag.qsb")?;
+    let valid = |id: &str| DistortionModel::from_name(id).id() == id;
+    if valid(stem) { return Some((stem.to_owned(), None)); }
+    stem.match_indices('_')
+        .map(|(i, _)| (&stem[..i], &stem[i + 1..]))
+        .find(|(model, digital)| valid(model) && valid(digital))
+        .map(|(model, digital)| (model.to_owned(), Some(digital.to_owned())))
+}
+
+/// Deterministic RGBA8 checkerboard with gradients, so every run uploads and samples the same data
+fn test_frame(size: (usize, usize)) -> Vec<u8> {
+    let mut frame = vec![0u8; size.0 * size.1 * 4];
+    for (i, px) in frame.chunks_exact_mut(4).enumerate() {
+        let (x, y) = (i % size.0, i / size.0);
+        let check = if ((x / 64) + (y / 64)) % 2 == 0 { 255 } else { 32 };
+        px.copy_from_slice(&[check, (x * 255 / size.0) as u8, (y * 255 / size.1) as u8, 255]);
+    }
+    frame
+}
+
+/// The same frame as NV12 (BT.709 limited range), to time the `_yuv` variants
+fn test_frame_nv12(size: (usize, usize)) -> Vec<u8> {
+    let rgba = test_frame(size);
+    let uv_rows = (size.1 + 1) / 2;
+    let mut frame = vec![128u8; size.0 * (size.1 + uv_rows)];
+    let (y_plane, uv_plane) = frame.split_at_mut(size.0 * size.1);
+    for (i, px) in rgba.chunks_exact(4).enumerate() {
+        let (r, g, b) = (px[0] as f32, px[1] as f32, px[2] as f32);
+        y_plane[i] = (16.0 + (0.1826 * r + 0.6142 * g + 0.0620 * b)) as u8;
+        let (x, y) = (i % size.0, i / size.0);
+        if x % 2 == 0 && y % 2 == 0 && x + 1 < size.0 {
+            let uv = (y / 2) * size.0 + x;
+            uv_plane[uv]     = (128.0 - 0.1006 * r - 0.3386 * g + 0.4392 * b) as u8;
+            uv_plane[uv + 1] = (128.0 + 0.4392 * r - 0.3989 * g - 0.0403 * b) as u8;
+        }
+    }
+    frame
+}
+
+/// `--benchmark-rhi`: times `HeadlessUndistort` with every base fragment shader in `SHADER_DIR` and writes the
+/// results as JSON (see `gyroflow_core::bench`), to stdout if `out` is None. Shaders with a `_yuv` variant are also timed with NV12 input.
+/// The cost of the pass only depends on the shader and the frame size, so it runs on a generated frame without motion,
+/// with each variant's model and digital lens set on the live mode lens profile
+pub fn run(out: Option<&str>, frames: usize, size: (usize, usize)) {
+    cpp!(unsafe [] {
+        if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+        static int argc = 0;
+        if (!qApp) new QGuiApplication(argc, nullptr);
+    });
+    crate::resources::rsrc();
+    crate::resources::rsrc_shader_variants();
+
+    let shader_dir = QString::from(SHADER_DIR);
+    let variants = cpp!(unsafe [shader_dir as "QString"] -> QString as "QString" {
+        return QDir(shader_dir).entryList({ "undistort_*.frag.qsb" }, QDir::Files, QDir::Name).join(";");
+    }).to_string();
+
+    let Some(mut headless) = HeadlessUndistort::new() else {
+        log::error!("benchmark: failed to create a headless Qt RHI");
+        return;
+    };
+
+    let stab = StabilizationManager::default();
+    {
+        let mut db = stab.lens_profile_db.write();
+        db.load_all();
+        db.prepare_list_for_ui();
+    }
+    stab.init_from_stream_data(FPS, size);
+    {
+        let db = stab.lens_profile_db.read();
+        if let Some(profile) = db.search(LENS, &HashSet::new(), 0, 0).first().and_then(|(_, key, ..)| db.get_by_id(key)) {
+            stab.lens.write().clone_from(profile);
+        } else {
+            log::warn!("benchmark: lens profile {LENS} not found, using the default lens");
+        }
+    }
+    stab.set_render_params(size, size);
+
+    let mut report = BenchReport::new("qt_rhi_undistort");
+    report.set_info("backend", json!(headless.backend_name()));
+    report.set_info("size", json!([size.0, size.1]));
+    report.set_info("warmup_frames", json!(WARMUP_FRAMES));
+
+    let mut input_rgba = test_frame(size);
+    let mut input_nv12 = test_frame_nv12(size);
+    let mut output = vec![0u8; size.0 * size.1 * 4];
+    // The specialized variants are picked by `HeadlessUndistort::render` itself when the params allow it,
+    // so the timings of each base shader are those of the variant it selects for these params
+    let specialized = |file: &str| SPECIALIZED_SHADERS.iter().any(|(suffix, _)| file.ends_with(&format!("{suffix}.frag.qsb"))) || file.ends_with("_yuv.frag.qsb");
+    let runs = variants.split(';').filter(|x| !x.is_empty() && !specialized(x)).flat_map(|file| {
+        let has_yuv = variants.split(';').any(|x| x == file.replace(".frag.qsb", "_yuv.frag.qsb"));
+        std::iter::once((file, InputFormat::Rgba8)).chain(has_yuv.then_some((file, InputFormat::Nv12)))
+    });
+    for (file, input_format) in runs {
+        let Some((model, digital)) = parse_variant(file) else {
+            log::warn!("benchmark: unknown shader variant {file}");
+            continue;
+        };
+        {
+            let mut lens = stab.lens.write();
+            lens.distortion_model = Some(model.clone());
+            lens.digital_lens = digital.clone();
+        }
+        stab.recompute_undistortion();
+        if !headless.set_formats(input_format, false, OutputFormat::Rgba8) { continue; }
+        let (input, input_stride, name) = match input_format {
+            InputFormat::Rgba8 => (&mut input_rgba, size.0 * 4, file.trim_end_matches(".frag.qsb").to_owned()),
+            _                  => (&mut input_nv12, size.0, file.replace(".frag.qsb", "_nv12")),
+        };
+
+        let mut cpu = Timings::new(&name);
+        let mut gpu = Timings::new("gpu");
+        let mut failed = 0;
+        let mut started = Instant::now();
+        for i in 0..WARMUP_FRAMES + frames {
+            if i == WARMUP_FRAMES { started = Instant::now(); }
+            let ts_us = (i as f64 * 1_000_000.0 / FPS).round() as i64;
+            let mut buffers = Buffers {
+                input:  BufferDescription { size: (size.0, size.1, input_stride), data: BufferSource::Cpu { buffer: input }, ..Default::default() },
+                output: BufferDescription { size: (size.0, size.1, size.0 * 4), data: BufferSource::Cpu { buffer: &mut output }, ..Default::default() },
+            };
+            let t = Instant::now();
+            let info = headless.render(&stab, ts_us, Some(i), &mut buffers);
+            if i < WARMUP_FRAMES { continue; }
+            cpu.push(t.elapsed());
+            match info {
+                Some(info) => if let Some(ms) = info.gpu_time_ms { gpu.push(Duration::from_secs_f64(ms / 1000.0)); },
+                None => failed += 1,
+            }
+        }
+        if failed > 0 { log::warn!("benchmark: {file}: {failed} of {frames} frames failed"); }
+        report.add(&cpu, Some(started.elapsed()), json!({ "distortion_model": model, "digital_lens": digital, "input": format!("{input_format:?}"), "gpu_ms": gpu.summary(), "failed_frames": failed }));
+    }
+
+    if let Err(e) = report.write(out) {
+        log::error!("benchmark: failed to write the results: {e:?}");
+    }
+}
@@ -6,6 +6,9 @@ NO_DIGITAL_LENS="vec2 digital_undistort_point(vec2 uv) { return uv; } vec2 digit
 DISTORTION_MODELS=( "opencv_fisheye" "opencv_standard" "poly3" "poly5" "ptlens" "insta360" "sony" )
 DIGITAL_LENSES=( "" "gopro_superview" "gopro6_superview" "gopro_hyperview" "digital_stretch" )
 
+# Only the base shaders are committed, build.rs compiles them again together with the `_yuv`, `_fast` and `_fast_rs` variants (see SHADER_VARIANTS there)
+# into :/src/qt_gpu/baked/ when Qt's qsb is installed
+
 for i in "${DISTORTION_MODELS[@]}"
 do
     for d in "${DIGITAL_LENSES[@]}"
@@ -2,16 +2,47 @@
 // Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
 
 #include <QQuickWindow>
+#include <QQuickItem>
+#include <QSGSimpleTextureNode>
+#include <QCoreApplication>
+#include <QPointer>
 #include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <memory>
+#include <functional>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <vector>
 #include <private/qquickitem_p.h>
 #if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
 #   include <rhi/qrhi.h>
 #else
 #   include <private/qrhi_p.h>
 #endif
+#if QT_VERSION < QT_VERSION_CHECK(6, 6, 0)
+#   include <private/qrhinull_p.h>
+#   include <private/qrhigles2_p.h>
+#   if QT_CONFIG(vulkan)
+#       include <private/qrhivulkan_p.h>
+#   endif
+#   ifdef Q_OS_WIN
+#       include <private/qrhid3d11_p.h>
+#   endif
+#   if defined(Q_OS_MACOS) || defined(Q_OS_IOS)
+#       include <private/qrhimetal_p.h>
+#   endif
+#endif
+#if QT_CONFIG(vulkan)
+#   include <QVulkanInstance>
+#endif
+#include <QOffscreenSurface>
 #include <private/qsgrenderer_p.h>
 #include <private/qsgdefaultrendercontext_p.h>
 #include <private/qshader_p.h>
+#include <private/qsgplaintexture_p.h>
 
 #define qDebug2(func) QMessageLogger(__FILE__, __LINE__, func).debug(QLoggingCategory("Qt RHI"))
 
@@ -43,56 +74,317 @@ static float quadVertexData[16] = { // Y up, CCW
 };
 static quint16 quadIndexData[6] = { 0, 1, 2, 0, 2, 3 };
 
+// Textures updated every frame, one set per frame that can be in flight. The uniform buffers are Dynamic, so QRhi
+// already keeps a copy of them per frame slot and they're shared
+struct FrameResources {
+    QScopedPointer<QRhiTexture> texMatrices;
+    QScopedPointer<QRhiTexture> texMeshData;
+    QScopedPointer<QRhiTexture> texCanvas;
+    QScopedPointer<QRhiShaderResourceBindings> srb;
+
+    // Last uploaded contents of this slot's textures, used to skip or narrow down the uploads
+    std::vector<uint8_t> matricesShadow;
+    std::vector<uint8_t> meshDataShadow;
+    uint32_t matricesHash{0};
+    uint32_t meshDataHash{0};
+    bool hashesValid{false};
+    QRect canvasUploadedRect; // area of texCanvas that may be non-zero
+    bool canvasUploaded{false};
+    uint32_t canvasHash{0};
+    bool canvasHashValid{false};
+};
+
+struct OutputTarget {
+    std::shared_ptr<QRhiTexture> texture; // Shared with PresentedOutput while it's on screen
+    QScopedPointer<QRhiTextureRenderTarget> rt;
+};
+
+// The preview output shown by UndistortPresenter. `texture` and `nodeTexture` are only used on the render thread,
+// `presenter` only on the GUI thread
+struct PresentedOutput {
+    std::shared_ptr<QRhiTexture> texture; // Kept alive until the node stops sampling it
+    QSGPlainTexture *nodeTexture{nullptr};
+    QPointer<QQuickItem> presenter;
+};
+
+class PresenterNode : public QSGSimpleTextureNode {
+public:
+    PresenterNode(std::shared_ptr<PresentedOutput> state) : m_state(std::move(state)) {
+        m_texture = new QSGPlainTexture();
+        m_texture->setOwnsTexture(false);
+        m_texture->setHasAlphaChannel(false);
+        setOwnsTexture(true);
+        setTexture(m_texture);
+        setFiltering(QSGTexture::Linear);
+        m_state->nodeTexture = m_texture;
+    }
+    ~PresenterNode() override {
+        if (m_state->nodeTexture == m_texture) m_state->nodeTexture = nullptr;
+    }
+    void setOutput(QRhiTexture *tex) {
+        if (m_texture->rhiTexture() == tex && m_texture->textureSize() == tex->pixelSize()) return;
+        m_texture->setTexture(tex);
+        m_texture->setTextureSize(tex->pixelSize());
+        markDirty(QSGNode::DirtyMaterial);
+    }
+
+private:
+    std::shared_ptr<PresentedOutput> m_state;
+    QSGPlainTexture *m_texture{nullptr};
+};
+
+// Child of the MDKPlayer item that draws the undistorted frame over it, so the preview doesn't copy the result back into the item texture
+class UndistortPresenter : public QQuickItem {
+public:
+    UndistortPresenter(QQuickItem *parent, std::shared_ptr<PresentedOutput> state) : QQuickItem(parent), m_state(std::move(state)) {
+        setFlag(ItemHasContents);
+        setSize(parent->size());
+        connect(parent, &QQuickItem::widthChanged,  this, [this, parent] { setWidth(parent->width()); });
+        connect(parent, &QQuickItem::heightChanged, this, [this, parent] { setHeight(parent->height()); });
+    }
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *) override {
+        QRhiTexture *tex = m_state->texture.get();
+        if (!tex) { delete oldNode; return nullptr; }
+        auto node = static_cast<PresenterNode *>(oldNode);
+        if (!node) node = new PresenterNode(m_state);
+        node->setOutput(tex);
+        node->setRect(boundingRect());
+        return node;
+    }
+
+private:
+    std::shared_ptr<PresentedOutput> m_state;
+};
+
+// One slot of the readback ring. `completed` only calls the callback and clears `pending`, the slot itself is
+// freed outside of it (see `queueReadback`)
+struct ReadbackSlot {
+    QRhiReadbackResult result;
+    qint64 timestamp{0};
+    std::function<void(qint64, QSize, const QByteArray &)> callback;
+    std::atomic<bool> pending{false};
+};
+
+// Slots with a readback in flight. Keeps them alive when their QtRHIUndistort is destroyed before the QRhi completes them,
+// they are released by the next queueReadback() once done
+struct InFlightReadbacks {
+    QMutex mutex;
+    std::vector<std::shared_ptr<ReadbackSlot>> slots;
+};
+static InFlightReadbacks &inFlightReadbacks() {
+    static InFlightReadbacks r;
+    return r;
+}
+
+// Uploads only the range of rows of `data` that differs from `shadow` (the last uploaded contents of `tex`).
+// The first upload covers the whole texture, since its initial contents are undefined. Returns the number of bytes uploaded
+static quint64 uploadChangedRows(QRhiResourceUpdateBatch *u, QRhiTexture *tex, std::vector<uint8_t> &shadow, const uint8_t *data, size_t len, size_t rowBytes) {
+    const QSize texSize = tex->pixelSize();
+    const int rows = std::min<size_t>(texSize.height(), len / rowBytes);
+    if (rows <= 0) return 0;
+
+    int first = -1, last = -1;
+    if (shadow.size() != texSize.height() * rowBytes) {
+        shadow.assign(texSize.height() * rowBytes, 0);
+        first = 0;
+        last = texSize.height() - 1;
+    } else {
+        for (int r = 0; r < rows; ++r) {
+            if (memcmp(shadow.data() + r * rowBytes, data + r * rowBytes, rowBytes) != 0) {
+                if (first < 0) first = r;
+                last = r;
+            }
+        }
+        if (first < 0) return 0;
+    }
+    memcpy(shadow.data() + first * rowBytes, data + first * rowBytes, (std::min(last + 1, rows) - first) * rowBytes);
+
+    QRhiTextureSubresourceUploadDescription desc(shadow.data() + first * rowBytes, (last - first + 1) * rowBytes);
+    desc.setDestinationTopLeft(QPoint(0, first));
+    desc.setSourceSize(QSize(texSize.width(), last - first + 1));
+    u->uploadTexture(tex, QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, desc) }));
+    return quint64(last - first + 1) * rowBytes;
+}
+
+// The rolling shutter matrices are 14 floats per row. The shaders baked by build.rs read them as 4 RGBA32F texels per row,
+// so the rows are padded to 16 floats, the committed ones as 14 R32F texels
+static constexpr int MatrixFloats = 14;
+#ifdef GYROFLOW_PACKED_MATRICES
+static constexpr int MatrixTexels = 4;
+static constexpr int MatrixRowFloats = 16;
+static constexpr QRhiTexture::Format MatrixFormat = QRhiTexture::RGBA32F;
+#else
+static constexpr int MatrixTexels = MatrixFloats;
+static constexpr int MatrixRowFloats = MatrixFloats;
+static constexpr QRhiTexture::Format MatrixFormat = QRhiTexture::R32F;
+#endif
+static constexpr size_t MatrixRowBytes = MatrixRowFloats * sizeof(float);
+
+// `matrices` in the layout of the matrices texture, padded into `packed` when the rows are wider. `len` is updated to the returned length
+static const uint8_t *packMatrices(std::vector<uint8_t> &packed, const uint8_t *matrices, size_t &len) {
+    if (MatrixRowFloats == MatrixFloats) return matrices;
+    const size_t rows = len / (MatrixFloats * sizeof(float));
+    packed.resize(rows * MatrixRowBytes);
+    for (size_t r = 0; r < rows; ++r) {
+        uint8_t *row = packed.data() + r * MatrixRowBytes;
+        memcpy(row, matrices + r * MatrixFloats * sizeof(float), MatrixFloats * sizeof(float));
+        memset(row + MatrixFloats * sizeof(float), 0, MatrixRowBytes - MatrixFloats * sizeof(float));
+    }
+    len = packed.size();
+    return packed.data();
+}
+
+// Uploads `rect` of the R8 canvas united with the rect uploaded last time (`uploadedRect`), `data` is zero outside of `rect`.
+// The first upload covers the whole texture, since its initial contents are undefined. Returns the number of bytes uploaded
+static quint64 uploadCanvasRect(QRhiResourceUpdateBatch *u, QRhiTexture *tex, QRect &uploadedRect, bool &initialized, const uint8_t *data, size_t len, const QRect &rect) {
+    const QSize texSize = tex->pixelSize();
+    const int stride = texSize.width();
+    const int rows = std::min<size_t>(texSize.height(), len / stride);
+    if (rows <= 0) return 0;
+
+    QRect region = initialized ? (rect | uploadedRect) : QRect(QPoint(0, 0), texSize);
+    region &= QRect(0, 0, stride, rows);
+    uploadedRect = rect;
+    initialized = true;
+    if (region.isEmpty()) return 0;
+
+    const size_t offset = size_t(region.y()) * stride + region.x();
+    QRhiTextureSubresourceUploadDescription desc(data + offset, size_t(region.height() - 1) * stride + region.width());
+    desc.setDataStride(stride);
+    desc.setSourceSize(region.size());
+    desc.setDestinationTopLeft(region.topLeft());
+    u->uploadTexture(tex, QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, desc) }));
+    return quint64(region.width()) * region.height();
+}
+
+struct RenderStats {
+    double gpuTimeMs{-1.0};   // Whole frame of the last completed command buffer, -1 if timestamps aren't enabled
+    double uploadTimeMs{0.0}; // CPU time spent preparing the upload batch
+    quint64 uploadBytes{0};
+};
+
+enum class InputFormat {
+    ItemTexture, // RGBA, sampled from the MDKPlayer item texture
+    NV12,        // 8-bit Y plane + interleaved UV plane, uploaded with uploadInput()
+    P010         // Same layout in 16-bit containers with 10 significant bits
+};
+
 // ubufAlignment
 // static inline uint aligned(uint v, uint byteAlign) { return (v + byteAlign - 1) & ~(byteAlign - 1); }
 
 class QtRHIUndistort {
 public:
     QtRHIUndistort() { }
+    ~QtRHIUndistort() {
+        if (m_present) {
+            QMetaObject::invokeMethod(qApp, [state = m_present] { delete state->presenter.data(); }, Qt::QueuedConnection);
+        }
+    }
 
     QSize outSize() { return m_outputSize; }
     QSize texSize() { return m_textureSize; }
     QString shaderPath() { return m_shaderPath; }
     QRhiTexture *itemTexturePtr() { return m_itemTexturePtr; }
     unsigned int sizeForRS() { return m_sizeForRS; }
+    QSize canvasSize() { return m_canvasSize; }
+    bool isPipelined() { return m_pipelined; }
+    bool ownsOutput() { return m_ownOutput; }
+    // Texture with the most recently rendered frame. With `ownOutput` this is one of the two ping-pong targets
+    // and stays valid until the next-but-one render(), otherwise the result is also copied to the copy target
+    QRhiTexture *outputTexture() { return m_targets[m_currentTarget].texture.get(); }
+
+    // Must be called before init(). YUV input is converted to RGB (BT.709) in the shader, so it needs the `_yuv` shader variant.
+    // Output formats other than RGBA8 (e.g. RGBA16F or RGB10A2 to keep HDR precision) are only possible with `ownOutput`
+    void setFormats(InputFormat input, QSize inputSize, bool fullRange, QRhiTexture::Format output) {
+        m_inputFormat = input;
+        m_inputSize = inputSize;
+        m_inputFullRange = fullRange;
+        m_outputFormat = output;
+    }
+    InputFormat inputFormat() { return m_inputFormat; }
+
+    // Queues the planes of the next YUV input frame, applied with the next render()
+    bool uploadInput(QRhi *rhi, const uint8_t *y, int yStride, const uint8_t *uv, int uvStride) {
+        if (m_inputFormat == InputFormat::ItemTexture || !m_texY || !m_texUV) return false;
+        if (!m_inputUpload) m_inputUpload = rhi->nextResourceUpdateBatch();
+
+        QRhiTextureSubresourceUploadDescription descY(y, yStride * m_texY->pixelSize().height());
+        descY.setDataStride(yStride);
+        QRhiTextureSubresourceUploadDescription descUV(uv, uvStride * m_texUV->pixelSize().height());
+        descUV.setDataStride(uvStride);
+        m_inputUpload->uploadTexture(m_texY.get(),  QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, descY) }));
+        m_inputUpload->uploadTexture(m_texUV.get(), QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, descUV) }));
+        return true;
+    }
 
-    bool init(MDKPlayer *item, QSize textureSize, QSize outputSize, const QString &shaderPath, int kernelParmsSize, unsigned int sizeForRS, QSize canvasSize) {
-        if (!item) return false;
-        auto context = item->rhiContext();
-        auto rhi = context->rhi();
+    // `ownOutput` renders alternately into two owned textures and skips the copy to the item texture, which is also the
+    // undistortion input. The result is shown by an UndistortPresenter over the item instead
+    bool init(MDKPlayer *item, QSize textureSize, QSize outputSize, const QString &shaderPath, int kernelParmsSize, unsigned int sizeForRS, QSize canvasSize, bool ownOutput = false) {
+        if (!item || !item->qmlItem()) return false;
+        if (!init(item->rhiContext()->rhi(), item->rhiTexture(), textureSize, outputSize, shaderPath, kernelParmsSize, sizeForRS, canvasSize, ownOutput, false)) return false;
+        if (ownOutput && !m_present) {
+            m_present = std::make_shared<PresentedOutput>();
+            QMetaObject::invokeMethod(qApp, [state = m_present, parent = QPointer<QQuickItem>(item->qmlItem())] {
+                if (parent && !state->presenter) state->presenter = new UndistortPresenter(parent, state);
+            }, Qt::QueuedConnection);
+        }
+        return true;
+    }
+
+    // Same as above for any QRhi. `inputTexture` is sampled in ItemTexture mode and is also the copy target without `ownOutput`.
+    // `offscreen` is for frames recorded between beginOffscreenFrame() and endOffscreenFrame(), which already wait for the GPU
+    bool init(QRhi *rhi, QRhiTexture *inputTexture, QSize textureSize, QSize outputSize, const QString &shaderPath, int kernelParmsSize, unsigned int sizeForRS, QSize canvasSize, bool ownOutput, bool offscreen) {
+        if (!rhi) return false;
 
         m_sizeForRS = sizeForRS;
         m_outputSize = outputSize;
         m_textureSize = textureSize;
         m_shaderPath = shaderPath;
-        m_itemTexturePtr = item->rhiTexture();
-
-        m_texIn.reset(rhi->newTexture(QRhiTexture::RGBA8, textureSize, 1, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource));
-        if (!m_texIn->create()) { qDebug2("init") << "failed to create m_texIn"; return false; }
-
-        m_rt.reset(rhi->newTextureRenderTarget({ QRhiColorAttachment(m_texIn.get()) }));
-        if (!m_rt) { qDebug2("init") << "failed to get new m_rt"; return false; }
-
-        m_rtRp.reset(m_rt->newCompatibleRenderPassDescriptor());
-        if (!m_rtRp) { qDebug2("init") << "failed to create m_rtRp"; return false; }
-
-        m_rt->setRenderPassDescriptor(m_rtRp.get());
-        if (!m_rt->create()) { qDebug2("init") << "failed to create m_rt"; return false; }
-
-        m_kernelParams.reset(rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, kernelParmsSize));
-        if (!m_kernelParams->create()) { qDebug2("init") << "failed to create m_kernelParams"; return false; }
+        m_canvasSize = canvasSize;
+        m_itemTexturePtr = inputTexture;
+        m_offscreen = offscreen;
+
+        // Let the render loop keep several frames in flight and rely on its per-slot fences, unless the backend
+        // can't do that (OpenGL reports 1) or blocking mode is forced with GYROFLOW_QRHI_BLOCKING=1
+        m_framesInFlight = offscreen ? 1 : qMax(1, rhi->resourceLimit(QRhi::FramesInFlight));
+        m_pipelined = m_framesInFlight > 1 && qEnvironmentVariableIntValue("GYROFLOW_QRHI_BLOCKING") == 0;
+
+        m_ownOutput = ownOutput;
+        m_currentTarget = 0;
+        m_rtRp.reset();
+
+        // The copy to the item texture needs a matching format
+        QRhiTexture::Format outputFormat = m_ownOutput ? m_outputFormat : QRhiTexture::RGBA8;
+        if (!rhi->isTextureFormatSupported(outputFormat, QRhiTexture::RenderTarget)) {
+            qDebug2("init") << "output format" << outputFormat << "is not supported, using RGBA8";
+            outputFormat = QRhiTexture::RGBA8;
+        }
+        for (int i = 0; i < (m_ownOutput ? 2 : 1); ++i) {
+            auto &target = m_targets[i];
+            target.texture.reset(rhi->newTexture(outputFormat, textureSize, 1, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource));
+            if (!target.texture->create()) { qDebug2("init") << "failed to create output texture" << i; return false; }
 
-        m_texMatrices.reset(rhi->newTexture(QRhiTexture::R32F, QSize(14, sizeForRS), 1, QRhiTexture::Flags()));
-        if (!m_texMatrices->create()) { qDebug2("init") << "failed to create m_texMatrices"; return false; }
+            target.rt.reset(rhi->newTextureRenderTarget({ QRhiColorAttachment(target.texture.get()) }));
+            if (!target.rt) { qDebug2("init") << "failed to get new render target" << i; return false; }
 
-        m_texMeshData.reset(rhi->newTexture(QRhiTexture::R32F, QSize(1, 1024), 1, QRhiTexture::Flags()));
-        if (!m_texMeshData->create()) { qDebug2("init") << "failed to create m_texMeshData"; return false; }
+            if (!m_rtRp) { // Both targets have the same format, so they can share the render pass descriptor
+                m_rtRp.reset(target.rt->newCompatibleRenderPassDescriptor());
+                if (!m_rtRp) { qDebug2("init") << "failed to create m_rtRp"; return false; }
+            }
 
-        matricesBuffer.resize(sizeForRS * 14 * sizeof(float));
-        meshDataBuffer.resize(1024 * sizeof(float));
+            target.rt->setRenderPassDescriptor(m_rtRp.get());
+            if (!target.rt->create()) { qDebug2("init") << "failed to create render target" << i; return false; }
+        }
 
-        m_texCanvas.reset(rhi->newTexture(QRhiTexture::R8, canvasSize, 1, QRhiTexture::Flags()));
-        if (!m_texCanvas->create()) { qDebug2("init") << "failed to create m_texCanvas"; return false; }
+        if (m_inputFormat != InputFormat::ItemTexture) {
+            const bool p010 = m_inputFormat == InputFormat::P010;
+            m_texY.reset(rhi->newTexture(p010 ? QRhiTexture::R16 : QRhiTexture::R8, m_inputSize, 1, QRhiTexture::Flags()));
+            if (!m_texY->create()) { qDebug2("init") << "failed to create m_texY"; return false; }
+            m_texUV.reset(rhi->newTexture(p010 ? QRhiTexture::RG16 : QRhiTexture::RG8, QSize((m_inputSize.width() + 1) / 2, (m_inputSize.height() + 1) / 2), 1, QRhiTexture::Flags()));
+            if (!m_texUV->create()) { qDebug2("init") << "failed to create m_texUV"; return false; }
+        }
 
         m_vertexBuffer.reset(rhi->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::VertexBuffer, sizeof(quadVertexData)));
         if (!m_vertexBuffer->create()) { qDebug2("init") << "failed to create m_vertexBuffer"; return false; }
@@ -100,9 +392,6 @@ public:
         m_indexBuffer.reset(rhi->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::IndexBuffer, sizeof(quadIndexData)));
         if (!m_indexBuffer->create()) { qDebug2("init") << "failed to create m_indexBuffer"; return false; }
 
-        m_drawingUniform.reset(rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, 64 + 4));
-        if (!m_drawingUniform->create()) { qDebug2("init") << "failed to create m_drawingUniform"; return false; }
-        qint32 flip = rhi->isYUpInFramebuffer();
 
         m_drawingSampler.reset(rhi->newSampler(QRhiSampler::Linear, QRhiSampler::Linear, QRhiSampler::None, QRhiSampler::ClampToEdge, QRhiSampler::ClampToEdge));
         if (!m_drawingSampler->create()) { qDebug2("init") << "failed to create m_drawingSampler"; return false; }
@@ -116,55 +405,193 @@ public:
         m_meshDataSampler.reset(rhi->newSampler(QRhiSampler::Nearest, QRhiSampler::Nearest, QRhiSampler::None, QRhiSampler::ClampToEdge, QRhiSampler::ClampToEdge));
         if (!m_meshDataSampler->create()) { qDebug2("init") << "failed to create m_meshDataSampler"; return false; }
 
-        m_srb.reset(rhi->newShaderResourceBindings());
-        m_srb->setBindings({
-            QRhiShaderResourceBinding::uniformBuffer (0, QRhiShaderResourceBinding::FragmentStage | QRhiShaderResourceBinding::VertexStage, m_drawingUniform.get()),
-            QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, item->rhiTexture(), m_drawingSampler.get()),
-            QRhiShaderResourceBinding::uniformBuffer (2, QRhiShaderResourceBinding::FragmentStage, m_kernelParams.get()),
-            QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage, m_texMatrices.get(), m_matricesSampler.get()),
-            QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage, m_texCanvas.get(), m_canvasSampler.get()),
-            QRhiShaderResourceBinding::sampledTexture(5, QRhiShaderResourceBinding::FragmentStage, m_texMeshData.get(), m_meshDataSampler.get()),
-        });
-        if (!m_srb->create()) { qDebug2("init") << "failed to create m_srb"; return false; }
+        m_kernelParams.reset(rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, kernelParmsSize));
+        if (!m_kernelParams->create()) { qDebug2("init") << "failed to create m_kernelParams"; return false; }
 
-        m_pipeline.reset(rhi->newGraphicsPipeline());
-        m_pipeline->setShaderStages({
-            { QRhiShaderStage::Vertex,   getShader(QLatin1String(":/src/qt_gpu/compiled/texture.vert.qsb")) },
-            { QRhiShaderStage::Fragment, getShader(shaderPath) }
-        });
-        QRhiVertexInputLayout inputLayout;
-        inputLayout.setBindings({ { 4 * sizeof(float) } });
-        inputLayout.setAttributes({
-            { 0, 0, QRhiVertexInputAttribute::Float2, 0 },
-            { 0, 1, QRhiVertexInputAttribute::Float2, 2 * sizeof(float) }
-        });
-        m_pipeline->setVertexInputLayout(inputLayout);
-        m_pipeline->setShaderResourceBindings(m_srb.get());
-        m_pipeline->setRenderPassDescriptor(m_rtRp.get());
-        if (!m_pipeline->create()) { qDebug2("init") << "failed to create m_pipeline"; return false; }
+        m_drawingUniform.reset(rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, 64 + 4));
+        if (!m_drawingUniform->create()) { qDebug2("init") << "failed to create m_drawingUniform"; return false; }
+        qint32 flip = rhi->isYUpInFramebuffer();
+
+        struct { float scale; qint32 fullRange; } yuvParams = {
+            m_inputFormat == InputFormat::P010 ? 65535.0f / (1023.0f * 64.0f) : 1.0f, // P010 keeps the 10 bits in the high bits
+            m_inputFullRange
+        };
+        if (m_inputFormat != InputFormat::ItemTexture) {
+            m_yuvParams.reset(rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, sizeof(yuvParams)));
+            if (!m_yuvParams->create()) { qDebug2("init") << "failed to create m_yuvParams"; return false; }
+        } else {
+            m_yuvParams.reset();
+        }
+
+        // One set of per-frame textures for each frame that can be in flight, so that updating
+        // the current frame never touches anything the GPU may still be reading for the previous one
+        m_frames.clear();
+        const int slots = m_pipelined ? m_framesInFlight : 1;
+        for (int i = 0; i < slots; ++i) {
+            std::unique_ptr<FrameResources> fr(new FrameResources());
+            if (!initFrameResources(rhi, inputTexture, *fr, sizeForRS, canvasSize)) return false;
+            m_frames.push_back(std::move(fr));
+        }
+
+        m_pipeline = getPipeline(rhi, shaderPath);
+        if (!m_pipeline) { qDebug2("init") << "failed to create m_pipeline"; return false; }
 
         m_initialUpdates = rhi->nextResourceUpdateBatch();
         m_initialUpdates->uploadStaticBuffer(m_vertexBuffer.get(), quadVertexData);
         m_initialUpdates->uploadStaticBuffer(m_indexBuffer.get(), quadIndexData);
         m_initialUpdates->updateDynamicBuffer(m_drawingUniform.get(), 64, 4, &flip);
+        if (m_yuvParams) m_initialUpdates->updateDynamicBuffer(m_yuvParams.get(), 0, sizeof(yuvParams), &yuvParams);
+
+        return true;
+    }
+
+    bool initFrameResources(QRhi *rhi, QRhiTexture *inputTexture, FrameResources &fr, unsigned int sizeForRS, QSize canvasSize) {
+        fr.texMatrices.reset(rhi->newTexture(MatrixFormat, QSize(MatrixTexels, sizeForRS), 1, QRhiTexture::Flags()));
+        if (!fr.texMatrices->create()) { qDebug2("init") << "failed to create texMatrices"; return false; }
+
+        fr.texMeshData.reset(rhi->newTexture(QRhiTexture::R32F, QSize(1, 1024), 1, QRhiTexture::Flags()));
+        if (!fr.texMeshData->create()) { qDebug2("init") << "failed to create texMeshData"; return false; }
+
+        fr.texCanvas.reset(rhi->newTexture(QRhiTexture::R8, canvasSize, 1, QRhiTexture::Flags()));
+        if (!fr.texCanvas->create()) { qDebug2("init") << "failed to create texCanvas"; return false; }
+
+        fr.srb.reset(rhi->newShaderResourceBindings());
+        return updateBindings(fr, inputTexture);
+    }
+
+    bool updateBindings(FrameResources &fr, QRhiTexture *itemTexture) {
+        const bool yuv = m_inputFormat != InputFormat::ItemTexture;
+        std::vector<QRhiShaderResourceBinding> bindings = {
+            QRhiShaderResourceBinding::uniformBuffer (0, QRhiShaderResourceBinding::FragmentStage | QRhiShaderResourceBinding::VertexStage, m_drawingUniform.get()),
+            QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, yuv ? m_texY.get() : itemTexture, m_drawingSampler.get()),
+            QRhiShaderResourceBinding::uniformBuffer (2, QRhiShaderResourceBinding::FragmentStage, m_kernelParams.get()),
+            QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage, fr.texMatrices.get(), m_matricesSampler.get()),
+            QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage, fr.texCanvas.get(), m_canvasSampler.get()),
+            QRhiShaderResourceBinding::sampledTexture(5, QRhiShaderResourceBinding::FragmentStage, fr.texMeshData.get(), m_meshDataSampler.get()),
+        };
+        if (yuv) {
+            bindings.push_back(QRhiShaderResourceBinding::sampledTexture(7, QRhiShaderResourceBinding::FragmentStage, m_texUV.get(), m_drawingSampler.get()));
+            bindings.push_back(QRhiShaderResourceBinding::uniformBuffer (8, QRhiShaderResourceBinding::FragmentStage, m_yuvParams.get()));
+        }
+        fr.srb->setBindings(bindings.cbegin(), bindings.cend());
+        if (!fr.srb->create()) { qDebug2("init") << "failed to create srb"; return false; }
 
         return true;
     }
 
-    bool render(MDKPlayer *item, uint8_t *params, uint paramsLen, uint8_t *matrices, uint matricesLen, uint8_t *canvas, uint canvasLen, float *meshData, uint meshDataLen) {
+    // Applies parameter changes in place, recreating only the affected resources. Rebuilt textures keep their QRhiTexture
+    // objects, and QRhi picks up the new native resources in the existing SRBs, so the bindings only change with the item texture.
+    // Returns false if any resource couldn't be recreated, in which case the caller should do a full init()
+    bool update(MDKPlayer *item, QSize textureSize, QSize outputSize, const QString &shaderPath, unsigned int sizeForRS, QSize canvasSize) {
+        if (!item) return false;
+        return update(item->rhiContext()->rhi(), item->rhiTexture(), textureSize, outputSize, shaderPath, sizeForRS, canvasSize);
+    }
+    bool update(QRhi *rhi, QRhiTexture *inputTexture, QSize textureSize, QSize outputSize, const QString &shaderPath, unsigned int sizeForRS, QSize canvasSize) {
+        if (!rhi || m_frames.empty()) return false;
+
+        m_outputSize = outputSize; // Only informational, the output is sized by the kernel params
+
+        if (m_sizeForRS != sizeForRS) {
+            for (auto &fr : m_frames) {
+                fr->texMatrices->setPixelSize(QSize(MatrixTexels, sizeForRS));
+                if (!fr->texMatrices->create()) { qDebug2("update") << "failed to resize texMatrices"; return false; }
+                fr->matricesShadow.clear();
+                fr->hashesValid = false;
+            }
+            m_sizeForRS = sizeForRS;
+        }
+
+        if (m_textureSize != textureSize) {
+            for (auto &target : m_targets) {
+                if (!target.texture) continue;
+                target.texture->setPixelSize(textureSize);
+                if (!target.texture->create()) { qDebug2("update") << "failed to resize output texture"; return false; }
+                if (!target.rt->create()) { qDebug2("update") << "failed to recreate render target"; return false; }
+            }
+            m_textureSize = textureSize;
+        }
+
+        if (m_canvasSize != canvasSize) {
+            for (auto &fr : m_frames) {
+                fr->texCanvas->setPixelSize(canvasSize);
+                if (!fr->texCanvas->create()) { qDebug2("update") << "failed to resize texCanvas"; return false; }
+                fr->canvasUploaded = false;
+                fr->canvasHashValid = false;
+            }
+            m_canvasSize = canvasSize;
+        }
+
+        if (m_itemTexturePtr != inputTexture && m_inputFormat == InputFormat::ItemTexture) {
+            for (auto &fr : m_frames) {
+                if (!updateBindings(*fr, inputTexture)) return false;
+            }
+            m_itemTexturePtr = inputTexture;
+        }
+
+        if (m_shaderPath != shaderPath) {
+            QRhiGraphicsPipeline *pipeline = getPipeline(rhi, shaderPath);
+            if (!pipeline) { qDebug2("update") << "failed to create pipeline for" << shaderPath; return false; }
+            m_pipeline = pipeline;
+            m_shaderPath = shaderPath;
+        }
+
+        return true;
+    }
+
+    // Asynchronous readback of the stabilized frames into a small ring. `callback` is called on the render thread
+    // when a frame has completed on the GPU, frames are dropped if all slots are still pending. Empty callback disables it
+    void setReadbackCallback(std::function<void(qint64 timestamp, QSize size, const QByteArray &rgba)> &&callback) {
+        m_readbackCallback = std::move(callback);
+    }
+    quint64 droppedReadbacks() { return m_droppedReadbacks; }
+    bool hasReadbackCallback() { return bool(m_readbackCallback); }
+    const RenderStats &lastStats() { return m_stats; }
+
+    void queueReadback(QRhiResourceUpdateBatch *u, QRhiTexture *texture, qint64 timestamp) {
+        auto &inFlight = inFlightReadbacks();
+        QMutexLocker lock(&inFlight.mutex);
+        inFlight.slots.erase(std::remove_if(inFlight.slots.begin(), inFlight.slots.end(), [](const auto &x) { return !x->pending; }), inFlight.slots.end());
+
+        auto &slot = m_readbacks[m_nextReadback];
+        if (!slot) {
+            slot = std::make_shared<ReadbackSlot>();
+            ReadbackSlot *ptr = slot.get();
+            slot->result.completed = [ptr] {
+                ptr->callback(ptr->timestamp, ptr->result.pixelSize, ptr->result.data);
+                ptr->pending = false;
+            };
+        }
+        if (slot->pending) { // Still in flight
+            ++m_droppedReadbacks;
+            return;
+        }
+        slot->pending = true;
+        inFlight.slots.push_back(slot);
+        slot->timestamp = timestamp;
+        slot->callback = m_readbackCallback;
+        u->readBackTexture(QRhiReadbackDescription(texture), &slot->result);
+        m_nextReadback = (m_nextReadback + 1) % m_readbacks.size();
+    }
+
+    // The hashes are computed by the caller over the whole `matrices` and `meshData` contents, and over `canvasRect` of the canvas.
+    // `canvasRect` holds everything drawn on the canvas, `canvasLen` is 0 when nothing is drawn and the kernel flags have drawing disabled
+    bool render(MDKPlayer *item, qint64 timestamp, uint8_t *params, uint paramsLen, uint8_t *matrices, uint matricesLen, uint32_t matricesHash, uint8_t *canvas, uint canvasLen, uint32_t canvasHash, QRect canvasRect, float *meshData, uint meshDataLen, uint32_t meshDataHash) {
         if (!item->qmlItem() || !item->rhiTexture() || !item->qmlWindow()) return false;
         auto context = item->rhiContext();
-        auto rhi = context->rhi();
-
-        if (matricesBuffer.size() < matricesLen) { matricesBuffer.resize(matricesLen); }
-        if (matricesLen > 0) memcpy(matricesBuffer.data(), matrices, matricesLen);
+        return render(context->rhi(), context->currentFrameCommandBuffer(), item->rhiTexture(), item->textureMatrix(), item->textureSize(), timestamp, params, paramsLen, matrices, matricesLen, matricesHash, canvas, canvasLen, canvasHash, canvasRect, meshData, meshDataLen, meshDataHash);
+    }
 
-        if (meshDataBuffer.size() < meshDataLen*4) { meshDataBuffer.resize(meshDataLen*4); }
-        if (meshDataLen > 0) memcpy(meshDataBuffer.data(), meshData, meshDataLen*4);
-        else if (meshDataBuffer[0] != 0) memset(meshDataBuffer.data(), 0, meshDataBuffer.size());
+    // Records the pass into `cb`, which must be in a frame. `copyTarget` gets the result when not rendering into our own output
+    bool render(QRhi *rhi, QRhiCommandBuffer *cb, QRhiTexture *copyTarget, const QMatrix4x4 &textureMatrix, QSize size, qint64 timestamp, uint8_t *params, uint paramsLen, uint8_t *matrices, uint matricesLen, uint32_t matricesHash, uint8_t *canvas, uint canvasLen, uint32_t canvasHash, QRect canvasRect, float *meshData, uint meshDataLen, uint32_t meshDataHash) {
+        if (!rhi || !cb || m_frames.empty() || (!m_ownOutput && !copyTarget)) return false;
+        FrameResources &fr = *m_frames[m_frames.size() > 1 ? rhi->currentFrameSlot() % m_frames.size() : 0];
 
-        const QSize size = item->textureSize();
-        QRhiCommandBuffer *cb = context->currentFrameCommandBuffer();
+        // Timestamps are only collected when the QRhi was created with EnableTimestamps (QSG_RHI_PROFILE=1 for Qt Quick)
+        const double gpuTime = cb->lastCompletedGpuTime();
+        m_stats.gpuTimeMs = gpuTime > 0.0 ? gpuTime * 1000.0 : -1.0;
+        m_stats.uploadBytes = paramsLen + 64;
+        QElapsedTimer uploadTimer;
+        uploadTimer.start();
 
         QRhiResourceUpdateBatch *u = rhi->nextResourceUpdateBatch();
         if (m_initialUpdates) {
@@ -172,46 +599,130 @@ public:
             m_initialUpdates->release();
             m_initialUpdates = nullptr;
         }
+        if (m_inputUpload) {
+            u->merge(m_inputUpload);
+            m_inputUpload->release();
+            m_inputUpload = nullptr;
+        }
 
         u->updateDynamicBuffer(m_kernelParams.get(), 0, paramsLen, params);
 
-        {
-            QRhiTextureSubresourceUploadDescription desc1(meshDataBuffer.data(), meshDataBuffer.size());
-            u->uploadTexture(m_texMeshData.get(), QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, desc1) }));
+        if (!fr.hashesValid || fr.meshDataHash != meshDataHash) {
+            static const std::vector<uint8_t> emptyMeshData(1024 * sizeof(float), 0);
+            if (meshDataLen > 0) m_stats.uploadBytes += uploadChangedRows(u, fr.texMeshData.get(), fr.meshDataShadow, reinterpret_cast<const uint8_t *>(meshData), meshDataLen * sizeof(float), sizeof(float));
+            else                 m_stats.uploadBytes += uploadChangedRows(u, fr.texMeshData.get(), fr.meshDataShadow, emptyMeshData.data(), emptyMeshData.size(), sizeof(float));
+            fr.meshDataHash = meshDataHash;
         }
+        if ((!fr.hashesValid || fr.matricesHash != matricesHash) && matricesLen > 0) {
+            size_t packedLen = matricesLen;
+            const uint8_t *packed = packMatrices(m_matricesPacked, matrices, packedLen);
+            m_stats.uploadBytes += uploadChangedRows(u, fr.texMatrices.get(), fr.matricesShadow, packed, packedLen, MatrixRowBytes);
+            fr.matricesHash = matricesHash;
+        }
+        fr.hashesValid = true;
 
-        QRhiTextureSubresourceUploadDescription desc1(matricesBuffer.data(), matricesBuffer.size());
-        u->uploadTexture(m_texMatrices.get(), QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, desc1) }));
-
-        if (canvasLen > 0) {
-            QRhiTextureSubresourceUploadDescription desc2(canvas, canvasLen);
-            u->uploadTexture(m_texCanvas.get(), QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, desc2) }));
+        if (canvasLen > 0 && (!fr.canvasHashValid || fr.canvasHash != canvasHash)) {
+            m_stats.uploadBytes += uploadCanvasRect(u, fr.texCanvas.get(), fr.canvasUploadedRect, fr.canvasUploaded, canvas, canvasLen, canvasRect);
+            fr.canvasHash = canvasHash;
+            fr.canvasHashValid = true;
         }
 
-        QMatrix4x4 mvp = item->textureMatrix();
+        QMatrix4x4 mvp = textureMatrix;
         mvp.scale(2.0f);
         u->updateDynamicBuffer(m_drawingUniform.get(), 0, 64, mvp.constData());
+        m_stats.uploadTimeMs = uploadTimer.nsecsElapsed() / 1000000.0;
+
+        if (m_ownOutput) m_currentTarget = (m_currentTarget + 1) % 2;
+        auto &target = m_targets[m_currentTarget];
 
-        cb->beginPass(m_rt.get(), QColor(Qt::black), { 1.0f, 0 }, u);
-        cb->setGraphicsPipeline(m_pipeline.get());
+        cb->beginPass(target.rt.get(), QColor(Qt::black), { 1.0f, 0 }, u);
+        cb->setGraphicsPipeline(m_pipeline);
         cb->setViewport({ 0, 0, float(size.width()), float(size.height()) });
-        cb->setShaderResources();
+        cb->setShaderResources(fr.srb.get());
         QRhiCommandBuffer::VertexInput vbufBinding(m_vertexBuffer.get(), 0);
         cb->setVertexInput(0, 1, &vbufBinding, m_indexBuffer.get(), 0, QRhiCommandBuffer::IndexUInt16);
         cb->drawIndexed(6);
         cb->endPass();
 
-        u = rhi->nextResourceUpdateBatch();
-        u->copyTexture(item->rhiTexture(), m_texIn.get(), {});
-        cb->resourceUpdate(u);
+        if (m_present) {
+            // The node may already be in this frame's batches, so point it at the new target right away, the sync makes sure it's picked up
+            m_present->texture = target.texture;
+            if (m_present->nodeTexture) {
+                m_present->nodeTexture->setTexture(target.texture.get());
+                m_present->nodeTexture->setTextureSize(target.texture->pixelSize());
+            }
+            QMetaObject::invokeMethod(qApp, [state = m_present] { if (state->presenter) state->presenter->update(); }, Qt::QueuedConnection);
+        }
 
-        rhi->finish();
+        if (!m_ownOutput || m_readbackCallback) {
+            u = rhi->nextResourceUpdateBatch();
+            if (!m_ownOutput) u->copyTexture(copyTarget, target.texture.get(), {});
+            if (m_readbackCallback) queueReadback(u, target.texture.get(), timestamp);
+            cb->resourceUpdate(u);
+        }
+
+        if (!m_pipelined && !m_offscreen) {
+            rhi->finish();
+        }
 
         return true;
     }
 
-    std::vector<uint8_t> matricesBuffer;
-    std::vector<uint8_t> meshDataBuffer;
+    // Pipelines are cached per QRhi and keyed by the shader, render pass and resource layout, so switching lens profiles
+    // or recreating QtRHIUndistort reuses the already compiled ones. They're destroyed together with the QRhi.
+    // Serialized formats are only available since Qt 6.6, older versions create a pipeline per instance
+    QRhiGraphicsPipeline *getPipeline(QRhi *rhi, const QString &shaderPath) {
+        QRhiShaderResourceBindings *srb = m_frames[0]->srb.get(); // All frame SRBs share the same layout
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+        static QMutex mutex;
+        static QHash<QRhi *, QHash<QByteArray, QRhiGraphicsPipeline *>> cache;
+
+        QByteArray key = shaderPath.toUtf8();
+        for (auto x : m_rtRp->serializedFormat())         key += QByteArray::number(x) + ',';
+        key += '|';
+        for (auto x : srb->serializedLayoutDescription()) key += QByteArray::number(x) + ',';
+
+        QMutexLocker lock(&mutex);
+        if (!cache.contains(rhi)) {
+            rhi->addCleanupCallback([](QRhi *rhi) {
+                QMutexLocker lock(&mutex);
+                qDeleteAll(cache.value(rhi));
+                cache.remove(rhi);
+            });
+        }
+        auto &pipelines = cache[rhi];
+        if (auto pipeline = pipelines.value(key)) {
+            pipeline->setShaderResourceBindings(srb); // The SRB it was created with may be gone already, only the layout matters
+            return pipeline;
+        }
+        QRhiGraphicsPipeline *pipeline = createPipeline(rhi, shaderPath, srb);
+        if (pipeline) pipelines.insert(key, pipeline);
+        return pipeline;
+#else
+        m_ownedPipeline.reset(createPipeline(rhi, shaderPath, srb));
+        return m_ownedPipeline.get();
+#endif
+    }
+    QRhiGraphicsPipeline *createPipeline(QRhi *rhi, const QString &shaderPath, QRhiShaderResourceBindings *srb) {
+        QRhiGraphicsPipeline *pipeline = rhi->newGraphicsPipeline();
+        // The vertex shader of the same set as the fragment shader, the committed compiled/ or the baked/ ones from build.rs
+        const QString vertexPath = shaderPath.left(shaderPath.lastIndexOf('/')) + QLatin1String("/texture.vert.qsb");
+        pipeline->setShaderStages({
+            { QRhiShaderStage::Vertex,   getShader(vertexPath) },
+            { QRhiShaderStage::Fragment, getShader(shaderPath) }
+        });
+        QRhiVertexInputLayout inputLayout;
+        inputLayout.setBindings({ { 4 * sizeof(float) } });
+        inputLayout.setAttributes({
+            { 0, 0, QRhiVertexInputAttribute::Float2, 0 },
+            { 0, 1, QRhiVertexInputAttribute::Float2, 2 * sizeof(float) }
+        });
+        pipeline->setVertexInputLayout(inputLayout);
+        pipeline->setShaderResourceBindings(srb);
+        pipeline->setRenderPassDescriptor(m_rtRp.get());
+        if (!pipeline->create()) { delete pipeline; return nullptr; }
+        return pipeline;
+    }
 
     /*QByteArray getContents(const QString &name) {
         QFile f(name);
@@ -219,40 +730,276 @@ public:
             return f.readAll();
         return QByteArray();
     }*/
-    QShader getShader(const QString &name) {
+    static QShader getShader(const QString &name) {
+        static QMutex mutex;
+        static QHash<QString, QShader> cache;
+        QMutexLocker lock(&mutex);
+        if (auto it = cache.constFind(name); it != cache.constEnd()) return *it;
+
         QFile f(name);
-        if (f.open(QIODevice::ReadOnly))
-            return QShader::fromSerialized(f.readAll());
+        if (f.open(QIODevice::ReadOnly)) {
+            QShader shader = QShader::fromSerialized(f.readAll());
+            if (shader.isValid()) cache.insert(name, shader);
+            return shader;
+        }
         return QShader();
     }
 
     QRhiTexture *m_itemTexturePtr{nullptr};
 
-    QScopedPointer<QRhiTexture> m_texIn;
-    QScopedPointer<QRhiTexture> m_texMatrices;
-    QScopedPointer<QRhiTexture> m_texCanvas;
+    OutputTarget m_targets[2];
+    int m_currentTarget{0};
+    bool m_ownOutput{false};
+    std::shared_ptr<PresentedOutput> m_present;
     QScopedPointer<QRhiBuffer> m_kernelParams;
-    QScopedPointer<QRhiTexture> m_texMeshData;
+    QScopedPointer<QRhiBuffer> m_drawingUniform;
+    QScopedPointer<QRhiBuffer> m_yuvParams;
+    QScopedPointer<QRhiTexture> m_texY;
+    QScopedPointer<QRhiTexture> m_texUV;
+    InputFormat m_inputFormat{InputFormat::ItemTexture};
+    QSize m_inputSize;
+    bool m_inputFullRange{false};
+    QRhiTexture::Format m_outputFormat{QRhiTexture::RGBA8};
+    QRhiResourceUpdateBatch *m_inputUpload{nullptr};
+    std::vector<uint8_t> m_matricesPacked;
+    std::vector<std::unique_ptr<FrameResources>> m_frames;
 
     QSize m_outputSize;
     QSize m_textureSize;
     QString m_shaderPath;
     unsigned int m_sizeForRS{0};
+    QSize m_canvasSize;
+    int m_framesInFlight{1};
+    bool m_pipelined{false};
+    bool m_offscreen{false};
 
     QScopedPointer<QRhiBuffer> m_vertexBuffer;
     QScopedPointer<QRhiBuffer> m_indexBuffer;
-    QScopedPointer<QRhiBuffer> m_drawingUniform;
     QScopedPointer<QRhiSampler> m_canvasSampler;
     QScopedPointer<QRhiSampler> m_drawingSampler;
     QScopedPointer<QRhiSampler> m_matricesSampler;
     QScopedPointer<QRhiSampler> m_meshDataSampler;
-    QScopedPointer<QRhiShaderResourceBindings> m_srb;
-    QScopedPointer<QRhiGraphicsPipeline> m_pipeline;
+    QRhiGraphicsPipeline *m_pipeline{nullptr};
+    QScopedPointer<QRhiGraphicsPipeline> m_ownedPipeline;
 
-    QScopedPointer<QRhiTextureRenderTarget> m_rt;
     QScopedPointer<QRhiRenderPassDescriptor> m_rtRp;
 
-    QScopedPointer<QRhiReadbackResult> m_readbackResult;
+    std::array<std::shared_ptr<ReadbackSlot>, 3> m_readbacks;
+    size_t m_nextReadback{0};
+    quint64 m_droppedReadbacks{0};
+    std::function<void(qint64, QSize, const QByteArray &)> m_readbackCallback;
+
+    RenderStats m_stats;
 
     QRhiResourceUpdateBatch *m_initialUpdates{nullptr};
 };
+
+// Owns an offscreen QRhi and a QtRHIUndistort rendering into it, so frames can be undistorted on the GPU without any
+// QML window, e.g. by the live pipeline. The input is either uploaded from CPU memory or an existing texture of rhi().
+// Every process() call is one offscreen frame which waits for the GPU and reads the result back, so the output is ready
+// when it returns. Must be created, used and destroyed on the same thread, and needs an existing QGuiApplication
+class QtRHIHeadlessUndistort {
+public:
+    ~QtRHIHeadlessUndistort() {
+        m_undistort.reset(); // All resources have to be released before the QRhi
+        m_inputTexture.reset();
+        m_rhi.reset();
+#if QT_CONFIG(vulkan)
+        m_vulkanInstance.reset();
+#endif
+    }
+
+    // Tries the backends in platform order, GYROFLOW_QRHI_HEADLESS_BACKEND=vulkan|d3d11|d3d12|metal|opengl|null forces one
+    bool create() {
+        const QByteArray forced = qgetenv("GYROFLOW_QRHI_HEADLESS_BACKEND").toLower();
+        QList<QRhi::Implementation> backends;
+        if      (forced == "vulkan") backends = { QRhi::Vulkan };
+        else if (forced == "d3d11")  backends = { QRhi::D3D11 };
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+        else if (forced == "d3d12")  backends = { QRhi::D3D12 };
+#endif
+        else if (forced == "metal")  backends = { QRhi::Metal };
+        else if (forced == "opengl") backends = { QRhi::OpenGLES2 };
+        else if (forced == "null")   backends = { QRhi::Null };
+        else {
+#if defined(Q_OS_MACOS) || defined(Q_OS_IOS)
+            backends = { QRhi::Metal, QRhi::OpenGLES2 };
+#elif defined(Q_OS_WIN)
+#   if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+            backends = { QRhi::D3D12, QRhi::D3D11, QRhi::Vulkan };
+#   else
+            backends = { QRhi::D3D11, QRhi::Vulkan };
+#   endif
+#else
+            backends = { QRhi::Vulkan, QRhi::OpenGLES2 };
+#endif
+        }
+
+        // Timestamps are cheap and let lastStats() report the GPU time like the preview does with QSG_RHI_PROFILE=1
+        const QRhi::Flags flags = QRhi::EnableTimestamps;
+        for (auto impl : backends) {
+            m_rhi.reset(createRhi(impl, flags));
+            if (m_rhi) {
+                qDebug2("createHeadless") << "Created offscreen" << m_rhi->backendName() << "QRhi on" << m_rhi->driverInfo().deviceName;
+                return true;
+            }
+        }
+        qDebug2("createHeadless") << "failed to create an offscreen QRhi";
+        return false;
+    }
+
+    QRhi *rhi() { return m_rhi.get(); }
+    QString backendName() { return m_rhi ? QString::fromLatin1(m_rhi->backendName()) : QString(); }
+    const RenderStats &lastStats() { return m_stats; }
+
+    // Formats of the next process() calls, see QtRHIUndistort::setFormats(). With NV12 or P010 the `input` buffer holds the Y plane
+    // followed by the UV plane, both with `inputStride` bytes per row. The output is read back in the format of outputTexture()
+    void setFormats(InputFormat input, bool fullRange, QRhiTexture::Format output) {
+        m_inputFormat = input;
+        m_inputFullRange = fullRange;
+        m_outputFormat = output;
+    }
+
+    // Undistorts one frame into `output` (`outputStride` bytes per row, sized by the kernel params).
+    // `inputTexture` has to belong to rhi(), otherwise `input` with `inputStride` bytes per row is uploaded
+    bool process(qint64 timestamp, QRhiTexture *inputTexture, const uint8_t *input, int inputStride, QSize inputSize, QSize outputSize, const QString &shaderPath,
+                 uint8_t *params, uint paramsLen, uint8_t *matrices, uint matricesLen, uint32_t matricesHash, uint8_t *canvas, uint canvasLen, uint32_t canvasHash, QRect canvasRect, QSize canvasSize,
+                 float *meshData, uint meshDataLen, uint32_t meshDataHash, unsigned int sizeForRS, uint8_t *output, int outputStride) {
+        if (!m_rhi || inputSize.isEmpty() || outputSize.isEmpty() || (!inputTexture && !input)) return false;
+        QRhi *rhi = m_rhi.get();
+        const bool yuv = m_inputFormat != InputFormat::ItemTexture;
+
+        // The formats are set before init() and the YUV planes are sized there, so any change needs a new QtRHIUndistort
+        if (m_undistort && m_formatsKey != formatsKey(yuv ? inputSize : QSize())) {
+            m_undistort.reset();
+        }
+        if (yuv) {
+            inputTexture = nullptr;
+        } else if (!inputTexture) {
+            if (!m_inputTexture || m_inputTexture->pixelSize() != inputSize) {
+                if (!m_inputTexture) m_inputTexture.reset(rhi->newTexture(QRhiTexture::RGBA8, inputSize, 1, QRhiTexture::Flags()));
+                m_inputTexture->setPixelSize(inputSize); // Picked up by the existing SRBs
+                if (!m_inputTexture->create()) { qDebug2("process") << "failed to create input texture"; return false; }
+            }
+            inputTexture = m_inputTexture.get();
+        }
+
+        if (m_undistort && m_paramsLen == paramsLen
+        && (m_undistort->texSize() != outputSize
+        || m_undistort->shaderPath() != shaderPath
+        || m_undistort->sizeForRS() != sizeForRS
+        || m_undistort->canvasSize() != canvasSize
+        || m_undistort->itemTexturePtr() != inputTexture)) {
+            if (!m_undistort->update(rhi, inputTexture, outputSize, outputSize, shaderPath, sizeForRS, canvasSize)) {
+                qDebug2("process") << "Failed to update, reinitializing";
+                m_undistort.reset();
+            }
+        }
+        if (!m_undistort || m_paramsLen != paramsLen) {
+            m_undistort.reset(new QtRHIUndistort());
+            m_undistort->setFormats(m_inputFormat, inputSize, m_inputFullRange, m_outputFormat);
+            m_formatsKey = formatsKey(yuv ? inputSize : QSize());
+            if (!m_undistort->init(rhi, inputTexture, outputSize, outputSize, shaderPath, paramsLen, sizeForRS, canvasSize, true, true)) {
+                qDebug2("process") << "Failed to initialize";
+                m_undistort.reset();
+                return false;
+            }
+            m_paramsLen = paramsLen;
+        }
+
+        QRhiCommandBuffer *cb = nullptr;
+        if (rhi->beginOffscreenFrame(&cb) != QRhi::FrameOpSuccess) { qDebug2("process") << "failed to begin offscreen frame"; return false; }
+
+        QElapsedTimer inputTimer;
+        inputTimer.start();
+        if (yuv) {
+            // Applied by render() together with the other uploads
+            m_undistort->uploadInput(rhi, input, inputStride, input + inputStride * inputSize.height(), inputStride);
+        } else if (inputTexture == m_inputTexture.get()) {
+            QRhiTextureSubresourceUploadDescription desc(input, inputStride * inputSize.height());
+            desc.setDataStride(inputStride);
+            QRhiResourceUpdateBatch *u = rhi->nextResourceUpdateBatch();
+            u->uploadTexture(inputTexture, QRhiTextureUploadDescription({ QRhiTextureUploadEntry(0, 0, desc) }));
+            cb->resourceUpdate(u);
+        }
+        const double inputUploadMs = inputTimer.nsecsElapsed() / 1000000.0;
+
+        bool ok = m_undistort->render(rhi, cb, nullptr, QMatrix4x4(), outputSize, timestamp, params, paramsLen, matrices, matricesLen, matricesHash, canvas, canvasLen, canvasHash, canvasRect, meshData, meshDataLen, meshDataHash);
+
+        QRhiReadbackResult result;
+        if (ok) {
+            QRhiResourceUpdateBatch *u = rhi->nextResourceUpdateBatch();
+            u->readBackTexture(QRhiReadbackDescription(m_undistort->outputTexture()), &result);
+            cb->resourceUpdate(u);
+        }
+        // Waits for the GPU, so the readback is complete afterwards
+        if (rhi->endOffscreenFrame() != QRhi::FrameOpSuccess) { qDebug2("process") << "failed to end offscreen frame"; return false; }
+        if (!ok || result.data.isEmpty()) return false;
+
+        m_stats = m_undistort->lastStats();
+        m_stats.uploadTimeMs += inputUploadMs;
+        if (yuv) m_stats.uploadBytes += quint64(inputStride) * (inputSize.height() + (inputSize.height() + 1) / 2);
+        else if (inputTexture == m_inputTexture.get()) m_stats.uploadBytes += quint64(inputStride) * inputSize.height();
+
+        const int bytesPerPixel = m_undistort->outputTexture()->format() == QRhiTexture::RGBA16F ? 8 : 4;
+        const int rows = std::min(outputSize.height(), result.pixelSize.height());
+        const int srcStride = result.data.size() / std::max(1, result.pixelSize.height());
+        const int rowBytes = std::min({ srcStride, outputStride, outputSize.width() * bytesPerPixel });
+        for (int y = 0; y < rows; ++y) {
+            memcpy(output + y * outputStride, result.data.constData() + y * srcStride, rowBytes);
+        }
+        return true;
+    }
+
+private:
+    QRhi *createRhi(QRhi::Implementation impl, QRhi::Flags flags) {
+        switch (impl) {
+#if QT_CONFIG(vulkan)
+            case QRhi::Vulkan: {
+                if (!m_vulkanInstance) {
+                    m_vulkanInstance.reset(new QVulkanInstance());
+                    m_vulkanInstance->setExtensions(QRhiVulkanInitParams::preferredInstanceExtensions());
+                    if (!m_vulkanInstance->create()) { m_vulkanInstance.reset(); return nullptr; }
+                }
+                QRhiVulkanInitParams params;
+                params.inst = m_vulkanInstance.get();
+                return QRhi::create(impl, &params, flags);
+            }
+#endif
+#ifdef Q_OS_WIN
+            case QRhi::D3D11: { QRhiD3D11InitParams params; return QRhi::create(impl, &params, flags); }
+#   if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+            case QRhi::D3D12: { QRhiD3D12InitParams params; return QRhi::create(impl, &params, flags); }
+#   endif
+#endif
+#if defined(Q_OS_MACOS) || defined(Q_OS_IOS)
+            case QRhi::Metal: { QRhiMetalInitParams params; return QRhi::create(impl, &params, flags); }
+#endif
+            case QRhi::OpenGLES2: {
+                m_fallbackSurface.reset(QRhiGles2InitParams::newFallbackSurface());
+                QRhiGles2InitParams params;
+                params.fallbackSurface = m_fallbackSurface.get();
+                return QRhi::create(impl, &params, flags);
+            }
+            case QRhi::Null: { QRhiNullInitParams params; return QRhi::create(impl, &params, flags); }
+            default: return nullptr;
+        }
+    }
+
+#if QT_CONFIG(vulkan)
+    std::unique_ptr<QVulkanInstance> m_vulkanInstance;
+#endif
+    std::unique_ptr<QOffscreenSurface> m_fallbackSurface;
+    std::unique_ptr<QRhi> m_rhi;
+    std::unique_ptr<QRhiTexture> m_inputTexture;
+    std::unique_ptr<QtRHIUndistort> m_undistort;
+    uint m_paramsLen{0};
+    RenderStats m_stats;
+
+    InputFormat m_inputFormat{InputFormat::ItemTexture};
+    bool m_inputFullRange{false};
+    QRhiTexture::Format m_outputFormat{QRhiTexture::RGBA8};
+    // The formats and YUV input size m_undistort was initialized with
+    QString formatsKey(QSize yuvSize) { return QString("%1:%2:%3:%4x%5").arg(int(m_inputFormat)).arg(m_inputFullRange).arg(int(m_outputFormat)).arg(yuvSize.width()).arg(yuvSize.height()); }
+    QString m_formatsKey;
+};
@@ -1,8 +1,12 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 // Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
 
-use gyroflow_core::{ stabilization::ProcessedInfo, gpu::Buffers };
+use gyroflow_core::{ stabilization::ProcessedInfo, gpu::{ Buffers, BufferSource } };
+use gyroflow_core::stabilization::{ KernelParams, KernelParamsFlags };
+use gyroflow_core::gpu::drawing::DrawCanvas;
 use qml_video_rs::video_player::MDKPlayerWrapper;
+use parking_lot::Mutex;
+use std::collections::BTreeMap;
 use std::sync::Arc;
 use crate::core::StabilizationManager;
 use crate::core::stabilization::RGBA8;
@@ -13,6 +17,94 @@ cpp! {{
     #include "src/qt_gpu/qrhi_undistort.cpp"
 }}
 
+/// Receives the stabilized preview frames as RGBA8: `(timestamp_us, width, height, pixels)`, returns false to stop the readback
+pub type FrameReadbackCallback = Box<dyn FnMut(i64, u32, u32, &[u8]) -> bool + Send>;
+static FRAME_READBACK: Mutex<Option<FrameReadbackCallback>> = Mutex::new(None);
+
+/// Reads back every stabilized preview frame asynchronously from the GPU, `None` disables it.
+/// The callback runs on the render thread a frame or two after the frame was rendered, so it should only hand the data off.
+/// Frames are dropped rather than stalling the render thread when the readback ring is full
+pub fn set_frame_readback(cb: Option<FrameReadbackCallback>) {
+    *FRAME_READBACK.lock() = cb;
+}
+
+/// Resource directory of the undistortion shaders. build.rs compiles all the variants into `baked/` when Qt's shader tools are installed,
+/// otherwise only the base shaders committed in `compiled/` are available
+pub const SHADER_DIR: &str = if cfg!(qrhi_baked_shaders) { ":/src/qt_gpu/baked" } else { ":/src/qt_gpu/compiled" };
+
+fn undistort_shader_path(stab: &StabilizationManager) -> QString {
+    let lens = stab.lens.read();
+    let distortion_model = lens.distortion_model.as_deref().unwrap_or("opencv_fisheye");
+    let digital_lens = lens.digital_lens.as_ref().map(|x| format!("_{}", x)).unwrap_or_else(|| "".into());
+
+    QString::from(format!("{SHADER_DIR}/undistort_{}{}.frag.qsb", distortion_model, digital_lens))
+}
+
+/// Whether a compiled shader is in the resources, cached since the resources don't change at runtime
+fn shader_exists(path: &str) -> bool {
+    static EXISTS: Mutex<BTreeMap<String, bool>> = Mutex::new(BTreeMap::new());
+    *EXISTS.lock().entry(path.to_owned()).or_insert_with(|| {
+        let qpath = QString::from(path);
+        cpp!(unsafe [qpath as "QString"] -> bool as "bool" { return QFile::exists(qpath); })
+    })
+}
+
+/// Suffixes of the shader variants compiled with parts of the kernel removed (see the top of undistort.frag),
+/// from the most specialized. `(suffix, needs a single matrix)`
+pub const SPECIALIZED_SHADERS: &[(&str, bool)] = &[("_fast", true), ("_fast_rs", false)];
+
+/// The most specialized variant of `path` that renders these params exactly like the generic shader, if it was compiled.
+/// The pipeline is only recreated when the selection changes, e.g. when the overlays are enabled
+fn specialized_shader_path(path: QString, params: &KernelParams) -> QString {
+    let flags = params.flags;
+    let safe_area = params.safe_area_rect;
+    let (lens_correction_amount, background_mode, matrix_count) = (params.lens_correction_amount, params.background_mode, params.matrix_count);
+    let no_safe_area = safe_area[0] <= 0.0 && safe_area[1] <= 0.0 && safe_area[2] >= params.output_width as f32 && safe_area[3] >= params.output_height as f32;
+    // Drawing, mesh data, focal plane distortion and underwater
+    if (flags & (8 | 512 | 1024 | 2048)) != 0 || !no_safe_area || background_mode != 0 || lens_correction_amount < 1.0 {
+        return path;
+    }
+    let base = path.to_string();
+    let Some(stem) = base.strip_suffix(".frag.qsb") else { return path; };
+    for (suffix, single_matrix) in SPECIALIZED_SHADERS {
+        if *single_matrix && matrix_count != 1 { continue; }
+        let candidate = format!("{stem}{suffix}.frag.qsb");
+        if shader_exists(&candidate) { return QString::from(candidate); }
+    }
+    path
+}
+
+/// The canvas to upload with its dirty rect as `[x, y, width, height]` and a hash of that rect. When nothing is drawn the
+/// canvas is empty and drawing is disabled in `kernel_params`, so the upload is skipped and the shader doesn't sample it
+fn canvas_upload<'a>(drawing: &'a DrawCanvas, kernel_params: &mut KernelParams) -> (&'a [u8], [i32; 4], u32) {
+    let canvas = drawing.get_drawn_buffer();
+    let Some((x, y, w, h)) = drawing.dirty_rect().filter(|_| !canvas.is_empty()) else {
+        kernel_params.flags &= !KernelParamsFlags::DRAWING_ENABLED.bits();
+        return (&[], [0; 4], 0);
+    };
+    let stride = drawing.get_size().0;
+    let mut hasher = crc32fast::Hasher::new();
+    hasher.update(bytemuck::bytes_of(&[x as u32, y as u32, w as u32, h as u32]));
+    for row in y..y + h {
+        let start = (row * stride + x).min(canvas.len());
+        hasher.update(&canvas[start..(start + w).min(canvas.len())]);
+    }
+    (canvas, [x as i32, y as i32, w as i32, h as i32], hasher.finalize())
+}
+
+/// Destroys the preview undistortion of `mdkplayer`, if any, which also removes its output from over the item.
+/// Used when the frames are shown unprocessed or processed by another pipeline
+pub fn release(mdkplayer: &MDKPlayerWrapper) {
+    cpp!(unsafe [mdkplayer as "MDKPlayerWrapper *"] {
+        if (!mdkplayer || !mdkplayer->mdkplayer || !mdkplayer->mdkplayer->userData()) return;
+        delete static_cast<QtRHIUndistort *>(mdkplayer->mdkplayer->userData());
+        mdkplayer->mdkplayer->setUserData(nullptr);
+    });
+}
+
+/// Undistorts the MDKPlayer item texture into textures owned by the C++ side, which are drawn over the item, so the result isn't
+/// copied back. MDK converts the decoded frames to that RGBA8 texture itself, so the preview always samples it
+/// (`InputFormat::ItemTexture` on the C++ side), YUV and high bit depth frames are handled by `HeadlessUndistort`
 pub fn render(mdkplayer: &MDKPlayerWrapper, timestamp: f64, frame: usize, width: u32, height: u32, stab: Arc<StabilizationManager>, buffers: &mut Buffers) -> Option<ProcessedInfo> {
     if stab.prevent_recompute.load(std::sync::atomic::Ordering::SeqCst) { return None; }
 
@@ -22,13 +114,7 @@ pub fn render(mdkplayer: &MDKPlayerWrapper, timestamp: f64, frame: usize, width:
 
     if let Some(p) = stab.params.try_read() {
         output_size = QSize { width: p.output_size.0 as u32, height: p.output_size.1 as u32 };
-        shader_path = {
-            let lens = stab.lens.read();
-            let distortion_model = lens.distortion_model.as_deref().unwrap_or("opencv_fisheye");
-            let digital_lens = lens.digital_lens.as_ref().map(|x| format!("_{}", x)).unwrap_or_else(|| "".into());
-
-            QString::from(format!(":/src/qt_gpu/compiled/undistort_{}{}.frag.qsb", distortion_model, digital_lens))
-        };
+        shader_path = undistort_shader_path(&stab);
 
         if let Some(scale) = p.fps_scale {
             timestamp_us = (timestamp_us as f64 / scale).round() as i64;
@@ -42,23 +128,37 @@ pub fn render(mdkplayer: &MDKPlayerWrapper, timestamp: f64, frame: usize, width:
 
     if let Some(undist) = stab.stabilization.try_read() {
         if let Some(itm) = undist.get_undistortion_data(timestamp_us) {
-            let params = bytemuck::bytes_of(&itm.kernel_params);
+            let mut kernel_params = itm.kernel_params;
+            let (canvas, canvas_rect, canvas_hash) = canvas_upload(&undist.drawing, &mut kernel_params);
+            let shader_path = if shader_path.is_empty() { shader_path } else { specialized_shader_path(shader_path, &kernel_params) };
+            let params = bytemuck::bytes_of(&kernel_params);
             let params_ptr = params.as_ptr();
             let params_len = params.len() as u32;
             let matrices_ptr = itm.matrices.as_ptr();
             let matrices_len = (itm.matrices.len() * 14 * std::mem::size_of::<f32>()) as u32;
-            let canvas = undist.drawing.get_buffer();
             let canvas_ptr = canvas.as_ptr();
             let canvas_len = canvas.len() as u32;
             let mesh_data_ptr = itm.mesh_data.as_ptr();
             let mesh_data_len = itm.mesh_data.len() as u32;
 
+            // Content hashes let the C++ side skip uploads of data that didn't change since the last frame
+            let matrices_hash = crc32fast::hash(bytemuck::cast_slice(&itm.matrices));
+            let mesh_data_hash = crc32fast::hash(bytemuck::cast_slice(&itm.mesh_data));
+
             let size_for_rs = if (itm.kernel_params.flags & 16) == 16 { itm.kernel_params.width } else { itm.kernel_params.height } as u32;
 
             let canvas_size = undist.drawing.get_size();
             let canvas_size = QSize { width: canvas_size.0 as u32, height: canvas_size.1 as u32 };
+            let readback = FRAME_READBACK.lock().is_some();
+
+            let mut gpu_time_ms = -1.0f64;
+            let mut upload_time_ms = 0.0f64;
+            let mut upload_bytes = 0u64;
+            let gpu_time_ptr = &mut gpu_time_ms as *mut f64;
+            let upload_time_ptr = &mut upload_time_ms as *mut f64;
+            let upload_bytes_ptr = &mut upload_bytes as *mut u64;
 
-            let ok = cpp!(unsafe [mdkplayer as "MDKPlayerWrapper *", output_size as "QSize", shader_path as "QString", width as "uint32_t", height as "uint32_t", params_ptr as "uint8_t*", matrices_ptr as "uint8_t*", canvas_ptr as "uint8_t*", mesh_data_ptr as "float*", mesh_data_len as "uint32_t", matrices_len as "uint32_t", params_len as "uint32_t", canvas_len as "uint32_t", canvas_size as "QSize", size_for_rs as "uint32_t"] -> bool as "bool" {
+            let ok = cpp!(unsafe [mdkplayer as "MDKPlayerWrapper *", output_size as "QSize", shader_path as "QString", width as "uint32_t", height as "uint32_t", params_ptr as "uint8_t*", matrices_ptr as "uint8_t*", canvas_ptr as "uint8_t*", mesh_data_ptr as "float*", mesh_data_len as "uint32_t", matrices_len as "uint32_t", params_len as "uint32_t", canvas_len as "uint32_t", canvas_size as "QSize", size_for_rs as "uint32_t", matrices_hash as "uint32_t", mesh_data_hash as "uint32_t", canvas_hash as "uint32_t", canvas_rect as "std::array<int32_t, 4>", readback as "bool", timestamp_us as "int64_t", gpu_time_ptr as "double *", upload_time_ptr as "double *", upload_bytes_ptr as "uint64_t *"] -> bool as "bool" {
                 if (!mdkplayer || !mdkplayer->mdkplayer || shader_path.isEmpty() || output_size.isEmpty()) return false;
 
                 auto rhiUndistortion = static_cast<QtRHIUndistort *>(mdkplayer->mdkplayer->userData());
@@ -75,38 +175,271 @@ pub fn render(mdkplayer: &MDKPlayerWrapper, timestamp: f64, frame: usize, width:
                     return true;
                 }
 
-                if (!rhiUndistortion
-                || rhiUndistortion->outSize() != output_size
+                if (rhiUndistortion
+                && (rhiUndistortion->outSize() != output_size
                 || rhiUndistortion->texSize() != QSize(width, height)
                 || rhiUndistortion->shaderPath() != shader_path
                 || rhiUndistortion->sizeForRS() != size_for_rs
-                || rhiUndistortion->itemTexturePtr() != mdkplayer->mdkplayer->rhiTexture()) {
-                    delete rhiUndistortion;
+                || rhiUndistortion->canvasSize() != canvas_size
+                || rhiUndistortion->itemTexturePtr() != mdkplayer->mdkplayer->rhiTexture())) {
+                    // Recreate only what changed, a full init is needed only if that fails
+                    if (rhiUndistortion->update(mdkplayer->mdkplayer, QSize(width, height), output_size, shader_path, size_for_rs, canvas_size)) {
+                        qDebug2("render") << "Updated" << QSize(width, height) << "->" << output_size << shader_path << rhiUndistortion;
+                    } else {
+                        qDebug2("render") << "Failed to update, reinitializing";
+                        delete rhiUndistortion;
+                        rhiUndistortion = nullptr;
+                        mdkplayer->mdkplayer->setUserData(nullptr);
+                    }
+                }
+                if (!rhiUndistortion) {
                     rhiUndistortion = new QtRHIUndistort();
-                    if (!rhiUndistortion->init(mdkplayer->mdkplayer, QSize(width, height), output_size, shader_path, params_len, size_for_rs, canvas_size)) {
+                    if (!rhiUndistortion->init(mdkplayer->mdkplayer, QSize(width, height), output_size, shader_path, params_len, size_for_rs, canvas_size, true)) {
                         qDebug2("render") << "Failed to initialize";
                         delete rhiUndistortion;
                         mdkplayer->mdkplayer->setUserData(nullptr);
                         return false;
                     }
-                    qDebug2("render") << "Initialized" << QSize(width, height) << "->" << output_size << shader_path << rhiUndistortion;
+                    qDebug2("render") << "Initialized" << QSize(width, height) << "->" << output_size << shader_path << (rhiUndistortion->isPipelined() ? "pipelined" : "blocking") << rhiUndistortion;
                     mdkplayer->mdkplayer->setUserData(static_cast<void *>(rhiUndistortion));
                     mdkplayer->mdkplayer->setUserDataDestructor([](void *ptr) {
                         delete static_cast<QtRHIUndistort *>(ptr);
                     });
                 }
 
-                return rhiUndistortion->render(mdkplayer->mdkplayer, params_ptr, params_len, matrices_ptr, matrices_len, canvas_ptr, canvas_len, mesh_data_ptr, mesh_data_len);
+                if (readback != rhiUndistortion->hasReadbackCallback()) {
+                    if (readback) {
+                        rhiUndistortion->setReadbackCallback([](qint64 timestamp, QSize size, const QByteArray &data) {
+                            auto data_ptr = reinterpret_cast<const uint8_t *>(data.constData());
+                            size_t data_len = data.size();
+                            uint32_t width = size.width(), height = size.height();
+                            rust!(Rust_QtRHIUndistort_readback [timestamp: i64 as "int64_t", width: u32 as "uint32_t", height: u32 as "uint32_t", data_ptr: *const u8 as "const uint8_t *", data_len: usize as "size_t"] {
+                                if data_len == 0 { return; }
+                                let mut lock = FRAME_READBACK.lock();
+                                if let Some(cb) = lock.as_mut() {
+                                    if !cb(timestamp, width, height, unsafe { std::slice::from_raw_parts(data_ptr, data_len) }) {
+                                        *lock = None;
+                                    }
+                                }
+                            });
+                        });
+                    } else {
+                        rhiUndistortion->setReadbackCallback(nullptr);
+                    }
+                }
+
+                bool ok = rhiUndistortion->render(mdkplayer->mdkplayer, timestamp_us, params_ptr, params_len, matrices_ptr, matrices_len, matrices_hash, canvas_ptr, canvas_len, canvas_hash, QRect(canvas_rect[0], canvas_rect[1], canvas_rect[2], canvas_rect[3]), mesh_data_ptr, mesh_data_len, mesh_data_hash);
+                const auto &stats = rhiUndistortion->lastStats();
+                *gpu_time_ptr = stats.gpuTimeMs;
+                *upload_time_ptr = stats.uploadTimeMs;
+                *upload_bytes_ptr = stats.uploadBytes;
+                return ok;
             });
             if ok {
+                ::log::trace!("Qt RHI frame {frame}: GPU {gpu_time_ms:.3}ms, upload {upload_bytes} bytes in {upload_time_ms:.3}ms");
                 return Some(ProcessedInfo {
                     fov: itm.fov,
                     minimal_fov: itm.minimal_fov,
                     focal_length: itm.focal_length,
-                    backend: "Qt RHI"
+                    backend: "Qt RHI",
+                    gpu_time_ms: if gpu_time_ms >= 0.0 { Some(gpu_time_ms) } else { None },
+                    upload_time_ms: Some(upload_time_ms),
+                    upload_bytes,
                 });
             }
         }
     }
     None
 }
+
+/// Pixel layout of the `HeadlessUndistort` input buffer
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum InputFormat {
+    #[default]
+    Rgba8,
+    /// Y plane followed by the interleaved UV plane, both with the buffer stride. Converted to RGB (BT.709) by the `_yuv` shaders
+    Nv12,
+    /// Same layout as NV12 in 16-bit little endian containers with the 10 bits in the high bits
+    P010,
+}
+impl InputFormat {
+    /// None for frame formats that have to be converted to RGBA8 first
+    pub fn from_ffmpeg(format: ffmpeg_next::format::Pixel) -> Option<Self> {
+        use ffmpeg_next::format::Pixel;
+        match format {
+            Pixel::RGBA   => Some(Self::Rgba8),
+            Pixel::NV12   => Some(Self::Nv12),
+            Pixel::P010LE => Some(Self::P010),
+            _ => None
+        }
+    }
+    fn rows(&self, height: usize) -> usize {
+        match self {
+            Self::Rgba8 => height,
+            Self::Nv12 | Self::P010 => height + (height + 1) / 2,
+        }
+    }
+}
+
+/// Pixel format of the `HeadlessUndistort` output buffer. The high bit depth ones fall back to RGBA8 if the backend can't render to them
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum OutputFormat {
+    #[default]
+    Rgba8,
+    /// 8 bytes per pixel
+    Rgba16F,
+    Rgb10A2,
+}
+
+/// Qt RHI undistortion on its own offscreen QRhi (Vulkan, D3D12/D3D11 or Metal, OpenGL as the last resort), without any QML window.
+/// Takes CPU RGBA8 buffers like `StabilizationManager::process_pixels` and returns when the output has been read back.
+/// The QRhi is bound to the thread that created it, so this type is neither `Send` nor `Sync`
+pub struct HeadlessUndistort {
+    ptr: *mut std::ffi::c_void,
+    input_format: InputFormat,
+}
+
+impl HeadlessUndistort {
+    /// Needs an existing `QGuiApplication`. `None` if no backend could be initialized
+    pub fn new() -> Option<Self> {
+        let ptr = cpp!(unsafe [] -> *mut std::ffi::c_void as "void *" {
+            auto headless = new QtRHIHeadlessUndistort();
+            if (!headless->create()) {
+                delete headless;
+                return nullptr;
+            }
+            return static_cast<void *>(headless);
+        });
+        if ptr.is_null() { None } else { Some(Self { ptr, input_format: InputFormat::Rgba8 }) }
+    }
+
+    pub fn backend_name(&self) -> String {
+        let ptr = self.ptr;
+        cpp!(unsafe [ptr as "QtRHIHeadlessUndistort *"] -> QString as "QString" {
+            return ptr->backendName();
+        }).to_string()
+    }
+
+    /// Whether the compiled shaders can take `input`, the YUV formats need the `_yuv` shader variants
+    pub fn supports_input(input: InputFormat) -> bool {
+        match input {
+            InputFormat::Rgba8 => true,
+            InputFormat::Nv12 | InputFormat::P010 => shader_exists(&format!("{SHADER_DIR}/undistort_opencv_fisheye_yuv.frag.qsb")),
+        }
+    }
+
+    /// Formats of the next `render()` calls, e.g. `InputFormat::from_ffmpeg()` of the decoded frames. `full_range` applies to the YUV formats.
+    /// Returns false and keeps the previous formats if `input` isn't supported (see `supports_input()`), the frames have to be converted to RGBA8 then
+    pub fn set_formats(&mut self, input: InputFormat, full_range: bool, output: OutputFormat) -> bool {
+        if !Self::supports_input(input) {
+            ::log::warn!("{input:?} input isn't supported, the `_yuv` shaders weren't compiled (see `bake_shaders` in build.rs)");
+            return false;
+        }
+        self.input_format = input;
+        let ptr = self.ptr;
+        let input = input as i32;
+        let output = output as i32;
+        cpp!(unsafe [ptr as "QtRHIHeadlessUndistort *", input as "int32_t", full_range as "bool", output as "int32_t"] {
+            static const QRhiTexture::Format outputFormats[] = { QRhiTexture::RGBA8, QRhiTexture::RGBA16F, QRhiTexture::RGB10A2 };
+            ptr->setFormats(static_cast<InputFormat>(input), full_range, outputFormats[output]);
+        });
+        true
+    }
+
+    /// `buffers` must be CPU buffers in the formats set with `set_formats()` (RGBA8 by default), with the input and output sizes set in the stabilization params
+    pub fn render(&mut self, stab: &StabilizationManager, mut timestamp_us: i64, frame: Option<usize>, buffers: &mut Buffers) -> Option<ProcessedInfo> {
+        if stab.prevent_recompute.load(std::sync::atomic::Ordering::SeqCst) { return None; }
+
+        let mut shader_path = undistort_shader_path(stab);
+        if self.input_format != InputFormat::Rgba8 {
+            let yuv_path = shader_path.to_string().replace(".frag.qsb", "_yuv.frag.qsb");
+            if !shader_exists(&yuv_path) {
+                ::log::warn!("{yuv_path} isn't available for {:?} input", self.input_format);
+                return None;
+            }
+            shader_path = QString::from(yuv_path);
+        }
+        if let Some(scale) = stab.params.read().fps_scale {
+            timestamp_us = (timestamp_us as f64 / scale).round() as i64;
+        }
+
+        {
+            let mut undist = stab.stabilization.write();
+            undist.ensure_stab_data_at_timestamp::<RGBA8>(timestamp_us, frame, buffers, true);
+            stab.draw_overlays(&mut undist.drawing, timestamp_us);
+        }
+
+        let input_size = QSize { width: buffers.input.size.0 as u32, height: buffers.input.size.1 as u32 };
+        let input_stride = buffers.input.size.2 as i32;
+        let output_size = QSize { width: buffers.output.size.0 as u32, height: buffers.output.size.1 as u32 };
+        let output_stride = buffers.output.size.2 as i32;
+        let BufferSource::Cpu { buffer: input } = &buffers.input.data else { return None; };
+        let input_ptr = input.as_ptr();
+        let BufferSource::Cpu { buffer: output } = &mut buffers.output.data else { return None; };
+        let output_ptr = output.as_mut_ptr();
+        if input.len() < input_stride as usize * self.input_format.rows(input_size.height as usize) || output.len() < output_stride as usize * output_size.height as usize { return None; }
+
+        let undist = stab.stabilization.read();
+        let itm = undist.get_undistortion_data(timestamp_us)?;
+        let mut kernel_params = itm.kernel_params;
+        let (canvas, canvas_rect, canvas_hash) = canvas_upload(&undist.drawing, &mut kernel_params);
+        let shader_path = specialized_shader_path(shader_path, &kernel_params);
+        let params = bytemuck::bytes_of(&kernel_params);
+        let params_ptr = params.as_ptr();
+        let params_len = params.len() as u32;
+        let matrices_ptr = itm.matrices.as_ptr();
+        let matrices_len = (itm.matrices.len() * 14 * std::mem::size_of::<f32>()) as u32;
+        let canvas_ptr = canvas.as_ptr();
+        let canvas_len = canvas.len() as u32;
+        let mesh_data_ptr = itm.mesh_data.as_ptr();
+        let mesh_data_len = itm.mesh_data.len() as u32;
+
+        let matrices_hash = crc32fast::hash(bytemuck::cast_slice(&itm.matrices));
+        let mesh_data_hash = crc32fast::hash(bytemuck::cast_slice(&itm.mesh_data));
+
+        let size_for_rs = if (itm.kernel_params.flags & 16) == 16 { itm.kernel_params.width } else { itm.kernel_params.height } as u32;
+        let canvas_size = undist.drawing.get_size();
+        let canvas_size = QSize { width: canvas_size.0 as u32, height: canvas_size.1 as u32 };
+
+        let mut gpu_time_ms = -1.0f64;
+        let mut upload_time_ms = 0.0f64;
+        let mut upload_bytes = 0u64;
+        let gpu_time_ptr = &mut gpu_time_ms as *mut f64;
+        let upload_time_ptr = &mut upload_time_ms as *mut f64;
+        let upload_bytes_ptr = &mut upload_bytes as *mut u64;
+
+        let ptr = self.ptr;
+        let ok = cpp!(unsafe [ptr as "QtRHIHeadlessUndistort *", timestamp_us as "int64_t", input_ptr as "const uint8_t *", input_stride as "int32_t", input_size as "QSize", output_size as "QSize", shader_path as "QString", params_ptr as "uint8_t*", params_len as "uint32_t", matrices_ptr as "uint8_t*", matrices_len as "uint32_t", matrices_hash as "uint32_t", canvas_ptr as "uint8_t*", canvas_len as "uint32_t", canvas_hash as "uint32_t", canvas_rect as "std::array<int32_t, 4>", canvas_size as "QSize", mesh_data_ptr as "float*", mesh_data_len as "uint32_t", mesh_data_hash as "uint32_t", size_for_rs as "uint32_t", output_ptr as "uint8_t *", output_stride as "int32_t", gpu_time_ptr as "double *", upload_time_ptr as "double *", upload_bytes_ptr as "uint64_t *"] -> bool as "bool" {
+            if (!QFile::exists(shader_path)) {
+                qDebug2("renderHeadless") << shader_path << "doesn't exist";
+                return false;
+            }
+            bool ok = ptr->process(timestamp_us, nullptr, input_ptr, input_stride, input_size, output_size, shader_path, params_ptr, params_len, matrices_ptr, matrices_len, matrices_hash, canvas_ptr, canvas_len, canvas_hash, QRect(canvas_rect[0], canvas_rect[1], canvas_rect[2], canvas_rect[3]), canvas_size, mesh_data_ptr, mesh_data_len, mesh_data_hash, size_for_rs, output_ptr, output_stride);
+            const auto &stats = ptr->lastStats();
+            *gpu_time_ptr = stats.gpuTimeMs;
+            *upload_time_ptr = stats.uploadTimeMs;
+            *upload_bytes_ptr = stats.uploadBytes;
+            return ok;
+        });
+        if !ok { return None; }
+
+        Some(ProcessedInfo {
+            fov: itm.fov,
+            minimal_fov: itm.minimal_fov,
+            focal_length: itm.focal_length,
+            backend: "Qt RHI (headless)",
+            gpu_time_ms: if gpu_time_ms >= 0.0 { Some(gpu_time_ms) } else { None },
+            upload_time_ms: Some(upload_time_ms),
+            upload_bytes,
+        })
+    }
+}
+
+impl Drop for HeadlessUndistort {
+    fn drop(&mut self) {
+        let ptr = self.ptr;
+        cpp!(unsafe [ptr as "QtRHIHeadlessUndistort *"] {
+            delete ptr;
+        });
+    }
+}
@@ -6,11 +6,57 @@
 
 #version 420
 
+// Specialized variants (see SHADER_VARIANTS in build.rs), each one is only selected when the kernel params make the
+// removed code a no-op, see `specialized_shader_path` in qrhi_undistort.rs:
+//   NO_DRAWING           - no overlays (flag 8) and no safe area
+//   NO_MESH_DATA         - no mesh or focal plane correction (flags 512, 1024)
+//   NO_UNDERWATER        - no light refraction (flag 2048)
+//   BACKGROUND_SOLID     - background_mode 0
+//   FULL_LENS_CORRECTION - lens_correction_amount >= 1
+//   SINGLE_MATRIX        - matrix_count 1, no rolling shutter correction
+
 layout(location = 0) in vec2 v_texcoord;
 layout(location = 0) out vec4 fragColor;
 
+// Must be identical to the block in texture.vert, the GL backends link both stages into one program
+layout(std140, binding = 0) uniform buf {
+    mat4 mvp;
+    int flip;
+} ubuf;
+
+#ifdef INPUT_YUV
+// NV12/P010: luma plane and interleaved half resolution chroma plane
+layout(binding = 1) uniform sampler2D texY;
+layout(binding = 7) uniform sampler2D texUV;
+
+layout(std140, binding = 8) uniform YuvParams {
+    float yuv_scale;    // Normalizes 16-bit containers of 10-bit data (P010)
+    int yuv_full_range;
+} yuv;
+
+vec4 sample_input(vec2 pos) {
+    float y = texture(texY, pos).r * yuv.yuv_scale;
+    vec2 c = texture(texUV, pos).rg * yuv.yuv_scale;
+    if (yuv.yuv_full_range != 0) {
+        c -= 128.0 / 255.0;
+    } else {
+        y = (y - 16.0 / 255.0) * (255.0 / 219.0);
+        c = (c - 128.0 / 255.0) * (255.0 / 224.0);
+    }
+    // BT.709
+    return vec4(
+        clamp(y + 1.5748 * c.y, 0.0, 1.0),
+        clamp(y - 0.1873 * c.x - 0.4681 * c.y, 0.0, 1.0),
+        clamp(y + 1.8556 * c.x, 0.0, 1.0),
+        1.0
+    );
+}
+#else
 layout(binding = 1) uniform sampler2D texIn;
 
+vec4 sample_input(vec2 pos) { return texture(texIn, pos); }
+#endif
+
 layout(std140, binding = 2) uniform KernelParams {
     int width;             // 4
     int height;            // 8
@@ -75,6 +121,7 @@ const vec4 colors[9] = vec4[9](
 );
 const float alphas[4] = float[4](1.0, 0.75, 0.50, 0.25);
 void draw_pixel(inout vec4 out_pix, float x, float y, bool isInput) {
+#ifndef NO_DRAWING
     if (!bool(params.flags & 8)) { // Drawing not enabled
         return;
     }
@@ -93,8 +140,10 @@ void draw_pixel(inout vec4 out_pix, float x, float y, bool isInput) {
             out_pix.a = 1.0;
         }
     }
+#endif
 }
 void draw_safe_area(inout vec4 out_pix, float x, float y) {
+#ifndef NO_DRAWING
     bool isSafeArea = x >= params.safe_area_rect.x && x <= params.safe_area_rect.z &&
                       y >= params.safe_area_rect.y && y <= params.safe_area_rect.w;
     if (!isSafeArea) {
@@ -109,27 +158,53 @@ void draw_safe_area(inout vec4 out_pix, float x, float y) {
             out_pix.z *= 0.5;
         }
     }
+#endif
 }
 
+#ifdef PACKED_MATRICES
+// Each row matrix is 14 floats packed into 4 RGBA32F texels (the last 2 components are padding), read at the texel centers
+// so that it also works without texelFetch (GLSL 120)
+vec4 get_param_texel(float row, int texel) {
+    int size = bool(params.flags & 16)? params.width : params.height;
+    return texture(texParams, vec2((float(texel) + 0.5) / 4.0, (floor(row) + 0.5) / float(size)));
+}
+float get_param(float row, float idx) {
+    float texel = floor(idx / 4.0);
+    return dot(get_param_texel(row, int(texel)), vec4(equal(vec4(idx - texel * 4.0), vec4(0.0, 1.0, 2.0, 3.0))));
+}
+#else
 float get_param(float row, float idx) {
     int size = bool(params.flags & 16)? params.width : params.height;
     return texture(texParams, vec2(idx / 13.0, row / float(size - 1))).r;
 }
+#endif
 
 float map_coord(float x, float in_min, float in_max, float out_min, float out_max) {
     return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
 
 vec2 rotate_and_distort(vec2 pos, float idx) {
-    float _x = (float(pos.x) * get_param(idx, 0)) + (float(pos.y) * get_param(idx, 1)) + get_param(idx, 2) + params.translation3d.x;
-    float _y = (float(pos.x) * get_param(idx, 3)) + (float(pos.y) * get_param(idx, 4)) + get_param(idx, 5) + params.translation3d.y;
-    float _w = (float(pos.x) * get_param(idx, 6)) + (float(pos.y) * get_param(idx, 7)) + get_param(idx, 8) + params.translation3d.z;
+#ifdef PACKED_MATRICES
+    vec4 m0 = get_param_texel(idx, 0); // 0..3
+    vec4 m1 = get_param_texel(idx, 1); // 4..7
+    vec4 m2 = get_param_texel(idx, 2); // 8..11
+    vec4 m3 = get_param_texel(idx, 3); // 12..13
+#else
+    vec4 m0 = vec4(get_param(idx, 0),  get_param(idx, 1),  get_param(idx, 2),  get_param(idx, 3));
+    vec4 m1 = vec4(get_param(idx, 4),  get_param(idx, 5),  get_param(idx, 6),  get_param(idx, 7));
+    vec4 m2 = vec4(get_param(idx, 8),  get_param(idx, 9),  get_param(idx, 10), get_param(idx, 11));
+    vec4 m3 = vec4(get_param(idx, 12), get_param(idx, 13), 0.0, 0.0);
+#endif
+    float _x = (float(pos.x) * m0.x) + (float(pos.y) * m0.y) + m0.z + params.translation3d.x;
+    float _y = (float(pos.x) * m0.w) + (float(pos.y) * m1.x) + m1.y + params.translation3d.y;
+    float _w = (float(pos.x) * m1.z) + (float(pos.y) * m1.w) + m2.x + params.translation3d.z;
 
     if (_w > 0.0) {
         if (params.r_limit > 0.0 && length(vec2(_x, _y) / _w) > params.r_limit) {
             return vec2(-99999.0, -99999.0);
         }
 
+#ifndef NO_UNDERWATER
         if (params.light_refraction_coefficient != 1.0 && params.light_refraction_coefficient > 0.0) {
             float r = length(vec2(_x, _y)) / _w;
             float sin_theta_d = (r / sqrt(1.0 + r * r)) * params.light_refraction_coefficient;
@@ -138,21 +213,24 @@ vec2 rotate_and_distort(vec2 pos, float idx) {
                 _w *= r / r_d;
             }
         }
+#endif
 
         vec2 uv = params.f * distort_point(_x, _y, _w) + params.c;
 
-        if (get_param(idx, 9) != 0.0 || get_param(idx, 10) != 0.0 || get_param(idx, 11) != 0.0 || get_param(idx, 12) != 0.0 || get_param(idx, 13) != 0.0) {
-            float ang_rad = get_param(idx, 11);
+        if (m2.yzw != vec3(0.0) || m3.xy != vec2(0.0)) {
+            float ang_rad = m2.w;
             float cos_a = cos(-ang_rad);
             float sin_a = sin(-ang_rad);
             uv -= params.c;
             uv = vec2(
-                cos_a * uv.x - sin_a * uv.y - get_param(idx, 9)  + get_param(idx, 12),
-                sin_a * uv.x + cos_a * uv.y - get_param(idx, 10) + get_param(idx, 13)
+                cos_a * uv.x - sin_a * uv.y - m2.y + m3.x,
+                sin_a * uv.x + cos_a * uv.y - m2.z + m3.y
             );
             uv += params.c;
         }
+#ifndef NO_MESH_DATA
         uv = process_coord(uv, idx);
+#endif
 
         if (bool(params.flags & 2)) { // Has digital lens
             uv = digital_distort_point(uv);
@@ -181,6 +259,7 @@ void main() {
 
     ///////////////////////////////////////////////////////////////////
     // Add lens distortion back
+#ifndef FULL_LENS_CORRECTION
     if (params.lens_correction_amount < 1.0) {
         float factor = max(1.0 - params.lens_correction_amount, 0.001); // FIXME: this is close but wrong
         vec2 out_c = vec2(params.output_width / 2.0, params.output_height / 2.0);
@@ -206,10 +285,14 @@ void main() {
 
         texPos = new_out_pos * (1.0 - params.lens_correction_amount) + (texPos * params.lens_correction_amount);
     }
+#endif
     ///////////////////////////////////////////////////////////////////
 
     ///////////////////////////////////////////////////////////////////
     // Calculate source `y` for rolling shutter
+#ifdef SINGLE_MATRIX
+    float idx = 0.0;
+#else
     float sy = texPos.y;
     if (bool(params.flags & 16)) { // Horizontal RS
         sy = min(params.width, max(0, floor(0.5 + texPos.x)));
@@ -230,6 +313,7 @@ void main() {
     ///////////////////////////////////////////////////////////////////
 
     float idx = min(sy, params.matrix_count - 1.0);
+#endif
 
     vec2 uv = rotate_and_distort(texPos, idx);
     vec2 frame_size = vec2(params.width, params.height);
@@ -241,6 +325,7 @@ void main() {
     }
 
     if (uv.x > -99998.0) {
+#ifndef BACKGROUND_SOLID
         if (params.background_mode == 1) { // edge repeat
             uv = max(vec2(0, 0), min(vec2(params.width - 1, params.height - 1), uv));
         } else if (params.background_mode == 2) { // edge mirror
@@ -264,8 +349,8 @@ void main() {
                 pt2 *= vec2(widthf, heightf);
             }
 
-            vec4 c1 = texture(texIn, vec2(uv.x / params.width, uv.y / params.height));
-            vec4 c2 = texture(texIn, vec2(pt2.x / params.width, pt2.y / params.height));
+            vec4 c1 = sample_input(vec2(uv.x / params.width, uv.y / params.height));
+            vec4 c2 = sample_input(vec2(pt2.x / params.width, pt2.y / params.height));
             fragColor = c1 * alpha + c2 * (1.0 - alpha);
             fragColor.a = 1.0;
             if (!((pt2.x >= 0 && pt2.x < params.width) && (pt2.y >= 0 && pt2.y < params.height))) {
@@ -276,9 +361,10 @@ void main() {
             draw_safe_area(fragColor, outPos.x, outPos.y);
             return;
         }
+#endif
 
         if ((uv.x >= 0 && uv.x < frame_size.x) && (uv.y >= 0 && uv.y < frame_size.y)) {
-            fragColor = texture(texIn, vec2(uv.x / frame_size.x, uv.y / frame_size.y));
+            fragColor = sample_input(vec2(uv.x / frame_size.x, uv.y / frame_size.y));
             draw_pixel(fragColor, uv.x, uv.y, true);
             draw_pixel(fragColor, outPos.x, outPos.y, false);
             draw_safe_area(fragColor, outPos.x, outPos.y);
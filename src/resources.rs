@@ -2,6 +2,8 @@
 // Copyright © 2021-2022 Adrian <adrian.eddy at gmail>
 
 use qmetaobject::qrc;
+#[cfg(qrhi_baked_shaders)]
+use cpp::*;
 
 qrc!(pub rsrc,
     "/" {
@@ -111,3 +113,22 @@ qrc!(pub rsrc,
         "resources/translations/zh_TW.qm",
     }
 );
+
+// The undistortion shaders with all their variants, compiled by build.rs (see `bake_shaders` there) as `:/src/qt_gpu/baked/`
+#[cfg(qrhi_baked_shaders)]
+static BAKED_SHADERS: &[u8] = include_bytes!(concat!(env!("OUT_DIR"), "/baked_shaders.rcc"));
+
+#[cfg(qrhi_baked_shaders)]
+cpp! {{
+    #include <QResource>
+}}
+
+/// Registers the shader variants that build.rs compiled, call after `rsrc()`
+pub fn rsrc_shader_variants() {
+    #[cfg(qrhi_baked_shaders)]
+    {
+        let data = BAKED_SHADERS.as_ptr();
+        let ok = cpp!(unsafe [data as "const uchar *"] -> bool as "bool" { return QResource::registerResource(data); });
+        if !ok { ::log::error!("Failed to register the compiled shaders"); }
+    }
+}
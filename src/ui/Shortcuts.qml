@@ -237,6 +237,16 @@ Item {
         onActivated: window.saveProject("");
     }
 
+    // Save the stabilized preview frame next to the output file
+    Shortcut {
+        sequence: "Ctrl+Shift+F";
+        onActivated: {
+            if (!videoArea.vid.loaded) return;
+            controller.save_preview_frame(window.outputFile.folderUrl, filesystem.filename_with_extension(window.outputFile.filename, "png"));
+            videoArea.vid.forceRedraw();
+        }
+    }
+
     // Toggle grid guide
     Shortcut {
         sequence: "G";
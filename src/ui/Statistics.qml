@@ -162,6 +162,17 @@ Item {
         }
     }
 
+    BasicText {
+        anchors.horizontalCenter: parent.horizontalCenter;
+        anchors.bottom: parent.bottom;
+        anchors.bottomMargin: 10 * dpiScale;
+        width: parent.width - 2 * (logValue.width + 200 * dpiScale);
+        horizontalAlignment: Text.AlignHCenter;
+        elide: Text.ElideRight;
+        text: controller.processing_info;
+        font.pixelSize: 11 * dpiScale;
+    }
+
     CheckBox {
         id: logValue;
 
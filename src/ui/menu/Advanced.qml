@@ -23,6 +23,7 @@ MenuItem {
         property alias featherPixels: featherPixels.value;
         property alias defaultSuffix: defaultSuffix.text;
         property alias playSounds: playSounds.checked;
+        property alias gpuProfiling: gpuProfiling.checked;
         property alias r3dConvertFormat: r3dConvertFormat.currentIndex;
         property alias r3dColorMode: r3dColorMode.currentIndex;
         property alias r3dGammaCurve: r3dGammaCurve.currentIndex;
@@ -382,6 +383,12 @@ MenuItem {
         wrapMode: Text.WordWrap;
         font.pixelSize: 11 * dpiScale;
     }
+    CheckBox {
+        id: gpuProfiling;
+        text: qsTr("Measure preview GPU time");
+        tooltip: qsTr("Enables GPU timestamp queries in the Qt RHI preview and shows the GPU time of the whole frame above.\nRequires restart.");
+        checked: false;
+    }
     Label {
         position: Label.LeftPosition;
         text: qsTr("Default file suffix");
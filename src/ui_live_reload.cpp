@@ -8,51 +8,183 @@
 #include <QQmlComponent>
 #include <QQuickItem>
 #include <QQuickWindow>
-#include <QDirIterator>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QPointer>
+#include <QDir>
+#include <QSet>
+#include <private/qquickloader_p.h>
 
-void init_live_reload(QQmlApplicationEngine *engine, const QString &path) {
-    QFileSystemWatcher *w = new QFileSystemWatcher();
-    QDirIterator it(path, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        it.next();
-        auto i = it.fileInfo();
-        if (i.isFile())
-            w->addPath(i.absoluteFilePath());
-    }
-
-    QUrl mainPath = QUrl::fromLocalFile(path + "/App.qml");
-
-    QObject::connect(w, &QFileSystemWatcher::fileChanged, [=](const QString &file) {
-        QTimer::singleShot(50, [=] {
-            static QQuickItem *previousItem = nullptr;
-            auto wnd = qobject_cast<QQuickWindow *>(engine->rootObjects().first());
-            w->addPath(file);
-
-            auto children = wnd->contentItem()->childItems();
-            if (!children.isEmpty()) {
-                auto itm = children.first();
-                if (itm->objectName() == "App" || itm->objectName() == "AppLoader") {
-                    itm->setParentItem(nullptr);
-                    if (itm == previousItem) previousItem = nullptr;
-                    delete itm;
-                }
+// Reloads the QML components that use a changed file.
+// Every directory is watched, plus its QML/JS files because saving in place doesn't change the directory on every platform.
+// An event only rescans its directory, and all changes within `DebounceMs` are applied in one reload.
+// A changed type is reloaded through the nearest Loader whose item is a whole QML file (e.g. the menus in App.qml),
+// anything else and any .js or qmldir change reloads App.qml through the AppLoader. The old item is destroyed before
+// the new one is created, and if the new code doesn't compile the current tree is kept.
+// Bindings declared on the item in the Loader's inline component (other than objectName) aren't reapplied.
+class LiveReload {
+public:
+    LiveReload(QQmlApplicationEngine *engine, const QString &path) : m_engine(engine), m_path(QDir(path).absolutePath()) {
+        m_debounce.setSingleShot(true);
+        m_debounce.setInterval(DebounceMs);
+        QObject::connect(&m_debounce, &QTimer::timeout, [this] { reload(); });
+        QObject::connect(&m_watcher, &QFileSystemWatcher::directoryChanged, [this](const QString &dir) { scanDirectory(dir, false); });
+        QObject::connect(&m_watcher, &QFileSystemWatcher::fileChanged, [this](const QString &file) {
+            m_pending.insert(file);
+            scanDirectory(QFileInfo(file).absolutePath(), false);
+        });
+        scanDirectory(m_path, true);
+    }
+
+private:
+    static constexpr int DebounceMs = 200;
+
+    struct FileState { QDateTime modified; qint64 size; };
+
+    // Updates the snapshot of `dir` and queues the files that were added, modified or removed since the last scan
+    void scanDirectory(const QString &dir, bool initial) {
+        if (!QFileInfo(dir).isDir()) return;
+        if (!m_watcher.directories().contains(dir)) m_watcher.addPath(dir);
+
+        QSet<QString> present;
+        QStringList unwatched;
+        const QStringList watched = m_watcher.files();
+        for (const QFileInfo &i : QDir(dir).entryInfoList({ "*.qml", "*.js", "qmldir" }, QDir::Files)) {
+            const QString file = i.absoluteFilePath();
+            present.insert(file);
+            auto it = m_files.constFind(file);
+            if (it == m_files.constEnd() || it->modified != i.lastModified() || it->size != i.size()) {
+                m_files.insert(file, FileState { i.lastModified(), i.size() });
+                if (!initial) m_pending.insert(file);
             }
+            // Saving through a temporary file replaces the file, so the watch has to be added again
+            if (!watched.contains(file)) unwatched.append(file);
+        }
+        if (!unwatched.isEmpty()) m_watcher.addPaths(unwatched);
 
-            if (previousItem) {
-                auto toDelete = previousItem;
-                QTimer::singleShot(5000, [=] {
-                    toDelete->setParentItem(nullptr);
-                    delete toDelete;
-                });
+        for (auto it = m_files.begin(); it != m_files.end(); ) {
+            if (!present.contains(it.key()) && QFileInfo(it.key()).absolutePath() == dir) {
+                m_pending.insert(it.key());
+                it = m_files.erase(it);
+            } else {
+                ++it;
             }
-            engine->clearComponentCache();
+        }
 
-            QQmlComponent component(engine, mainPath, wnd);
-            previousItem = qobject_cast<QQuickItem *>(component.create());
-            if (previousItem) {
-                previousItem->setObjectName("App");
-                previousItem->setParentItem(wnd->contentItem());
+        for (const QFileInfo &i : QDir(dir).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks)) {
+            if (!m_watcher.directories().contains(i.absoluteFilePath())) scanDirectory(i.absoluteFilePath(), initial);
+        }
+
+        if (!m_pending.isEmpty()) m_debounce.start();
+    }
+
+    // Composite types are named after their file, e.g. "Stabilization_QMLTYPE_12"
+    static QString typeName(const QMetaObject *mo) {
+        const QString name = QString::fromLatin1(mo->className());
+        const int i = name.indexOf("_QMLTYPE_");
+        return i > 0 ? name.left(i) : QString();
+    }
+    static bool isInstanceOf(const QObject *obj, const QSet<QString> &types) {
+        for (const QMetaObject *mo = obj->metaObject(); mo; mo = mo->superClass()) {
+            if (types.contains(typeName(mo))) return true;
+        }
+        return false;
+    }
+    // The watched .qml file `obj` is an instance of, empty for objects declared inline
+    QString fileOf(const QObject *obj) const {
+        const QString name = typeName(obj->metaObject());
+        if (name.isEmpty()) return QString();
+        for (auto it = m_files.constBegin(); it != m_files.constEnd(); ++it) {
+            const QFileInfo i(it.key());
+            if (i.suffix() == "qml" && i.completeBaseName() == name) return it.key();
+        }
+        return QString();
+    }
+    // The nearest Loader above `obj` whose item can be recreated from its file alone
+    QQuickLoader *reloadBoundary(QObject *obj, QQuickLoader *appLoader) const {
+        for (QObject *o = obj; o && o != appLoader; o = o->parent()) {
+            auto loader = qobject_cast<QQuickLoader *>(o->parent());
+            if (loader && loader->item() == o && !fileOf(o).isEmpty()) return loader;
+        }
+        return appLoader;
+    }
+
+    void reload() {
+        const QSet<QString> changed = std::exchange(m_pending, {});
+        auto wnd = qobject_cast<QQuickWindow *>(m_engine->rootObjects().value(0));
+        auto appLoader = wnd ? wnd->findChild<QQuickLoader *>("AppLoader") : nullptr;
+        if (!appLoader) { qWarning() << "Live reload: AppLoader not found"; return; }
+
+        QSet<QString> types;
+        bool reloadApp = false;
+        for (const QString &file : changed) {
+            const QFileInfo i(file);
+            if (i.fileName() == "main_window.qml") qWarning() << "Live reload: main_window.qml can't be reloaded, restart the app to apply it";
+            else if (i.suffix() == "qml") types.insert(i.completeBaseName());
+            else reloadApp = true;
+        }
+
+        QList<QQuickLoader *> loaders;
+        if (reloadApp) {
+            loaders.append(appLoader);
+        } else if (!types.isEmpty()) {
+            for (QObject *obj : wnd->findChildren<QObject *>()) {
+                if (!isInstanceOf(obj, types)) continue;
+                QQuickLoader *loader = reloadBoundary(obj, appLoader);
+                if (!loaders.contains(loader)) loaders.append(loader);
+            }
+        }
+        // Loaders inside another reloaded one are recreated with it
+        const QList<QQuickLoader *> all = loaders;
+        loaders.removeIf([&](QQuickLoader *loader) {
+            for (QObject *p = loader->parent(); p; p = p->parent()) {
+                if (all.contains(p)) return true;
             }
+            return false;
         });
-    });
+
+        // Also without live instances, so the next Qt.createComponent() of a changed file gets the new version
+        m_engine->clearComponentCache();
+        for (QQuickLoader *loader : loaders) {
+            reloadLoader(loader, loader == appLoader ? m_path + "/App.qml" : fileOf(loader->item()));
+        }
+        qDebug() << "Live reload:" << changed.size() << "changed files," << loaders.size() << "components reloaded";
+    }
+
+    void reloadLoader(QQuickLoader *loader, const QString &file) {
+        auto component = new QQmlComponent(m_engine, QUrl::fromLocalFile(file), QQmlComponent::PreferSynchronous, loader);
+        if (component->isError()) {
+            qWarning() << "Live reload:" << component->errors();
+            delete component;
+            return;
+        }
+        const QString objectName = loader->item() ? loader->item()->objectName() : QString();
+
+        // Free the old tree before the new one is created
+        loader->setSourceComponent(nullptr);
+        QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+        m_engine->collectGarbage();
+        if (auto previous = m_components.take(loader)) delete previous.data();
+
+        m_components.insert(loader, component);
+        if (!objectName.isEmpty()) {
+            QObject::connect(loader, &QQuickLoader::loaded, loader, [loader, objectName] {
+                if (loader->item()) loader->item()->setObjectName(objectName);
+            }, Qt::SingleShotConnection);
+        }
+        loader->setSourceComponent(component);
+    }
+
+    QQmlApplicationEngine *m_engine;
+    QString m_path;
+    QFileSystemWatcher m_watcher;
+    QTimer m_debounce;
+    QHash<QString, FileState> m_files; // snapshot of the watched files
+    QSet<QString> m_pending;           // changed since the last reload
+    QHash<QObject *, QPointer<QQmlComponent>> m_components; // created by the last reload of each Loader
+};
+
+void init_live_reload(QQmlApplicationEngine *engine, const QString &path) {
+    new LiveReload(engine, path);
 }
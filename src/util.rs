@@ -475,6 +475,19 @@ pub fn image_to_b64(img: QImage) -> QString {
     })
 }
 
+pub fn image_data_to_png(w: u32, h: u32, s: u32, data: &[u8]) -> Vec<u8> {
+    let ptr = data.as_ptr();
+    let png = cpp!(unsafe [w as "uint32_t", h as "uint32_t", s as "uint32_t", ptr as "const uint8_t *"] -> QByteArray as "QByteArray" {
+        QImage img(ptr, w, h, s, QImage::Format_RGBA8888);
+        QByteArray byteArray;
+        QBuffer buffer(&byteArray);
+        buffer.open(QIODevice::WriteOnly);
+        img.save(&buffer, "PNG");
+        return byteArray;
+    });
+    png.to_slice().to_vec()
+}
+
 pub fn update_file_times(output_url: &str, input_url: &str, additional_ms: Option<f64>) {
     if let Err(e) = || -> std::io::Result<()> {
         let input_path = gyroflow_core::filesystem::url_to_path(input_url);